@@ -0,0 +1,243 @@
+#include <math.h>
+#include <emmintrin.h>
+
+#include "lg3d.h"
+
+// the SoA arrays in the scratch block
+#define AIM_ARRAYS 5
+
+// a node's world frame, points go from its space to the world as v * m + t.  This is
+// the renderer's space, Y up, so our (x, y, z) is (x, z, y) here.
+#define FRAME_SIZE 12
+#define FRAME_T 9
+
+#define AIM_PI 3.14159265358979f
+
+static void Rotation(float *m, int axis, float degrees)
+{
+	float c = cosf(DEG2RADf(degrees)), s = sinf(DEG2RADf(degrees));
+	memset(m, 0, sizeof(float) * 9);
+	switch (axis) {
+		case 0: m[0] = 1.0f; m[4] = c; m[5] = s; m[7] = -s; m[8] = c; break;
+		case 1: m[0] = c; m[2] = -s; m[4] = 1.0f; m[6] = s; m[8] = c; break;
+		case 2: m[0] = c; m[1] = s; m[3] = -s; m[4] = c; m[8] = 1.0f; break;
+	}
+}
+
+static void MulRotation(const float *a, const float *b, float *out)
+{
+	int r, c;
+	for(r=0;r<3;r++)
+		for(c=0;c<3;c++)
+			out[r*3+c] = a[r*3]*b[c] + a[r*3+1]*b[3+c] + a[r*3+2]*b[6+c];
+}
+
+// a then b, so the frame of a child (a) hanging from b
+static void MulFrame(const float *a, const float *b, float *out)
+{
+	int c;
+	MulRotation(a, b, out);
+	for(c=0;c<3;c++)
+		out[FRAME_T+c] = a[FRAME_T]*b[c] + a[FRAME_T+1]*b[3+c] + a[FRAME_T+2]*b[6+c] + b[FRAME_T+c];
+}
+
+// the same rotations the renderer builds for a node, roll then pitch then heading
+static void NodeFrame(const LG3DSceneNode *node, float *frame)
+{
+	float roll[9], pitch[9], head[9], rp[9];
+	Rotation(roll, 2, node->orientation.r);
+	Rotation(pitch, 0, -node->orientation.p);
+	Rotation(head, 1, node->orientation.h);
+	MulRotation(roll, pitch, rp);
+	MulRotation(rp, head, frame);
+	frame[FRAME_T] = node->position.x;
+	frame[FRAME_T+1] = node->position.z;
+	frame[FRAME_T+2] = node->position.y;
+}
+
+static void ToWorld(const float *frame, const float *v, float *w)
+{
+	int c;
+	for(c=0;c<3;c++)
+		w[c] = v[0]*frame[c] + v[1]*frame[3+c] + v[2]*frame[6+c] + frame[FRAME_T+c];
+}
+
+// the rotation is orthonormal, so going back is by its transpose
+static void ToLocal(const float *frame, const float *w, float *v)
+{
+	float d[3] = {w[0] - frame[FRAME_T], w[1] - frame[FRAME_T+1], w[2] - frame[FRAME_T+2]};
+	int r;
+	for(r=0;r<3;r++)
+		v[r] = d[0]*frame[r*3] + d[1]*frame[r*3+1] + d[2]*frame[r*3+2];
+}
+
+// atan2 of 4 pairs, an odd polynomial for atan on 0..1 then folded out to the
+// right octant, good to about 1e-5 radians
+static __m128 Atan2Ps(__m128 y, __m128 x)
+{
+	__m128 signMask = _mm_set1_ps(-0.0f);
+	__m128 ax = _mm_andnot_ps(signMask, x);
+	__m128 ay = _mm_andnot_ps(signMask, y);
+	__m128 a = _mm_div_ps(_mm_min_ps(ax, ay), _mm_max_ps(_mm_max_ps(ax, ay), _mm_set1_ps(1e-30f)));
+	__m128 s = _mm_mul_ps(a, a);
+	__m128 r = _mm_set1_ps(-0.01172120f);
+	r = _mm_add_ps(_mm_mul_ps(r, s), _mm_set1_ps(0.05265332f));
+	r = _mm_add_ps(_mm_mul_ps(r, s), _mm_set1_ps(-0.11643287f));
+	r = _mm_add_ps(_mm_mul_ps(r, s), _mm_set1_ps(0.19354346f));
+	r = _mm_add_ps(_mm_mul_ps(r, s), _mm_set1_ps(-0.33262347f));
+	r = _mm_add_ps(_mm_mul_ps(r, s), _mm_set1_ps(0.99997726f));
+	r = _mm_mul_ps(r, a);
+
+	__m128 steep = _mm_cmpgt_ps(ay, ax);
+	r = _mm_or_ps(_mm_and_ps(steep, _mm_sub_ps(_mm_set1_ps(AIM_PI * 0.5f), r)), _mm_andnot_ps(steep, r));
+	__m128 back = _mm_cmplt_ps(x, _mm_setzero_ps());
+	r = _mm_or_ps(_mm_and_ps(back, _mm_sub_ps(_mm_set1_ps(AIM_PI), r)), _mm_andnot_ps(back, r));
+	return _mm_or_ps(r, _mm_and_ps(y, signMask));
+}
+
+LG3DAimSolver::LG3DAimSolver()
+{
+	capacity = 0;
+	scratch = NULL;
+	dirX = dirY = dirZ = NULL;
+	head = pitch = NULL;
+	nodeFrame = NULL;
+	numNodeFrames = 0;
+}
+
+LG3DAimSolver::~LG3DAimSolver()
+{
+	_aligned_free(scratch);
+	free(nodeFrame);
+}
+
+void LG3DAimSolver::BuildNodeFrames(const LG3DControlData *data)
+{
+	int i;
+	if (numNodeFrames < data->numSceneNodes) {
+		nodeFrame = (float *)realloc(nodeFrame, sizeof(float) * FRAME_SIZE * data->numSceneNodes);
+		numNodeFrames = data->numSceneNodes;
+	}
+	for(i=0;i<data->numSceneNodes;i++) {
+		const LG3DSceneNode *node = &data->sceneNodeList[i];
+		if ((node->parent >= 0) && (node->parent < i)) {
+			float local[FRAME_SIZE];
+			NodeFrame(node, local);
+			MulFrame(local, &nodeFrame[node->parent * FRAME_SIZE], &nodeFrame[i * FRAME_SIZE]);
+		} else
+			NodeFrame(node, &nodeFrame[i * FRAME_SIZE]);
+	}
+}
+
+int LG3DAimSolver::Aim(LG3DControlData *data, const int *lights, int numLights, const LG3DPosition *targets, int numTargets)
+{
+	int n;
+	if ((numLights <= 0) || (numTargets <= 0))
+		return 0;
+	if (numLights > capacity) {
+		capacity = (numLights + 3) & ~3;
+		_aligned_free(scratch);
+		scratch = (float *)_aligned_malloc(sizeof(float) * AIM_ARRAYS * capacity, 16);
+		dirX = scratch;
+		dirY = dirX + capacity;
+		dirZ = dirY + capacity;
+		head = dirZ + capacity;
+		pitch = head + capacity;
+	}
+
+	// the way from each light to its target, in the light's own frame
+	LG3DLightTable *table = &data->lights;
+	bool framesBuilt = false;
+	int padded = (numLights + 3) & ~3;
+	for(n=0;n<padded;n++) {
+		int i = (n < numLights) ? lights[n] : -1;
+		if (!data->LightInUse(i)) {
+			dirX[n] = dirY[n] = 0.0f;
+			dirZ[n] = 1.0f;
+			head[n] = 0.0f;
+			continue;
+		}
+		const LG3DPosition *t = &targets[(numTargets == 1) ? 0 : min(n, numTargets-1)];
+		float w[3] = {t->x, t->z, t->y};
+		int node = table->parentNode[i];
+		if ((node >= 0) && (node < data->numSceneNodes)) {
+			if (!framesBuilt) {
+				BuildNodeFrames(data);
+				framesBuilt = true;
+			}
+			float l[3];
+			ToLocal(&nodeFrame[node * FRAME_SIZE], w, l);
+			w[0] = l[0];
+			w[1] = l[1];
+			w[2] = l[2];
+		}
+		dirX[n] = w[0] - table->posX[i];
+		dirY[n] = w[1] - table->posZ[i];
+		dirZ[n] = w[2] - table->posY[i];
+		head[n] = table->head[i];
+	}
+
+	// the renderer points a light down (sin h cos p, sin p, cos h cos p), so heading is
+	// atan2(x, z) and pitch the rise over the level distance.  The heading is unwrapped to
+	// the turn nearest the light's current one.
+	__m128 toDegrees = _mm_set1_ps(180.0f / AIM_PI);
+	__m128 turn = _mm_set1_ps(360.0f);
+	__m128 perTurn = _mm_set1_ps(1.0f / 360.0f);
+	for(n=0;n<padded;n+=4) {
+		__m128 x = _mm_load_ps(&dirX[n]);
+		__m128 y = _mm_load_ps(&dirY[n]);
+		__m128 z = _mm_load_ps(&dirZ[n]);
+		__m128 h = _mm_mul_ps(Atan2Ps(x, z), toDegrees);
+		__m128 level = _mm_sqrt_ps(_mm_add_ps(_mm_mul_ps(x, x), _mm_mul_ps(z, z)));
+		__m128 p = _mm_mul_ps(Atan2Ps(y, level), toDegrees);
+		__m128 turns = _mm_cvtepi32_ps(_mm_cvtps_epi32(_mm_mul_ps(_mm_sub_ps(_mm_load_ps(&head[n]), h), perTurn)));
+		_mm_store_ps(&head[n], _mm_add_ps(h, _mm_mul_ps(turns, turn)));
+		_mm_store_ps(&pitch[n], p);
+	}
+
+	// write back what changed
+	int turned = 0;
+	for(n=0;n<numLights;n++) {
+		int i = lights[n];
+		if (!data->LightInUse(i))
+			continue;
+		if ((dirX[n] == 0.0f) && (dirY[n] == 0.0f) && (dirZ[n] == 0.0f))
+			continue; // the target is right on the light, any way is as good
+		unsigned long pin = table->pinMask[i];
+		bool changed = false;
+		if (!(pin & LG3DPinMask_H) && (table->head[i] != head[n])) {
+			table->head[i] = head[n];
+			changed = true;
+		}
+		if (!(pin & LG3DPinMask_P) && (table->pitch[i] != pitch[n])) {
+			table->pitch[i] = pitch[n];
+			changed = true;
+		}
+		if (changed) {
+			data->MarkLightDirty(i, LG3DDirty_Orientation);
+			turned++;
+		}
+	}
+	return turned;
+}
+
+int LG3DAimSolver::AimAtObject(LG3DControlData *data, const int *lights, int numLights, int objectIndex, const LG3DPosition *offset)
+{
+	if (!data->ObjectInUse(objectIndex))
+		return 0;
+
+	const LG3DSceneObject *obj = &data->sceneObjectList[objectIndex];
+	float w[3] = {obj->position.x, obj->position.z, obj->position.y};
+	if ((obj->parentNode >= 0) && (obj->parentNode < data->numSceneNodes)) {
+		float l[3] = {w[0], w[1], w[2]};
+		BuildNodeFrames(data);
+		ToWorld(&nodeFrame[obj->parentNode * FRAME_SIZE], l, w);
+	}
+	LG3DPosition target = {w[0], w[2], w[1]};
+	if (offset) {
+		target.x += offset->x;
+		target.y += offset->y;
+		target.z += offset->z;
+	}
+	return Aim(data, lights, numLights, &target, 1);
+}
@@ -0,0 +1,390 @@
+#include <math.h>
+
+#include "lg3d.h"
+
+// element k of an array, placed from the template's position & orientation (passed in)
+static void PlaceElement(const LG3DArrayLayout *layout, int k, LG3DPosition *pos, LG3DOrientation *orient)
+{
+	switch (layout->shape) {
+		case LG3DArray_Line:
+			pos->x += k * layout->step.x;
+			pos->y += k * layout->step.y;
+			pos->z += k * layout->step.z;
+		break;
+
+		case LG3DArray_Grid: {
+			int columns = max(layout->columns, 1);
+			int c = k % columns, r = k / columns;
+			pos->x += c * layout->step.x + r * layout->rowStep.x;
+			pos->y += c * layout->step.y + r * layout->rowStep.y;
+			pos->z += c * layout->step.z + r * layout->rowStep.z;
+		}
+		break;
+
+		case LG3DArray_Ring: {
+			// element 0 of a ring sits on -Y of the origin with the template's heading, which
+			// looks along +Y, so the ring faces in
+			double angle = layout->startAngle + (double)k * layout->sweep / max(layout->count, 1);
+			pos->x -= (float)(layout->radius * sin(DEG2RAD(angle)));
+			pos->y -= (float)(layout->radius * cos(DEG2RAD(angle)));
+			orient->h += (float)angle;
+		}
+		break;
+	}
+}
+
+static const LG3DLightArrayOverride *FindLightOverride(const LG3DLightArray *array, int element)
+{
+	int lo = 0, hi = array->numOverrides;
+	while (lo < hi) {
+		int mid = (lo + hi) >> 1;
+		if (array->overrides[mid].element < element)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+	return ((lo < array->numOverrides) && (array->overrides[lo].element == element)) ? &array->overrides[lo] : NULL;
+}
+
+static const LG3DObjectArrayOverride *FindObjectOverride(const LG3DObjectArray *array, int element)
+{
+	int lo = 0, hi = array->numOverrides;
+	while (lo < hi) {
+		int mid = (lo + hi) >> 1;
+		if (array->overrides[mid].element < element)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+	return ((lo < array->numOverrides) && (array->overrides[lo].element == element)) ? &array->overrides[lo] : NULL;
+}
+
+static void OverrideLight(LG3DSceneLight *light, const LG3DLightArrayOverride *o)
+{
+	unsigned long fields = o->fields;
+	if (fields == LG3DDirty_All) {
+		*light = o->light;
+		return;
+	}
+	if (fields & LG3DDirty_Position)
+		light->position = o->light.position;
+	if (fields & LG3DDirty_Orientation)
+		light->orientation = o->light.orientation;
+	if (fields & LG3DDirty_Color)
+		light->color = o->light.color;
+	if (fields & LG3DDirty_Cone) {
+		light->umbra = o->light.umbra;
+		light->penumbra = o->light.penumbra;
+	}
+	if (fields & LG3DDirty_Attenuation) {
+		light->att1 = o->light.att1;
+		light->att2 = o->light.att2;
+	}
+	if (fields & LG3DDirty_Enabled)
+		light->enabled = o->light.enabled;
+	if (fields & LG3DDirty_Shadows)
+		light->castsShadows = o->light.castsShadows;
+	if (fields & LG3DDirty_Node)
+		light->parentNode = o->light.parentNode;
+}
+
+static void OverrideObject(LG3DSceneObject *object, const LG3DObjectArrayOverride *o)
+{
+	unsigned long fields = o->fields;
+	if (fields == LG3DDirty_All) {
+		*object = o->object;
+		return;
+	}
+	if (fields & LG3DDirty_Position)
+		object->position = o->object.position;
+	if (fields & LG3DDirty_Orientation)
+		object->orientation = o->object.orientation;
+	if (fields & LG3DDirty_Node)
+		object->parentNode = o->object.parentNode;
+}
+
+// once loaded, sceneLightList may run on past the listed lights (see Reload), the arrays
+// then start where LoadScene put them
+int LG3DControlData::ListedLights() const
+{
+	if ((numLightArrays > 0) && (lightArrayList[0].firstLight >= 0))
+		return lightArrayList[0].firstLight;
+	return numSceneLights;
+}
+
+int LG3DControlData::ListedObjects() const
+{
+	if ((numObjectArrays > 0) && (objectArrayList[0].firstObject >= 0))
+		return objectArrayList[0].firstObject;
+	return numSceneObjects;
+}
+
+int LG3DControlData::DescribedLights() const
+{
+	int a, n = ListedLights();
+	for(a=0;a<numLightArrays;a++)
+		n += max(lightArrayList[a].layout.count, 0);
+	return n;
+}
+
+int LG3DControlData::DescribedObjects() const
+{
+	int a, n = ListedObjects();
+	for(a=0;a<numObjectArrays;a++)
+		n += max(objectArrayList[a].layout.count, 0);
+	return n;
+}
+
+void LG3DControlData::DescribeLight(int lightIndex, LG3DSceneLight *light) const
+{
+	int a, first = ListedLights();
+	if (lightIndex < first) {
+		*light = sceneLightList[lightIndex];
+		return;
+	}
+	for(a=0;a<numLightArrays;a++) {
+		const LG3DLightArray *array = &lightArrayList[a];
+		int k = lightIndex - first;
+		if (k < array->layout.count) {
+			*light = array->light;
+			PlaceElement(&array->layout, k, &light->position, &light->orientation);
+			const LG3DLightArrayOverride *o = FindLightOverride(array, k);
+			if (o)
+				OverrideLight(light, o);
+			return;
+		}
+		first += max(array->layout.count, 0);
+	}
+	LG3DSceneLight empty;
+	*light = empty;
+}
+
+void LG3DControlData::DescribeObject(int objectIndex, LG3DSceneObject *object) const
+{
+	int a, first = ListedObjects();
+	if (objectIndex < first) {
+		*object = sceneObjectList[objectIndex];
+		return;
+	}
+	for(a=0;a<numObjectArrays;a++) {
+		const LG3DObjectArray *array = &objectArrayList[a];
+		int k = objectIndex - first;
+		if (k < array->layout.count) {
+			*object = array->object;
+			PlaceElement(&array->layout, k, &object->position, &object->orientation);
+			const LG3DObjectArrayOverride *o = FindObjectOverride(array, k);
+			if (o)
+				OverrideObject(object, o);
+			return;
+		}
+		first += max(array->layout.count, 0);
+	}
+	LG3DSceneObject empty;
+	*object = empty;
+}
+
+// generate the array elements, the lights into the table from firstLight on (which it has
+// room for) and the objects onto the end of sceneObjectList
+void LG3DControlData::LoadArrays(int firstLight)
+{
+	int a, k, n;
+	int first = firstLight;
+	for(a=0;a<numLightArrays;a++) {
+		LG3DLightArray *array = &lightArrayList[a];
+		int count = max(array->layout.count, 0);
+		array->firstLight = first;
+		if (count == 0)
+			continue;
+
+		// the template once, copied down the array, then only the placement differs
+		lights.Load(first, &array->light);
+		lights.Repeat(first, count-1);
+		for(k=0;k<count;k++) {
+			LG3DPosition pos = array->light.position;
+			LG3DOrientation orient = array->light.orientation;
+			PlaceElement(&array->layout, k, &pos, &orient);
+			lights.posX[first+k] = pos.x;
+			lights.posY[first+k] = pos.y;
+			lights.posZ[first+k] = pos.z;
+			lights.head[first+k] = orient.h;
+		}
+		for(n=0;n<array->numOverrides;n++) {
+			const LG3DLightArrayOverride *o = &array->overrides[n];
+			if ((o->element < 0) || (o->element >= count))
+				continue;
+			LG3DSceneLight light = array->light;
+			PlaceElement(&array->layout, o->element, &light.position, &light.orientation);
+			OverrideLight(&light, o);
+			lights.Load(first + o->element, &light);
+		}
+		first += count;
+	}
+
+	// objects only need adding the once
+	if ((numObjectArrays == 0) || (objectArrayList[0].firstObject >= 0))
+		return;
+	int numObjects = numSceneObjects;
+	for(a=0;a<numObjectArrays;a++) {
+		objectArrayList[a].firstObject = numObjects;
+		numObjects += max(objectArrayList[a].layout.count, 0);
+	}
+	int listed = numSceneObjects;
+	GrowSceneObjects(numObjects);
+	for(n=listed;n<numObjects;n++)
+		DescribeObject(n, &sceneObjectList[n]);
+}
+
+// take on the arrays of a show being reloaded, placed where the reload put their elements
+void LG3DControlData::CopyArrays(const LG3DControlData *src)
+{
+	int a;
+	for(a=0;a<numLightArrays;a++)
+		if (!IsMapped(lightArrayList[a].overrides))
+			delete [] lightArrayList[a].overrides;
+	if (!IsMapped(lightArrayList))
+		delete [] lightArrayList;
+	lightArrayList = NULL;
+	numLightArrays = src->numLightArrays;
+	int first = src->ListedLights();
+	if (numLightArrays > 0) {
+		lightArrayList = new LG3DLightArray[numLightArrays];
+		for(a=0;a<numLightArrays;a++) {
+			LG3DLightArray *array = &lightArrayList[a];
+			*array = src->lightArrayList[a];
+			if (array->numOverrides > 0) {
+				array->overrides = new LG3DLightArrayOverride[array->numOverrides];
+				memcpy(array->overrides, src->lightArrayList[a].overrides, sizeof(LG3DLightArrayOverride) * array->numOverrides);
+			} else
+				array->overrides = NULL;
+			array->firstLight = first;
+			first += max(array->layout.count, 0);
+		}
+	}
+
+	for(a=0;a<numObjectArrays;a++)
+		if (!IsMapped(objectArrayList[a].overrides))
+			delete [] objectArrayList[a].overrides;
+	if (!IsMapped(objectArrayList))
+		delete [] objectArrayList;
+	objectArrayList = NULL;
+	numObjectArrays = src->numObjectArrays;
+	first = src->ListedObjects();
+	if (numObjectArrays > 0) {
+		objectArrayList = new LG3DObjectArray[numObjectArrays];
+		for(a=0;a<numObjectArrays;a++) {
+			LG3DObjectArray *array = &objectArrayList[a];
+			*array = src->objectArrayList[a];
+			if (array->numOverrides > 0) {
+				array->overrides = new LG3DObjectArrayOverride[array->numOverrides];
+				memcpy(array->overrides, src->objectArrayList[a].overrides, sizeof(LG3DObjectArrayOverride) * array->numOverrides);
+			} else
+				array->overrides = NULL;
+			array->firstObject = first;
+			first += max(array->layout.count, 0);
+		}
+	}
+}
+
+int LG3DControlData::SetLightArrayLayout(int arrayIndex, const LG3DArrayLayout *layout, const LG3DPosition *origin, const LG3DOrientation *orient)
+{
+	int k, moved = 0;
+	if ((arrayIndex < 0) || (arrayIndex >= numLightArrays))
+		return 0;
+	LG3DLightArray *array = &lightArrayList[arrayIndex];
+	int count = array->layout.count;
+	if (layout) {
+		array->layout = *layout;
+		array->layout.count = count;
+	}
+	if (origin)
+		array->light.position = *origin;
+	if (orient)
+		array->light.orientation = *orient;
+	if (array->firstLight < 0)
+		return 0; // not loaded yet, the new layout is used when it is
+
+	// one pass down the array, the overrides are sorted so they are walked alongside it
+	const LG3DLightArrayOverride *o = array->overrides;
+	const LG3DLightArrayOverride *end = o + array->numOverrides;
+	for(k=0;k<count;k++) {
+		int i = array->firstLight + k;
+		while ((o < end) && (o->element < k))
+			o++;
+		unsigned long keep = ((o < end) && (o->element == k)) ? o->fields : 0;
+		if (!LightInUse(i))
+			continue; // removed
+		LG3DPosition pos = array->light.position;
+		LG3DOrientation orient = array->light.orientation;
+		PlaceElement(&array->layout, k, &pos, &orient);
+
+		unsigned long fields = 0;
+		if (!(keep & LG3DDirty_Position) &&
+			((lights.posX[i] != pos.x) || (lights.posY[i] != pos.y) || (lights.posZ[i] != pos.z))) {
+			lights.posX[i] = pos.x;
+			lights.posY[i] = pos.y;
+			lights.posZ[i] = pos.z;
+			fields |= LG3DDirty_Position;
+		}
+		if (!(keep & LG3DDirty_Orientation) &&
+			((lights.head[i] != orient.h) || (lights.pitch[i] != orient.p) || (lights.roll[i] != orient.r))) {
+			lights.head[i] = orient.h;
+			lights.pitch[i] = orient.p;
+			lights.roll[i] = orient.r;
+			fields |= LG3DDirty_Orientation;
+		}
+		if (fields) {
+			MarkLightDirty(i, fields);
+			moved++;
+		}
+	}
+	return moved;
+}
+
+int LG3DControlData::SetObjectArrayLayout(int arrayIndex, const LG3DArrayLayout *layout, const LG3DPosition *origin, const LG3DOrientation *orient)
+{
+	int k, moved = 0;
+	if ((arrayIndex < 0) || (arrayIndex >= numObjectArrays))
+		return 0;
+	LG3DObjectArray *array = &objectArrayList[arrayIndex];
+	int count = array->layout.count;
+	if (layout) {
+		array->layout = *layout;
+		array->layout.count = count;
+	}
+	if (origin)
+		array->object.position = *origin;
+	if (orient)
+		array->object.orientation = *orient;
+	if (array->firstObject < 0)
+		return 0;
+
+	const LG3DObjectArrayOverride *o = array->overrides;
+	const LG3DObjectArrayOverride *end = o + array->numOverrides;
+	for(k=0;k<count;k++) {
+		int i = array->firstObject + k;
+		while ((o < end) && (o->element < k))
+			o++;
+		unsigned long keep = ((o < end) && (o->element == k)) ? o->fields : 0;
+		if (!ObjectInUse(i))
+			continue;
+		LG3DSceneObject *object = &sceneObjectList[i];
+		LG3DPosition pos = array->object.position;
+		LG3DOrientation orient = array->object.orientation;
+		PlaceElement(&array->layout, k, &pos, &orient);
+
+		unsigned long fields = 0;
+		if (!(keep & LG3DDirty_Position) && memcmp(&object->position, &pos, sizeof(LG3DPosition))) {
+			object->position = pos;
+			fields |= LG3DDirty_Position;
+		}
+		if (!(keep & LG3DDirty_Orientation) && memcmp(&object->orientation, &orient, sizeof(LG3DOrientation))) {
+			object->orientation = orient;
+			fields |= LG3DDirty_Orientation;
+		}
+		if (fields) {
+			MarkObjectDirty(i, fields);
+			moved++;
+		}
+	}
+	return moved;
+}
@@ -0,0 +1,395 @@
+#include <winsock2.h>
+
+#include "lg3d.h"
+
+#pragma comment( lib, "ws2_32.lib" )
+
+// ArtDmx packet: "Art-Net\0", opcode (low byte first), protocol version (high byte first),
+// sequence, physical port, port address (low byte SubUni, high byte Net), length (high
+// byte first, 2 to 512), then the channels
+#define ARTNET_OP_DMX 0x5000
+#define ARTNET_VERSION 14
+#define ARTNET_HEADER 18
+#define ARTNET_MAX_PACKET (ARTNET_HEADER + LG3D_DMX_CHANNELS)
+#define ARTNET_UNIVERSES 32768
+
+// a packet this many behind the last of its universe is late & dropped, further back it is
+// taken as the console having restarted its count
+#define ARTNET_LATE_WINDOW 32
+
+// room for a few frames of 64+ universes, should the frame moves stall
+#define ARTNET_RECEIVE_BUFFER (1024*1024)
+
+static const char artNetId[8] = {'A', 'r', 't', '-', 'N', 'e', 't', 0};
+
+struct LG3DDmxUniverse {
+	int				address;				// Art-Net port address
+	int				firstFixture;
+	int				numFixtures;
+	unsigned char	*dmx;					// as last received
+	unsigned char	*applied;				// as last applied to the lights
+	unsigned char	sequence;				// of the last packet, 0 if it had none
+	unsigned char	sendSequence;
+	bool			changed;				// received since the last apply
+	bool			fresh;					// never applied, every light is set
+};
+
+struct LG3DDmxFixture {
+	int				light;
+	int				personality;
+	unsigned short	start;					// channel range in the universe
+	unsigned short	footprint;
+	int				firstOp;
+	int				numOps;
+};
+
+struct LG3DDmxOp {
+	unsigned short	coarse;					// channel in the universe
+	unsigned short	fine;					// the low byte of a 16 bit value, the same as coarse for 8 bit ones
+	unsigned char	kind;					// LG3DDmxChannelType
+};
+
+LG3DArtNet::LG3DArtNet()
+{
+	sock = INVALID_SOCKET;
+	port = 0;
+	packet = (unsigned char *)malloc(ARTNET_MAX_PACKET);
+	personality = NULL;
+	universeSlot = NULL;
+	universe = NULL;
+	numUniverses = 0;
+	fixture = NULL;
+	numFixtures = 0;
+	op = NULL;
+	numOps = 0;
+	channels = NULL;
+	packetsUsed = 0;
+	packetsDropped = 0;
+}
+
+LG3DArtNet::~LG3DArtNet()
+{
+	Close();
+	FreePlan();
+	free(packet);
+}
+
+void LG3DArtNet::FreePlan()
+{
+	free(personality);
+	free(universeSlot);
+	free(universe);
+	free(fixture);
+	free(op);
+	free(channels);
+	personality = NULL;
+	universeSlot = NULL;
+	universe = NULL;
+	fixture = NULL;
+	op = NULL;
+	channels = NULL;
+	numUniverses = numFixtures = numOps = 0;
+}
+
+bool LG3DArtNet::Open(unsigned short _port)
+{
+	WSADATA wsa;
+	Close();
+	if (WSAStartup(MAKEWORD(2, 2), &wsa) != 0)
+		return false;
+	SOCKET s = socket(AF_INET, SOCK_DGRAM, IPPROTO_UDP);
+	if (s == INVALID_SOCKET) {
+		WSACleanup();
+		return false;
+	}
+	int size = ARTNET_RECEIVE_BUFFER;
+	setsockopt(s, SOL_SOCKET, SO_RCVBUF, (const char *)&size, sizeof(size));
+	sockaddr_in addr;
+	memset(&addr, 0, sizeof(addr));
+	addr.sin_family = AF_INET;
+	addr.sin_port = htons(_port);
+	addr.sin_addr.s_addr = htonl(INADDR_ANY);
+	u_long nonBlocking = 1;
+	if ((bind(s, (const sockaddr *)&addr, sizeof(addr)) != 0) || (ioctlsocket(s, FIONBIO, &nonBlocking) != 0)) {
+		closesocket(s);
+		WSACleanup();
+		return false;
+	}
+	sock = s;
+	port = _port;
+	return true;
+}
+
+void LG3DArtNet::Close()
+{
+	if (sock == INVALID_SOCKET)
+		return;
+	closesocket(sock);
+	WSACleanup();
+	sock = INVALID_SOCKET;
+}
+
+bool LG3DArtNet::IsOpen() const
+{
+	return sock != INVALID_SOCKET;
+}
+
+static int ComparePatch(const void *a, const void *b)
+{
+	const LG3DDmxPatch *pa = (const LG3DDmxPatch *)a;
+	const LG3DDmxPatch *pb = (const LG3DDmxPatch *)b;
+	if (pa->universe != pb->universe)
+		return pa->universe - pb->universe;
+	return pa->address - pb->address;
+}
+
+int LG3DArtNet::Compile(const LG3DDmxPersonality *personalities, int numPersonalities, const LG3DDmxPatch *patch, int numPatch)
+{
+	int i, c;
+	FreePlan();
+
+	// the good entries, in universe & address order
+	LG3DDmxPatch *sorted = (LG3DDmxPatch *)malloc(sizeof(LG3DDmxPatch) * (numPatch+1));
+	int numSorted = 0;
+	for(i=0;i<numPatch;i++) {
+		const LG3DDmxPatch *p = &patch[i];
+		if ((p->personality < 0) || (p->personality >= numPersonalities) || (p->lightIndex < 0) ||
+			(p->universe < 0) || (p->universe >= ARTNET_UNIVERSES) || (p->address < 1))
+			continue;
+		int footprint = personalities[p->personality].numChannels;
+		if ((footprint < 1) || (footprint > LG3D_DMX_MAX_FOOTPRINT) || (p->address - 1 + footprint > LG3D_DMX_CHANNELS))
+			continue;
+		sorted[numSorted++] = *p;
+	}
+	qsort(sorted, numSorted, sizeof(LG3DDmxPatch), ComparePatch);
+	personality = (LG3DDmxPersonality *)malloc(sizeof(LG3DDmxPersonality) * (numPersonalities+1));
+	memcpy(personality, personalities, sizeof(LG3DDmxPersonality) * numPersonalities);
+
+	for(i=0;i<numSorted;i++)
+		if ((i == 0) || (sorted[i].universe != sorted[i-1].universe))
+			numUniverses++;
+	universeSlot = (short *)malloc(sizeof(short) * ARTNET_UNIVERSES);
+	for(i=0;i<ARTNET_UNIVERSES;i++)
+		universeSlot[i] = -1;
+	universe = (LG3DDmxUniverse *)calloc(numUniverses+1, sizeof(LG3DDmxUniverse));
+	channels = (unsigned char *)calloc(numUniverses+1, 2 * LG3D_DMX_CHANNELS);
+	fixture = (LG3DDmxFixture *)malloc(sizeof(LG3DDmxFixture) * (numSorted+1));
+	op = (LG3DDmxOp *)malloc(sizeof(LG3DDmxOp) * (numSorted * LG3D_DMX_MAX_FOOTPRINT + 1));
+
+	int u = -1;
+	for(i=0;i<numSorted;i++) {
+		const LG3DDmxPatch *p = &sorted[i];
+		const LG3DDmxPersonality *type = &personalities[p->personality];
+		if ((u < 0) || (p->universe != universe[u].address)) {
+			u++;
+			universe[u].address = p->universe;
+			universe[u].firstFixture = numFixtures;
+			universe[u].dmx = &channels[u * 2 * LG3D_DMX_CHANNELS];
+			universe[u].applied = universe[u].dmx + LG3D_DMX_CHANNELS;
+			universe[u].fresh = true;
+			universeSlot[p->universe] = (short)u;
+		}
+		universe[u].numFixtures++;
+
+		LG3DDmxFixture *f = &fixture[numFixtures++];
+		f->light = p->lightIndex;
+		f->personality = p->personality;
+		f->start = (unsigned short)(p->address - 1);
+		f->footprint = (unsigned short)type->numChannels;
+		f->firstOp = numOps;
+
+		// each coarse channel is an op, paired with its fine channel if the fixture has one
+		for(c=0;c<type->numChannels;c++) {
+			unsigned char kind = type->channel[c];
+			if ((kind == LG3DDmx_Unused) || (kind == LG3DDmx_PanFine) || (kind == LG3DDmx_TiltFine) || (kind > LG3DDmx_Zoom))
+				continue;
+			LG3DDmxOp *o = &op[numOps++];
+			o->kind = kind;
+			o->coarse = o->fine = (unsigned short)(f->start + c);
+			int k;
+			for(k=0;k<type->numChannels;k++)
+				if (((kind == LG3DDmx_Pan) && (type->channel[k] == LG3DDmx_PanFine)) ||
+					((kind == LG3DDmx_Tilt) && (type->channel[k] == LG3DDmx_TiltFine)))
+					o->fine = (unsigned short)(f->start + k);
+		}
+		f->numOps = numOps - f->firstOp;
+	}
+	free(sorted);
+	return numFixtures;
+}
+
+int LG3DArtNet::BuildPacket(unsigned char *packet, int universe, unsigned char sequence, const unsigned char *dmx, int numChannels)
+{
+	numChannels = min(max(numChannels, 0), LG3D_DMX_CHANNELS);
+	int length = max(numChannels + (numChannels & 1), 2); // always an even length
+	memcpy(packet, artNetId, sizeof(artNetId));
+	packet[8] = ARTNET_OP_DMX & 0xff;
+	packet[9] = ARTNET_OP_DMX >> 8;
+	packet[10] = 0;
+	packet[11] = ARTNET_VERSION;
+	packet[12] = sequence;
+	packet[13] = 0;
+	packet[14] = (unsigned char)(universe & 0xff);
+	packet[15] = (unsigned char)((universe >> 8) & 0x7f);
+	packet[16] = (unsigned char)(length >> 8);
+	packet[17] = (unsigned char)(length & 0xff);
+	memcpy(&packet[ARTNET_HEADER], dmx, numChannels);
+	memset(&packet[ARTNET_HEADER + numChannels], 0, length - numChannels);
+	return ARTNET_HEADER + length;
+}
+
+bool LG3DArtNet::Ingest(const unsigned char *p, int size)
+{
+	if ((size < ARTNET_HEADER) || memcmp(p, artNetId, sizeof(artNetId)) ||
+		((p[8] | (p[9] << 8)) != ARTNET_OP_DMX) || (((p[10] << 8) | p[11]) < ARTNET_VERSION))
+		return false; // not ArtDmx, polls & the like are no concern of ours
+	int address = p[14] | ((p[15] & 0x7f) << 8);
+	int length = (p[16] << 8) | p[17];
+	if (!universeSlot || (universeSlot[address] < 0))
+		return false;
+	if ((length > LG3D_DMX_CHANNELS) || (ARTNET_HEADER + length > size)) {
+		packetsDropped++;
+		return false;
+	}
+	LG3DDmxUniverse *u = &universe[universeSlot[address]];
+	unsigned char sequence = p[12];
+	if (sequence && u->sequence) {
+		unsigned char behind = (unsigned char)(u->sequence - sequence);
+		if ((behind > 0) && (behind <= ARTNET_LATE_WINDOW)) {
+			packetsDropped++;
+			return false;
+		}
+	}
+	u->sequence = sequence;
+	memcpy(u->dmx, &p[ARTNET_HEADER], length);
+	u->changed = true;
+	packetsUsed++;
+	return true;
+}
+
+int LG3DArtNet::Receive()
+{
+	int used = 0;
+	if (sock == INVALID_SOCKET)
+		return 0;
+	for(;;) {
+		int size = recvfrom(sock, (char *)packet, ARTNET_MAX_PACKET, 0, NULL, NULL);
+		if (size == SOCKET_ERROR) {
+			int error = WSAGetLastError();
+			if ((error == WSAEMSGSIZE) || (error == WSAECONNRESET)) {
+				packetsDropped++; // too big to be ArtDmx, or an ICMP from a send that went nowhere
+				continue;
+			}
+			break; // WSAEWOULDBLOCK, nothing more waiting
+		}
+		used += Ingest(packet, size);
+	}
+	return used;
+}
+
+bool LG3DArtNet::Send(unsigned long ipAddress, int universeAddress, const unsigned char *dmx, int numChannels)
+{
+	unsigned char out[ARTNET_MAX_PACKET];
+	if ((sock == INVALID_SOCKET) || (universeAddress < 0) || (universeAddress >= ARTNET_UNIVERSES))
+		return false;
+	unsigned char sequence = 0;
+	if (universeSlot && (universeSlot[universeAddress] >= 0)) {
+		LG3DDmxUniverse *u = &universe[universeSlot[universeAddress]];
+		if (++u->sendSequence == 0)
+			u->sendSequence = 1; // 0 is no sequence
+		sequence = u->sendSequence;
+	}
+	int size = BuildPacket(out, universeAddress, sequence, dmx, numChannels);
+	sockaddr_in addr;
+	memset(&addr, 0, sizeof(addr));
+	addr.sin_family = AF_INET;
+	addr.sin_port = htons(port);
+	addr.sin_addr.s_addr = htonl(ipAddress);
+	return sendto(sock, (const char *)out, size, 0, (const sockaddr *)&addr, sizeof(addr)) == size;
+}
+
+// run one fixture's ops, writing the fields whose channels changed.  Returns true if it changed the light.
+static bool ApplyFixture(LG3DControlData *data, const LG3DDmxFixture *f, const LG3DDmxOp *op, const LG3DDmxPersonality *personality,
+	const unsigned char *dmx, const unsigned char *applied, bool all)
+{
+	int i = f->light;
+	if (!data->LightInUse(i))
+		return false;
+	LG3DLightTable *t = &data->lights;
+	unsigned long pin = t->pinMask[i];
+	unsigned long fields = 0;
+	float rgb[3] = {1.0f, 1.0f, 1.0f};
+	float dimmer = 1.0f;
+	bool color = false;
+	int o;
+	for(o=0;o<f->numOps;o++) {
+		const LG3DDmxOp *op1 = &op[o];
+		bool changed = all || (dmx[op1->coarse] != applied[op1->coarse]) || (dmx[op1->fine] != applied[op1->fine]);
+		// 8 bit values are spread over the 16 bit range, 255 is full
+		float v = ((dmx[op1->coarse] << 8) | dmx[op1->fine]) * (1.0f / 65535.0f);
+		switch (op1->kind) {
+			case LG3DDmx_Pan:
+				if (changed && !(pin & LG3DPinMask_H)) {
+					t->head[i] = (v - 0.5f) * personality->panRange;
+					fields |= LG3DDirty_Orientation;
+				}
+			break;
+
+			case LG3DDmx_Tilt:
+				if (changed && !(pin & LG3DPinMask_P)) {
+					t->pitch[i] = (v - 0.5f) * personality->tiltRange;
+					fields |= LG3DDirty_Orientation;
+				}
+			break;
+
+			case LG3DDmx_Red:
+			case LG3DDmx_Green:
+			case LG3DDmx_Blue:
+				rgb[op1->kind - LG3DDmx_Red] = v;
+				color |= changed;
+			break;
+
+			case LG3DDmx_Dimmer:
+				dimmer = v;
+				color |= changed;
+			break;
+
+			case LG3DDmx_Zoom:
+				if (changed) {
+					t->SetCone(i, personality->zoomMin + v * (personality->zoomMax - personality->zoomMin), t->penumbra[i]);
+					fields |= LG3DDirty_Cone;
+				}
+			break;
+		}
+	}
+	// a fixture missing one of red, green & blue has that one full
+	if (color) {
+		t->colorR[i] = rgb[0] * dimmer;
+		t->colorG[i] = rgb[1] * dimmer;
+		t->colorB[i] = rgb[2] * dimmer;
+		fields |= LG3DDirty_Color;
+	}
+	if (fields)
+		data->MarkLightDirty(i, fields);
+	return fields != 0;
+}
+
+int LG3DArtNet::Apply(LG3DControlData *data)
+{
+	int u, n, numChanged = 0;
+	for(u=0;u<numUniverses;u++) {
+		LG3DDmxUniverse *uni = &universe[u];
+		if (!uni->changed)
+			continue;
+		const LG3DDmxFixture *f = &fixture[uni->firstFixture];
+		for(n=0;n<uni->numFixtures;n++,f++) {
+			if (!uni->fresh && !memcmp(&uni->dmx[f->start], &uni->applied[f->start], f->footprint))
+				continue;
+			numChanged += ApplyFixture(data, f, &op[f->firstOp], &personality[f->personality], uni->dmx, uni->applied, uni->fresh);
+		}
+		memcpy(uni->applied, uni->dmx, LG3D_DMX_CHANNELS);
+		uni->changed = false;
+		uni->fresh = false;
+	}
+	return numChanged;
+}
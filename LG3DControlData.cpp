@@ -0,0 +1,1015 @@
+#include <math.h>
+
+#include "lg3d.h"
+
+// number of 4 byte arrays carved out of LG3DLightTable::block
+#define LIGHT_TABLE_ARRAYS 18
+
+// used by the bulk updates to pick between old & new values on the bit pattern, without branching
+union LG3DFloatBits {
+	float			f;
+	unsigned long	u;
+};
+
+// all ones if 'bit' is set in 'bits', else zero
+static inline unsigned long BitMask(unsigned long bits, unsigned long bit)
+{
+	return 0 - (unsigned long)((bits & bit) != 0);
+}
+
+// returns newVal, or oldVal where keep is all ones, and ORs any bits that changed into *diff.
+// +0 and -0 are the same value, going from one to the other is no change.
+static inline float SelectFloat(float oldVal, float newVal, unsigned long keep, unsigned long *diff)
+{
+	LG3DFloatBits o, n;
+	o.f = oldVal;
+	n.f = newVal;
+	n.u = (o.u & keep) | (n.u & ~keep);
+	*diff |= (o.u ^ n.u) & (0 - (unsigned long)(((o.u | n.u) & 0x7fffffff) != 0));
+	return n.f;
+}
+
+// cur + value where rel is all ones, otherwise value itself - not value + cur*0, which is NaN
+// for an infinite or NaN cur
+static inline float RelativeFloat(float cur, float value, unsigned long rel)
+{
+	LG3DFloatBits sum, v;
+	sum.f = cur + value;
+	v.f = value;
+	v.u = (sum.u & rel) | (v.u & ~rel);
+	return v.f;
+}
+
+LG3DLightTable::LG3DLightTable()
+{
+	memset(this, 0, sizeof(LG3DLightTable));
+}
+
+LG3DLightTable::~LG3DLightTable()
+{
+	_aligned_free(block);
+	free(cold);
+}
+
+void LG3DLightTable::AssignArrays()
+{
+	float *f = (float *)block;
+	posX = f; f += capacity;
+	posY = f; f += capacity;
+	posZ = f; f += capacity;
+	head = f; f += capacity;
+	pitch = f; f += capacity;
+	roll = f; f += capacity;
+	colorR = f; f += capacity;
+	colorG = f; f += capacity;
+	colorB = f; f += capacity;
+	umbra = f; f += capacity;
+	penumbra = f; f += capacity;
+	cosTheta = f; f += capacity;
+	att1 = f; f += capacity;
+	att2 = f; f += capacity;
+	pinMask = (unsigned long *)f; f += capacity;
+	flags = (unsigned long *)f; f += capacity;
+	parentNode = (int *)f; f += capacity;
+	dirty = (unsigned long *)f; f += capacity;
+}
+
+void LG3DLightTable::Resize(int newCount)
+{
+	int a;
+	if (newCount > capacity) {
+		// grow geometrically, and keep each array a multiple of 4 entries (16 bytes) long
+		int newCapacity = (newCount + 3) & ~3;
+		if (newCapacity < capacity*2)
+			newCapacity = capacity*2;
+
+		void *newBlock = _aligned_malloc(sizeof(float) * LIGHT_TABLE_ARRAYS * newCapacity, 16);
+		memset(newBlock, 0, sizeof(float) * LIGHT_TABLE_ARRAYS * newCapacity);
+		if (block) {
+			for(a=0;a<LIGHT_TABLE_ARRAYS;a++)
+				memcpy((float *)newBlock + a*newCapacity, (float *)block + a*capacity, sizeof(float) * count);
+			_aligned_free(block);
+		}
+		block = newBlock;
+		capacity = newCapacity;
+		AssignArrays();
+
+		cold = (LG3DLightColdData *)realloc(cold, sizeof(LG3DLightColdData) * capacity);
+	}
+
+	// new entries start out zeroed, same as a freshly constructed LG3DSceneLight
+	if (newCount > count) {
+		for(a=0;a<LIGHT_TABLE_ARRAYS;a++)
+			memset((float *)block + a*capacity + count, 0, sizeof(float) * (newCount-count));
+		memset(&cold[count], 0, sizeof(LG3DLightColdData) * (newCount-count));
+	}
+	count = newCount;
+}
+
+void LG3DLightTable::Load(int index, const LG3DSceneLight *light)
+{
+	posX[index] = light->position.x;
+	posY[index] = light->position.y;
+	posZ[index] = light->position.z;
+	head[index] = light->orientation.h;
+	pitch[index] = light->orientation.p;
+	roll[index] = light->orientation.r;
+	colorR[index] = light->color.r/255.0f;
+	colorG[index] = light->color.g/255.0f;
+	colorB[index] = light->color.b/255.0f;
+	SetCone(index, light->umbra, light->penumbra);
+	att1[index] = light->att1;
+	att2[index] = light->att2;
+	pinMask[index] = light->pinMask;
+	flags[index] =
+		(light->enabled ? LG3DLightFlag_Enabled : 0) |
+		(light->castsShadows ? LG3DLightFlag_CastsShadows : 0) |
+		(light->goboName != 0 ? LG3DLightFlag_HasGobo : 0);
+	parentNode[index] = light->parentNode;
+	cold[index].goboName = light->goboName;
+}
+
+void LG3DLightTable::Store(int index, LG3DSceneLight *light) const
+{
+	light->position.x = posX[index];
+	light->position.y = posY[index];
+	light->position.z = posZ[index];
+	light->orientation.h = head[index];
+	light->orientation.p = pitch[index];
+	light->orientation.r = roll[index];
+	light->color.r = (int)(colorR[index]*255.0f + 0.5f);
+	light->color.g = (int)(colorG[index]*255.0f + 0.5f);
+	light->color.b = (int)(colorB[index]*255.0f + 0.5f);
+	light->umbra = umbra[index];
+	light->penumbra = penumbra[index];
+	light->att1 = att1[index];
+	light->att2 = att2[index];
+	light->pinMask = pinMask[index];
+	light->enabled = (flags[index] & LG3DLightFlag_Enabled) != 0;
+	light->castsShadows = (flags[index] & LG3DLightFlag_CastsShadows) != 0;
+	light->parentNode = parentNode[index];
+	light->goboName = cold[index].goboName;
+}
+
+void LG3DLightTable::CopyRange(const LG3DLightTable *src, int first, int num)
+{
+	// the dirty bits are the last array in the block, and belong to each table's own owner
+	int a;
+	for(a=0;a<LIGHT_TABLE_ARRAYS-1;a++)
+		memcpy((float *)block + a*capacity + first, (const float *)src->block + a*src->capacity + first, sizeof(float) * num);
+}
+
+void LG3DLightTable::Repeat(int index, int num)
+{
+	int a, k;
+	for(a=0;a<LIGHT_TABLE_ARRAYS-1;a++) {
+		unsigned long *v = (unsigned long *)block + a*capacity + index;
+		for(k=1;k<=num;k++)
+			v[k] = v[0];
+	}
+	for(k=1;k<=num;k++)
+		cold[index+k] = cold[index];
+}
+
+float *LG3DLightTable::Field(LG3DDirtyFieldType field, int n) const
+{
+	// each field's arrays are laid out one after the other, see AssignArrays
+	switch (field) {
+		case LG3DDirty_Position: return posX + n*capacity;
+		case LG3DDirty_Orientation: return head + n*capacity;
+		case LG3DDirty_Color: return colorR + n*capacity;
+		case LG3DDirty_Cone: return umbra + n*capacity;
+		case LG3DDirty_Attenuation: return att1 + n*capacity;
+		default: break;
+	}
+	return NULL;
+}
+
+void LG3DLightTable::FieldArrays(const unsigned long *fieldList, int num, float **a) const
+{
+	int k, n = 0;
+	for(k=0;k<num;k++) {
+		n = ((k > 0) && (fieldList[k] == fieldList[k-1])) ? n+1 : 0;
+		a[k] = Field((LG3DDirtyFieldType)fieldList[k], n);
+	}
+}
+
+void LG3DLightTable::SetCone(int index, float newUmbra, float newPenumbra)
+{
+	umbra[index] = newUmbra;
+	penumbra[index] = newPenumbra;
+	cosTheta[index] = cosf(DEG2RADf(newUmbra + newPenumbra));
+}
+LG3DSlotList::LG3DSlotList()
+{
+	memset(this, 0, sizeof(LG3DSlotList));
+}
+
+LG3DSlotList::~LG3DSlotList()
+{
+	free(serial);
+	free(freeList);
+}
+
+static void GrowSlotList(LG3DSlotList *slots, int newCount)
+{
+	if (newCount <= slots->capacity)
+		return;
+	int newCapacity = slots->capacity*2;
+	if (newCapacity < newCount)
+		newCapacity = newCount;
+	slots->serial = (unsigned long *)realloc(slots->serial, sizeof(unsigned long) * newCapacity);
+	slots->freeList = (int *)realloc(slots->freeList, sizeof(int) * newCapacity);
+	slots->capacity = newCapacity;
+}
+
+void LG3DSlotList::Reset(int newCount)
+{
+	GrowSlotList(this, newCount);
+	if (newCount > 0)
+		memset(serial, 0, sizeof(unsigned long) * newCount);
+	count = newCount;
+	numFree = 0;
+}
+
+int LG3DSlotList::Alloc()
+{
+	int slot;
+	if (numFree > 0) {
+		slot = freeList[--numFree];
+		serial[slot]++;
+	} else {
+		GrowSlotList(this, count+1);
+		slot = count++;
+		serial[slot] = 0;
+	}
+	return slot;
+}
+
+void LG3DSlotList::Free(int slot)
+{
+	serial[slot]++;
+	freeList[numFree++] = slot;
+}
+
+void LG3DSlotList::Reload(int numInUse)
+{
+	int i;
+	if (numInUse > count) {
+		GrowSlotList(this, numInUse);
+		for(i=count;i<numInUse;i++)
+			serial[i] = 0;
+		count = numInUse;
+	}
+
+	// freed slots get the lowest indices reused first
+	numFree = 0;
+	for(i=count-1;i>=0;i--) {
+		bool inUse = (i < numInUse);
+		if (inUse != InUse(i))
+			serial[i]++;
+		if (!inUse)
+			freeList[numFree++] = i;
+	}
+}
+
+int LG3DSlotList::Slot(LG3DHandle handle) const
+{
+	int slot = (int)(handle & LG3D_HANDLE_SLOT_MASK);
+	if ((handle == LG3D_INVALID_HANDLE) || (slot >= count) || !InUse(slot) || (Handle(slot) != handle))
+		return -1;
+	return slot;
+}
+
+LG3DControlData::LG3DControlData()
+{
+	numSceneObjects = 0;
+	sceneObjectList = NULL;
+	numSceneLights = 0;
+	sceneLightList = NULL;
+	numSceneNodes = 0;
+	sceneNodeList = NULL;
+	numLightArrays = 0;
+	lightArrayList = NULL;
+	numObjectArrays = 0;
+	objectArrayList = NULL;
+	ambient.r = ambient.g = ambient.b = 24;
+	numCameras = 0;
+	cameraList = NULL;
+	sceneFile = NULL;
+	curLight = -1;
+	curCamera = -1;
+	wantShadows = true;
+	wantEffects = false;
+	generation = 0;
+	dirtyLightList = NULL;
+	numDirtyLights = 0;
+	objectDirty = NULL;
+	dirtyObjectList = NULL;
+	numDirtyObjects = 0;
+	nodeDirty = NULL;
+	firstDirtyNode = 0;
+	maxDirtyLights = 0;
+	maxDirtyObjects = 0;
+	maxDirtyNodes = 0;
+	maxSceneLights = 0;
+	maxSceneObjects = 0;
+}
+
+LG3DControlData::~LG3DControlData()
+{
+	FreeDirtyState();
+}
+
+void LG3DControlData::LoadScene()
+{
+	int listed = ListedLights();
+	int numLights = DescribedLights();
+	lights.Resize(numLights);
+	maxSceneLights = numSceneLights; // whatever the host allocated, it holds no more than this
+	maxSceneObjects = numSceneObjects;
+	int i;
+	for(i=0;i<listed;i++)
+		lights.Load(i, &sceneLightList[i]);
+	LoadArrays(listed);
+	lightSlots.Reset(numLights);
+	objectSlots.Reset(numSceneObjects);
+	generation++;
+}
+
+LG3DHandle LG3DControlData::AddLight(const LG3DSceneLight *light)
+{
+	int slot = lightSlots.Alloc();
+	if (slot == lights.count) {
+		// grow the rig description along with the table, it is allocated with new [] by the host.
+		// Past the array elements there is no description to keep.
+		if (slot == numSceneLights)
+			GrowSceneLights(slot+1);
+		lights.Resize(slot+1);
+		GrowDirtyState();
+	}
+	if (slot < numSceneLights)
+		sceneLightList[slot] = *light;
+	lights.Load(slot, light);
+	MarkLightDirty(slot, LG3DDirty_All);
+	return lightSlots.Handle(slot);
+}
+
+void LG3DControlData::RemoveLight(LG3DHandle light)
+{
+	int slot = lightSlots.Slot(light);
+	if (slot < 0)
+		return;
+	lightSlots.Free(slot);
+
+	// a free slot is left as a disabled light, with no shadows or gobo
+	LG3DSceneLight empty;
+	if (slot < numSceneLights)
+		sceneLightList[slot] = empty;
+	lights.Load(slot, &empty);
+	if (curLight == slot)
+		curLight = -1;
+	MarkLightDirty(slot, LG3DDirty_All);
+}
+
+LG3DHandle LG3DControlData::AddObject(const LG3DSceneObject *object)
+{
+	int slot = objectSlots.Alloc();
+	if (slot == numSceneObjects) {
+		GrowSceneObjects(slot+1);
+		GrowDirtyState();
+	}
+	sceneObjectList[slot] = *object;
+	MarkObjectDirty(slot, LG3DDirty_All);
+	return objectSlots.Handle(slot);
+}
+
+void LG3DControlData::RemoveObject(LG3DHandle object)
+{
+	int slot = objectSlots.Slot(object);
+	if (slot < 0)
+		return;
+	objectSlots.Free(slot);
+
+	LG3DSceneObject empty;
+	sceneObjectList[slot] = empty;
+	MarkObjectDirty(slot, LG3DDirty_All);
+}
+
+// LG3DDirtyFieldType bits of the fields that differ between two rig descriptions of a light
+static unsigned long DiffSceneLight(const LG3DSceneLight *a, const LG3DSceneLight *b)
+{
+	unsigned long fields = 0;
+	if (memcmp(&a->position, &b->position, sizeof(LG3DPosition)))
+		fields |= LG3DDirty_Position;
+	if (memcmp(&a->orientation, &b->orientation, sizeof(LG3DOrientation)))
+		fields |= LG3DDirty_Orientation;
+	if (memcmp(&a->color, &b->color, sizeof(LG3DLightColor)))
+		fields |= LG3DDirty_Color;
+	if (a->umbra != b->umbra || a->penumbra != b->penumbra)
+		fields |= LG3DDirty_Cone;
+	if (a->att1 != b->att1 || a->att2 != b->att2)
+		fields |= LG3DDirty_Attenuation;
+	if (a->enabled != b->enabled)
+		fields |= LG3DDirty_Enabled;
+	if (a->castsShadows != b->castsShadows)
+		fields |= LG3DDirty_Shadows;
+	if (a->parentNode != b->parentNode)
+		fields |= LG3DDirty_Node | LG3DDirty_Transform;
+	if (a->goboName != b->goboName)
+		fields |= LG3DDirty_All; // gobo texture has to be swapped, rebuild the whole light
+	return fields;
+}
+
+int LG3DControlData::Reload(const LG3DControlData *src)
+{
+	int i, changed = 0;
+
+	// the rig only grows, surplus lights & objects are left in place as free slots.  The
+	// lights src lists one by one keep a description here, array elements only a table entry.
+	int srcLights = src->DescribedLights();
+	int srcObjects = src->DescribedObjects();
+	int numLights = max(lights.count, srcLights);
+	int srcListed = src->ListedLights();
+	GrowSceneLights(srcListed);
+	lights.Resize(numLights);
+	int numObjects = max(numSceneObjects, srcObjects);
+	GrowSceneObjects(numObjects);
+	GrowDirtyState();
+
+	// ---------------------------------------------------------
+	// lights
+	// ---------------------------------------------------------
+	LG3DSceneLight empty;
+	int oldNumLights = lightSlots.count;
+	for(i=0;i<numLights;i++) {
+		LG3DSceneLight described;
+		const LG3DSceneLight *light = &empty;
+		if (i < srcListed)
+			light = &src->sceneLightList[i];
+		else if (i < srcLights) {
+			src->DescribeLight(i, &described);
+			light = &described;
+		}
+		if (i < numSceneLights)
+			sceneLightList[i] = *light;
+		bool wasInUse = (i < oldNumLights) && lightSlots.InUse(i);
+		unsigned long fields;
+		if (wasInUse != (i < srcLights))
+			fields = LG3DDirty_All;
+		else {
+			LG3DSceneLight cur;
+			lights.Store(i, &cur);
+			fields = DiffSceneLight(&cur, light);
+			if (!fields && cur.pinMask == light->pinMask)
+				continue;
+		}
+		lights.Load(i, light);
+		if (fields) {
+			MarkLightDirty(i, fields);
+			changed++;
+		}
+	}
+	lightSlots.Reload(srcLights);
+	if (curLight >= srcLights)
+		curLight = -1;
+
+	// ---------------------------------------------------------
+	// objects
+	// ---------------------------------------------------------
+	int oldNumObjects = objectSlots.count;
+	LG3DSceneObject emptyObject;
+	for(i=0;i<numObjects;i++) {
+		LG3DSceneObject described;
+		const LG3DSceneObject *object = &emptyObject;
+		if (i < srcObjects) {
+			src->DescribeObject(i, &described);
+			object = &described;
+		}
+		LG3DSceneObject *cur = &sceneObjectList[i];
+		bool wasInUse = (i < oldNumObjects) && objectSlots.InUse(i);
+		unsigned long fields = 0;
+		if ((wasInUse != (i < srcObjects)) || (cur->meshName != object->meshName))
+			fields = LG3DDirty_All;
+		else {
+			if (memcmp(&cur->position, &object->position, sizeof(LG3DPosition)))
+				fields |= LG3DDirty_Position;
+			if (memcmp(&cur->orientation, &object->orientation, sizeof(LG3DOrientation)))
+				fields |= LG3DDirty_Orientation;
+			if (cur->parentNode != object->parentNode)
+				fields |= LG3DDirty_Node | LG3DDirty_Transform;
+		}
+		if (fields) {
+			*cur = *object;
+			MarkObjectDirty(i, fields);
+			changed++;
+		}
+	}
+	objectSlots.Reload(srcObjects);
+	CopyArrays(src);
+
+	// ---------------------------------------------------------
+	// nodes - the count only grows, the same as the lights'.  Any
+	// src lacks are left in place, with nothing hanging from them
+	// ---------------------------------------------------------
+	int oldNodes = numSceneNodes;
+	if (src->numSceneNodes > numSceneNodes) {
+		LG3DSceneNode *newList = new LG3DSceneNode[src->numSceneNodes];
+		memcpy(newList, sceneNodeList, sizeof(LG3DSceneNode) * numSceneNodes);
+		if (!IsMapped(sceneNodeList))
+			delete [] sceneNodeList;
+		sceneNodeList = newList;
+		numSceneNodes = src->numSceneNodes;
+		GrowDirtyState();
+	}
+	int numNodes = src->numSceneNodes;
+	for(i=0;i<numNodes;i++) {
+		if ((i >= oldNodes) || memcmp(&sceneNodeList[i], &src->sceneNodeList[i], sizeof(LG3DSceneNode))) {
+			sceneNodeList[i] = src->sceneNodeList[i];
+			MarkNodeDirty(i, LG3DDirty_Transform);
+			changed++;
+		}
+	}
+
+	// ---------------------------------------------------------
+	// cameras & the rest of the show settings
+	// ---------------------------------------------------------
+	if (numCameras != src->numCameras) {
+		if (!IsMapped(cameraList))
+			delete [] cameraList;
+		cameraList = new LG3DCameraObject[src->numCameras];
+		numCameras = src->numCameras;
+	}
+	for(i=0;i<numCameras;i++)
+		cameraList[i] = src->cameraList[i];
+	if (curCamera >= numCameras)
+		curCamera = src->curCamera;
+	ambient = src->ambient;
+	clearColor = src->clearColor;
+	generation++;
+
+	return changed;
+}
+
+void LG3DControlData::CommitLight(int lightIndex)
+{
+	if (lightIndex >= numSceneLights)
+		return;
+	lights.Load(lightIndex, &sceneLightList[lightIndex]);
+	MarkLightDirty(lightIndex, LG3DDirty_All);
+}
+
+void LG3DControlData::AllocDirtyState()
+{
+	FreeDirtyState();
+	maxDirtyLights = lights.capacity+1;
+	maxDirtyObjects = numSceneObjects+1;
+	dirtyLightList = (int *)malloc(sizeof(int) * maxDirtyLights);
+	objectDirty = (unsigned long *)malloc(sizeof(unsigned long) * maxDirtyObjects);
+	dirtyObjectList = (int *)malloc(sizeof(int) * maxDirtyObjects);
+	int i;
+	for(i=0;i<lights.count;i++) {
+		lights.dirty[i] = LG3DDirty_All;
+		dirtyLightList[i] = i;
+	}
+	numDirtyLights = lights.count;
+	for(i=0;i<numSceneObjects;i++) {
+		objectDirty[i] = LG3DDirty_All;
+		dirtyObjectList[i] = i;
+	}
+	numDirtyObjects = numSceneObjects;
+	objectDirty[numSceneObjects] = 0; // the spare entry, the next object added goes there
+	maxDirtyNodes = numSceneNodes+1;
+	nodeDirty = (unsigned long *)malloc(sizeof(unsigned long) * maxDirtyNodes);
+	for(i=0;i<numSceneNodes;i++)
+		nodeDirty[i] = LG3DDirty_All;
+	firstDirtyNode = 0;
+	generation++;
+}
+
+void LG3DControlData::FreeDirtyState()
+{
+	free(dirtyLightList);
+	free(objectDirty);
+	free(dirtyObjectList);
+	free(nodeDirty);
+	dirtyLightList = NULL;
+	objectDirty = NULL;
+	dirtyObjectList = NULL;
+	nodeDirty = NULL;
+	numDirtyLights = 0;
+	numDirtyObjects = 0;
+	firstDirtyNode = numSceneNodes;
+	maxDirtyLights = 0;
+	maxDirtyObjects = 0;
+	maxDirtyNodes = 0;
+}
+
+void LG3DControlData::GrowDirtyState()
+{
+	if (!dirtyLightList)
+		return; // not attached to a renderer yet
+
+	if (lights.count > maxDirtyLights) {
+		maxDirtyLights = lights.capacity+1;
+		dirtyLightList = (int *)realloc(dirtyLightList, sizeof(int) * maxDirtyLights);
+	}
+
+	if (numSceneObjects > maxDirtyObjects) {
+		int oldMax = maxDirtyObjects;
+		maxDirtyObjects = numSceneObjects*2;
+		objectDirty = (unsigned long *)realloc(objectDirty, sizeof(unsigned long) * maxDirtyObjects);
+		dirtyObjectList = (int *)realloc(dirtyObjectList, sizeof(int) * maxDirtyObjects);
+		memset(&objectDirty[oldMax], 0, sizeof(unsigned long) * (maxDirtyObjects-oldMax));
+	}
+
+	if (numSceneNodes >= maxDirtyNodes) {
+		int oldMax = maxDirtyNodes;
+		maxDirtyNodes = numSceneNodes+1;
+		nodeDirty = (unsigned long *)realloc(nodeDirty, sizeof(unsigned long) * maxDirtyNodes);
+		memset(&nodeDirty[oldMax], 0, sizeof(unsigned long) * (maxDirtyNodes-oldMax));
+	}
+}
+
+void LG3DControlData::GrowSceneLights(int count)
+{
+	if (count <= numSceneLights)
+		return;
+	if (count > maxSceneLights) {
+		// the lists are host arrays allocated with new [], one that was handed over is replaced
+		maxSceneLights = max(count, numSceneLights*2);
+		LG3DSceneLight *newList = new LG3DSceneLight[maxSceneLights];
+		memcpy(newList, sceneLightList, sizeof(LG3DSceneLight) * numSceneLights);
+		if (!IsMapped(sceneLightList))
+			delete [] sceneLightList;
+		sceneLightList = newList;
+	}
+	numSceneLights = count;
+}
+
+void LG3DControlData::GrowSceneObjects(int count)
+{
+	if (count <= numSceneObjects)
+		return;
+	if (count > maxSceneObjects) {
+		maxSceneObjects = max(count, numSceneObjects*2);
+		LG3DSceneObject *newList = new LG3DSceneObject[maxSceneObjects];
+		memcpy(newList, sceneObjectList, sizeof(LG3DSceneObject) * numSceneObjects);
+		if (!IsMapped(sceneObjectList))
+			delete [] sceneObjectList;
+		sceneObjectList = newList;
+	}
+	numSceneObjects = count;
+}
+
+void LG3DControlData::MoveLight(int lightIndex, LG3DPosition *posDelta, LG3DOrientation *orientDelta)
+{
+	unsigned long pin = lights.pinMask[lightIndex];
+	unsigned long fields = 0;
+
+	if (posDelta) {
+		if (!(pin & LG3DPinMask_X) && posDelta->x != 0.0f) {
+			lights.posX[lightIndex] += posDelta->x;
+			fields |= LG3DDirty_Position;
+		}
+		if (!(pin & LG3DPinMask_Y) && posDelta->y != 0.0f) {
+			lights.posY[lightIndex] += posDelta->y;
+			fields |= LG3DDirty_Position;
+		}
+		if (!(pin & LG3DPinMask_Z) && posDelta->z != 0.0f) {
+			lights.posZ[lightIndex] += posDelta->z;
+			fields |= LG3DDirty_Position;
+		}
+	}
+
+	if (orientDelta) {
+		if (!(pin & LG3DPinMask_H) && orientDelta->h != 0.0f) {
+			lights.head[lightIndex] += orientDelta->h;
+			fields |= LG3DDirty_Orientation;
+		}
+		if (!(pin & LG3DPinMask_P) && orientDelta->p != 0.0f) {
+			lights.pitch[lightIndex] += orientDelta->p;
+			fields |= LG3DDirty_Orientation;
+		}
+		if (!(pin & LG3DPinMask_R) && orientDelta->r != 0.0f) {
+			lights.roll[lightIndex] += orientDelta->r;
+			fields |= LG3DDirty_Orientation;
+		}
+	}
+
+	if (fields)
+		MarkLightDirty(lightIndex, fields);
+}
+
+void LG3DControlData::MoveObject(int objectIndex, LG3DPosition *posDelta, LG3DOrientation *orientDelta)
+{
+	unsigned long fields = 0;
+
+	if (posDelta && (posDelta->x != 0.0f || posDelta->y != 0.0f || posDelta->z != 0.0f)) {
+		sceneObjectList[objectIndex].position.x += posDelta->x;
+		sceneObjectList[objectIndex].position.y += posDelta->y;
+		sceneObjectList[objectIndex].position.z += posDelta->z;
+		fields |= LG3DDirty_Position;
+	}
+
+	if (orientDelta && (orientDelta->h != 0.0f || orientDelta->p != 0.0f || orientDelta->r != 0.0f)) {
+		sceneObjectList[objectIndex].orientation.h += orientDelta->h;
+		sceneObjectList[objectIndex].orientation.p += orientDelta->p;
+		sceneObjectList[objectIndex].orientation.r += orientDelta->r;
+		fields |= LG3DDirty_Orientation;
+	}
+
+	if (fields)
+		MarkObjectDirty(objectIndex, fields);
+}
+
+void LG3DControlData::SetLightPosition(int lightIndex, const LG3DPosition *pos)
+{
+	unsigned long pin = lights.pinMask[lightIndex];
+	bool changed = false;
+	if (!(pin & LG3DPinMask_X) && lights.posX[lightIndex] != pos->x) {
+		lights.posX[lightIndex] = pos->x;
+		changed = true;
+	}
+	if (!(pin & LG3DPinMask_Y) && lights.posY[lightIndex] != pos->y) {
+		lights.posY[lightIndex] = pos->y;
+		changed = true;
+	}
+	if (!(pin & LG3DPinMask_Z) && lights.posZ[lightIndex] != pos->z) {
+		lights.posZ[lightIndex] = pos->z;
+		changed = true;
+	}
+	if (changed)
+		MarkLightDirty(lightIndex, LG3DDirty_Position);
+}
+
+void LG3DControlData::SetLightOrientation(int lightIndex, const LG3DOrientation *orient)
+{
+	unsigned long pin = lights.pinMask[lightIndex];
+	bool changed = false;
+	if (!(pin & LG3DPinMask_H) && lights.head[lightIndex] != orient->h) {
+		lights.head[lightIndex] = orient->h;
+		changed = true;
+	}
+	if (!(pin & LG3DPinMask_P) && lights.pitch[lightIndex] != orient->p) {
+		lights.pitch[lightIndex] = orient->p;
+		changed = true;
+	}
+	if (!(pin & LG3DPinMask_R) && lights.roll[lightIndex] != orient->r) {
+		lights.roll[lightIndex] = orient->r;
+		changed = true;
+	}
+	if (changed)
+		MarkLightDirty(lightIndex, LG3DDirty_Orientation);
+}
+
+void LG3DControlData::SetLightColor(int lightIndex, const LG3DLightColor *color)
+{
+	float r = color->r/255.0f, g = color->g/255.0f, b = color->b/255.0f;
+	if (lights.colorR[lightIndex] != r || lights.colorG[lightIndex] != g || lights.colorB[lightIndex] != b) {
+		lights.colorR[lightIndex] = r;
+		lights.colorG[lightIndex] = g;
+		lights.colorB[lightIndex] = b;
+		MarkLightDirty(lightIndex, LG3DDirty_Color);
+	}
+}
+
+void LG3DControlData::SetLightCone(int lightIndex, float umbra, float penumbra)
+{
+	if (lights.umbra[lightIndex] != umbra || lights.penumbra[lightIndex] != penumbra) {
+		lights.SetCone(lightIndex, umbra, penumbra);
+		MarkLightDirty(lightIndex, LG3DDirty_Cone);
+	}
+}
+
+void LG3DControlData::SetLightAttenuation(int lightIndex, float att1, float att2)
+{
+	if (lights.att1[lightIndex] != att1 || lights.att2[lightIndex] != att2) {
+		lights.att1[lightIndex] = att1;
+		lights.att2[lightIndex] = att2;
+		MarkLightDirty(lightIndex, LG3DDirty_Attenuation);
+	}
+}
+
+void LG3DControlData::EnableLight(int lightIndex, bool enabled)
+{
+	if (IsLightEnabled(lightIndex) != enabled) {
+		lights.flags[lightIndex] ^= LG3DLightFlag_Enabled;
+		MarkLightDirty(lightIndex, LG3DDirty_Enabled);
+	}
+}
+
+void LG3DControlData::SetLightCastsShadows(int lightIndex, bool castsShadows)
+{
+	if (((lights.flags[lightIndex] & LG3DLightFlag_CastsShadows) != 0) != castsShadows) {
+		lights.flags[lightIndex] ^= LG3DLightFlag_CastsShadows;
+		MarkLightDirty(lightIndex, LG3DDirty_Shadows);
+	}
+}
+
+void LG3DControlData::SetObjectPosition(int objectIndex, const LG3DPosition *pos)
+{
+	LG3DSceneObject *obj = &sceneObjectList[objectIndex];
+	if (obj->position.x != pos->x || obj->position.y != pos->y || obj->position.z != pos->z) {
+		obj->position = *pos;
+		MarkObjectDirty(objectIndex, LG3DDirty_Position);
+	}
+}
+
+void LG3DControlData::SetObjectOrientation(int objectIndex, const LG3DOrientation *orient)
+{
+	LG3DSceneObject *obj = &sceneObjectList[objectIndex];
+	if (obj->orientation.h != orient->h || obj->orientation.p != orient->p || obj->orientation.r != orient->r) {
+		obj->orientation = *orient;
+		MarkObjectDirty(objectIndex, LG3DDirty_Orientation);
+	}
+}
+
+void LG3DControlData::MoveNode(int nodeIndex, LG3DPosition *posDelta, LG3DOrientation *orientDelta)
+{
+	LG3DSceneNode *node = &sceneNodeList[nodeIndex];
+	unsigned long fields = 0;
+
+	if (posDelta && (posDelta->x != 0.0f || posDelta->y != 0.0f || posDelta->z != 0.0f)) {
+		node->position.x += posDelta->x;
+		node->position.y += posDelta->y;
+		node->position.z += posDelta->z;
+		fields |= LG3DDirty_Position;
+	}
+
+	if (orientDelta && (orientDelta->h != 0.0f || orientDelta->p != 0.0f || orientDelta->r != 0.0f)) {
+		node->orientation.h += orientDelta->h;
+		node->orientation.p += orientDelta->p;
+		node->orientation.r += orientDelta->r;
+		fields |= LG3DDirty_Orientation;
+	}
+
+	if (fields)
+		MarkNodeDirty(nodeIndex, fields);
+}
+
+void LG3DControlData::SetNodePosition(int nodeIndex, const LG3DPosition *pos)
+{
+	LG3DSceneNode *node = &sceneNodeList[nodeIndex];
+	if (node->position.x != pos->x || node->position.y != pos->y || node->position.z != pos->z) {
+		node->position = *pos;
+		MarkNodeDirty(nodeIndex, LG3DDirty_Position);
+	}
+}
+
+void LG3DControlData::SetNodeOrientation(int nodeIndex, const LG3DOrientation *orient)
+{
+	LG3DSceneNode *node = &sceneNodeList[nodeIndex];
+	if (node->orientation.h != orient->h || node->orientation.p != orient->p || node->orientation.r != orient->r) {
+		node->orientation = *orient;
+		MarkNodeDirty(nodeIndex, LG3DDirty_Orientation);
+	}
+}
+
+void LG3DControlData::AttachLight(int lightIndex, int nodeIndex)
+{
+	if (lights.parentNode[lightIndex] != nodeIndex) {
+		lights.parentNode[lightIndex] = nodeIndex;
+		MarkLightDirty(lightIndex, LG3DDirty_Node | LG3DDirty_Transform);
+	}
+}
+
+void LG3DControlData::AttachObject(int objectIndex, int nodeIndex)
+{
+	if (sceneObjectList[objectIndex].parentNode != nodeIndex) {
+		sceneObjectList[objectIndex].parentNode = nodeIndex;
+		MarkObjectDirty(objectIndex, LG3DDirty_Node | LG3DDirty_Transform);
+	}
+}
+
+void LG3DControlData::GetLightPosition(int lightIndex, LG3DPosition *pos) const
+{
+	pos->x = lights.posX[lightIndex];
+	pos->y = lights.posY[lightIndex];
+	pos->z = lights.posZ[lightIndex];
+}
+
+void LG3DControlData::GetLightOrientation(int lightIndex, LG3DOrientation *orient) const
+{
+	orient->h = lights.head[lightIndex];
+	orient->p = lights.pitch[lightIndex];
+	orient->r = lights.roll[lightIndex];
+}
+
+void LG3DControlData::GetLightColor(int lightIndex, LG3DLightColor *color) const
+{
+	color->r = (int)(lights.colorR[lightIndex]*255.0f + 0.5f);
+	color->g = (int)(lights.colorG[lightIndex]*255.0f + 0.5f);
+	color->b = (int)(lights.colorB[lightIndex]*255.0f + 0.5f);
+}
+
+int LG3DControlData::UpdateLights(const LG3DLightUpdate *updates, int numUpdates)
+{
+	int n, numChanged = 0;
+	for(n=0;n<numUpdates;n++) {
+		const LG3DLightUpdate *u = &updates[n];
+		int i = u->index;
+		unsigned long pin = lights.pinMask[i];
+		unsigned long fields = u->fields;
+		unsigned long rel = u->relative ? 0xffffffff : 0;
+		unsigned long keep, diff, changed = 0;
+
+		// fields not asked for, and pinned axes, keep their current value
+		keep = ~BitMask(fields, LG3DDirty_Position);
+		diff = 0;
+		lights.posX[i] = SelectFloat(lights.posX[i], RelativeFloat(lights.posX[i], u->position.x, rel), keep | BitMask(pin, LG3DPinMask_X), &diff);
+		lights.posY[i] = SelectFloat(lights.posY[i], RelativeFloat(lights.posY[i], u->position.y, rel), keep | BitMask(pin, LG3DPinMask_Y), &diff);
+		lights.posZ[i] = SelectFloat(lights.posZ[i], RelativeFloat(lights.posZ[i], u->position.z, rel), keep | BitMask(pin, LG3DPinMask_Z), &diff);
+		changed |= LG3DDirty_Position & BitMask(diff, 0xffffffff);
+
+		keep = ~BitMask(fields, LG3DDirty_Orientation);
+		diff = 0;
+		lights.head[i] = SelectFloat(lights.head[i], RelativeFloat(lights.head[i], u->orientation.h, rel), keep | BitMask(pin, LG3DPinMask_H), &diff);
+		lights.pitch[i] = SelectFloat(lights.pitch[i], RelativeFloat(lights.pitch[i], u->orientation.p, rel), keep | BitMask(pin, LG3DPinMask_P), &diff);
+		lights.roll[i] = SelectFloat(lights.roll[i], RelativeFloat(lights.roll[i], u->orientation.r, rel), keep | BitMask(pin, LG3DPinMask_R), &diff);
+		changed |= LG3DDirty_Orientation & BitMask(diff, 0xffffffff);
+
+		keep = ~BitMask(fields, LG3DDirty_Color);
+		diff = 0;
+		lights.colorR[i] = SelectFloat(lights.colorR[i], u->color.r/255.0f, keep, &diff);
+		lights.colorG[i] = SelectFloat(lights.colorG[i], u->color.g/255.0f, keep, &diff);
+		lights.colorB[i] = SelectFloat(lights.colorB[i], u->color.b/255.0f, keep, &diff);
+		changed |= LG3DDirty_Color & BitMask(diff, 0xffffffff);
+
+		keep = ~BitMask(fields, LG3DDirty_Cone);
+		diff = 0;
+		lights.umbra[i] = SelectFloat(lights.umbra[i], u->umbra, keep, &diff);
+		lights.penumbra[i] = SelectFloat(lights.penumbra[i], u->penumbra, keep, &diff);
+		changed |= LG3DDirty_Cone & BitMask(diff, 0xffffffff);
+
+		keep = ~BitMask(fields, LG3DDirty_Attenuation);
+		diff = 0;
+		lights.att1[i] = SelectFloat(lights.att1[i], u->att1, keep, &diff);
+		lights.att2[i] = SelectFloat(lights.att2[i], u->att2, keep, &diff);
+		changed |= LG3DDirty_Attenuation & BitMask(diff, 0xffffffff);
+
+		unsigned long want = (LG3DLightFlag_Enabled & BitMask(fields, LG3DDirty_Enabled)) |
+							 (LG3DLightFlag_CastsShadows & BitMask(fields, LG3DDirty_Shadows));
+		unsigned long newFlags = (u->enabled ? LG3DLightFlag_Enabled : 0) | (u->castsShadows ? LG3DLightFlag_CastsShadows : 0);
+		diff = (lights.flags[i] ^ newFlags) & want;
+		lights.flags[i] ^= diff;
+		changed |= (LG3DDirty_Enabled & BitMask(diff, LG3DLightFlag_Enabled)) |
+				   (LG3DDirty_Shadows & BitMask(diff, LG3DLightFlag_CastsShadows));
+
+		if (changed) {
+			if (changed & LG3DDirty_Cone)
+				lights.SetCone(i, lights.umbra[i], lights.penumbra[i]);
+
+			// same as MarkLightDirty, without bumping the generation for every record
+			if (dirtyLightList) {
+				if (lights.dirty[i] == 0)
+					dirtyLightList[numDirtyLights++] = i;
+				lights.dirty[i] |= changed;
+			}
+			numChanged++;
+		}
+	}
+
+	if (numChanged)
+		generation++;
+	return numChanged;
+}
+
+int LG3DControlData::UpdateObjects(const LG3DObjectUpdate *updates, int numUpdates)
+{
+	int n, numChanged = 0;
+	for(n=0;n<numUpdates;n++) {
+		const LG3DObjectUpdate *u = &updates[n];
+		int i = u->index;
+		LG3DSceneObject *obj = &sceneObjectList[i];
+		unsigned long rel = u->relative ? 0xffffffff : 0;
+		unsigned long keep, diff, changed = 0;
+
+		keep = ~BitMask(u->fields, LG3DDirty_Position);
+		diff = 0;
+		obj->position.x = SelectFloat(obj->position.x, RelativeFloat(obj->position.x, u->position.x, rel), keep, &diff);
+		obj->position.y = SelectFloat(obj->position.y, RelativeFloat(obj->position.y, u->position.y, rel), keep, &diff);
+		obj->position.z = SelectFloat(obj->position.z, RelativeFloat(obj->position.z, u->position.z, rel), keep, &diff);
+		changed |= LG3DDirty_Position & BitMask(diff, 0xffffffff);
+
+		keep = ~BitMask(u->fields, LG3DDirty_Orientation);
+		diff = 0;
+		obj->orientation.h = SelectFloat(obj->orientation.h, RelativeFloat(obj->orientation.h, u->orientation.h, rel), keep, &diff);
+		obj->orientation.p = SelectFloat(obj->orientation.p, RelativeFloat(obj->orientation.p, u->orientation.p, rel), keep, &diff);
+		obj->orientation.r = SelectFloat(obj->orientation.r, RelativeFloat(obj->orientation.r, u->orientation.r, rel), keep, &diff);
+		changed |= LG3DDirty_Orientation & BitMask(diff, 0xffffffff);
+
+		if (changed) {
+			if (objectDirty) {
+				if (objectDirty[i] == 0)
+					dirtyObjectList[numDirtyObjects++] = i;
+				objectDirty[i] |= changed;
+			}
+			numChanged++;
+		}
+	}
+
+	if (numChanged)
+		generation++;
+	return numChanged;
+}
@@ -0,0 +1,195 @@
+#include <math.h>
+#include <xmmintrin.h>
+
+#include "lg3d.h"
+
+// number of light table values a crossfade interpolates, see fadeField
+#define FADE_VALUES 13
+#define FADE_HEAD 3
+
+// 'value' holds the start values, then the end values, then the current ones
+#define FADE_FROM 0
+#define FADE_TO FADE_VALUES
+#define FADE_CUR (FADE_VALUES*2)
+
+// the LG3DLightFlagType bits a crossfade switches
+#define FADE_FLAGS (LG3DLightFlag_Enabled | LG3DLightFlag_CastsShadows)
+
+// the LG3DDirtyFieldType bit & LG3DPinMaskType bit of each interpolated value, the
+// fields' arrays are the values - see LG3DLightTable::FieldArrays
+static const unsigned long fadeField[FADE_VALUES] = {
+	LG3DDirty_Position, LG3DDirty_Position, LG3DDirty_Position,
+	LG3DDirty_Orientation, LG3DDirty_Orientation, LG3DDirty_Orientation,
+	LG3DDirty_Color, LG3DDirty_Color, LG3DDirty_Color,
+	LG3DDirty_Cone, LG3DDirty_Cone,
+	LG3DDirty_Attenuation, LG3DDirty_Attenuation,
+};
+
+static const unsigned long fadePin[FADE_VALUES] = {
+	LG3DPinMask_X, LG3DPinMask_Y, LG3DPinMask_Z,
+	LG3DPinMask_H, LG3DPinMask_P, LG3DPinMask_R,
+	0, 0, 0, 0, 0, 0, 0,
+};
+
+LG3DCrossfade::LG3DCrossfade()
+{
+	numFading = 0;
+	capacity = 0;
+	light = NULL;
+	value = NULL;
+	endHead = NULL;
+	flagsOn = NULL;
+	flagsOff = NULL;
+	startTime = 0.0;
+	duration = 0.0f;
+	started = false;
+}
+
+LG3DCrossfade::~LG3DCrossfade()
+{
+	free(light);
+	_aligned_free(value);
+	free(endHead);
+	free(flagsOn);
+	free(flagsOff);
+}
+
+int LG3DCrossfade::Start(const LG3DControlData *data, const LG3DLightTable *to, float _duration, double startAt)
+{
+	int i, v;
+	numFading = 0;
+	duration = _duration;
+	startTime = startAt;
+	started = false;
+
+	int numLights = min(data->lights.count, to->count);
+	if (numLights > capacity) {
+		capacity = (numLights + 3) & ~3;
+		light = (int *)realloc(light, sizeof(int) * capacity);
+		_aligned_free(value);
+		value = (float *)_aligned_malloc(sizeof(float) * FADE_VALUES*3 * capacity, 16);
+		endHead = (float *)realloc(endHead, sizeof(float) * capacity);
+		flagsOn = (unsigned long *)realloc(flagsOn, sizeof(unsigned long) * capacity);
+		flagsOff = (unsigned long *)realloc(flagsOff, sizeof(unsigned long) * capacity);
+	}
+
+	float *live[FADE_VALUES], *target[FADE_VALUES];
+	data->lights.FieldArrays(fadeField, FADE_VALUES, live);
+	to->FieldArrays(fadeField, FADE_VALUES, target);
+
+	// only lights that end up somewhere else are put on the fade list
+	for(i=0;i<numLights;i++) {
+		if (!data->LightInUse(i))
+			continue;
+		unsigned long pin = data->lights.pinMask[i];
+		int n = numFading;
+		bool differs = false;
+		for(v=0;v<FADE_VALUES;v++) {
+			float from = live[v][i];
+			float end = (pin & fadePin[v]) ? from : target[v][i];
+			value[(FADE_FROM+v)*capacity + n] = from;
+			value[(FADE_TO+v)*capacity + n] = end;
+			if (end != from)
+				differs = true;
+		}
+
+		// heading takes the short way round, the exact end value is put back when the fade ends
+		float end = value[(FADE_TO+FADE_HEAD)*capacity + n];
+		float from = value[(FADE_FROM+FADE_HEAD)*capacity + n];
+		float turn = fmodf(end - from, 360.0f);
+		if (turn > 180.0f)
+			turn -= 360.0f;
+		else if (turn < -180.0f)
+			turn += 360.0f;
+		value[(FADE_TO+FADE_HEAD)*capacity + n] = from + turn;
+		endHead[n] = end;
+
+		unsigned long flags = data->lights.flags[i] & FADE_FLAGS;
+		unsigned long endFlags = to->flags[i] & FADE_FLAGS;
+		flagsOn[n] = endFlags & ~flags;
+		flagsOff[n] = flags & ~endFlags;
+
+		if (differs || flagsOn[n] || flagsOff[n])
+			light[numFading++] = i;
+	}
+
+	// the batches run over whole groups of 4, give the spare entries of the last one sane values
+	for(i=numFading;i<((numFading + 3) & ~3);i++) {
+		for(v=0;v<FADE_VALUES;v++)
+			value[(FADE_FROM+v)*capacity + i] = value[(FADE_TO+v)*capacity + i] = 0.0f;
+	}
+	return numFading;
+}
+
+bool LG3DCrossfade::Evaluate(LG3DControlData *data, double time)
+{
+	int i, j, v;
+	if (numFading == 0)
+		return false;
+
+	LG3DLightTable *lights = &data->lights;
+	if (!started) {
+		if (startTime < 0.0)
+			startTime = time;
+		started = true;
+		for(j=0;j<numFading;j++) {
+			if (flagsOn[j]) {
+				lights->flags[light[j]] |= flagsOn[j];
+				data->MarkLightDirty(light[j], ((flagsOn[j] & LG3DLightFlag_Enabled) ? LG3DDirty_Enabled : 0) |
+					((flagsOn[j] & LG3DLightFlag_CastsShadows) ? LG3DDirty_Shadows : 0));
+			}
+		}
+	}
+
+	float t = (duration > 0.0f) ? (float)((time - startTime) / duration) : 1.0f;
+	bool done = (t >= 1.0f);
+	if (t < 0.0f)
+		t = 0.0f;
+
+	// current = start * (1-t) + end * t, which lands exactly on the end values at t = 1
+	if (done) {
+		memcpy(&value[FADE_CUR*capacity], &value[FADE_TO*capacity], sizeof(float) * FADE_VALUES * capacity);
+		memcpy(&value[(FADE_CUR+FADE_HEAD)*capacity], endHead, sizeof(float) * numFading);
+	} else {
+		__m128 t4 = _mm_set1_ps(t);
+		__m128 s4 = _mm_set1_ps(1.0f - t);
+		int numBatched = (numFading + 3) & ~3;
+		for(v=0;v<FADE_VALUES;v++) {
+			const float *from = &value[(FADE_FROM+v)*capacity];
+			const float *to = &value[(FADE_TO+v)*capacity];
+			float *cur = &value[(FADE_CUR+v)*capacity];
+			for(j=0;j<numBatched;j+=4)
+				_mm_store_ps(cur + j, _mm_add_ps(_mm_mul_ps(_mm_load_ps(from + j), s4), _mm_mul_ps(_mm_load_ps(to + j), t4)));
+		}
+	}
+
+	// write back, marking only what actually moved
+	float *live[FADE_VALUES];
+	lights->FieldArrays(fadeField, FADE_VALUES, live);
+	for(j=0;j<numFading;j++) {
+		i = light[j];
+		unsigned long fields = 0;
+		for(v=0;v<FADE_VALUES;v++) {
+			float cur = value[(FADE_CUR+v)*capacity + j];
+			if (live[v][i] != cur) {
+				live[v][i] = cur;
+				fields |= fadeField[v];
+			}
+		}
+		if (fields & LG3DDirty_Cone)
+			lights->SetCone(i, lights->umbra[i], lights->penumbra[i]);
+		if (done && flagsOff[j]) {
+			lights->flags[i] &= ~flagsOff[j];
+			if (flagsOff[j] & LG3DLightFlag_Enabled)
+				fields |= LG3DDirty_Enabled;
+			if (flagsOff[j] & LG3DLightFlag_CastsShadows)
+				fields |= LG3DDirty_Shadows;
+		}
+		if (fields)
+			data->MarkLightDirty(i, fields);
+	}
+
+	if (done)
+		numFading = 0;
+	return !done;
+}
@@ -0,0 +1,267 @@
+#include <math.h>
+#include <stdio.h>
+
+#include "lg3d.h"
+
+// a timecode frame further than this from the locked clock is a jump, and relocks
+#define CUE_RELOCK_DISTANCE 0.25
+
+// how much of each frame's difference from the locked clock is taken up, the rest is
+// treated as arrival jitter.  At 30 fps the clock settles in well under a second.
+#define CUE_LOCK_GAIN 0.05
+
+// no timecode for this long and the scheduler freewheels no further, stopping the cues
+#define CUE_FREEWHEEL 0.5
+
+struct LG3DCue {
+	double					time;			// show time
+	const LG3DLightTable	*look;
+	float					fadeTime;
+};
+
+struct LG3DTimecodeFrame {
+	double			arrival;				// seconds from the start of the recording
+	LG3DTimecode	tc;
+};
+
+double LG3DTimecodeSeconds(const LG3DTimecode *tc)
+{
+	return tc->hours * 3600.0 + tc->minutes * 60.0 + tc->seconds + tc->frames / (double)tc->fps;
+}
+
+void LG3DSecondsTimecode(double seconds, float fps, LG3DTimecode *tc)
+{
+	// rounded to the nearest frame, so a frame's own time converts back to it
+	int frames = (int)floor(seconds * fps + 0.5);
+	int perSecond = (int)(fps + 0.5f);
+	tc->fps = fps;
+	tc->frames = frames % perSecond;
+	int whole = frames / perSecond;
+	tc->seconds = whole % 60;
+	tc->minutes = (whole / 60) % 60;
+	tc->hours = whole / 3600;
+}
+
+LG3DCueScheduler::LG3DCueScheduler()
+{
+	cue = NULL;
+	numCues = 0;
+	nextCue = 0;
+	crossfade = NULL;
+	latency = 0.0f;
+	offset = 0.0;
+	lastReceived = 0.0;
+	locked = false;
+	catchUp = false;
+	ResetStats();
+}
+
+LG3DCueScheduler::~LG3DCueScheduler()
+{
+	free(cue);
+}
+
+int LG3DCueScheduler::AddCue(double showTime, const LG3DLightTable *look, float fadeTime)
+{
+	// after any cues at the same time, so they fire in the order added
+	int c = numCues;
+	while ((c > 0) && (cue[c-1].time > showTime))
+		c--;
+	cue = (LG3DCue *)realloc(cue, sizeof(LG3DCue) * (numCues+1));
+	memmove(&cue[c+1], &cue[c], sizeof(LG3DCue) * (numCues - c));
+	cue[c].time = showTime;
+	cue[c].look = look;
+	cue[c].fadeTime = fadeTime;
+	numCues++;
+	if (c < nextCue)
+		nextCue++; // already in the past, it waits for the show to come round again
+	return c;
+}
+
+void LG3DCueScheduler::ClearCues()
+{
+	free(cue);
+	cue = NULL;
+	numCues = 0;
+	nextCue = 0;
+	catchUp = false;
+}
+
+void LG3DCueScheduler::Reposition(double showTime)
+{
+	int lo = 0, hi = numCues;
+	while (lo < hi) {
+		int mid = (lo + hi) >> 1;
+		if (cue[mid].time <= showTime)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+	nextCue = lo;
+	catchUp = true;
+}
+
+void LG3DCueScheduler::ReceiveTimecode(const LG3DTimecode *tc, double time)
+{
+	double show = LG3DTimecodeSeconds(tc);
+	double residual = show - ShowTime(time);
+	if (!IsLocked(time) || (fabs(residual) > CUE_RELOCK_DISTANCE)) {
+		offset = show - time;
+		locked = true;
+		Reposition(show);
+	} else {
+		offset += residual * CUE_LOCK_GAIN;
+		residualSumSq += residual * residual;
+		numResiduals++;
+	}
+	lastReceived = time;
+}
+
+bool LG3DCueScheduler::IsLocked(double time) const
+{
+	return locked && (time - lastReceived < CUE_FREEWHEEL);
+}
+
+void LG3DCueScheduler::Dispatch(LG3DControlData *data, double time)
+{
+	if (!crossfade || !IsLocked(time))
+		return;
+
+	// the show time this frame will be seen at.  A fade is started back at its cue's time on
+	// the frame move clock, so it is exactly as far along as it should be when presented.
+	double show = ShowTime(time + latency);
+	if (catchUp) {
+		catchUp = false;
+		if (nextCue > 0) {
+			const LG3DCue *c = &cue[nextCue-1];
+			crossfade->Start(data, c->look, c->fadeTime, time - (show - c->time));
+		}
+	}
+
+	// of several cues due together only the last is seen, its fade drops the others
+	int last = -1;
+	while ((nextCue < numCues) && (cue[nextCue].time <= show)) {
+		double late = show - cue[nextCue].time;
+		lateSum += late;
+		lateSumSq += late * late;
+		lateMax = max(lateMax, late);
+		numFired++;
+		last = nextCue++;
+	}
+	if (last >= 0)
+		crossfade->Start(data, cue[last].look, cue[last].fadeTime, time - (show - cue[last].time));
+}
+
+void LG3DCueScheduler::GetStats(LG3DCueStats *stats) const
+{
+	stats->cuesFired = numFired;
+	stats->meanLate = numFired ? lateSum / numFired : 0.0;
+	stats->jitter = numFired ? sqrt(max(0.0, lateSumSq / numFired - stats->meanLate * stats->meanLate)) : 0.0;
+	stats->maxLate = lateMax;
+	stats->lockJitter = numResiduals ? sqrt(residualSumSq / numResiduals) : 0.0;
+}
+
+void LG3DCueScheduler::ResetStats()
+{
+	numFired = 0;
+	lateSum = lateSumSq = lateMax = 0.0;
+	numResiduals = 0;
+	residualSumSq = 0.0;
+}
+
+LG3DTimecodeSource::LG3DTimecodeSource()
+{
+	running = false;
+	loopback = false;
+	fps = 30.0f;
+	jitter = 0.0f;
+	startTime = 0.0;
+	startShow = 0.0;
+	nextFrame = 0;
+	frame = NULL;
+	numFrames = 0;
+}
+
+LG3DTimecodeSource::~LG3DTimecodeSource()
+{
+	free(frame);
+}
+
+void LG3DTimecodeSource::StartLoopback(const LG3DTimecode *from, double time, float _jitter)
+{
+	loopback = true;
+	running = true;
+	fps = from->fps;
+	jitter = _jitter;
+	startTime = time;
+	startShow = LG3DTimecodeSeconds(from);
+	nextFrame = 0;
+}
+
+bool LG3DTimecodeSource::LoadFile(const WCHAR *path, float _fps)
+{
+	FILE *file;
+	if (_wfopen_s(&file, path, L"rt") != 0)
+		return false;
+
+	free(frame);
+	frame = NULL;
+	numFrames = 0;
+	int maxFrames = 0;
+	char line[256];
+	while (fgets(line, sizeof(line), file)) {
+		LG3DTimecodeFrame f;
+		if (sscanf_s(line, "%lf %d:%d:%d:%d", &f.arrival, &f.tc.hours, &f.tc.minutes, &f.tc.seconds, &f.tc.frames) != 5)
+			continue; // blank lines & comments
+		f.tc.fps = _fps;
+		if (numFrames == maxFrames) {
+			maxFrames = maxFrames ? maxFrames*2 : 1024;
+			frame = (LG3DTimecodeFrame *)realloc(frame, sizeof(LG3DTimecodeFrame) * maxFrames);
+		}
+		frame[numFrames++] = f;
+	}
+	fclose(file);
+	fps = _fps;
+	running = false;
+	return numFrames > 0;
+}
+
+void LG3DTimecodeSource::StartFile(double time)
+{
+	loopback = false;
+	running = (numFrames > 0);
+	startTime = time;
+	nextFrame = 0;
+}
+
+int LG3DTimecodeSource::Poll(LG3DCueScheduler *cues, double time)
+{
+	int n = 0;
+	if (!running)
+		return 0;
+
+	if (loopback) {
+		// frame k leaves the playback machine at startTime + k/fps, and turns up a little later
+		for(;;) {
+			double sent = startTime + nextFrame / (double)fps;
+			if (sent > time)
+				break;
+			LG3DTimecode tc;
+			LG3DSecondsTimecode(startShow + nextFrame / (double)fps, fps, &tc);
+			double arrival = min(time, sent + jitter * (rand() / (double)RAND_MAX));
+			cues->ReceiveTimecode(&tc, arrival);
+			nextFrame++;
+			n++;
+		}
+		return n;
+	}
+
+	while ((nextFrame < numFrames) && (startTime + frame[nextFrame].arrival <= time)) {
+		cues->ReceiveTimecode(&frame[nextFrame].tc, startTime + frame[nextFrame].arrival);
+		nextFrame++;
+		n++;
+	}
+	if (nextFrame == numFrames)
+		running = false;
+	return n;
+}
@@ -0,0 +1,352 @@
+#include <math.h>
+#include <emmintrin.h>
+
+#include "lg3d.h"
+#include "LG3DInternal.h"
+
+// the most light table arrays one effect drives, intensity drives all 3 colors
+#define EFFECT_CHANNELS 3
+
+// golden ratio constant the random wave mixes the cycle number with
+#define EFFECT_RANDOM_MIX 0x9E3779B9UL
+
+struct LG3DEffectSlot {
+	bool			inUse;
+	bool			fresh;					// the bases have not been read from the lights yet
+	LG3DEffect		effect;
+	LG3DExpression	*program;				// runs this in place of the wave when set
+	int				numLights;
+	int				capacity;				// numLights padded to a multiple of 4
+	int				*light;
+	float			*base;					// EFFECT_CHANNELS * capacity, the values the wave is laid over
+	float			*last;					// EFFECT_CHANNELS * capacity, what the effect last wrote
+	float			*next;					// EFFECT_CHANNELS * capacity, what it writes this frame
+	float			*offset;				// capacity, each member's phase offset into the wave, 0 to 1
+	float			*pos;					// capacity, each member's place in the group, -1 to 1
+	unsigned long	*seed;					// capacity, each member's random wave seed
+};
+
+// the LG3DDirtyFieldType & LG3DPinMaskType bits of an effect parameter
+static unsigned long EffectField(int param)
+{
+	switch (param) {
+		case LG3DTrack_PosX: case LG3DTrack_PosY: case LG3DTrack_PosZ: return LG3DDirty_Position;
+		case LG3DTrack_Head: case LG3DTrack_Pitch: case LG3DTrack_Roll: return LG3DDirty_Orientation;
+		case LG3DTrack_Umbra: case LG3DTrack_Penumbra: return LG3DDirty_Cone;
+		case LG3DTrack_Att1: case LG3DTrack_Att2: return LG3DDirty_Attenuation;
+	}
+	return LG3DDirty_Color;
+}
+
+// the arrays an effect drives, returns how many
+static int EffectChannels(LG3DLightTable *lights, int param, float **values)
+{
+	if (param == LG3DTrack_Intensity) {
+		values[0] = lights->colorR;
+		values[1] = lights->colorG;
+		values[2] = lights->colorB;
+		return 3;
+	}
+	values[0] = LightParam(lights, param);
+	return values[0] ? 1 : 0;
+}
+
+static unsigned long EffectPin(int param)
+{
+	switch (param) {
+		case LG3DTrack_PosX: return LG3DPinMask_X;
+		case LG3DTrack_PosY: return LG3DPinMask_Y;
+		case LG3DTrack_PosZ: return LG3DPinMask_Z;
+		case LG3DTrack_Head: return LG3DPinMask_H;
+		case LG3DTrack_Pitch: return LG3DPinMask_P;
+		case LG3DTrack_Roll: return LG3DPinMask_R;
+	}
+	return 0;
+}
+
+// work out each member's phase offset & place from the effect's phase & spread
+static void LayOutMembers(LG3DEffectSlot *s)
+{
+	int j, n = s->numLights;
+	for(j=0;j<s->capacity;j++) {
+		if (j < n) {
+			float o = s->effect.phase + s->effect.phaseSpread * (float)j / (float)n;
+			s->offset[j] = o - floorf(o);
+			s->pos[j] = (n > 1) ? 2.0f * (float)j / (float)(n-1) - 1.0f : 0.0f;
+			s->seed[j] = ((unsigned long)s->light[j] + 1) * 2654435761UL;
+		} else {
+			s->offset[j] = 0.0f;
+			s->pos[j] = 0.0f;
+			s->seed[j] = 1;
+		}
+	}
+}
+
+// take the effect's output back off its lights, leaving the base it was laid over.  Values
+// written over the effect since are left, the effect starts from them next.  Returns the
+// number of lights put back, marked dirty if mark is set.
+static int TakeOff(LG3DControlData *data, LG3DEffectSlot *s, bool mark)
+{
+	int j, c, taken = 0;
+	if (!s->inUse || s->fresh || s->program)
+		return 0;
+	float *values[EFFECT_CHANNELS];
+	int numChannels = EffectChannels(&data->lights, s->effect.param, values);
+	unsigned long field = EffectField(s->effect.param);
+	unsigned long pin = EffectPin(s->effect.param);
+	int cap = s->capacity;
+	for(j=0;j<s->numLights;j++) {
+		int i = s->light[j];
+		if (!data->LightInUse(i) || (data->lights.pinMask[i] & pin))
+			continue;
+		bool changed = false;
+		for(c=0;c<numChannels;c++) {
+			float *v = &values[c][i];
+			if ((*v == s->last[c*cap + j]) && (*v != s->base[c*cap + j])) {
+				*v = s->base[c*cap + j];
+				changed = true;
+			}
+		}
+		if (changed && mark) {
+			if (field == LG3DDirty_Cone)
+				data->lights.SetCone(i, data->lights.umbra[i], data->lights.penumbra[i]);
+			data->MarkLightDirty(i, field);
+		}
+		taken += changed;
+	}
+	return taken;
+}
+
+static void FreeSlot(LG3DEffectSlot *s)
+{
+	free(s->light);
+	_aligned_free(s->base);
+	memset(s, 0, sizeof(LG3DEffectSlot));
+}
+
+LG3DEffects::LG3DEffects()
+{
+	slot = NULL;
+	numSlots = 0;
+	numActive = 0;
+}
+
+LG3DEffects::~LG3DEffects()
+{
+	int e;
+	for(e=0;e<numSlots;e++)
+		FreeSlot(&slot[e]);
+	free(slot);
+}
+
+int LG3DEffects::Add(const LG3DEffect *effect, const int *lights, int numLights)
+{
+	int e;
+	if ((numLights <= 0) || ((effect->param != LG3DTrack_Intensity) && (effect->param > LG3DTrack_Att2)) || (effect->param < 0))
+		return -1;
+
+	for(e=0;e<numSlots;e++)
+		if (!slot[e].inUse)
+			break;
+	if (e == numSlots) {
+		slot = (LG3DEffectSlot *)realloc(slot, sizeof(LG3DEffectSlot) * (numSlots+1));
+		memset(&slot[numSlots], 0, sizeof(LG3DEffectSlot));
+		numSlots++;
+	}
+
+	LG3DEffectSlot *s = &slot[e];
+	s->inUse = true;
+	s->fresh = true;
+	s->effect = *effect;
+	s->numLights = numLights;
+	s->capacity = (numLights + 3) & ~3;
+	s->light = (int *)malloc(sizeof(int) * numLights);
+	memcpy(s->light, lights, sizeof(int) * numLights);
+
+	// all the float arrays in one aligned block, the seeds after them
+	s->base = (float *)_aligned_malloc(sizeof(float) * s->capacity * (EFFECT_CHANNELS*3 + 3), 16);
+	memset(s->base, 0, sizeof(float) * s->capacity * (EFFECT_CHANNELS*3 + 3));
+	s->last = s->base + s->capacity * EFFECT_CHANNELS;
+	s->next = s->last + s->capacity * EFFECT_CHANNELS;
+	s->offset = s->next + s->capacity * EFFECT_CHANNELS;
+	s->pos = s->offset + s->capacity;
+	s->seed = (unsigned long *)(s->pos + s->capacity);
+	LayOutMembers(s);
+
+	numActive++;
+	return e;
+}
+
+int LG3DEffects::AddExpression(LG3DExpression *program, const int *lights, int numLights)
+{
+	if (numLights <= 0)
+		return -1;
+
+	// a place holding wave sets the slot up, the program replaces it
+	LG3DEffect effect;
+	int e = Add(&effect, lights, numLights);
+	slot[e].program = program;
+	return e;
+}
+
+void LG3DEffects::Change(int effectIndex, const LG3DEffect *effect)
+{
+	if ((effectIndex < 0) || (effectIndex >= numSlots) || !slot[effectIndex].inUse)
+		return;
+	LG3DEffectSlot *s = &slot[effectIndex];
+	if (s->program)
+		return;
+	int param = s->effect.param;
+	s->effect = *effect;
+	s->effect.param = param;
+	LayOutMembers(s);
+}
+
+void LG3DEffects::Remove(int effectIndex, LG3DControlData *data)
+{
+	int e;
+	if ((effectIndex < 0) || (effectIndex >= numSlots) || !slot[effectIndex].inUse)
+		return;
+
+	// lights still showing the effect's output go back to their base, anything set over the
+	// effect since is left as it is.  Effects evaluated after it come off too, the next
+	// Evaluate lays them over the base again.
+	for(e=numSlots-1;e>=effectIndex;e--)
+		TakeOff(data, &slot[e], true);
+
+	FreeSlot(&slot[effectIndex]);
+	numActive--;
+}
+
+void LG3DEffects::Evaluate(LG3DControlData *data, double time)
+{
+	int e, j, c;
+	LG3DLightTable *lights = &data->lights;
+
+	// take every effect's last output back off, newest first, so each one finds the value it
+	// was laid over.  Anything written since is left and becomes that effect's new base.
+	for(e=numSlots-1;e>=0;e--)
+		TakeOff(data, &slot[e], false);
+
+	// then lay them on again in order, each over what the ones before it left, so effects
+	// stacked on the same field add up rather than feeding on each other
+	for(e=0;e<numSlots;e++) {
+		LG3DEffectSlot *s = &slot[e];
+		if (!s->inUse)
+			continue;
+		if (s->program) {
+			s->program->Run(data, s->light, s->numLights, time);
+			continue;
+		}
+		const LG3DEffect *fx = &s->effect;
+		int cap = s->capacity;
+		float *values[EFFECT_CHANNELS];
+		int numChannels = EffectChannels(lights, fx->param, values);
+
+		for(j=0;j<s->numLights;j++) {
+			int i = s->light[j];
+			if (!data->LightInUse(i))
+				continue;
+			for(c=0;c<numChannels;c++) {
+				s->base[c*cap + j] = values[c][i];
+				if (s->fresh)
+					s->last[c*cap + j] = values[c][i];
+			}
+		}
+		s->fresh = false;
+
+		// where the effect is in its wave, kept in double so long shows stay smooth
+		double cycles = time * fx->speed;
+		double whole = floor(cycles);
+		__m128 frac = _mm_set1_ps((float)(cycles - whole));
+		__m128i mix = _mm_set1_epi32((int)((unsigned long)fmod(whole, 4294967296.0) * EFFECT_RANDOM_MIX));
+		__m128i mixStep = _mm_set1_epi32((int)EFFECT_RANDOM_MIX);
+		// colors stay in 0..1 the way expressions keep them, and intensity can at most
+		// take a light to black
+		bool intensity = (fx->param == LG3DTrack_Intensity);
+		bool color = intensity || ((fx->param >= LG3DTrack_ColorR) && (fx->param <= LG3DTrack_ColorB));
+		float amount = fx->size;
+		if (intensity)
+			amount = (amount < 0.0f) ? 0.0f : ((amount > 1.0f) ? 1.0f : amount);
+		else if (color)
+			amount /= 255.0f;
+		__m128 size = _mm_set1_ps(amount);
+		__m128 zero = _mm_setzero_ps();
+		__m128 one = _mm_set1_ps(1.0f);
+		__m128 half = _mm_set1_ps(0.5f);
+
+		for(j=0;j<cap;j+=4) {
+			__m128 x = _mm_add_ps(frac, _mm_load_ps(&s->offset[j]));
+			__m128i wrapped = _mm_cvttps_epi32(x);
+			x = _mm_sub_ps(x, _mm_cvtepi32_ps(wrapped));
+
+			__m128 w;
+			switch (fx->wave) {
+				case LG3DWave_Sine:
+					w = SineWave(x);
+					break;
+				case LG3DWave_Triangle:
+					w = _mm_sub_ps(one, _mm_mul_ps(_mm_set1_ps(4.0f), _mm_andnot_ps(_mm_set1_ps(-0.0f), _mm_sub_ps(x, half))));
+					break;
+				case LG3DWave_Square:
+					w = _mm_sub_ps(_mm_and_ps(_mm_cmplt_ps(x, half), _mm_set1_ps(2.0f)), one);
+					break;
+				case LG3DWave_Saw:
+					w = _mm_sub_ps(_mm_add_ps(x, x), one);
+					break;
+				case LG3DWave_Fan:
+					w = _mm_load_ps(&s->pos[j]);
+					break;
+				default: {
+					// hash the member's seed with its cycle number, a xorshift round or two
+					// is plenty to make neighbouring cycles look unrelated
+					__m128i h = _mm_add_epi32(mix, _mm_and_si128(_mm_sub_epi32(_mm_setzero_si128(), wrapped), mixStep));
+					h = _mm_xor_si128(h, _mm_load_si128((const __m128i *)&s->seed[j]));
+					h = _mm_xor_si128(h, _mm_slli_epi32(h, 13));
+					h = _mm_xor_si128(h, _mm_srli_epi32(h, 17));
+					h = _mm_xor_si128(h, _mm_slli_epi32(h, 5));
+					h = _mm_xor_si128(h, _mm_slli_epi32(h, 13));
+					h = _mm_xor_si128(h, _mm_srli_epi32(h, 17));
+					h = _mm_and_si128(_mm_srli_epi32(h, 8), _mm_set1_epi32(0xffff));
+					w = _mm_sub_ps(_mm_mul_ps(_mm_cvtepi32_ps(h), _mm_set1_ps(2.0f / 65535.0f)), one);
+					break;
+				}
+			}
+
+			if (intensity) {
+				// size 1 takes the bottom of the wave all the way to black
+				__m128 scale = _mm_sub_ps(one, _mm_mul_ps(size, _mm_add_ps(half, _mm_mul_ps(half, w))));
+				for(c=0;c<numChannels;c++)
+					_mm_store_ps(&s->next[c*cap + j], _mm_min_ps(_mm_max_ps(_mm_mul_ps(_mm_load_ps(&s->base[c*cap + j]), scale), zero), one));
+			} else {
+				__m128 v = _mm_add_ps(_mm_load_ps(&s->base[j]), _mm_mul_ps(size, w));
+				if (color)
+					v = _mm_min_ps(_mm_max_ps(v, zero), one);
+				_mm_store_ps(&s->next[j], v);
+			}
+		}
+
+		// every light gets its value back, only those that moved since last frame are dirty
+		unsigned long field = EffectField(fx->param);
+		unsigned long pin = EffectPin(fx->param);
+		for(j=0;j<s->numLights;j++) {
+			int i = s->light[j];
+			if (!data->LightInUse(i) || (lights->pinMask[i] & pin))
+				continue;
+			bool changed = false;
+			for(c=0;c<numChannels;c++) {
+				float v = s->next[c*cap + j];
+				values[c][i] = v;
+				if (s->last[c*cap + j] != v) {
+					s->last[c*cap + j] = v;
+					changed = true;
+				}
+			}
+			if (changed) {
+				if (field == LG3DDirty_Cone)
+					lights->SetCone(i, lights->umbra[i], lights->penumbra[i]);
+				data->MarkLightDirty(i, field);
+			}
+		}
+	}
+}
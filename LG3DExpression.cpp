@@ -0,0 +1,636 @@
+#include <math.h>
+#include <wchar.h>
+#include <wctype.h>
+#include <emmintrin.h>
+
+#include "lg3d.h"
+#include "LG3DInternal.h"
+
+// the registers every program starts with, the light fields follow in fieldName order
+#define EXPR_T 0
+#define EXPR_INDEX 1
+#define EXPR_COUNT 2
+#define EXPR_LIGHT 3
+#define EXPR_FIELD 4
+#define EXPR_FIELDS 11
+#define EXPR_INPUTS (EXPR_FIELD + EXPR_FIELDS)
+
+// t goes back to 0 every this many seconds.  The time is reduced in double first, so t keeps
+// to half a millisecond however long the show has been running - as a float the raw time is
+// down to whole seconds after a few months.
+#define EXPR_T_PERIOD 3600.0
+
+// registers are never reused, each op result gets a new one
+#define EXPR_MAX_REGS 256
+#define EXPR_MAX_LOCALS 64
+#define EXPR_MAX_NAME 32
+
+#define EXPR_PI 3.14159265358979f
+
+enum LG3DExprCode {
+	LG3DExpr_Add,
+	LG3DExpr_Sub,
+	LG3DExpr_Mul,
+	LG3DExpr_Div,
+	LG3DExpr_Neg,
+	LG3DExpr_Sin,
+	LG3DExpr_Cos,
+	LG3DExpr_Abs,
+	LG3DExpr_Sqrt,
+	LG3DExpr_Floor,
+	LG3DExpr_Frac,
+	LG3DExpr_Min,
+	LG3DExpr_Max,
+	LG3DExpr_Rand,
+};
+
+struct LG3DExprOp {
+	unsigned char	code;					// LG3DExprCode
+	unsigned char	dst, a, b;				// registers, b only for the 2 operand codes
+};
+
+static const WCHAR *fieldName[EXPR_FIELDS] = {
+	L"x", L"y", L"z", L"pan", L"tilt", L"roll", L"red", L"green", L"blue", L"umbra", L"penumbra",
+};
+
+static const unsigned long fieldDirty[EXPR_FIELDS] = {
+	LG3DDirty_Position, LG3DDirty_Position, LG3DDirty_Position,
+	LG3DDirty_Orientation, LG3DDirty_Orientation, LG3DDirty_Orientation,
+	LG3DDirty_Color, LG3DDirty_Color, LG3DDirty_Color,
+	LG3DDirty_Cone, LG3DDirty_Cone,
+};
+
+static const unsigned long fieldPin[EXPR_FIELDS] = {
+	LG3DPinMask_X, LG3DPinMask_Y, LG3DPinMask_Z,
+	LG3DPinMask_H, LG3DPinMask_P, LG3DPinMask_R,
+	0, 0, 0, 0, 0,
+};
+
+static bool IsColorField(int f)
+{
+	return (f >= 6) && (f <= 8);
+}
+
+static struct {
+	const WCHAR		*name;
+	int				code;
+	int				numArgs;
+} exprFunction[] = {
+	{L"sin", LG3DExpr_Sin, 1},
+	{L"cos", LG3DExpr_Cos, 1},
+	{L"abs", LG3DExpr_Abs, 1},
+	{L"sqrt", LG3DExpr_Sqrt, 1},
+	{L"floor", LG3DExpr_Floor, 1},
+	{L"frac", LG3DExpr_Frac, 1},
+	{L"min", LG3DExpr_Min, 2},
+	{L"max", LG3DExpr_Max, 2},
+	{L"rand", LG3DExpr_Rand, 1},
+};
+#define EXPR_NUM_FUNCTIONS (sizeof(exprFunction) / sizeof(exprFunction[0]))
+
+// the hash behind rand, one at a time style adds & shifts so the SIMD version can match it
+static unsigned long RandHash(unsigned long h)
+{
+	h += h << 10;
+	h ^= h >> 6;
+	h += h << 3;
+	h ^= h >> 11;
+	h += h << 15;
+	return h;
+}
+
+static float RandValue(float v)
+{
+	return (float)((RandHash((unsigned long)(long)floorf(v)) >> 8) & 0xffff) / 65535.0f;
+}
+
+// what an op works out to on constants, the same as Execute up to rounding
+static float FoldOp(int code, float a, float b)
+{
+	switch (code) {
+		case LG3DExpr_Add: return a + b;
+		case LG3DExpr_Sub: return a - b;
+		case LG3DExpr_Mul: return a * b;
+		case LG3DExpr_Div: return a / b;
+		case LG3DExpr_Neg: return -a;
+		case LG3DExpr_Sin: return sinf(a);
+		case LG3DExpr_Cos: return cosf(a);
+		case LG3DExpr_Abs: return fabsf(a);
+		case LG3DExpr_Sqrt: return sqrtf(a);
+		case LG3DExpr_Floor: return floorf(a);
+		case LG3DExpr_Frac: return a - floorf(a);
+		case LG3DExpr_Min: return (a < b) ? a : b;
+		case LG3DExpr_Max: return (a > b) ? a : b;
+	}
+	return RandValue(a);
+}
+
+// compile state, a recursive descent parser emitting ops as it goes
+struct ExprParser {
+	const WCHAR		*text;
+	int				pos;
+	bool			failed;
+	LG3DExprOp		*op;
+	int				numOps;
+	int				maxOps;
+	int				numRegs;
+	bool			isConst[EXPR_MAX_REGS];
+	float			constValue[EXPR_MAX_REGS];
+	int				fieldReg[EXPR_FIELDS];		// the register a light field is read from
+	unsigned long	fieldsRead;
+	WCHAR			localName[EXPR_MAX_LOCALS][EXPR_MAX_NAME];
+	int				localReg[EXPR_MAX_LOCALS];
+	int				numLocals;
+};
+
+static int ParseExpr(ExprParser *p);
+
+static void SkipSpace(ExprParser *p)
+{
+	while ((p->text[p->pos] == L' ') || (p->text[p->pos] == L'\t') || (p->text[p->pos] == L'\r'))
+		p->pos++;
+}
+
+static int Fail(ExprParser *p)
+{
+	p->failed = true;
+	return 0;
+}
+
+static bool Accept(ExprParser *p, WCHAR c)
+{
+	SkipSpace(p);
+	if (p->text[p->pos] != c)
+		return false;
+	p->pos++;
+	return true;
+}
+
+static bool ParseName(ExprParser *p, WCHAR *name)
+{
+	SkipSpace(p);
+	int n = 0;
+	while (iswalpha(p->text[p->pos]) || (p->text[p->pos] == L'_') || (n && iswdigit(p->text[p->pos]))) {
+		if (n == EXPR_MAX_NAME-1)
+			return false;
+		name[n++] = p->text[p->pos++];
+	}
+	name[n] = 0;
+	return n > 0;
+}
+
+static int NewReg(ExprParser *p)
+{
+	if (p->numRegs == EXPR_MAX_REGS)
+		return Fail(p);
+	p->isConst[p->numRegs] = false;
+	return p->numRegs++;
+}
+
+static int Constant(ExprParser *p, float value)
+{
+	int r;
+	for(r=EXPR_INPUTS;r<p->numRegs;r++)
+		if (p->isConst[r] && (p->constValue[r] == value))
+			return r;
+	r = NewReg(p);
+	if (p->failed)
+		return 0;
+	p->isConst[r] = true;
+	p->constValue[r] = value;
+	return r;
+}
+
+static int Emit(ExprParser *p, int code, int a, int b)
+{
+	if (p->failed)
+		return 0;
+	bool twoArgs = (code == LG3DExpr_Add) || (code == LG3DExpr_Sub) || (code == LG3DExpr_Mul) ||
+		(code == LG3DExpr_Div) || (code == LG3DExpr_Min) || (code == LG3DExpr_Max);
+	if (p->isConst[a] && (!twoArgs || p->isConst[b]))
+		return Constant(p, FoldOp(code, p->constValue[a], twoArgs ? p->constValue[b] : 0.0f));
+
+	int dst = NewReg(p);
+	if (p->failed)
+		return 0;
+	if (p->numOps == p->maxOps) {
+		p->maxOps = p->maxOps ? p->maxOps*2 : 32;
+		p->op = (LG3DExprOp *)realloc(p->op, sizeof(LG3DExprOp) * p->maxOps);
+	}
+	LG3DExprOp *o = &p->op[p->numOps++];
+	o->code = (unsigned char)code;
+	o->dst = (unsigned char)dst;
+	o->a = (unsigned char)a;
+	o->b = (unsigned char)(twoArgs ? b : a);
+	return dst;
+}
+
+// the register a name reads, -1 if there is no such name
+static int LookUpName(ExprParser *p, const WCHAR *name)
+{
+	int i;
+	for(i=0;i<p->numLocals;i++)
+		if (!wcscmp(p->localName[i], name))
+			return p->localReg[i];
+	for(i=0;i<EXPR_FIELDS;i++) {
+		if (!wcscmp(fieldName[i], name)) {
+			if (p->fieldReg[i] == EXPR_FIELD+i)
+				p->fieldsRead |= 1 << i;
+			return p->fieldReg[i];
+		}
+	}
+	if (!wcscmp(name, L"t"))
+		return EXPR_T;
+	if (!wcscmp(name, L"index"))
+		return EXPR_INDEX;
+	if (!wcscmp(name, L"count"))
+		return EXPR_COUNT;
+	if (!wcscmp(name, L"light"))
+		return EXPR_LIGHT;
+	if (!wcscmp(name, L"pi"))
+		return Constant(p, EXPR_PI);
+	return -1;
+}
+
+static int ParsePrimary(ExprParser *p)
+{
+	SkipSpace(p);
+	if (Accept(p, L'(')) {
+		int r = ParseExpr(p);
+		if (!Accept(p, L')'))
+			return Fail(p);
+		return r;
+	}
+	if (iswdigit(p->text[p->pos]) || (p->text[p->pos] == L'.')) {
+		WCHAR *end;
+		double value = wcstod(p->text + p->pos, &end);
+		if (end == p->text + p->pos)
+			return Fail(p);
+		p->pos = (int)(end - p->text);
+		return Constant(p, (float)value);
+	}
+
+	WCHAR name[EXPR_MAX_NAME];
+	int start = p->pos;
+	if (!ParseName(p, name))
+		return Fail(p);
+	if (!Accept(p, L'(')) {
+		int r = LookUpName(p, name);
+		if (r < 0) {
+			p->pos = start;
+			return Fail(p);
+		}
+		return r;
+	}
+
+	int f;
+	for(f=0;f<(int)EXPR_NUM_FUNCTIONS;f++)
+		if (!wcscmp(exprFunction[f].name, name))
+			break;
+	if (f == (int)EXPR_NUM_FUNCTIONS) {
+		p->pos = start;
+		return Fail(p);
+	}
+	int a = ParseExpr(p), b = a;
+	if (exprFunction[f].numArgs == 2) {
+		if (!Accept(p, L','))
+			return Fail(p);
+		b = ParseExpr(p);
+	}
+	if (!Accept(p, L')'))
+		return Fail(p);
+	return Emit(p, exprFunction[f].code, a, b);
+}
+
+static int ParseUnary(ExprParser *p)
+{
+	if (Accept(p, L'-'))
+		return Emit(p, LG3DExpr_Neg, ParseUnary(p), 0);
+	if (Accept(p, L'+'))
+		return ParseUnary(p);
+	return ParsePrimary(p);
+}
+
+static int ParseTerm(ExprParser *p)
+{
+	int r = ParseUnary(p);
+	while (!p->failed) {
+		if (Accept(p, L'*'))
+			r = Emit(p, LG3DExpr_Mul, r, ParseUnary(p));
+		else if (Accept(p, L'/'))
+			r = Emit(p, LG3DExpr_Div, r, ParseUnary(p));
+		else
+			break;
+	}
+	return r;
+}
+
+static int ParseExpr(ExprParser *p)
+{
+	int r = ParseTerm(p);
+	while (!p->failed) {
+		if (Accept(p, L'+'))
+			r = Emit(p, LG3DExpr_Add, r, ParseTerm(p));
+		else if (Accept(p, L'-'))
+			r = Emit(p, LG3DExpr_Sub, r, ParseTerm(p));
+		else
+			break;
+	}
+	return r;
+}
+
+// name = expr, the name being a light field or a local
+static void ParseStatement(ExprParser *p)
+{
+	WCHAR name[EXPR_MAX_NAME];
+	int start = p->pos;
+	if (!ParseName(p, name) || !Accept(p, L'=')) {
+		p->pos = start;
+		Fail(p);
+		return;
+	}
+	int r = ParseExpr(p);
+	if (p->failed)
+		return;
+
+	int i;
+	for(i=0;i<EXPR_FIELDS;i++) {
+		if (!wcscmp(fieldName[i], name)) {
+			p->fieldReg[i] = r;
+			return;
+		}
+	}
+	if (LookUpName(p, name) >= 0) {
+		for(i=0;i<p->numLocals;i++) {
+			if (!wcscmp(p->localName[i], name)) {
+				p->localReg[i] = r;
+				return;
+			}
+		}
+		p->pos = start; // the inputs can not be assigned
+		Fail(p);
+		return;
+	}
+	if (p->numLocals == EXPR_MAX_LOCALS) {
+		Fail(p);
+		return;
+	}
+	wcscpy_s(p->localName[p->numLocals], EXPR_MAX_NAME, name);
+	p->localReg[p->numLocals++] = r;
+}
+
+// floor of 4 values, cvttps truncates towards 0
+static __m128 FloorPs(__m128 x)
+{
+	__m128 t = _mm_cvtepi32_ps(_mm_cvttps_epi32(x));
+	return _mm_sub_ps(t, _mm_and_ps(_mm_cmpgt_ps(t, x), _mm_set1_ps(1.0f)));
+}
+
+// sin of radians, cos is the same a quarter cycle on
+static __m128 SinPs(__m128 x, float quarter)
+{
+	__m128 c = _mm_add_ps(_mm_mul_ps(x, _mm_set1_ps(0.5f / EXPR_PI)), _mm_set1_ps(quarter));
+	return SineWave(_mm_sub_ps(c, FloorPs(c)));
+}
+
+static __m128i RandHashPs(__m128i h)
+{
+	h = _mm_add_epi32(h, _mm_slli_epi32(h, 10));
+	h = _mm_xor_si128(h, _mm_srli_epi32(h, 6));
+	h = _mm_add_epi32(h, _mm_slli_epi32(h, 3));
+	h = _mm_xor_si128(h, _mm_srli_epi32(h, 11));
+	h = _mm_add_epi32(h, _mm_slli_epi32(h, 15));
+	return h;
+}
+
+LG3DExpression::LG3DExpression()
+{
+	op = NULL;
+	numOps = 0;
+	reg = NULL;
+	numRegs = 0;
+	fieldsRead = 0;
+	errorPos = -1;
+	int f;
+	for(f=0;f<EXPR_FIELDS;f++)
+		fieldOut[f] = -1;
+}
+
+LG3DExpression::~LG3DExpression()
+{
+	Clear();
+}
+
+void LG3DExpression::Clear()
+{
+	free(op);
+	_aligned_free(reg);
+	op = NULL;
+	numOps = 0;
+	reg = NULL;
+	numRegs = 0;
+	fieldsRead = 0;
+	int f;
+	for(f=0;f<EXPR_FIELDS;f++)
+		fieldOut[f] = -1;
+}
+
+bool LG3DExpression::Compile(const WCHAR *text)
+{
+	int r, f, k;
+	Clear();
+	errorPos = -1;
+
+	ExprParser *p = new ExprParser;
+	p->text = text;
+	p->pos = 0;
+	p->failed = false;
+	p->op = NULL;
+	p->numOps = 0;
+	p->maxOps = 0;
+	p->numRegs = EXPR_INPUTS;
+	for(r=0;r<EXPR_INPUTS;r++)
+		p->isConst[r] = false;
+	for(f=0;f<EXPR_FIELDS;f++)
+		p->fieldReg[f] = EXPR_FIELD+f;
+	p->fieldsRead = 0;
+	p->numLocals = 0;
+
+	for(;;) {
+		SkipSpace(p);
+		if (!text[p->pos])
+			break;
+		if ((text[p->pos] == L';') || (text[p->pos] == L'\n')) {
+			p->pos++;
+			continue;
+		}
+		ParseStatement(p);
+		if (p->failed)
+			break;
+		SkipSpace(p);
+		if (text[p->pos] && (text[p->pos] != L';') && (text[p->pos] != L'\n'))
+			Fail(p);
+		if (p->failed)
+			break;
+	}
+
+	if (p->failed) {
+		errorPos = p->pos;
+		free(p->op);
+		delete p;
+		return false;
+	}
+
+	op = p->op;
+	numOps = p->numOps;
+	numRegs = p->numRegs;
+	fieldsRead = p->fieldsRead;
+	for(f=0;f<EXPR_FIELDS;f++)
+		fieldOut[f] = (p->fieldReg[f] != EXPR_FIELD+f) ? p->fieldReg[f] : -1;
+
+	// the constants are laid out across the batch once, here
+	reg = (float *)_aligned_malloc(sizeof(float) * numRegs * LG3D_EXPR_BATCH, 16);
+	memset(reg, 0, sizeof(float) * numRegs * LG3D_EXPR_BATCH);
+	for(r=EXPR_INPUTS;r<numRegs;r++)
+		if (p->isConst[r])
+			for(k=0;k<LG3D_EXPR_BATCH;k++)
+				reg[r*LG3D_EXPR_BATCH + k] = p->constValue[r];
+	delete p;
+	return true;
+}
+
+// run every op over a whole batch, the op is looked at once per batch not once per light
+void LG3DExpression::Execute()
+{
+	int n, k;
+	__m128 signMask = _mm_set1_ps(-0.0f);
+	for(n=0;n<numOps;n++) {
+		const LG3DExprOp *o = &op[n];
+		float *d = &reg[o->dst * LG3D_EXPR_BATCH];
+		const float *a = &reg[o->a * LG3D_EXPR_BATCH];
+		const float *b = &reg[o->b * LG3D_EXPR_BATCH];
+		switch (o->code) {
+			case LG3DExpr_Add:
+				for(k=0;k<LG3D_EXPR_BATCH;k+=4)
+					_mm_store_ps(d+k, _mm_add_ps(_mm_load_ps(a+k), _mm_load_ps(b+k)));
+			break;
+			case LG3DExpr_Sub:
+				for(k=0;k<LG3D_EXPR_BATCH;k+=4)
+					_mm_store_ps(d+k, _mm_sub_ps(_mm_load_ps(a+k), _mm_load_ps(b+k)));
+			break;
+			case LG3DExpr_Mul:
+				for(k=0;k<LG3D_EXPR_BATCH;k+=4)
+					_mm_store_ps(d+k, _mm_mul_ps(_mm_load_ps(a+k), _mm_load_ps(b+k)));
+			break;
+			case LG3DExpr_Div:
+				for(k=0;k<LG3D_EXPR_BATCH;k+=4)
+					_mm_store_ps(d+k, _mm_div_ps(_mm_load_ps(a+k), _mm_load_ps(b+k)));
+			break;
+			case LG3DExpr_Neg:
+				for(k=0;k<LG3D_EXPR_BATCH;k+=4)
+					_mm_store_ps(d+k, _mm_xor_ps(_mm_load_ps(a+k), signMask));
+			break;
+			case LG3DExpr_Sin:
+				for(k=0;k<LG3D_EXPR_BATCH;k+=4)
+					_mm_store_ps(d+k, SinPs(_mm_load_ps(a+k), 0.0f));
+			break;
+			case LG3DExpr_Cos:
+				for(k=0;k<LG3D_EXPR_BATCH;k+=4)
+					_mm_store_ps(d+k, SinPs(_mm_load_ps(a+k), 0.25f));
+			break;
+			case LG3DExpr_Abs:
+				for(k=0;k<LG3D_EXPR_BATCH;k+=4)
+					_mm_store_ps(d+k, _mm_andnot_ps(signMask, _mm_load_ps(a+k)));
+			break;
+			case LG3DExpr_Sqrt:
+				for(k=0;k<LG3D_EXPR_BATCH;k+=4)
+					_mm_store_ps(d+k, _mm_sqrt_ps(_mm_load_ps(a+k)));
+			break;
+			case LG3DExpr_Floor:
+				for(k=0;k<LG3D_EXPR_BATCH;k+=4)
+					_mm_store_ps(d+k, FloorPs(_mm_load_ps(a+k)));
+			break;
+			case LG3DExpr_Frac:
+				for(k=0;k<LG3D_EXPR_BATCH;k+=4) {
+					__m128 x = _mm_load_ps(a+k);
+					_mm_store_ps(d+k, _mm_sub_ps(x, FloorPs(x)));
+				}
+			break;
+			case LG3DExpr_Min:
+				for(k=0;k<LG3D_EXPR_BATCH;k+=4)
+					_mm_store_ps(d+k, _mm_min_ps(_mm_load_ps(a+k), _mm_load_ps(b+k)));
+			break;
+			case LG3DExpr_Max:
+				for(k=0;k<LG3D_EXPR_BATCH;k+=4)
+					_mm_store_ps(d+k, _mm_max_ps(_mm_load_ps(a+k), _mm_load_ps(b+k)));
+			break;
+			case LG3DExpr_Rand:
+				for(k=0;k<LG3D_EXPR_BATCH;k+=4) {
+					__m128i h = RandHashPs(_mm_cvttps_epi32(FloorPs(_mm_load_ps(a+k))));
+					h = _mm_and_si128(_mm_srli_epi32(h, 8), _mm_set1_epi32(0xffff));
+					_mm_store_ps(d+k, _mm_mul_ps(_mm_cvtepi32_ps(h), _mm_set1_ps(1.0f / 65535.0f)));
+				}
+			break;
+		}
+	}
+}
+
+void LG3DExpression::Run(LG3DControlData *data, const int *lights, int numLights, double time)
+{
+	int b, k, f;
+	if (!reg)
+		return;
+	LG3DLightTable *table = &data->lights;
+	float *field[EXPR_FIELDS];
+	table->FieldArrays(fieldDirty, EXPR_FIELDS, field);
+
+	float t = (float)(time - floor(time / EXPR_T_PERIOD) * EXPR_T_PERIOD);
+	for(k=0;k<LG3D_EXPR_BATCH;k++) {
+		reg[EXPR_T*LG3D_EXPR_BATCH + k] = t;
+		reg[EXPR_COUNT*LG3D_EXPR_BATCH + k] = (float)numLights;
+	}
+
+	for(b=0;b<numLights;b+=LG3D_EXPR_BATCH) {
+		int num = min(LG3D_EXPR_BATCH, numLights - b);
+
+		// fill in the per light inputs, only the fields the program reads are gathered
+		for(k=0;k<LG3D_EXPR_BATCH;k++) {
+			int i = (k < num) ? lights[b+k] : -1;
+			bool valid = data->LightInUse(i);
+			reg[EXPR_INDEX*LG3D_EXPR_BATCH + k] = (float)(b+k);
+			reg[EXPR_LIGHT*LG3D_EXPR_BATCH + k] = (float)i;
+			for(f=0;f<EXPR_FIELDS;f++) {
+				if (fieldsRead & (1 << f)) {
+					float v = valid ? field[f][i] : 0.0f;
+					reg[(EXPR_FIELD+f)*LG3D_EXPR_BATCH + k] = IsColorField(f) ? v * 255.0f : v;
+				}
+			}
+		}
+
+		Execute();
+
+		// write back what changed
+		for(k=0;k<num;k++) {
+			int i = lights[b+k];
+			if (!data->LightInUse(i))
+				continue;
+			unsigned long dirty = 0;
+			for(f=0;f<EXPR_FIELDS;f++) {
+				if ((fieldOut[f] < 0) || (table->pinMask[i] & fieldPin[f]))
+					continue;
+				float v = reg[fieldOut[f]*LG3D_EXPR_BATCH + k];
+				if (IsColorField(f))
+					v = max(0.0f, min(1.0f, v / 255.0f));
+				if (field[f][i] != v) {
+					field[f][i] = v;
+					dirty |= fieldDirty[f];
+				}
+			}
+			if (dirty) {
+				if (dirty & LG3DDirty_Cone)
+					table->SetCone(i, table->umbra[i], table->penumbra[i]);
+				data->MarkLightDirty(i, dirty);
+			}
+		}
+	}
+}
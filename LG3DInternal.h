@@ -0,0 +1,41 @@
+#ifndef __LG3DInternal__
+#define __LG3DInternal__
+
+// helpers shared by the library's own source files, not part of the interface
+
+#include <xmmintrin.h>
+
+#include "lg3d.h"
+
+// sin(2 pi x) for x in 0..1, a parabola with one correction step, good to about 0.001
+static inline __m128 SineWave(__m128 x)
+{
+	__m128 one = _mm_set1_ps(1.0f);
+	__m128 signMask = _mm_set1_ps(-0.0f);
+	__m128 t = _mm_sub_ps(_mm_add_ps(x, x), one);				// -1..1, and sin(pi t) = -sin(2 pi x)
+	__m128 y = _mm_mul_ps(_mm_mul_ps(_mm_set1_ps(4.0f), t), _mm_sub_ps(one, _mm_andnot_ps(signMask, t)));
+	__m128 ay = _mm_andnot_ps(signMask, y);
+	y = _mm_add_ps(_mm_mul_ps(_mm_set1_ps(0.225f), _mm_sub_ps(_mm_mul_ps(y, ay), y)), y);
+	return _mm_xor_ps(y, signMask);
+}
+
+// the light table array a track or effect parameter drives, NULL for the flags, the
+// camera fov and the effect intensity
+static inline float *LightParam(LG3DLightTable *lights, int param)
+{
+	switch (param) {
+		case LG3DTrack_PosX: case LG3DTrack_PosY: case LG3DTrack_PosZ:
+			return lights->Field(LG3DDirty_Position, param - LG3DTrack_PosX);
+		case LG3DTrack_Head: case LG3DTrack_Pitch: case LG3DTrack_Roll:
+			return lights->Field(LG3DDirty_Orientation, param - LG3DTrack_Head);
+		case LG3DTrack_ColorR: case LG3DTrack_ColorG: case LG3DTrack_ColorB:
+			return lights->Field(LG3DDirty_Color, param - LG3DTrack_ColorR);
+		case LG3DTrack_Umbra: case LG3DTrack_Penumbra:
+			return lights->Field(LG3DDirty_Cone, param - LG3DTrack_Umbra);
+		case LG3DTrack_Att1: case LG3DTrack_Att2:
+			return lights->Field(LG3DDirty_Attenuation, param - LG3DTrack_Att1);
+	}
+	return NULL;
+}
+
+#endif /* __LG3DInternal__ */
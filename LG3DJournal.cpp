@@ -0,0 +1,461 @@
+#include <math.h>
+
+#include "lg3d.h"
+
+#define JOURNAL_LIGHT 0
+#define JOURNAL_OBJECT 1
+
+// Every field a journal keeps has a fixed place among a touched light's or object's values.
+// In the stream each record is written as a header, then the values of just the fields that
+// changed before the edit, then the same after it.
+#define JOURNAL_FIELDS 8
+#define JOURNAL_VALUES 16
+
+static const struct {
+	unsigned long	field;
+	int				offset;
+	int				count;
+} journalField[JOURNAL_FIELDS] = {
+	{LG3DDirty_Position, 0, 3},
+	{LG3DDirty_Orientation, 3, 3},
+	{LG3DDirty_Color, 6, 3},
+	{LG3DDirty_Cone, 9, 2},
+	{LG3DDirty_Attenuation, 11, 2},
+	{LG3DDirty_Enabled, 13, 1},
+	{LG3DDirty_Shadows, 14, 1},
+	{LG3DDirty_Node, 15, 1},
+};
+
+static const unsigned long journalLightFields = LG3DDirty_Position | LG3DDirty_Orientation | LG3DDirty_Color |
+	LG3DDirty_Cone | LG3DDirty_Attenuation | LG3DDirty_Enabled | LG3DDirty_Shadows | LG3DDirty_Node;
+static const unsigned long journalObjectFields = LG3DDirty_Position | LG3DDirty_Orientation | LG3DDirty_Node;
+
+struct LG3DJournalTouch {
+	int				kind;
+	LG3DHandle		handle;					// the light's or object's slot when it was touched
+	unsigned long	fields;
+	float			before[JOURNAL_VALUES];
+};
+
+struct LG3DJournalRecord {
+	LG3DHandle		handle;
+	unsigned short	kind;
+	unsigned short	fields;
+};
+
+static int NumValues(unsigned long fields)
+{
+	int f, n = 0;
+	for(f=0;f<JOURNAL_FIELDS;f++)
+		if (fields & journalField[f].field)
+			n += journalField[f].count;
+	return n;
+}
+
+static bool Exists(const LG3DControlData *data, int kind, int index)
+{
+	return (kind == JOURNAL_LIGHT) ? data->LightInUse(index) : data->ObjectInUse(index);
+}
+
+// the index of a touched light or object, -1 once it has been removed (and its slot perhaps
+// reused) - the values kept for it no longer belong to anything
+static int Index(const LG3DControlData *data, int kind, LG3DHandle handle)
+{
+	return (kind == JOURNAL_LIGHT) ? data->LightIndex(handle) : data->ObjectIndex(handle);
+}
+
+static void Gather(const LG3DControlData *data, int kind, int i, unsigned long fields, float *v)
+{
+	if (kind == JOURNAL_OBJECT) {
+		const LG3DSceneObject *obj = &data->sceneObjectList[i];
+		if (fields & LG3DDirty_Position) {
+			v[0] = obj->position.x;
+			v[1] = obj->position.y;
+			v[2] = obj->position.z;
+		}
+		if (fields & LG3DDirty_Orientation) {
+			v[3] = obj->orientation.h;
+			v[4] = obj->orientation.p;
+			v[5] = obj->orientation.r;
+		}
+		if (fields & LG3DDirty_Node)
+			v[15] = (float)obj->parentNode;
+		return;
+	}
+
+	const LG3DLightTable *t = &data->lights;
+	if (fields & LG3DDirty_Position) {
+		v[0] = t->posX[i];
+		v[1] = t->posY[i];
+		v[2] = t->posZ[i];
+	}
+	if (fields & LG3DDirty_Orientation) {
+		v[3] = t->head[i];
+		v[4] = t->pitch[i];
+		v[5] = t->roll[i];
+	}
+	if (fields & LG3DDirty_Color) {
+		v[6] = t->colorR[i];
+		v[7] = t->colorG[i];
+		v[8] = t->colorB[i];
+	}
+	if (fields & LG3DDirty_Cone) {
+		v[9] = t->umbra[i];
+		v[10] = t->penumbra[i];
+	}
+	if (fields & LG3DDirty_Attenuation) {
+		v[11] = t->att1[i];
+		v[12] = t->att2[i];
+	}
+	if (fields & LG3DDirty_Enabled)
+		v[13] = (t->flags[i] & LG3DLightFlag_Enabled) ? 1.0f : 0.0f;
+	if (fields & LG3DDirty_Shadows)
+		v[14] = (t->flags[i] & LG3DLightFlag_CastsShadows) ? 1.0f : 0.0f;
+	if (fields & LG3DDirty_Node)
+		v[15] = (float)t->parentNode[i];
+}
+
+// write the values back, straight past the pins, and mark what changed dirty
+static void Scatter(LG3DControlData *data, int kind, int i, unsigned long fields, const float *v)
+{
+	if (kind == JOURNAL_OBJECT) {
+		LG3DSceneObject *obj = &data->sceneObjectList[i];
+		unsigned long dirty = 0;
+		if (fields & LG3DDirty_Position) {
+			obj->position.x = v[0];
+			obj->position.y = v[1];
+			obj->position.z = v[2];
+			dirty |= LG3DDirty_Position;
+		}
+		if (fields & LG3DDirty_Orientation) {
+			obj->orientation.h = v[3];
+			obj->orientation.p = v[4];
+			obj->orientation.r = v[5];
+			dirty |= LG3DDirty_Orientation;
+		}
+		data->MarkObjectDirty(i, dirty);
+		if (fields & LG3DDirty_Node)
+			data->AttachObject(i, (int)v[15]);
+		return;
+	}
+
+	LG3DLightTable *t = &data->lights;
+	unsigned long dirty = 0;
+	if (fields & LG3DDirty_Position) {
+		t->posX[i] = v[0];
+		t->posY[i] = v[1];
+		t->posZ[i] = v[2];
+		dirty |= LG3DDirty_Position;
+	}
+	if (fields & LG3DDirty_Orientation) {
+		t->head[i] = v[3];
+		t->pitch[i] = v[4];
+		t->roll[i] = v[5];
+		dirty |= LG3DDirty_Orientation;
+	}
+	if (fields & LG3DDirty_Color) {
+		t->colorR[i] = v[6];
+		t->colorG[i] = v[7];
+		t->colorB[i] = v[8];
+		dirty |= LG3DDirty_Color;
+	}
+	data->MarkLightDirty(i, dirty);
+	if (fields & LG3DDirty_Cone)
+		data->SetLightCone(i, v[9], v[10]);
+	if (fields & LG3DDirty_Attenuation)
+		data->SetLightAttenuation(i, v[11], v[12]);
+	if (fields & LG3DDirty_Enabled)
+		data->EnableLight(i, v[13] != 0.0f);
+	if (fields & LG3DDirty_Shadows)
+		data->SetLightCastsShadows(i, v[14] != 0.0f);
+	if (fields & LG3DDirty_Node)
+		data->AttachLight(i, (int)v[15]);
+}
+
+static float *Pack(float *out, unsigned long fields, const float *v)
+{
+	int f, k;
+	for(f=0;f<JOURNAL_FIELDS;f++) {
+		if (!(fields & journalField[f].field))
+			continue;
+		for(k=0;k<journalField[f].count;k++)
+			*out++ = v[journalField[f].offset + k];
+	}
+	return out;
+}
+
+static const float *Unpack(const float *in, unsigned long fields, float *v)
+{
+	int f, k;
+	for(f=0;f<JOURNAL_FIELDS;f++) {
+		if (!(fields & journalField[f].field))
+			continue;
+		for(k=0;k<journalField[f].count;k++)
+			v[journalField[f].offset + k] = *in++;
+	}
+	return in;
+}
+
+static unsigned int TouchHash(int kind, LG3DHandle handle)
+{
+	return ((unsigned int)handle * 2 + kind) * 2654435761U;
+}
+
+LG3DJournal::LG3DJournal()
+{
+	stream = NULL;
+	streamSize = 0;
+	streamCapacity = 0;
+	stepStart = NULL;
+	stepKey = NULL;
+	numSteps = 0;
+	maxSteps = 0;
+	cursor = 0;
+	maxBytes = 0;
+	lastKey = 0;
+	open = false;
+	openKey = 0;
+	touch = NULL;
+	numTouched = 0;
+	maxTouched = 0;
+	touchHash = NULL;
+	hashSize = 0;
+}
+
+LG3DJournal::~LG3DJournal()
+{
+	free(stream);
+	free(stepStart);
+	free(stepKey);
+	free(touch);
+	free(touchHash);
+}
+
+void LG3DJournal::Clear()
+{
+	streamSize = 0;
+	numSteps = 0;
+	cursor = 0;
+	open = false;
+	numTouched = 0;
+	if (touchHash)
+		memset(touchHash, 0xff, sizeof(int) * hashSize);
+}
+
+void LG3DJournal::SetMaxBytes(int bytes)
+{
+	maxBytes = bytes;
+	while ((maxBytes > 0) && (streamSize > maxBytes) && (numSteps > 1) && (cursor > 0))
+		DropOldest();
+}
+
+void LG3DJournal::DropOldest()
+{
+	int s;
+	int size = stepStart[1];
+	memmove(stream, stream + size, streamSize - size);
+	streamSize -= size;
+	for(s=0;s<numSteps;s++) {
+		stepStart[s] = stepStart[s+1] - size;
+		stepKey[s] = stepKey[s+1];
+	}
+	numSteps--;
+	cursor--;
+}
+
+void LG3DJournal::BeginEdit(unsigned long mergeKey)
+{
+	if (open)
+		return; // still the same edit
+	open = true;
+	openKey = mergeKey;
+	numTouched = 0;
+	if ((mergeKey == 0) || (cursor != numSteps) || (numSteps == 0) || (stepKey[numSteps-1] != mergeKey))
+		return;
+
+	// the same drag again - reopen its step, keeping the values from before it began
+	int end = stepStart[numSteps];
+	int pos = stepStart[numSteps-1];
+	while (pos < end) {
+		const LG3DJournalRecord *rec = (const LG3DJournalRecord *)(stream + pos);
+		const float *values = (const float *)(rec + 1);
+		Touch(rec->kind, rec->handle, 0, NULL);
+		LG3DJournalTouch *t = &touch[numTouched-1];
+		t->fields = rec->fields;
+		Unpack(values, rec->fields, t->before);
+		pos += sizeof(LG3DJournalRecord) + sizeof(float) * NumValues(rec->fields) * 2;
+	}
+	streamSize = stepStart[numSteps-1];
+	numSteps--;
+	cursor--;
+}
+
+void LG3DJournal::TouchLight(const LG3DControlData *data, int lightIndex, unsigned long fields)
+{
+	if (open && Exists(data, JOURNAL_LIGHT, lightIndex))
+		Touch(JOURNAL_LIGHT, data->LightHandle(lightIndex), fields & journalLightFields, data);
+}
+
+void LG3DJournal::TouchObject(const LG3DControlData *data, int objectIndex, unsigned long fields)
+{
+	if (open && Exists(data, JOURNAL_OBJECT, objectIndex))
+		Touch(JOURNAL_OBJECT, data->ObjectHandle(objectIndex), fields & journalObjectFields, data);
+}
+
+// find or add the touch of a light or object, taking the values of fields it didn't cover yet
+void LG3DJournal::Touch(int kind, LG3DHandle handle, unsigned long fields, const LG3DControlData *data)
+{
+	int i;
+	int index = (int)(handle & LG3D_HANDLE_SLOT_MASK);
+	if (numTouched*2 >= hashSize) {
+		hashSize = hashSize ? hashSize*2 : 64;
+		touchHash = (int *)realloc(touchHash, sizeof(int) * hashSize);
+		memset(touchHash, 0xff, sizeof(int) * hashSize);
+		for(i=0;i<numTouched;i++) {
+			unsigned int h = TouchHash(touch[i].kind, touch[i].handle) & (hashSize-1);
+			while (touchHash[h] >= 0)
+				h = (h+1) & (hashSize-1);
+			touchHash[h] = i;
+		}
+	}
+
+	unsigned int h = TouchHash(kind, handle) & (hashSize-1);
+	while (touchHash[h] >= 0) {
+		LG3DJournalTouch *t = &touch[touchHash[h]];
+		if ((t->kind == kind) && (t->handle == handle)) {
+			unsigned long newFields = fields & ~t->fields;
+			if (newFields) {
+				Gather(data, kind, index, newFields, t->before);
+				t->fields |= newFields;
+			}
+			return;
+		}
+		h = (h+1) & (hashSize-1);
+	}
+
+	if (numTouched == maxTouched) {
+		maxTouched = maxTouched ? maxTouched*2 : 32;
+		touch = (LG3DJournalTouch *)realloc(touch, sizeof(LG3DJournalTouch) * maxTouched);
+	}
+	LG3DJournalTouch *t = &touch[numTouched];
+	t->kind = kind;
+	t->handle = handle;
+	t->fields = fields;
+	if (fields)
+		Gather(data, kind, index, fields, t->before);
+	touchHash[h] = numTouched++;
+}
+
+void LG3DJournal::EndEdit(const LG3DControlData *data)
+{
+	int i, f;
+	if (!open)
+		return;
+	open = false;
+
+	// keep only the fields that really changed
+	float after[JOURNAL_VALUES];
+	int bytes = 0;
+	for(i=0;i<numTouched;i++) {
+		LG3DJournalTouch *t = &touch[i];
+		int index = Index(data, t->kind, t->handle);
+		if (index < 0) {
+			t->fields = 0;
+			continue;
+		}
+		Gather(data, t->kind, index, t->fields, after);
+		unsigned long changed = 0;
+		for(f=0;f<JOURNAL_FIELDS;f++) {
+			int o = journalField[f].offset;
+			if ((t->fields & journalField[f].field) && memcmp(&t->before[o], &after[o], sizeof(float) * journalField[f].count))
+				changed |= journalField[f].field;
+		}
+		t->fields = changed;
+		if (changed)
+			bytes += sizeof(LG3DJournalRecord) + sizeof(float) * NumValues(changed) * 2;
+	}
+	if (touchHash)
+		memset(touchHash, 0xff, sizeof(int) * hashSize);
+	int touched = numTouched;
+	numTouched = 0;
+	if (bytes == 0)
+		return;
+
+	// a new step drops whatever could have been redone
+	streamSize = stepStart ? stepStart[cursor] : 0;
+	numSteps = cursor;
+	if (streamSize + bytes > streamCapacity) {
+		streamCapacity = max(streamSize + bytes, streamCapacity*2);
+		stream = (unsigned char *)realloc(stream, streamCapacity);
+	}
+	if (numSteps+2 > maxSteps) {
+		maxSteps = max(numSteps+2, maxSteps*2);
+		stepStart = (int *)realloc(stepStart, sizeof(int) * maxSteps);
+		stepKey = (unsigned long *)realloc(stepKey, sizeof(unsigned long) * maxSteps);
+	}
+
+	stepStart[numSteps] = streamSize;
+	stepKey[numSteps] = openKey;
+	for(i=0;i<touched;i++) {
+		const LG3DJournalTouch *t = &touch[i];
+		if (!t->fields)
+			continue;
+		LG3DJournalRecord *rec = (LG3DJournalRecord *)(stream + streamSize);
+		rec->handle = t->handle;
+		rec->kind = (unsigned short)t->kind;
+		rec->fields = (unsigned short)t->fields;
+		Gather(data, t->kind, t->handle & LG3D_HANDLE_SLOT_MASK, t->fields, after);
+		float *values = Pack((float *)(rec + 1), t->fields, t->before);
+		values = Pack(values, t->fields, after);
+		streamSize = (int)((unsigned char *)values - stream);
+	}
+	numSteps++;
+	cursor = numSteps;
+	stepStart[numSteps] = streamSize;
+
+	while ((maxBytes > 0) && (streamSize > maxBytes) && (numSteps > 1))
+		DropOldest();
+}
+
+bool LG3DJournal::Undo(LG3DControlData *data)
+{
+	if (open || (cursor == 0))
+		return false;
+	cursor--;
+	int pos = stepStart[cursor];
+	int end = stepStart[cursor+1];
+	float v[JOURNAL_VALUES];
+	while (pos < end) {
+		const LG3DJournalRecord *rec = (const LG3DJournalRecord *)(stream + pos);
+		const float *values = (const float *)(rec + 1);
+		int index = Index(data, rec->kind, rec->handle);
+		if (index >= 0) {
+			Unpack(values, rec->fields, v);
+			Scatter(data, rec->kind, index, rec->fields, v);
+		}
+		pos += sizeof(LG3DJournalRecord) + sizeof(float) * NumValues(rec->fields) * 2;
+	}
+	return true;
+}
+
+bool LG3DJournal::Redo(LG3DControlData *data)
+{
+	if (open || (cursor == numSteps))
+		return false;
+	int pos = stepStart[cursor];
+	int end = stepStart[cursor+1];
+	float v[JOURNAL_VALUES];
+	while (pos < end) {
+		const LG3DJournalRecord *rec = (const LG3DJournalRecord *)(stream + pos);
+		int n = NumValues(rec->fields);
+		const float *values = (const float *)(rec + 1);
+		int index = Index(data, rec->kind, rec->handle);
+		if (index >= 0) {
+			Unpack(values + n, rec->fields, v);
+			Scatter(data, rec->kind, index, rec->fields, v);
+		}
+		pos += sizeof(LG3DJournalRecord) + sizeof(float) * n * 2;
+	}
+	cursor++;
+	return true;
+}
@@ -0,0 +1,347 @@
+#include <math.h>
+#include <xmmintrin.h>
+
+#include "lg3d.h"
+
+// posX, posY & posZ move under the speed limits, head & pitch under the turn limits
+#define KIN_CHANNELS 5
+#define KIN_FIRST_TURN 3
+#define KIN_LIMITS 4
+#define KIN_ARRAYS (KIN_CHANNELS*3 + KIN_LIMITS)
+
+// what a limit of 0 is stored as, big enough that any move finishes in one frame
+#define KIN_NO_LIMIT 1e18f
+
+// the light table arrays of the channels, see LG3DLightTable::FieldArrays
+static const unsigned long channelField[KIN_CHANNELS] = {
+	LG3DDirty_Position, LG3DDirty_Position, LG3DDirty_Position, LG3DDirty_Orientation, LG3DDirty_Orientation,
+};
+
+static const unsigned long channelPin[KIN_CHANNELS] = {
+	LG3DPinMask_X, LG3DPinMask_Y, LG3DPinMask_Z, LG3DPinMask_H, LG3DPinMask_P,
+};
+
+static float StoredLimit(float value)
+{
+	return (value > 0.0f) ? value : KIN_NO_LIMIT;
+}
+
+LG3DKinematics::LG3DKinematics()
+{
+	count = 0;
+	capacity = 0;
+	block = NULL;
+	groupActive = NULL;
+	groupRestored = NULL;
+	handle = NULL;
+	memset(cur, 0, sizeof(cur));
+	memset(target, 0, sizeof(target));
+	memset(velocity, 0, sizeof(velocity));
+	memset(limit, 0, sizeof(limit));
+	numMoving = 0;
+
+	// a typical moving head
+	SetDefaultLimits(2.0f, 4.0f, 180.0f, 720.0f);
+}
+
+LG3DKinematics::~LG3DKinematics()
+{
+	_aligned_free(block);
+	free(groupActive);
+	free(groupRestored);
+	free(handle);
+}
+
+static LG3DHandle SlotHandle(const LG3DControlData *data, int i)
+{
+	return (i < data->lightSlots.count) ? data->LightHandle(i) : LG3D_INVALID_HANDLE;
+}
+
+void LG3DKinematics::SetDefaultLimits(float maxSpeed, float maxAccel, float maxTurn, float maxTurnAccel)
+{
+	defaultLimit[0] = StoredLimit(maxSpeed);
+	defaultLimit[1] = StoredLimit(maxAccel);
+	defaultLimit[2] = StoredLimit(maxTurn);
+	defaultLimit[3] = StoredLimit(maxTurnAccel);
+}
+
+// take on lights added to (or dropped from) the rig, new ones at rest where they are
+void LG3DKinematics::Sync(const LG3DControlData *data)
+{
+	int a, c, j;
+	int n = data->lights.count;
+	if (n == count)
+		return;
+
+	int newCapacity = (n + 3) & ~3;
+	if (newCapacity > capacity) {
+		float *newBlock = (float *)_aligned_malloc(sizeof(float) * KIN_ARRAYS * newCapacity, 16);
+		for(a=0;a<KIN_ARRAYS;a++)
+			if (block)
+				memcpy(&newBlock[a*newCapacity], &block[a*capacity], sizeof(float) * min(count, n));
+		_aligned_free(block);
+		block = newBlock;
+		groupActive = (unsigned char *)realloc(groupActive, newCapacity / 4);
+		groupRestored = (unsigned char *)realloc(groupRestored, KIN_CHANNELS * newCapacity / 4);
+		memset(&groupRestored[KIN_CHANNELS * capacity / 4], 0, KIN_CHANNELS * (newCapacity - capacity) / 4);
+		capacity = newCapacity;
+		handle = (LG3DHandle *)realloc(handle, sizeof(LG3DHandle) * capacity);
+		for(c=0;c<KIN_CHANNELS;c++) {
+			cur[c] = &block[c*capacity];
+			target[c] = &block[(KIN_CHANNELS + c)*capacity];
+			velocity[c] = &block[(KIN_CHANNELS*2 + c)*capacity];
+		}
+		for(a=0;a<KIN_LIMITS;a++)
+			limit[a] = &block[(KIN_CHANNELS*3 + a)*capacity];
+	}
+
+	float *live[KIN_CHANNELS];
+	data->lights.FieldArrays(channelField, KIN_CHANNELS, live);
+	for(j=(min(count, n) + 3) & ~3;j<capacity;j+=4) {
+		groupActive[j >> 2] = 0;
+		memset(&groupRestored[KIN_CHANNELS * (j >> 2)], 0, KIN_CHANNELS);
+	}
+	for(j=min(count, n);j<capacity;j++) {
+		for(c=0;c<KIN_CHANNELS;c++) {
+			cur[c][j] = target[c][j] = (j < n) ? live[c][j] : 0.0f;
+			velocity[c][j] = 0.0f;
+		}
+		for(a=0;a<KIN_LIMITS;a++)
+			limit[a][j] = defaultLimit[a];
+		handle[j] = (j < n) ? SlotHandle(data, j) : LG3D_INVALID_HANDLE;
+	}
+	count = n;
+}
+
+// at rest where the light is now
+void LG3DKinematics::Seed(const LG3DControlData *data, int lightIndex, bool resetLimits)
+{
+	int a, c;
+	float *live[KIN_CHANNELS];
+	data->lights.FieldArrays(channelField, KIN_CHANNELS, live);
+	for(c=0;c<KIN_CHANNELS;c++) {
+		cur[c][lightIndex] = target[c][lightIndex] = live[c][lightIndex];
+		velocity[c][lightIndex] = 0.0f;
+	}
+	if (resetLimits) {
+		for(a=0;a<KIN_LIMITS;a++)
+			limit[a][lightIndex] = defaultLimit[a];
+	}
+	handle[lightIndex] = SlotHandle(data, lightIndex);
+}
+
+// a fixture added or removed in the light's slot since it was seeded is a new one
+void LG3DKinematics::SeedIfReplaced(const LG3DControlData *data, int lightIndex)
+{
+	if (handle[lightIndex] != SlotHandle(data, lightIndex))
+		Seed(data, lightIndex, true);
+}
+
+void LG3DKinematics::Snap(const LG3DControlData *data)
+{
+	int j;
+	Sync(data);
+	for(j=0;j<count;j++)
+		Seed(data, j, false);
+}
+
+void LG3DKinematics::SetLimits(const LG3DControlData *data, int lightIndex, float maxSpeed, float maxAccel, float maxTurn, float maxTurnAccel)
+{
+	Sync(data);
+	if ((lightIndex < 0) || (lightIndex >= count))
+		return;
+	SeedIfReplaced(data, lightIndex);
+	limit[0][lightIndex] = StoredLimit(maxSpeed);
+	limit[1][lightIndex] = StoredLimit(maxAccel);
+	limit[2][lightIndex] = StoredLimit(maxTurn);
+	limit[3][lightIndex] = StoredLimit(maxTurnAccel);
+	groupActive[lightIndex >> 2] = 15;
+}
+
+void LG3DKinematics::SetTarget(const LG3DControlData *data, int lightIndex, const LG3DPosition *pos, const LG3DOrientation *orient)
+{
+	Sync(data);
+	if ((lightIndex < 0) || (lightIndex >= count))
+		return;
+	SeedIfReplaced(data, lightIndex);
+	if (pos) {
+		target[0][lightIndex] = pos->x;
+		target[1][lightIndex] = pos->y;
+		target[2][lightIndex] = pos->z;
+	}
+	if (orient) {
+		target[3][lightIndex] = orient->h;
+		target[4][lightIndex] = orient->p;
+	}
+	groupActive[lightIndex >> 2] = 15;
+}
+
+void LG3DKinematics::MoveTarget(const LG3DControlData *data, int lightIndex, const LG3DPosition *posDelta, const LG3DOrientation *orientDelta)
+{
+	Sync(data);
+	if ((lightIndex < 0) || (lightIndex >= count))
+		return;
+	SeedIfReplaced(data, lightIndex);
+	if (posDelta) {
+		target[0][lightIndex] += posDelta->x;
+		target[1][lightIndex] += posDelta->y;
+		target[2][lightIndex] += posDelta->z;
+	}
+	if (orientDelta) {
+		target[3][lightIndex] += orientDelta->h;
+		target[4][lightIndex] += orientDelta->p;
+	}
+	groupActive[lightIndex >> 2] = 15;
+}
+
+void LG3DKinematics::GetTarget(int lightIndex, LG3DPosition *pos, LG3DOrientation *orient) const
+{
+	if ((lightIndex < 0) || (lightIndex >= count))
+		return;
+	if (pos) {
+		pos->x = target[0][lightIndex];
+		pos->y = target[1][lightIndex];
+		pos->z = target[2][lightIndex];
+	}
+	if (orient) {
+		orient->h = target[3][lightIndex];
+		orient->p = target[4][lightIndex];
+	}
+}
+
+// lights on their way show their targets to the inputs, so what they write over them (an
+// effect riding on the pan, say) is laid over the target and not over wherever the fixture
+// happened to have got to
+void LG3DKinematics::BeginFrame(LG3DControlData *data)
+{
+	int c, j, k;
+	LG3DLightTable *lights = &data->lights;
+	Sync(data);
+
+	float *live[KIN_CHANNELS];
+	lights->FieldArrays(channelField, KIN_CHANNELS, live);
+	for(j=0;j<count;j+=4) {
+		if (!groupActive[j >> 2])
+			continue;
+		int valid = (j+4 > count) ? (1 << (count-j)) - 1 : 15;
+		for(c=0;c<KIN_CHANNELS;c++) {
+			// only where nothing has been written since the last frame move
+			__m128 p = _mm_load_ps(&cur[c][j]);
+			int bits = _mm_movemask_ps(_mm_and_ps(_mm_cmpeq_ps(_mm_load_ps(&live[c][j]), p), _mm_cmpneq_ps(_mm_load_ps(&target[c][j]), p))) & valid;
+			int restored = 0;
+			for(k=0;bits;k++,bits>>=1) {
+				int i = j+k;
+				if (!(bits & 1) || (lights->pinMask[i] & channelPin[c]) || (handle[i] != SlotHandle(data, i)))
+					continue;
+				live[c][i] = target[c][i];
+				restored |= 1 << k;
+			}
+			groupRestored[KIN_CHANNELS * (j >> 2) + c] = (unsigned char)restored;
+		}
+	}
+}
+
+void LG3DKinematics::Advance(LG3DControlData *data, float elapsed)
+{
+	int c, j, k;
+	LG3DLightTable *lights = &data->lights;
+	Sync(data);
+	numMoving = 0;
+
+	// fixtures added or removed since the last frame move start at rest where they are
+	for(k=0;k<data->numDirtyLights;k++) {
+		j = data->dirtyLightList[k];
+		if ((j < count) && (lights->dirty[j] & LG3DDirty_Slot))
+			SeedIfReplaced(data, j);
+	}
+
+	__m128 dt = _mm_set1_ps(elapsed);
+	__m128 dtInv = _mm_set1_ps((elapsed > 0.0f) ? 1.0f / elapsed : 0.0f);
+	__m128 signMask = _mm_set1_ps(-0.0f);
+	__m128 zero = _mm_setzero_ps();
+	__m128 quarter = _mm_set1_ps(0.25f);
+	__m128 half = _mm_set1_ps(0.5f);
+	__m128 two = _mm_set1_ps(2.0f);
+
+	// one pass, 4 lights at a time.  The light table is padded to a multiple of 4 too, so
+	// whole groups can be compared with it.
+	float *live[KIN_CHANNELS];
+	lights->FieldArrays(channelField, KIN_CHANNELS, live);
+	for(j=0;j<count;j+=4) {
+		int valid = (j+4 > count) ? (1 << (count-j)) - 1 : 15;
+
+		// anything written since the last frame move is a new target, as is whatever the inputs
+		// left on a light BeginFrame put on its target
+		int active = groupActive[j >> 2];
+		unsigned char *restored = &groupRestored[KIN_CHANNELS * (j >> 2)];
+		for(c=0;c<KIN_CHANNELS;c++) {
+			int bits = (_mm_movemask_ps(_mm_cmpneq_ps(_mm_load_ps(&live[c][j]), _mm_load_ps(&cur[c][j]))) | restored[c]) & valid;
+			active |= bits;
+			for(k=0;bits;k++,bits>>=1)
+				if (bits & 1)
+					target[c][j+k] = live[c][j+k];
+		}
+		if (!active)
+			continue;
+
+		// head for the target as fast as the limits allow, easing off in time to stop on it.
+		// The speed wanted is the most that can still be shed a frame at a time over the
+		// distance left: n frames of braking cover a dt^2 n(n+1)/2, so it is a dt n for
+		//		n = sqrt(1/4 + 2 dist / (a dt^2)) - 1/2
+		// worked out without the cancellation, so huge limits still get there.  The speed
+		// changes toward it by no more than the acceleration allows, and passing the target
+		// (or being on it) lands exactly on it, stopped.
+		int moving = 0;
+		for(c=0;c<KIN_CHANNELS && (elapsed > 0.0f);c++) {
+			const float *maxV = limit[(c < KIN_FIRST_TURN) ? 0 : 2];
+			const float *maxA = limit[(c < KIN_FIRST_TURN) ? 1 : 3];
+			__m128 v = _mm_load_ps(&velocity[c][j]);
+			__m128 p = _mm_load_ps(&cur[c][j]);
+			__m128 t = _mm_load_ps(&target[c][j]);
+			__m128 a = _mm_load_ps(&maxA[j]);
+			__m128 d = _mm_sub_ps(t, p);
+			__m128 dist = _mm_andnot_ps(signMask, d);
+			__m128 dvMax = _mm_mul_ps(a, dt);
+			__m128 x = _mm_div_ps(_mm_mul_ps(two, dist), _mm_mul_ps(dvMax, dt));
+			__m128 want = _mm_div_ps(_mm_mul_ps(_mm_mul_ps(two, dist), dtInv), _mm_add_ps(_mm_sqrt_ps(_mm_add_ps(quarter, x)), half));
+			want = _mm_min_ps(_mm_load_ps(&maxV[j]), want);
+			want = _mm_or_ps(want, _mm_and_ps(d, signMask));
+			__m128 dv = _mm_min_ps(_mm_max_ps(_mm_sub_ps(want, v), _mm_xor_ps(dvMax, signMask)), dvMax);
+			v = _mm_add_ps(v, dv);
+			__m128 np = _mm_add_ps(p, _mm_mul_ps(v, dt));
+			__m128 arrived = _mm_cmple_ps(_mm_mul_ps(d, _mm_sub_ps(t, np)), zero);
+			np = _mm_or_ps(_mm_and_ps(arrived, t), _mm_andnot_ps(arrived, np));
+			v = _mm_andnot_ps(arrived, v);
+			_mm_store_ps(&cur[c][j], np);
+			_mm_store_ps(&velocity[c][j], v);
+			moving |= _mm_movemask_ps(_mm_or_ps(_mm_cmpneq_ps(v, zero), _mm_cmpneq_ps(np, t)));
+		}
+
+		// put the lights where the fixtures are, only those that moved are marked dirty
+		for(c=0;c<KIN_CHANNELS;c++) {
+			int bits = (_mm_movemask_ps(_mm_cmpneq_ps(_mm_load_ps(&cur[c][j]), _mm_load_ps(&live[c][j]))) | restored[c]) & valid;
+			restored[c] = 0;
+			for(k=0;bits;k++,bits>>=1) {
+				if (!(bits & 1))
+					continue;
+				int i = j+k;
+				if (lights->pinMask[i] & channelPin[c]) {
+					// pinned where it stands
+					cur[c][i] = target[c][i] = live[c][i];
+					velocity[c][i] = 0.0f;
+					continue;
+				}
+				live[c][i] = cur[c][i];
+				data->MarkLightDirty(i, (c < KIN_FIRST_TURN) ? LG3DDirty_Position : LG3DDirty_Orientation);
+			}
+		}
+
+		// with no time passing nothing moves, but the targets are still waiting
+		if (elapsed <= 0.0f)
+			moving = active;
+		moving &= valid;
+		groupActive[j >> 2] = (unsigned char)moving;
+		for(;moving;moving>>=1)
+			numMoving += moving & 1;
+	}
+}
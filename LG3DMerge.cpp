@@ -0,0 +1,392 @@
+#include <emmintrin.h>
+
+#include "lg3d.h"
+
+// lights are grown, tracked & merged in blocks of this many entries
+#define MERGE_BLOCK_SHIFT 6
+#define MERGE_BLOCK_SIZE (1<<MERGE_BLOCK_SHIFT)
+
+// number of 4 byte arrays carved out of LG3DMergeSource::block
+#define MERGE_SOURCE_ARRAYS 12
+
+// latest takes precedence keys are the priority (plus one) above a 24 bit write stamp
+#define MERGE_STAMP_BITS 24
+#define MERGE_STAMP_MASK ((1<<MERGE_STAMP_BITS)-1)
+
+// One input's buffer.  A key of 0 means the source does not hold that value of the light.
+// Color keys are just the priority plus one, position & orientation keys also carry the
+// stamp of the write, so the highest key of a light is always the one that wins.
+struct LG3DMergeSource {
+	bool			inUse;
+	int				priority;
+	void			*block;					// single allocation holding all the arrays, 16 byte aligned
+	int				*colorKey;
+	float			*colorR, *colorG, *colorB;	// 0 to 1
+	int				*posKey;
+	float			*posX, *posY, *posZ;
+	int				*orientKey;
+	float			*head, *pitch, *roll;
+};
+
+static void AssignSourceArrays(LG3DMergeSource *s, int capacity)
+{
+	float *f = (float *)s->block;
+	s->colorKey = (int *)f; f += capacity;
+	s->colorR = f; f += capacity;
+	s->colorG = f; f += capacity;
+	s->colorB = f; f += capacity;
+	s->posKey = (int *)f; f += capacity;
+	s->posX = f; f += capacity;
+	s->posY = f; f += capacity;
+	s->posZ = f; f += capacity;
+	s->orientKey = (int *)f; f += capacity;
+	s->head = f; f += capacity;
+	s->pitch = f; f += capacity;
+	s->roll = f; f += capacity;
+}
+
+// highest of two sets of 4 keys, SSE2 has no signed max
+static inline __m128i MaxKey(__m128i a, __m128i b)
+{
+	__m128i gt = _mm_cmpgt_epi32(a, b);
+	return _mm_or_si128(_mm_and_si128(gt, a), _mm_andnot_si128(gt, b));
+}
+
+LG3DMerge::LG3DMerge()
+{
+	source = new LG3DMergeSource[LG3D_MAX_MERGE_SOURCES];
+	memset(source, 0, sizeof(LG3DMergeSource) * LG3D_MAX_MERGE_SOURCES);
+	capacity = 0;
+	blockDirty = NULL;
+	anyDirty = false;
+	stamp = 0;
+}
+
+LG3DMerge::~LG3DMerge()
+{
+	int s;
+	for(s=0;s<LG3D_MAX_MERGE_SOURCES;s++)
+		_aligned_free(source[s].block);
+	delete [] source;
+	free(blockDirty);
+}
+
+void LG3DMerge::Grow(int lightIndex)
+{
+	int s, a;
+	if (lightIndex < capacity)
+		return;
+	int newCapacity = (lightIndex + MERGE_BLOCK_SIZE) & ~(MERGE_BLOCK_SIZE-1);
+	if (newCapacity < capacity*2)
+		newCapacity = capacity*2;
+
+	// new entries are zero, which is a zero key - not held
+	for(s=0;s<LG3D_MAX_MERGE_SOURCES;s++) {
+		LG3DMergeSource *src = &source[s];
+		if (!src->inUse)
+			continue;
+		void *newBlock = _aligned_malloc(sizeof(float) * MERGE_SOURCE_ARRAYS * newCapacity, 16);
+		memset(newBlock, 0, sizeof(float) * MERGE_SOURCE_ARRAYS * newCapacity);
+		if (src->block) {
+			for(a=0;a<MERGE_SOURCE_ARRAYS;a++)
+				memcpy((float *)newBlock + a*newCapacity, (float *)src->block + a*capacity, sizeof(float) * capacity);
+			_aligned_free(src->block);
+		}
+		src->block = newBlock;
+		AssignSourceArrays(src, newCapacity);
+	}
+	blockDirty = (unsigned char *)realloc(blockDirty, newCapacity >> MERGE_BLOCK_SHIFT);
+	memset(blockDirty + (capacity >> MERGE_BLOCK_SHIFT), 0, (newCapacity - capacity) >> MERGE_BLOCK_SHIFT);
+	capacity = newCapacity;
+}
+
+void LG3DMerge::Touch(int lightIndex)
+{
+	blockDirty[lightIndex >> MERGE_BLOCK_SHIFT] = 1;
+	anyDirty = true;
+}
+
+// stamp for the next latest takes precedence write.  When the stamps run out, each light's
+// held keys are renumbered 1, 2, 3.. in their current order, which is all the merge compares.
+int LG3DMerge::NextStamp()
+{
+	if (++stamp <= MERGE_STAMP_MASK)
+		return (int)stamp;
+
+	int i, s, k, n;
+	int *key[LG3D_MAX_MERGE_SOURCES];
+	for(k=0;k<2;k++) {
+		for(i=0;i<capacity;i++) {
+			n = 0;
+			for(s=0;s<LG3D_MAX_MERGE_SOURCES;s++) {
+				int *keys = (k == 0) ? source[s].posKey : source[s].orientKey;
+				if (source[s].inUse && keys[i])
+					key[n++] = &keys[i];
+			}
+			// a handful of sources at most, a plain insertion sort on the stamps will do
+			int j;
+			for(j=1;j<n;j++) {
+				int *move = key[j];
+				int m = j;
+				while ((m > 0) && ((*key[m-1] & MERGE_STAMP_MASK) > (*move & MERGE_STAMP_MASK))) {
+					key[m] = key[m-1];
+					m--;
+				}
+				key[m] = move;
+			}
+			for(j=0;j<n;j++)
+				*key[j] = (*key[j] & ~MERGE_STAMP_MASK) | (j+1);
+		}
+	}
+	stamp = LG3D_MAX_MERGE_SOURCES + 1;
+	return (int)stamp;
+}
+
+bool LG3DMerge::IsSource(int s) const
+{
+	return (s >= 0) && (s < LG3D_MAX_MERGE_SOURCES) && source[s].inUse;
+}
+
+int LG3DMerge::AddSource(int priority)
+{
+	int s;
+	for(s=0;s<LG3D_MAX_MERGE_SOURCES;s++) {
+		LG3DMergeSource *src = &source[s];
+		if (src->inUse)
+			continue;
+		src->inUse = true;
+		src->priority = max(0, min(priority, LG3D_MAX_MERGE_PRIORITY));
+		if (capacity > 0) {
+			src->block = _aligned_malloc(sizeof(float) * MERGE_SOURCE_ARRAYS * capacity, 16);
+			memset(src->block, 0, sizeof(float) * MERGE_SOURCE_ARRAYS * capacity);
+			AssignSourceArrays(src, capacity);
+		}
+		return s;
+	}
+	return -1;
+}
+
+void LG3DMerge::RemoveSource(int s)
+{
+	if (!IsSource(s))
+		return;
+	LG3DMergeSource *src = &source[s];
+	int i;
+	for(i=0;i<capacity;i++) {
+		if (src->colorKey[i] || src->posKey[i] || src->orientKey[i])
+			Touch(i);
+	}
+	_aligned_free(src->block);
+	memset(src, 0, sizeof(LG3DMergeSource));
+}
+
+void LG3DMerge::SetSourcePriority(int s, int priority)
+{
+	if (!IsSource(s))
+		return;
+	LG3DMergeSource *src = &source[s];
+	src->priority = max(0, min(priority, LG3D_MAX_MERGE_PRIORITY));
+	int i;
+	int prio = src->priority + 1;
+	for(i=0;i<capacity;i++) {
+		if (!src->colorKey[i] && !src->posKey[i] && !src->orientKey[i])
+			continue;
+		if (src->colorKey[i])
+			src->colorKey[i] = prio;
+		if (src->posKey[i])
+			src->posKey[i] = (prio << MERGE_STAMP_BITS) | (src->posKey[i] & MERGE_STAMP_MASK);
+		if (src->orientKey[i])
+			src->orientKey[i] = (prio << MERGE_STAMP_BITS) | (src->orientKey[i] & MERGE_STAMP_MASK);
+		Touch(i);
+	}
+}
+
+void LG3DMerge::SetColor(int s, int lightIndex, const LG3DLightColor *color)
+{
+	if (!IsSource(s) || (lightIndex < 0))
+		return;
+	Grow(lightIndex);
+	LG3DMergeSource *src = &source[s];
+	src->colorKey[lightIndex] = src->priority + 1;
+	src->colorR[lightIndex] = color->r/255.0f;
+	src->colorG[lightIndex] = color->g/255.0f;
+	src->colorB[lightIndex] = color->b/255.0f;
+	Touch(lightIndex);
+}
+
+void LG3DMerge::SetPosition(int s, int lightIndex, const LG3DPosition *pos)
+{
+	if (!IsSource(s) || (lightIndex < 0))
+		return;
+	Grow(lightIndex);
+	int key = ((source[s].priority + 1) << MERGE_STAMP_BITS) | NextStamp();
+	LG3DMergeSource *src = &source[s];
+	src->posKey[lightIndex] = key;
+	src->posX[lightIndex] = pos->x;
+	src->posY[lightIndex] = pos->y;
+	src->posZ[lightIndex] = pos->z;
+	Touch(lightIndex);
+}
+
+void LG3DMerge::SetOrientation(int s, int lightIndex, const LG3DOrientation *orient)
+{
+	if (!IsSource(s) || (lightIndex < 0))
+		return;
+	Grow(lightIndex);
+	int key = ((source[s].priority + 1) << MERGE_STAMP_BITS) | NextStamp();
+	LG3DMergeSource *src = &source[s];
+	src->orientKey[lightIndex] = key;
+	src->head[lightIndex] = orient->h;
+	src->pitch[lightIndex] = orient->p;
+	src->roll[lightIndex] = orient->r;
+	Touch(lightIndex);
+}
+
+void LG3DMerge::Release(int s, int lightIndex, unsigned long fields)
+{
+	if (!IsSource(s) || (lightIndex < 0) || (lightIndex >= capacity))
+		return;
+	LG3DMergeSource *src = &source[s];
+	if (fields & LG3DDirty_Color)
+		src->colorKey[lightIndex] = 0;
+	if (fields & LG3DDirty_Position)
+		src->posKey[lightIndex] = 0;
+	if (fields & LG3DDirty_Orientation)
+		src->orientKey[lightIndex] = 0;
+	Touch(lightIndex);
+}
+
+int LG3DMerge::Merge(LG3DControlData *data)
+{
+	int b, j, k, s, changed = 0;
+	if (!anyDirty)
+		return 0;
+
+	// sources in use, gathered once
+	const LG3DMergeSource *active[LG3D_MAX_MERGE_SOURCES];
+	int numActive = 0;
+	for(s=0;s<LG3D_MAX_MERGE_SOURCES;s++) {
+		if (source[s].inUse && source[s].block)
+			active[numActive++] = &source[s];
+	}
+
+	LG3DLightTable *lights = &data->lights;
+	int numLights = min(capacity, lights->count);
+	const __m128i zero = _mm_setzero_si128();
+	for(b=0;b<(capacity >> MERGE_BLOCK_SHIFT);b++) {
+		if (!blockDirty[b])
+			continue;
+		blockDirty[b] = 0;
+		int first = b << MERGE_BLOCK_SHIFT;
+		int last = min(first + MERGE_BLOCK_SIZE, numLights);
+
+		// the table's arrays are padded to a multiple of 4, so whole groups can be read
+		for(j=first;j<last;j+=4) {
+			// the winning keys: the highest priority holding the color, and the
+			// highest priority & latest stamp holding position & orientation
+			__m128i colorWin = zero, posWin = zero, orientWin = zero;
+			for(s=0;s<numActive;s++) {
+				colorWin = MaxKey(colorWin, _mm_load_si128((const __m128i *)(active[s]->colorKey + j)));
+				posWin = MaxKey(posWin, _mm_load_si128((const __m128i *)(active[s]->posKey + j)));
+				orientWin = MaxKey(orientWin, _mm_load_si128((const __m128i *)(active[s]->orientKey + j)));
+			}
+			__m128 colorHeld = _mm_castsi128_ps(_mm_cmpgt_epi32(colorWin, zero));
+			__m128 posHeld = _mm_castsi128_ps(_mm_cmpgt_epi32(posWin, zero));
+			__m128 orientHeld = _mm_castsi128_ps(_mm_cmpgt_epi32(orientWin, zero));
+			if (!_mm_movemask_ps(_mm_or_ps(colorHeld, _mm_or_ps(posHeld, orientHeld))))
+				continue;
+
+			// colors of the winning priority merge by max, and only one source has the
+			// winning position & orientation key, so its values are simply or'd in
+			__m128 r = _mm_setzero_ps(), g = _mm_setzero_ps(), bl = _mm_setzero_ps();
+			__m128 x = _mm_setzero_ps(), y = _mm_setzero_ps(), z = _mm_setzero_ps();
+			__m128 h = _mm_setzero_ps(), p = _mm_setzero_ps(), rl = _mm_setzero_ps();
+			for(s=0;s<numActive;s++) {
+				const LG3DMergeSource *src = active[s];
+				__m128 m = _mm_and_ps(colorHeld, _mm_castsi128_ps(_mm_cmpeq_epi32(_mm_load_si128((const __m128i *)(src->colorKey + j)), colorWin)));
+				r = _mm_max_ps(r, _mm_and_ps(m, _mm_load_ps(src->colorR + j)));
+				g = _mm_max_ps(g, _mm_and_ps(m, _mm_load_ps(src->colorG + j)));
+				bl = _mm_max_ps(bl, _mm_and_ps(m, _mm_load_ps(src->colorB + j)));
+				m = _mm_and_ps(posHeld, _mm_castsi128_ps(_mm_cmpeq_epi32(_mm_load_si128((const __m128i *)(src->posKey + j)), posWin)));
+				x = _mm_or_ps(x, _mm_and_ps(m, _mm_load_ps(src->posX + j)));
+				y = _mm_or_ps(y, _mm_and_ps(m, _mm_load_ps(src->posY + j)));
+				z = _mm_or_ps(z, _mm_and_ps(m, _mm_load_ps(src->posZ + j)));
+				m = _mm_and_ps(orientHeld, _mm_castsi128_ps(_mm_cmpeq_epi32(_mm_load_si128((const __m128i *)(src->orientKey + j)), orientWin)));
+				h = _mm_or_ps(h, _mm_and_ps(m, _mm_load_ps(src->head + j)));
+				p = _mm_or_ps(p, _mm_and_ps(m, _mm_load_ps(src->pitch + j)));
+				rl = _mm_or_ps(rl, _mm_and_ps(m, _mm_load_ps(src->roll + j)));
+			}
+
+			// lights whose held values differ from the live ones
+			__m128 colorDiff = _mm_and_ps(colorHeld, _mm_or_ps(_mm_cmpneq_ps(r, _mm_load_ps(lights->colorR + j)),
+				_mm_or_ps(_mm_cmpneq_ps(g, _mm_load_ps(lights->colorG + j)), _mm_cmpneq_ps(bl, _mm_load_ps(lights->colorB + j)))));
+			__m128 posDiff = _mm_and_ps(posHeld, _mm_or_ps(_mm_cmpneq_ps(x, _mm_load_ps(lights->posX + j)),
+				_mm_or_ps(_mm_cmpneq_ps(y, _mm_load_ps(lights->posY + j)), _mm_cmpneq_ps(z, _mm_load_ps(lights->posZ + j)))));
+			__m128 orientDiff = _mm_and_ps(orientHeld, _mm_or_ps(_mm_cmpneq_ps(h, _mm_load_ps(lights->head + j)),
+				_mm_or_ps(_mm_cmpneq_ps(p, _mm_load_ps(lights->pitch + j)), _mm_cmpneq_ps(rl, _mm_load_ps(lights->roll + j)))));
+			int colorMask = _mm_movemask_ps(colorDiff);
+			int posMask = _mm_movemask_ps(posDiff);
+			int orientMask = _mm_movemask_ps(orientDiff);
+			if (!(colorMask | posMask | orientMask))
+				continue;
+
+			float out[9][4];
+			_mm_storeu_ps(out[0], r);
+			_mm_storeu_ps(out[1], g);
+			_mm_storeu_ps(out[2], bl);
+			_mm_storeu_ps(out[3], x);
+			_mm_storeu_ps(out[4], y);
+			_mm_storeu_ps(out[5], z);
+			_mm_storeu_ps(out[6], h);
+			_mm_storeu_ps(out[7], p);
+			_mm_storeu_ps(out[8], rl);
+			for(k=0;(k<4) && (j+k<last);k++) {
+				int i = j + k;
+				if (!data->LightInUse(i))
+					continue;
+				unsigned long pin = lights->pinMask[i];
+				unsigned long fields = 0;
+				if (colorMask & (1<<k)) {
+					lights->colorR[i] = out[0][k];
+					lights->colorG[i] = out[1][k];
+					lights->colorB[i] = out[2][k];
+					fields |= LG3DDirty_Color;
+				}
+				if (posMask & (1<<k)) {
+					if (!(pin & LG3DPinMask_X) && lights->posX[i] != out[3][k]) {
+						lights->posX[i] = out[3][k];
+						fields |= LG3DDirty_Position;
+					}
+					if (!(pin & LG3DPinMask_Y) && lights->posY[i] != out[4][k]) {
+						lights->posY[i] = out[4][k];
+						fields |= LG3DDirty_Position;
+					}
+					if (!(pin & LG3DPinMask_Z) && lights->posZ[i] != out[5][k]) {
+						lights->posZ[i] = out[5][k];
+						fields |= LG3DDirty_Position;
+					}
+				}
+				if (orientMask & (1<<k)) {
+					if (!(pin & LG3DPinMask_H) && lights->head[i] != out[6][k]) {
+						lights->head[i] = out[6][k];
+						fields |= LG3DDirty_Orientation;
+					}
+					if (!(pin & LG3DPinMask_P) && lights->pitch[i] != out[7][k]) {
+						lights->pitch[i] = out[7][k];
+						fields |= LG3DDirty_Orientation;
+					}
+					if (!(pin & LG3DPinMask_R) && lights->roll[i] != out[8][k]) {
+						lights->roll[i] = out[8][k];
+						fields |= LG3DDirty_Orientation;
+					}
+				}
+				if (fields) {
+					data->MarkLightDirty(i, fields);
+					changed++;
+				}
+			}
+		}
+	}
+	anyDirty = false;
+	return changed;
+}
@@ -0,0 +1,107 @@
+#include <wchar.h>
+
+#include "lg3d.h"
+
+// process wide table of interned names.  Names are only interned while a rig is being set up
+// and only looked up when device resources are loaded, so a simple lock is plenty here.
+struct LG3DNameTable {
+	CRITICAL_SECTION	lock;
+	WCHAR				**name;				// indexed by LG3DNameId, entry 0 is the empty name
+	int					numNames;
+	int					maxNames;
+	LG3DNameId			*hash;				// open addressed hash of ids, 0 for an empty bucket
+	int					hashSize;			// always a power of 2, kept at most half full
+
+	LG3DNameTable()
+	{
+		InitializeCriticalSection(&lock);
+		maxNames = 64;
+		name = (WCHAR **)malloc(sizeof(WCHAR *) * maxNames);
+		name[0] = (WCHAR *)calloc(1, sizeof(WCHAR));
+		numNames = 1;
+		hashSize = 128;
+		hash = (LG3DNameId *)calloc(hashSize, sizeof(LG3DNameId));
+	}
+
+	~LG3DNameTable()
+	{
+		int i;
+		for(i=0;i<numNames;i++)
+			free(name[i]);
+		free(name);
+		free(hash);
+		DeleteCriticalSection(&lock);
+	}
+};
+
+static LG3DNameTable nameTable;
+
+// FNV-1a over the characters of the name
+static unsigned long HashName(const WCHAR *str)
+{
+	unsigned long h = 2166136261UL;
+	while (*str) {
+		h ^= (unsigned long)*str++;
+		h *= 16777619UL;
+	}
+	return h;
+}
+
+static void InsertHash(LG3DNameTable *table, LG3DNameId id)
+{
+	unsigned long mask = table->hashSize - 1;
+	unsigned long h = HashName(table->name[id]) & mask;
+	while (table->hash[h])
+		h = (h + 1) & mask;
+	table->hash[h] = id;
+}
+
+LG3DNameId LG3DInternName(const WCHAR *str)
+{
+	if (!str || !str[0])
+		return 0;
+
+	LG3DNameTable *table = &nameTable;
+	EnterCriticalSection(&table->lock);
+
+	unsigned long mask = table->hashSize - 1;
+	unsigned long h = HashName(str) & mask;
+	LG3DNameId id;
+	while ((id = table->hash[h]) != 0) {
+		if (wcscmp(table->name[id], str) == 0) {
+			LeaveCriticalSection(&table->lock);
+			return id;
+		}
+		h = (h + 1) & mask;
+	}
+
+	// not seen before, add it
+	if (table->numNames == table->maxNames) {
+		table->maxNames *= 2;
+		table->name = (WCHAR **)realloc(table->name, sizeof(WCHAR *) * table->maxNames);
+	}
+	id = table->numNames++;
+	table->name[id] = _wcsdup(str);
+
+	if (table->numNames*2 > table->hashSize) {
+		free(table->hash);
+		table->hashSize *= 2;
+		table->hash = (LG3DNameId *)calloc(table->hashSize, sizeof(LG3DNameId));
+		LG3DNameId i;
+		for(i=1;i<(LG3DNameId)table->numNames;i++)
+			InsertHash(table, i);
+	} else
+		table->hash[h] = id;
+
+	LeaveCriticalSection(&table->lock);
+	return id;
+}
+
+const WCHAR *LG3DNameString(LG3DNameId id)
+{
+	LG3DNameTable *table = &nameTable;
+	EnterCriticalSection(&table->lock);
+	const WCHAR *str = (id < (LG3DNameId)table->numNames) ? table->name[id] : table->name[0];
+	LeaveCriticalSection(&table->lock);
+	return str;
+}
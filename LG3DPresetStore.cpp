@@ -0,0 +1,255 @@
+#include "lg3d.h"
+
+// presets are stored & shared in blocks of this many lights
+#define PRESET_BLOCK_SHIFT 5
+#define PRESET_BLOCK_SIZE (1<<PRESET_BLOCK_SHIFT)
+
+// number of light table arrays a preset keeps, see presetField
+#define PRESET_ARRAYS 15
+#define PRESET_FLAGS_ARRAY 14
+
+// the LG3DLightFlagType bits a preset keeps, the rest (HasGobo) always stay as they are
+#define PRESET_FLAGS (LG3DLightFlag_Enabled | LG3DLightFlag_CastsShadows)
+
+struct LG3DPresetBlock {
+	unsigned long	value[PRESET_ARRAYS][PRESET_BLOCK_SIZE];	// raw bits of the light table values, entries past the rig are zero
+	unsigned long	hash;
+	int				refCount;				// number of presets using this block
+	LG3DPresetBlock	*next;					// next block in the same hash chain
+};
+
+struct LG3DPreset {
+	int				numLights;
+	LG3DPresetBlock	**block;				// NULL while nothing is stored
+};
+
+// the LG3DDirtyFieldType bit each kept array is reported as, the flags are worked out bit by bit
+static const unsigned long presetField[PRESET_ARRAYS] = {
+	LG3DDirty_Position, LG3DDirty_Position, LG3DDirty_Position,
+	LG3DDirty_Orientation, LG3DDirty_Orientation, LG3DDirty_Orientation,
+	LG3DDirty_Color, LG3DDirty_Color, LG3DDirty_Color,
+	LG3DDirty_Cone, LG3DDirty_Cone, LG3DDirty_Cone,
+	LG3DDirty_Attenuation, LG3DDirty_Attenuation,
+	0,
+};
+
+// the light table arrays a preset keeps, compared & copied as raw bits
+static void PresetArrays(const LG3DLightTable *t, unsigned long **a)
+{
+	int k;
+	float *f[PRESET_FLAGS_ARRAY];
+	t->FieldArrays(presetField, PRESET_FLAGS_ARRAY, f);
+	for(k=0;k<PRESET_FLAGS_ARRAY;k++)
+		a[k] = (unsigned long *)f[k];
+	a[PRESET_FLAGS_ARRAY] = t->flags;
+}
+
+static int NumLightBlocks(int numLights)
+{
+	return (numLights + PRESET_BLOCK_SIZE-1) >> PRESET_BLOCK_SHIFT;
+}
+
+// FNV-1a over the words of the block's values
+static unsigned long HashBlock(const LG3DPresetBlock *block)
+{
+	const unsigned long *v = &block->value[0][0];
+	unsigned long h = 2166136261UL;
+	int i;
+	for(i=0;i<PRESET_ARRAYS*PRESET_BLOCK_SIZE;i++) {
+		h ^= v[i];
+		h *= 16777619UL;
+	}
+	return h;
+}
+
+LG3DPresetStore::LG3DPresetStore()
+{
+	preset = NULL;
+	numPresets = 0;
+	hashSize = 256;
+	hash = (LG3DPresetBlock **)calloc(hashSize, sizeof(LG3DPresetBlock *));
+	numBlocks = 0;
+}
+
+LG3DPresetStore::~LG3DPresetStore()
+{
+	int i;
+	for(i=0;i<numPresets;i++)
+		Clear(i);
+	free(preset);
+	free(hash);
+}
+
+LG3DPresetBlock *LG3DPresetStore::ShareBlock(const LG3DPresetBlock *values)
+{
+	unsigned long h = HashBlock(values);
+	LG3DPresetBlock *block;
+	for(block=hash[h & (hashSize-1)];block;block=block->next) {
+		if (block->hash == h && !memcmp(block->value, values->value, sizeof(block->value))) {
+			block->refCount++;
+			return block;
+		}
+	}
+
+	// keep the chains short, rehash into twice the buckets once there are more blocks than buckets
+	if (numBlocks >= hashSize) {
+		int newHashSize = hashSize*2;
+		LG3DPresetBlock **newHash = (LG3DPresetBlock **)calloc(newHashSize, sizeof(LG3DPresetBlock *));
+		int i;
+		for(i=0;i<hashSize;i++) {
+			while (hash[i]) {
+				LG3DPresetBlock *move = hash[i];
+				hash[i] = move->next;
+				move->next = newHash[move->hash & (newHashSize-1)];
+				newHash[move->hash & (newHashSize-1)] = move;
+			}
+		}
+		free(hash);
+		hash = newHash;
+		hashSize = newHashSize;
+	}
+
+	block = (LG3DPresetBlock *)malloc(sizeof(LG3DPresetBlock));
+	memcpy(block->value, values->value, sizeof(block->value));
+	block->hash = h;
+	block->refCount = 1;
+	block->next = hash[h & (hashSize-1)];
+	hash[h & (hashSize-1)] = block;
+	numBlocks++;
+	return block;
+}
+
+void LG3DPresetStore::ReleaseBlock(LG3DPresetBlock *block)
+{
+	if (--block->refCount > 0)
+		return;
+	LG3DPresetBlock **link = &hash[block->hash & (hashSize-1)];
+	while (*link != block)
+		link = &(*link)->next;
+	*link = block->next;
+	free(block);
+	numBlocks--;
+}
+
+void LG3DPresetStore::Store(int presetIndex, const LG3DControlData *data)
+{
+	int b, a, i;
+	if (presetIndex < 0)
+		return;
+	if (presetIndex >= numPresets) {
+		preset = (LG3DPreset *)realloc(preset, sizeof(LG3DPreset) * (presetIndex+1));
+		memset(&preset[numPresets], 0, sizeof(LG3DPreset) * (presetIndex+1 - numPresets));
+		numPresets = presetIndex+1;
+	}
+
+	unsigned long *live[PRESET_ARRAYS];
+	PresetArrays(&data->lights, live);
+	int numLights = data->lights.count;
+	int numLightBlocks = NumLightBlocks(numLights);
+	LG3DPresetBlock **newBlock = (LG3DPresetBlock **)malloc(sizeof(LG3DPresetBlock *) * (numLightBlocks+1));
+
+	// gather each block of the live values, then share it with any stored block holding the same
+	LG3DPresetBlock values;
+	for(b=0;b<numLightBlocks;b++) {
+		int first = b << PRESET_BLOCK_SHIFT;
+		int num = min(PRESET_BLOCK_SIZE, numLights - first);
+		memset(values.value, 0, sizeof(values.value));
+		for(a=0;a<PRESET_ARRAYS;a++)
+			memcpy(values.value[a], live[a] + first, sizeof(unsigned long) * num);
+		for(i=0;i<num;i++)
+			values.value[PRESET_FLAGS_ARRAY][i] &= PRESET_FLAGS;
+		newBlock[b] = ShareBlock(&values);
+	}
+
+	// the old blocks go after the new ones are in, so any still wanted are kept rather than re-made
+	Clear(presetIndex);
+	preset[presetIndex].numLights = numLights;
+	preset[presetIndex].block = newBlock;
+}
+
+int LG3DPresetStore::Recall(int presetIndex, LG3DControlData *data)
+{
+	int b, a, i, changed = 0;
+	if (!IsStored(presetIndex))
+		return 0;
+	const LG3DPreset *p = &preset[presetIndex];
+
+	unsigned long *live[PRESET_ARRAYS];
+	PresetArrays(&data->lights, live);
+	int numLights = min(p->numLights, data->lights.count);
+
+	for(b=0;b<NumLightBlocks(numLights);b++) {
+		const LG3DPresetBlock *block = p->block[b];
+		int first = b << PRESET_BLOCK_SHIFT;
+		int num = min(PRESET_BLOCK_SIZE, numLights - first);
+
+		// most blocks of a typical recall are unchanged, rule those out with a straight compare
+		bool same = true;
+		for(a=0;(a<PRESET_FLAGS_ARRAY) && same;a++)
+			same = !memcmp(block->value[a], live[a] + first, sizeof(unsigned long) * num);
+		for(i=0;(i<num) && same;i++)
+			same = ((live[PRESET_FLAGS_ARRAY][first+i] & PRESET_FLAGS) == block->value[PRESET_FLAGS_ARRAY][i]);
+		if (same)
+			continue;
+
+		for(i=0;i<num;i++) {
+			int light = first + i;
+			if (!data->LightInUse(light))
+				continue;
+
+			unsigned long fields = 0;
+			for(a=0;a<PRESET_FLAGS_ARRAY;a++) {
+				unsigned long v = block->value[a][i];
+				if (live[a][light] != v) {
+					live[a][light] = v;
+					fields |= presetField[a];
+				}
+			}
+			unsigned long flags = live[PRESET_FLAGS_ARRAY][light];
+			unsigned long diff = (flags & PRESET_FLAGS) ^ block->value[PRESET_FLAGS_ARRAY][i];
+			if (diff) {
+				live[PRESET_FLAGS_ARRAY][light] = flags ^ diff;
+				if (diff & LG3DLightFlag_Enabled)
+					fields |= LG3DDirty_Enabled;
+				if (diff & LG3DLightFlag_CastsShadows)
+					fields |= LG3DDirty_Shadows;
+			}
+
+			if (fields) {
+				data->MarkLightDirty(light, fields);
+				changed++;
+			}
+		}
+	}
+	return changed;
+}
+
+void LG3DPresetStore::Clear(int presetIndex)
+{
+	if (!IsStored(presetIndex))
+		return;
+	LG3DPreset *p = &preset[presetIndex];
+	int b;
+	for(b=0;b<NumLightBlocks(p->numLights);b++)
+		ReleaseBlock(p->block[b]);
+	free(p->block);
+	p->block = NULL;
+	p->numLights = 0;
+}
+
+bool LG3DPresetStore::IsStored(int presetIndex) const
+{
+	return (presetIndex >= 0) && (presetIndex < numPresets) && (preset[presetIndex].block != NULL);
+}
+
+size_t LG3DPresetStore::MemoryUsed() const
+{
+	size_t bytes = sizeof(LG3DPreset) * numPresets + sizeof(LG3DPresetBlock *) * hashSize;
+	bytes += sizeof(LG3DPresetBlock) * numBlocks;
+	int i;
+	for(i=0;i<numPresets;i++) {
+		if (preset[i].block)
+			bytes += sizeof(LG3DPresetBlock *) * (NumLightBlocks(preset[i].numLights)+1);
+	}
+	return bytes;
+}
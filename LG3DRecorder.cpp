@@ -0,0 +1,929 @@
+#include "lg3d.h"
+
+// A recording is a magic & version word, then frames back to back, the first of them holding
+// the whole rig.  Numbers are varints, 7 bits to a byte low bits first, and values (float bits,
+// the time's double bits) are stored XORed with the last value recorded in their place, so an
+// unchanged or barely changed value takes a byte or two.  A frame is
+//
+//	time, elapsed, flags (RECORD_ bits)
+//	[counts]	number of lights, objects & nodes
+//	[camera]	curCamera + 1, position, orientation & fov of that camera
+//	[settings]	ambient & clear color, zigzagged, then RECORD_SETTING_ bits
+//	lights		how many, then for each the index (zigzagged, from the one before), its
+//				LG3DDirtyFieldType bits and the values of those fields.  A slot change
+//				carries whether the slot is in use and the gobo name, and every field.
+//	objects		the same, with the mesh name
+//	nodes		how many, then index & the 6 values of each
+//
+// The first frame lists every light, object & node.
+
+#define RECORD_MAGIC 0x5233474c			// "LG3R"
+#define RECORD_VERSION 2
+
+#define RECORD_COUNTS 1
+#define RECORD_CAMERA 2
+#define RECORD_SETTINGS 4
+
+#define RECORD_SETTING_SHADOWS 1
+#define RECORD_SETTING_EFFECTS 2
+
+#define RECORD_LIGHT_VALUES 16
+#define RECORD_OBJECT_VALUES 7
+#define RECORD_NODE_VALUES 6
+#define RECORD_CAMERA_VALUES 7
+
+// worst cases of a record, less its name
+#define RECORD_MAX_VARINT 5
+#define RECORD_MAX_LIGHT ((3 + RECORD_LIGHT_VALUES) * RECORD_MAX_VARINT)
+#define RECORD_MAX_HEADER (2*10 + (9 + RECORD_CAMERA_VALUES) * RECORD_MAX_VARINT + 7 * RECORD_MAX_VARINT)
+#define RECORD_MAX_NAME 1024
+
+// a file recording is written out once this much has built up
+#define RECORD_FLUSH_BYTES 65536
+
+static const struct {
+	unsigned long	field;
+	int				offset;
+	int				count;
+} lightField[] = {
+	{LG3DDirty_Position, 0, 3},
+	{LG3DDirty_Orientation, 3, 3},
+	{LG3DDirty_Color, 6, 3},
+	{LG3DDirty_Cone, 9, 2},
+	{LG3DDirty_Attenuation, 11, 2},
+	{LG3DDirty_Enabled, 13, 1},
+	{LG3DDirty_Shadows, 14, 1},
+	{LG3DDirty_Node, 15, 1},
+}, objectField[] = {
+	{LG3DDirty_Position, 0, 3},
+	{LG3DDirty_Orientation, 3, 3},
+	{LG3DDirty_Node, 6, 1},
+};
+
+#define NUM_LIGHT_FIELDS (sizeof(lightField) / sizeof(lightField[0]))
+#define NUM_OBJECT_FIELDS (sizeof(objectField) / sizeof(objectField[0]))
+
+static const unsigned long recordLightFields = LG3DDirty_Position | LG3DDirty_Orientation | LG3DDirty_Color |
+	LG3DDirty_Cone | LG3DDirty_Attenuation | LG3DDirty_Enabled | LG3DDirty_Shadows | LG3DDirty_Node | LG3DDirty_Slot;
+static const unsigned long recordObjectFields = LG3DDirty_Position | LG3DDirty_Orientation | LG3DDirty_Node | LG3DDirty_Slot;
+
+// the last recorded values, as bits, kept the same by the recorder & the replay
+struct LG3DRecordState {
+	int				numLights;
+	int				numObjects;
+	int				numNodes;
+	int				maxLights;
+	int				maxObjects;
+	unsigned long	*light;					// RECORD_LIGHT_VALUES per light
+	unsigned long	*object;				// RECORD_OBJECT_VALUES per object
+	unsigned long	*node;					// RECORD_NODE_VALUES per node
+	int				curCamera;
+	unsigned long	camera[RECORD_CAMERA_VALUES];
+	LG3DLightColor	ambient;
+	LG3DLightColor	clearColor;
+	unsigned long	settings;				// RECORD_SETTING_ bits
+	ULONGLONG		time;
+	unsigned long	elapsed;
+};
+
+static LG3DRecordState *NewState()
+{
+	LG3DRecordState *s = (LG3DRecordState *)calloc(1, sizeof(LG3DRecordState));
+	s->curCamera = -1;
+	return s;
+}
+
+static void FreeState(LG3DRecordState *s)
+{
+	if (!s)
+		return;
+	free(s->light);
+	free(s->object);
+	free(s->node);
+	free(s);
+}
+
+// new lights & objects start out as zeros
+static void ResizeState(LG3DRecordState *s, int numLights, int numObjects, int numNodes)
+{
+	if (numLights > s->maxLights) {
+		int n = max(numLights, s->maxLights*2);
+		s->light = (unsigned long *)realloc(s->light, sizeof(unsigned long) * RECORD_LIGHT_VALUES * n);
+		s->maxLights = n;
+	}
+	if (numLights > s->numLights)
+		memset(&s->light[s->numLights * RECORD_LIGHT_VALUES], 0, sizeof(unsigned long) * RECORD_LIGHT_VALUES * (numLights - s->numLights));
+	s->numLights = numLights;
+	if (numObjects > s->maxObjects) {
+		int n = max(numObjects, s->maxObjects*2);
+		s->object = (unsigned long *)realloc(s->object, sizeof(unsigned long) * RECORD_OBJECT_VALUES * n);
+		s->maxObjects = n;
+	}
+	if (numObjects > s->numObjects)
+		memset(&s->object[s->numObjects * RECORD_OBJECT_VALUES], 0, sizeof(unsigned long) * RECORD_OBJECT_VALUES * (numObjects - s->numObjects));
+	s->numObjects = numObjects;
+	if (numNodes != s->numNodes) {
+		s->node = (unsigned long *)realloc(s->node, sizeof(unsigned long) * RECORD_NODE_VALUES * (numNodes+1));
+		memset(s->node, 0, sizeof(unsigned long) * RECORD_NODE_VALUES * numNodes);
+		s->numNodes = numNodes;
+	}
+}
+
+static unsigned long Bits(float f)
+{
+	unsigned long b;
+	memcpy(&b, &f, sizeof(b));
+	return b;
+}
+
+static float Float(unsigned long b)
+{
+	float f;
+	memcpy(&f, &b, sizeof(f));
+	return f;
+}
+
+static unsigned long ZigZag(int v)
+{
+	return ((unsigned long)v << 1) ^ (unsigned long)(v >> 31);
+}
+
+static int UnZigZag(unsigned long v)
+{
+	return (int)(v >> 1) ^ -(int)(v & 1);
+}
+
+// ---------------------------------------------------------
+// writing
+// ---------------------------------------------------------
+
+static unsigned char *PutVarint(unsigned char *p, unsigned long v)
+{
+	while (v >= 0x80) {
+		*p++ = (unsigned char)(v | 0x80);
+		v >>= 7;
+	}
+	*p++ = (unsigned char)v;
+	return p;
+}
+
+static unsigned char *PutVarint64(unsigned char *p, ULONGLONG v)
+{
+	while (v >= 0x80) {
+		*p++ = (unsigned char)(v | 0x80);
+		v >>= 7;
+	}
+	*p++ = (unsigned char)v;
+	return p;
+}
+
+static unsigned char *PutValues(unsigned char *p, unsigned long *last, const unsigned long *v, int n)
+{
+	int k;
+	for(k=0;k<n;k++) {
+		p = PutVarint(p, v[k] ^ last[k]);
+		last[k] = v[k];
+	}
+	return p;
+}
+
+static unsigned char *PutName(unsigned char *p, LG3DNameId id)
+{
+	const WCHAR *name = LG3DNameString(id);
+	int k, len = min((int)wcslen(name), RECORD_MAX_NAME);
+	p = PutVarint(p, len);
+	for(k=0;k<len;k++)
+		p = PutVarint(p, name[k]);
+	return p;
+}
+
+static void GatherLight(const LG3DLightTable *t, int i, unsigned long *v)
+{
+	v[0] = Bits(t->posX[i]);
+	v[1] = Bits(t->posY[i]);
+	v[2] = Bits(t->posZ[i]);
+	v[3] = Bits(t->head[i]);
+	v[4] = Bits(t->pitch[i]);
+	v[5] = Bits(t->roll[i]);
+	v[6] = Bits(t->colorR[i]);
+	v[7] = Bits(t->colorG[i]);
+	v[8] = Bits(t->colorB[i]);
+	v[9] = Bits(t->umbra[i]);
+	v[10] = Bits(t->penumbra[i]);
+	v[11] = Bits(t->att1[i]);
+	v[12] = Bits(t->att2[i]);
+	v[13] = (t->flags[i] & LG3DLightFlag_Enabled) ? 1 : 0;
+	v[14] = (t->flags[i] & LG3DLightFlag_CastsShadows) ? 1 : 0;
+	v[15] = (unsigned long)t->parentNode[i];
+}
+
+static void GatherObject(const LG3DSceneObject *obj, unsigned long *v)
+{
+	v[0] = Bits(obj->position.x);
+	v[1] = Bits(obj->position.y);
+	v[2] = Bits(obj->position.z);
+	v[3] = Bits(obj->orientation.h);
+	v[4] = Bits(obj->orientation.p);
+	v[5] = Bits(obj->orientation.r);
+	v[6] = (unsigned long)obj->parentNode;
+}
+
+static void GatherNode(const LG3DSceneNode *node, unsigned long *v)
+{
+	v[0] = Bits(node->position.x);
+	v[1] = Bits(node->position.y);
+	v[2] = Bits(node->position.z);
+	v[3] = Bits(node->orientation.h);
+	v[4] = Bits(node->orientation.p);
+	v[5] = Bits(node->orientation.r);
+}
+
+static void GatherCamera(const LG3DControlData *data, unsigned long *v)
+{
+	memset(v, 0, sizeof(unsigned long) * RECORD_CAMERA_VALUES);
+	if ((data->curCamera < 0) || (data->curCamera >= data->numCameras))
+		return;
+	const LG3DCameraObject *camera = &data->cameraList[data->curCamera];
+	v[0] = Bits(camera->position.x);
+	v[1] = Bits(camera->position.y);
+	v[2] = Bits(camera->position.z);
+	v[3] = Bits(camera->orientation.h);
+	v[4] = Bits(camera->orientation.p);
+	v[5] = Bits(camera->orientation.r);
+	v[6] = Bits(camera->fov);
+}
+
+static unsigned char *PutLight(unsigned char *p, LG3DRecordState *s, const LG3DControlData *data, int i, unsigned long fields, int *prev)
+{
+	unsigned long v[RECORD_LIGHT_VALUES];
+	unsigned int f;
+	fields &= recordLightFields;
+	if (fields & LG3DDirty_Slot)
+		fields = recordLightFields;
+	p = PutVarint(p, ZigZag(i - *prev));
+	p = PutVarint(p, fields);
+	*prev = i;
+	if (fields & LG3DDirty_Slot) {
+		bool inUse = data->LightInUse(i);
+		p = PutVarint(p, inUse ? 1 : 0);
+		p = PutName(p, data->lights.cold[i].goboName);
+	}
+	GatherLight(&data->lights, i, v);
+	unsigned long *last = &s->light[i * RECORD_LIGHT_VALUES];
+	for(f=0;f<NUM_LIGHT_FIELDS;f++)
+		if (fields & lightField[f].field)
+			p = PutValues(p, &last[lightField[f].offset], &v[lightField[f].offset], lightField[f].count);
+	return p;
+}
+
+static unsigned char *PutObject(unsigned char *p, LG3DRecordState *s, const LG3DControlData *data, int i, unsigned long fields, int *prev)
+{
+	unsigned long v[RECORD_OBJECT_VALUES];
+	unsigned int f;
+	fields &= recordObjectFields;
+	if (fields & LG3DDirty_Slot)
+		fields = recordObjectFields;
+	p = PutVarint(p, ZigZag(i - *prev));
+	p = PutVarint(p, fields);
+	*prev = i;
+	const LG3DSceneObject *obj = &data->sceneObjectList[i];
+	if (fields & LG3DDirty_Slot) {
+		bool inUse = data->ObjectInUse(i);
+		p = PutVarint(p, inUse ? 1 : 0);
+		p = PutName(p, obj->meshName);
+	}
+	GatherObject(obj, v);
+	unsigned long *last = &s->object[i * RECORD_OBJECT_VALUES];
+	for(f=0;f<NUM_OBJECT_FIELDS;f++)
+		if (fields & objectField[f].field)
+			p = PutValues(p, &last[objectField[f].offset], &v[objectField[f].offset], objectField[f].count);
+	return p;
+}
+
+static unsigned char *PutNode(unsigned char *p, LG3DRecordState *s, const LG3DControlData *data, int i, int *prev)
+{
+	unsigned long v[RECORD_NODE_VALUES];
+	p = PutVarint(p, ZigZag(i - *prev));
+	*prev = i;
+	GatherNode(&data->sceneNodeList[i], v);
+	return PutValues(p, &s->node[i * RECORD_NODE_VALUES], v, RECORD_NODE_VALUES);
+}
+
+static int NameLength(LG3DNameId id)
+{
+	return min((int)wcslen(LG3DNameString(id)), RECORD_MAX_NAME);
+}
+
+LG3DRecorder::LG3DRecorder()
+{
+	log = NULL;
+	logSize = 0;
+	logCapacity = 0;
+	file = INVALID_HANDLE_VALUE;
+	flushed = 0;
+	recording = false;
+	failed = false;
+	numFrames = 0;
+	state = NULL;
+}
+
+LG3DRecorder::~LG3DRecorder()
+{
+	Stop();
+	free(log);
+	FreeState(state);
+}
+
+unsigned char *LG3DRecorder::Reserve(int bytes)
+{
+	if (logSize + bytes > logCapacity) {
+		logCapacity = max(logSize + bytes, logCapacity*2);
+		log = (unsigned char *)realloc(log, logCapacity);
+	}
+	return log + logSize;
+}
+
+// a file that can't be written (a full disk) ends the recording, what made it out is kept
+void LG3DRecorder::Flush()
+{
+	if ((file == INVALID_HANDLE_VALUE) || (logSize == 0))
+		return;
+	DWORD written = 0;
+	BOOL ok = WriteFile(file, log, logSize, &written, NULL);
+	flushed += written;
+	if (!ok || (written != (DWORD)logSize)) {
+		failed = true;
+		recording = false;
+		CloseHandle(file);
+		file = INVALID_HANDLE_VALUE;
+	}
+	logSize = 0;
+}
+
+bool LG3DRecorder::Start(const LG3DControlData *data, const WCHAR *path)
+{
+	int i;
+	Stop();
+	logSize = 0;
+	flushed = 0;
+	numFrames = 0;
+	if (path) {
+		file = CreateFile(path, GENERIC_WRITE, 0, NULL, CREATE_ALWAYS, FILE_ATTRIBUTE_NORMAL, NULL);
+		if (file == INVALID_HANDLE_VALUE)
+			return false;
+	}
+	FreeState(state);
+	state = NewState();
+
+	unsigned char *p = Reserve(8);
+	unsigned long magic[2] = {RECORD_MAGIC, RECORD_VERSION};
+	memcpy(p, magic, sizeof(magic));
+	logSize += sizeof(magic);
+
+	// the whole rig, as a frame at time 0 that changed everything
+	ResizeState(state, data->lights.count, data->numSceneObjects, data->numSceneNodes);
+	p = Reserve(RECORD_MAX_HEADER);
+	p = PutVarint64(p, 0);
+	p = PutVarint(p, 0);
+	p = PutVarint(p, RECORD_COUNTS | RECORD_CAMERA | RECORD_SETTINGS);
+	logSize = (int)(p - log);
+	recording = true;
+	RecordHeader(data, RECORD_COUNTS | RECORD_CAMERA | RECORD_SETTINGS);
+
+	int prev = 0;
+	p = Reserve(RECORD_MAX_VARINT);
+	p = PutVarint(p, data->lights.count);
+	logSize = (int)(p - log);
+	for(i=0;i<data->lights.count;i++) {
+		p = Reserve(RECORD_MAX_LIGHT + RECORD_MAX_VARINT * (1 + NameLength(data->lights.cold[i].goboName)));
+		p = PutLight(p, state, data, i, LG3DDirty_Slot, &prev);
+		logSize = (int)(p - log);
+	}
+	prev = 0;
+	p = Reserve(RECORD_MAX_VARINT);
+	p = PutVarint(p, data->numSceneObjects);
+	logSize = (int)(p - log);
+	for(i=0;i<data->numSceneObjects;i++) {
+		p = Reserve(RECORD_MAX_LIGHT + RECORD_MAX_VARINT * (1 + NameLength(data->sceneObjectList[i].meshName)));
+		p = PutObject(p, state, data, i, LG3DDirty_Slot, &prev);
+		logSize = (int)(p - log);
+	}
+	prev = 0;
+	p = Reserve(RECORD_MAX_VARINT * (1 + data->numSceneNodes * (1 + RECORD_NODE_VALUES)));
+	p = PutVarint(p, data->numSceneNodes);
+	for(i=0;i<data->numSceneNodes;i++)
+		p = PutNode(p, state, data, i, &prev);
+	logSize = (int)(p - log);
+	Flush();
+	return !failed;
+}
+
+void LG3DRecorder::Stop()
+{
+	failed = false;
+	if (!recording)
+		return;
+	recording = false;
+	Flush();
+	if (file != INVALID_HANDLE_VALUE) {
+		CloseHandle(file);
+		file = INVALID_HANDLE_VALUE;
+	}
+}
+
+// the counts, camera & settings parts of a frame, those of 'flags'
+void LG3DRecorder::RecordHeader(const LG3DControlData *data, unsigned long flags)
+{
+	int k;
+	unsigned char *p = Reserve(RECORD_MAX_HEADER);
+	if (flags & RECORD_COUNTS) {
+		p = PutVarint(p, data->lights.count);
+		p = PutVarint(p, data->numSceneObjects);
+		p = PutVarint(p, data->numSceneNodes);
+	}
+	if (flags & RECORD_CAMERA) {
+		unsigned long v[RECORD_CAMERA_VALUES];
+		GatherCamera(data, v);
+		state->curCamera = data->curCamera;
+		p = PutVarint(p, data->curCamera + 1);
+		p = PutValues(p, state->camera, v, RECORD_CAMERA_VALUES);
+	}
+	if (flags & RECORD_SETTINGS) {
+		const int *color[2] = {&data->ambient.r, &data->clearColor.r};
+		for(k=0;k<6;k++)
+			p = PutVarint(p, ZigZag(color[k/3][k%3]));
+		p = PutVarint(p, (data->wantShadows ? RECORD_SETTING_SHADOWS : 0) | (data->wantEffects ? RECORD_SETTING_EFFECTS : 0));
+		state->ambient = data->ambient;
+		state->clearColor = data->clearColor;
+		state->settings = (data->wantShadows ? RECORD_SETTING_SHADOWS : 0) | (data->wantEffects ? RECORD_SETTING_EFFECTS : 0);
+	}
+	logSize = (int)(p - log);
+}
+
+void LG3DRecorder::RecordFrame(const LG3DControlData *data, double time, float elapsed)
+{
+	int i, n;
+	if (!recording || !data->dirtyLightList)
+		return;
+
+	// what changed beyond the lights, objects & nodes is found by comparing
+	unsigned long flags = 0;
+	if ((data->lights.count != state->numLights) || (data->numSceneObjects != state->numObjects) || (data->numSceneNodes != state->numNodes))
+		flags |= RECORD_COUNTS;
+	unsigned long camera[RECORD_CAMERA_VALUES];
+	GatherCamera(data, camera);
+	if ((data->curCamera != state->curCamera) || memcmp(camera, state->camera, sizeof(camera)))
+		flags |= RECORD_CAMERA;
+	unsigned long settings = (data->wantShadows ? RECORD_SETTING_SHADOWS : 0) | (data->wantEffects ? RECORD_SETTING_EFFECTS : 0);
+	if (memcmp(&data->ambient, &state->ambient, sizeof(LG3DLightColor)) ||
+		memcmp(&data->clearColor, &state->clearColor, sizeof(LG3DLightColor)) || (settings != state->settings))
+		flags |= RECORD_SETTINGS;
+
+	ULONGLONG timeBits;
+	memcpy(&timeBits, &time, sizeof(timeBits));
+	unsigned long elapsedBits = Bits(elapsed);
+	unsigned char *p = Reserve(RECORD_MAX_HEADER);
+	p = PutVarint64(p, timeBits ^ state->time);
+	p = PutVarint(p, elapsedBits ^ state->elapsed);
+	p = PutVarint(p, flags);
+	logSize = (int)(p - log);
+	state->time = timeBits;
+	state->elapsed = elapsedBits;
+	if (flags & RECORD_COUNTS)
+		ResizeState(state, data->lights.count, data->numSceneObjects, data->numSceneNodes);
+	RecordHeader(data, flags);
+
+	// the lights & objects on the dirty lists
+	int prev = 0;
+	const LG3DLightTable *lights = &data->lights;
+	p = Reserve(RECORD_MAX_VARINT);
+	p = PutVarint(p, data->numDirtyLights);
+	logSize = (int)(p - log);
+	for(n=0;n<data->numDirtyLights;n++) {
+		i = data->dirtyLightList[n];
+		unsigned long dirty = lights->dirty[i];
+		int name = (dirty & LG3DDirty_Slot) ? 1 + NameLength(lights->cold[i].goboName) : 0;
+		p = Reserve(RECORD_MAX_LIGHT + RECORD_MAX_VARINT * name);
+		p = PutLight(p, state, data, i, dirty, &prev);
+		logSize = (int)(p - log);
+	}
+	prev = 0;
+	p = Reserve(RECORD_MAX_VARINT);
+	p = PutVarint(p, data->numDirtyObjects);
+	logSize = (int)(p - log);
+	for(n=0;n<data->numDirtyObjects;n++) {
+		i = data->dirtyObjectList[n];
+		unsigned long dirty = data->objectDirty[i];
+		int name = (dirty & LG3DDirty_Slot) ? 1 + NameLength(data->sceneObjectList[i].meshName) : 0;
+		p = Reserve(RECORD_MAX_LIGHT + RECORD_MAX_VARINT * name);
+		p = PutObject(p, state, data, i, dirty, &prev);
+		logSize = (int)(p - log);
+	}
+
+	// nodes have no list, only a first dirty one
+	int numNodes = 0;
+	if (data->nodeDirty)
+		for(i=data->firstDirtyNode;i<data->numSceneNodes;i++)
+			numNodes += (data->nodeDirty[i] != 0);
+	prev = 0;
+	p = Reserve(RECORD_MAX_VARINT * (1 + numNodes * (1 + RECORD_NODE_VALUES)));
+	p = PutVarint(p, numNodes);
+	for(i=data->firstDirtyNode;(i<data->numSceneNodes) && numNodes;i++)
+		if (data->nodeDirty[i])
+			p = PutNode(p, state, data, i, &prev);
+	logSize = (int)(p - log);
+
+	numFrames++;
+	if (logSize >= RECORD_FLUSH_BYTES)
+		Flush();
+}
+
+bool LG3DRecorder::Save(const WCHAR *path) const
+{
+	if ((file != INVALID_HANDLE_VALUE) || (logSize == 0))
+		return false;
+	HANDLE out = CreateFile(path, GENERIC_WRITE, 0, NULL, CREATE_ALWAYS, FILE_ATTRIBUTE_NORMAL, NULL);
+	if (out == INVALID_HANDLE_VALUE)
+		return false;
+	DWORD written = 0;
+	BOOL ok = WriteFile(out, log, logSize, &written, NULL);
+	CloseHandle(out);
+	return ok && (written == (DWORD)logSize);
+}
+
+// ---------------------------------------------------------
+// playing back
+// ---------------------------------------------------------
+
+// reads past the end give zeros and mark the recording bad
+struct LG3DRecordReader {
+	const unsigned char	*p;
+	const unsigned char	*end;
+	bool				bad;
+};
+
+static ULONGLONG GetVarint64(LG3DRecordReader *r)
+{
+	ULONGLONG v = 0;
+	int shift;
+	for(shift=0;shift<64;shift+=7) {
+		if (r->p >= r->end) {
+			r->bad = true;
+			return 0;
+		}
+		unsigned char b = *r->p++;
+		v |= (ULONGLONG)(b & 0x7f) << shift;
+		if (!(b & 0x80))
+			return v;
+	}
+	r->bad = true;
+	return 0;
+}
+
+static unsigned long GetVarint(LG3DRecordReader *r)
+{
+	return (unsigned long)GetVarint64(r);
+}
+
+static void GetValues(LG3DRecordReader *r, unsigned long *last, int n)
+{
+	int k;
+	for(k=0;k<n;k++)
+		last[k] ^= GetVarint(r);
+}
+
+static LG3DNameId GetName(LG3DRecordReader *r)
+{
+	WCHAR name[RECORD_MAX_NAME+1];
+	unsigned long k, len = GetVarint(r);
+	if (len > RECORD_MAX_NAME) {
+		r->bad = true;
+		return 0;
+	}
+	for(k=0;k<len;k++)
+		name[k] = (WCHAR)GetVarint(r);
+	name[len] = 0;
+	return r->bad ? 0 : LG3DInternName(name);
+}
+
+// write the values straight into the table, past the pins
+static void ScatterLight(LG3DControlData *data, int i, unsigned long fields, const unsigned long *v)
+{
+	LG3DLightTable *t = &data->lights;
+	if (fields & LG3DDirty_Position) {
+		t->posX[i] = Float(v[0]);
+		t->posY[i] = Float(v[1]);
+		t->posZ[i] = Float(v[2]);
+	}
+	if (fields & LG3DDirty_Orientation) {
+		t->head[i] = Float(v[3]);
+		t->pitch[i] = Float(v[4]);
+		t->roll[i] = Float(v[5]);
+	}
+	if (fields & LG3DDirty_Color) {
+		t->colorR[i] = Float(v[6]);
+		t->colorG[i] = Float(v[7]);
+		t->colorB[i] = Float(v[8]);
+	}
+	if (fields & LG3DDirty_Cone) {
+		t->SetCone(i, Float(v[9]), Float(v[10]));
+	}
+	if (fields & LG3DDirty_Attenuation) {
+		t->att1[i] = Float(v[11]);
+		t->att2[i] = Float(v[12]);
+	}
+	if (fields & LG3DDirty_Enabled)
+		t->flags[i] = v[13] ? (t->flags[i] | LG3DLightFlag_Enabled) : (t->flags[i] & ~LG3DLightFlag_Enabled);
+	if (fields & LG3DDirty_Shadows)
+		t->flags[i] = v[14] ? (t->flags[i] | LG3DLightFlag_CastsShadows) : (t->flags[i] & ~LG3DLightFlag_CastsShadows);
+	if (fields & LG3DDirty_Node) {
+		t->parentNode[i] = (int)v[15];
+		fields |= LG3DDirty_Transform;
+	}
+	data->MarkLightDirty(i, fields);
+}
+
+static void ScatterObject(LG3DControlData *data, int i, unsigned long fields, const unsigned long *v)
+{
+	LG3DSceneObject *obj = &data->sceneObjectList[i];
+	if (fields & LG3DDirty_Position) {
+		obj->position.x = Float(v[0]);
+		obj->position.y = Float(v[1]);
+		obj->position.z = Float(v[2]);
+	}
+	if (fields & LG3DDirty_Orientation) {
+		obj->orientation.h = Float(v[3]);
+		obj->orientation.p = Float(v[4]);
+		obj->orientation.r = Float(v[5]);
+	}
+	if (fields & LG3DDirty_Node) {
+		obj->parentNode = (int)v[6];
+		fields |= LG3DDirty_Transform;
+	}
+	data->MarkObjectDirty(i, fields);
+}
+
+// a slot added, removed or replaced while recording, the values then go on as any others.
+// False when the rig hands out another slot than the recording did - it is not this show's.
+static bool ReplayLightSlot(LG3DControlData *data, int i, bool inUse, LG3DNameId gobo)
+{
+	bool live = data->LightInUse(i);
+	if (inUse && !live) {
+		LG3DSceneLight light;
+		light.goboName = gobo;
+		if (data->LightIndex(data->AddLight(&light)) != i)
+			return false;
+	} else if (!inUse && live)
+		data->RemoveLight(data->LightHandle(i));
+	else if (inUse) {
+		data->lights.cold[i].goboName = gobo;
+		if (gobo)
+			data->lights.flags[i] |= LG3DLightFlag_HasGobo;
+		else
+			data->lights.flags[i] &= ~LG3DLightFlag_HasGobo;
+		data->MarkLightDirty(i, LG3DDirty_Slot);
+	}
+	return true;
+}
+
+static bool ReplayObjectSlot(LG3DControlData *data, int i, bool inUse, LG3DNameId mesh)
+{
+	bool live = data->ObjectInUse(i);
+	if (inUse && !live) {
+		LG3DSceneObject object;
+		object.meshName = mesh;
+		if (data->ObjectIndex(data->AddObject(&object)) != i)
+			return false;
+	} else if (!inUse && live)
+		data->RemoveObject(data->ObjectHandle(i));
+	else if (inUse) {
+		data->sceneObjectList[i].meshName = mesh;
+		data->MarkObjectDirty(i, LG3DDirty_Slot);
+	}
+	return true;
+}
+
+// one frame, from r, into data.  The first one is checked against the rig before any of it is applied.
+static bool ReadFrame(LG3DRecordReader *r, LG3DRecordState *s, LG3DControlData *data, bool first, double *time, float *elapsed)
+{
+	int i, k, n, num;
+	s->time ^= GetVarint64(r);
+	s->elapsed ^= GetVarint(r);
+	if (time)
+		memcpy(time, &s->time, sizeof(double));
+	if (elapsed)
+		*elapsed = Float(s->elapsed);
+	unsigned long flags = GetVarint(r);
+
+	if (flags & RECORD_COUNTS) {
+		int numLights = (int)GetVarint(r);
+		int numObjects = (int)GetVarint(r);
+		int numNodes = (int)GetVarint(r);
+		if (first && ((numLights != data->lights.count) || (numObjects != data->numSceneObjects) || (numNodes != data->numSceneNodes)))
+			return false;
+		if ((numLights < 0) || (numObjects < 0) || (numNodes < 0) || (numLights > (1 << LG3D_HANDLE_SLOT_BITS)) ||
+			(numObjects > (1 << LG3D_HANDLE_SLOT_BITS)) || (numNodes > (1 << LG3D_HANDLE_SLOT_BITS))) {
+			r->bad = true;
+			return false;
+		}
+		ResizeState(s, max(numLights, s->numLights), max(numObjects, s->numObjects), numNodes);
+	}
+	if (flags & RECORD_CAMERA) {
+		s->curCamera = (int)GetVarint(r) - 1;
+		GetValues(r, s->camera, RECORD_CAMERA_VALUES);
+		if ((s->curCamera >= 0) && (s->curCamera < data->numCameras)) {
+			data->curCamera = s->curCamera;
+			LG3DCameraObject *camera = &data->cameraList[s->curCamera];
+			camera->position.x = Float(s->camera[0]);
+			camera->position.y = Float(s->camera[1]);
+			camera->position.z = Float(s->camera[2]);
+			camera->orientation.h = Float(s->camera[3]);
+			camera->orientation.p = Float(s->camera[4]);
+			camera->orientation.r = Float(s->camera[5]);
+			camera->fov = Float(s->camera[6]);
+		}
+	}
+	if (flags & RECORD_SETTINGS) {
+		int *color[2] = {&data->ambient.r, &data->clearColor.r};
+		for(k=0;k<6;k++)
+			color[k/3][k%3] = UnZigZag(GetVarint(r));
+		unsigned long settings = GetVarint(r);
+		data->wantShadows = (settings & RECORD_SETTING_SHADOWS) != 0;
+		data->wantEffects = (settings & RECORD_SETTING_EFFECTS) != 0;
+		data->generation++;
+	}
+
+	int prev = 0;
+	num = (int)GetVarint(r);
+	for(n=0;(n<num) && !r->bad;n++) {
+		i = prev + UnZigZag(GetVarint(r));
+		unsigned long fields = GetVarint(r);
+		prev = i;
+		if ((i < 0) || (i >= s->numLights)) {
+			r->bad = true;
+			break;
+		}
+		if (fields & LG3DDirty_Slot) {
+			bool inUse = GetVarint(r) != 0;
+			LG3DNameId gobo = GetName(r);
+			if (!first && !ReplayLightSlot(data, i, inUse, gobo)) {
+				r->bad = true;
+				break;
+			}
+		}
+		unsigned long *v = &s->light[i * RECORD_LIGHT_VALUES];
+		for(k=0;k<(int)NUM_LIGHT_FIELDS;k++)
+			if (fields & lightField[k].field)
+				GetValues(r, &v[lightField[k].offset], lightField[k].count);
+		if (i < data->lights.count)
+			ScatterLight(data, i, fields & ~LG3DDirty_Slot, v);
+	}
+
+	prev = 0;
+	num = (int)GetVarint(r);
+	for(n=0;(n<num) && !r->bad;n++) {
+		i = prev + UnZigZag(GetVarint(r));
+		unsigned long fields = GetVarint(r);
+		prev = i;
+		if ((i < 0) || (i >= s->numObjects)) {
+			r->bad = true;
+			break;
+		}
+		if (fields & LG3DDirty_Slot) {
+			bool inUse = GetVarint(r) != 0;
+			LG3DNameId mesh = GetName(r);
+			if (!first && !ReplayObjectSlot(data, i, inUse, mesh)) {
+				r->bad = true;
+				break;
+			}
+		}
+		unsigned long *v = &s->object[i * RECORD_OBJECT_VALUES];
+		for(k=0;k<(int)NUM_OBJECT_FIELDS;k++)
+			if (fields & objectField[k].field)
+				GetValues(r, &v[objectField[k].offset], objectField[k].count);
+		if (i < data->numSceneObjects)
+			ScatterObject(data, i, fields & ~LG3DDirty_Slot, v);
+	}
+
+	prev = 0;
+	num = (int)GetVarint(r);
+	for(n=0;(n<num) && !r->bad;n++) {
+		i = prev + UnZigZag(GetVarint(r));
+		prev = i;
+		if ((i < 0) || (i >= s->numNodes)) {
+			r->bad = true;
+			break;
+		}
+		unsigned long *v = &s->node[i * RECORD_NODE_VALUES];
+		GetValues(r, v, RECORD_NODE_VALUES);
+		if (i >= data->numSceneNodes)
+			continue;
+		LG3DSceneNode *node = &data->sceneNodeList[i];
+		node->position.x = Float(v[0]);
+		node->position.y = Float(v[1]);
+		node->position.z = Float(v[2]);
+		node->orientation.h = Float(v[3]);
+		node->orientation.p = Float(v[4]);
+		node->orientation.r = Float(v[5]);
+		data->MarkNodeDirty(i, LG3DDirty_Transform);
+	}
+	return !r->bad;
+}
+
+LG3DReplay::LG3DReplay()
+{
+	log = NULL;
+	logSize = 0;
+	pos = 0;
+	start = 0;
+	playing = false;
+	framesPlayed = 0;
+	firstTime = 0.0;
+	nextTime = 0.0;
+	state = NULL;
+}
+
+LG3DReplay::~LG3DReplay()
+{
+	free(log);
+	FreeState(state);
+}
+
+bool LG3DReplay::Load(const WCHAR *path)
+{
+	playing = false;
+	HANDLE in = CreateFile(path, GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+	if (in == INVALID_HANDLE_VALUE)
+		return false;
+	DWORD size = GetFileSize(in, NULL);
+	DWORD got = 0;
+	bool ok = (size != 0xffffffff) && (size >= 8);
+	if (ok) {
+		log = (unsigned char *)realloc(log, size);
+		ok = ReadFile(in, log, size, &got, NULL) && (got == size);
+	}
+	CloseHandle(in);
+	logSize = ok ? (int)size : 0;
+	return ok;
+}
+
+bool LG3DReplay::LoadRecording(const LG3DRecorder *recorder)
+{
+	playing = false;
+	if ((recorder->file != INVALID_HANDLE_VALUE) || (recorder->flushed > 0) || (recorder->logSize < 8))
+		return false;
+	log = (unsigned char *)realloc(log, recorder->logSize);
+	memcpy(log, recorder->log, recorder->logSize);
+	logSize = recorder->logSize;
+	return true;
+}
+
+bool LG3DReplay::Start(LG3DControlData *data)
+{
+	playing = false;
+	framesPlayed = 0;
+	unsigned long magic[2];
+	if (logSize < (int)sizeof(magic))
+		return false;
+	memcpy(magic, log, sizeof(magic));
+	if ((magic[0] != RECORD_MAGIC) || (magic[1] != RECORD_VERSION))
+		return false;
+
+	FreeState(state);
+	state = NewState();
+	ResizeState(state, 0, 0, data->numSceneNodes);
+	LG3DRecordReader r = {log + sizeof(magic), log + logSize, false};
+	if (!ReadFrame(&r, state, data, true, NULL, NULL))
+		return false;
+	pos = (int)(r.p - log);
+	start = pos;
+	playing = true;
+	PeekTime();
+	firstTime = nextTime;
+	return true;
+}
+
+// the time of the frame at pos, the first thing in it
+void LG3DReplay::PeekTime()
+{
+	if (pos >= logSize)
+		return;
+	LG3DRecordReader r = {log + pos, log + logSize, false};
+	ULONGLONG bits = state->time ^ GetVarint64(&r);
+	memcpy(&nextTime, &bits, sizeof(nextTime));
+}
+
+bool LG3DReplay::NextFrame(LG3DControlData *data, double *time, float *elapsed)
+{
+	if (AtEnd())
+		return false;
+	LG3DRecordReader r = {log + pos, log + logSize, false};
+	if (!ReadFrame(&r, state, data, false, time, elapsed)) {
+		playing = false; // a recording cut short, or not this show's
+		return false;
+	}
+	pos = (int)(r.p - log);
+	framesPlayed++;
+	PeekTime();
+	return true;
+}
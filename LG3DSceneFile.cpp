@@ -0,0 +1,944 @@
+#include <stdio.h>
+#include <stddef.h>
+
+#include "lg3d.h"
+
+// ---------------------------------------------------------
+// binary form
+// ---------------------------------------------------------
+//
+// A header, then each section 8 byte aligned.  The record sections are the structs exactly
+// as LG3DControlData holds them, except that name fields hold a string number + 1 (0 is still
+// the empty name), the arrays' override pointers are NULL and their first light & object -1.
+// The strings are back to back, each 0 terminated.  The name fixups are the file offsets of
+// every name field that isn't empty, so Open only touches the records that have names.
+
+#define SCENE_FILE_MAGIC 0x5333474c			// "LG3S"
+#define SCENE_FILE_VERSION 1
+#define SCENE_FILE_ALIGN 8
+
+enum {
+	SECTION_NODES,
+	SECTION_OBJECTS,
+	SECTION_LIGHTS,
+	SECTION_CAMERAS,
+	SECTION_LIGHT_ARRAYS,
+	SECTION_LIGHT_OVERRIDES,
+	SECTION_OBJECT_ARRAYS,
+	SECTION_OBJECT_OVERRIDES,
+	SECTION_STRINGS,						// count is the number of strings
+	SECTION_NAME_FIXUPS,
+	NUM_SECTIONS,
+};
+
+#define NUM_RECORD_SECTIONS SECTION_STRINGS
+
+static const unsigned long recordSize[NUM_SECTIONS] = {
+	sizeof(LG3DSceneNode),
+	sizeof(LG3DSceneObject),
+	sizeof(LG3DSceneLight),
+	sizeof(LG3DCameraObject),
+	sizeof(LG3DLightArray),
+	sizeof(LG3DLightArrayOverride),
+	sizeof(LG3DObjectArray),
+	sizeof(LG3DObjectArrayOverride),
+	sizeof(WCHAR),
+	sizeof(unsigned long),
+};
+
+#define SCENE_FLAG_SHADOWS 1
+#define SCENE_FLAG_EFFECTS 2
+
+struct LG3DSceneFileSection {
+	unsigned long	offset;
+	unsigned long	size;					// bytes
+	unsigned long	count;
+};
+
+struct LG3DSceneFileHeader {
+	unsigned long	magic;
+	unsigned long	version;
+	unsigned long	fileSize;
+	unsigned long	recordSize[NUM_SECTIONS];	// as the writing build laid them out
+	LG3DSceneFileSection section[NUM_SECTIONS];
+	LG3DLightColor	ambient;
+	LG3DLightColor	clearColor;
+	int				curCamera;
+	unsigned long	flags;					// SCENE_FLAG_ bits
+};
+
+static unsigned long Align(unsigned long offset)
+{
+	return (offset + SCENE_FILE_ALIGN-1) & ~(SCENE_FILE_ALIGN-1);
+}
+
+// the file being put together, and the string numbers given to the names met so far
+struct LG3DSceneWriter {
+	unsigned char	*buf;
+	unsigned long	size;
+	unsigned long	capacity;
+	unsigned long	*number;				// indexed by LG3DNameId, 0 if not written yet
+	unsigned long	maxIds;
+	unsigned long	numStrings;
+	WCHAR			*strings;
+	unsigned long	stringsSize;			// in WCHARs
+	unsigned long	stringsCapacity;
+	unsigned long	*fixup;
+	unsigned long	numFixups;
+	unsigned long	maxFixups;
+};
+
+static void Reserve(void **p, unsigned long *capacity, unsigned long needed, unsigned long elementSize)
+{
+	if (needed <= *capacity)
+		return;
+	*capacity = max(needed, *capacity * 2);
+	*p = realloc(*p, elementSize * *capacity);
+}
+
+// the name field at 'offset' in the file, written as its string number
+static void WriteName(LG3DSceneWriter *w, unsigned long offset)
+{
+	LG3DNameId *field = (LG3DNameId *)(w->buf + offset);
+	LG3DNameId id = *field;
+	if (id == 0)
+		return;
+	if (id >= w->maxIds) {
+		unsigned long oldMax = w->maxIds;
+		Reserve((void **)&w->number, &w->maxIds, id+1, sizeof(unsigned long));
+		memset(&w->number[oldMax], 0, sizeof(unsigned long) * (w->maxIds - oldMax));
+	}
+	if (w->number[id] == 0) {
+		const WCHAR *str = LG3DNameString(id);
+		unsigned long len = (unsigned long)wcslen(str) + 1;
+		Reserve((void **)&w->strings, &w->stringsCapacity, w->stringsSize + len, sizeof(WCHAR));
+		memcpy(&w->strings[w->stringsSize], str, sizeof(WCHAR) * len);
+		w->stringsSize += len;
+		w->number[id] = ++w->numStrings;
+	}
+	*field = w->number[id];
+	Reserve((void **)&w->fixup, &w->maxFixups, w->numFixups+1, sizeof(unsigned long));
+	w->fixup[w->numFixups++] = offset;
+}
+
+// a listed light as it is now - once loaded the table holds the live values, sceneLightList
+// only what was loaded or added
+static void CurrentLight(const LG3DControlData *data, int lightIndex, LG3DSceneLight *light)
+{
+	if (lightIndex < data->lights.count)
+		data->lights.Store(lightIndex, light);
+	else
+		data->DescribeLight(lightIndex, light);
+}
+
+bool LG3DSceneFile::Write(const WCHAR *path, const LG3DControlData *data)
+{
+	int a, i;
+	unsigned long s;
+	LG3DSceneFileHeader header;
+	memset(&header, 0, sizeof(header));
+	header.magic = SCENE_FILE_MAGIC;
+	header.version = SCENE_FILE_VERSION;
+	memcpy(header.recordSize, recordSize, sizeof(recordSize));
+	header.ambient = data->ambient;
+	header.clearColor = data->clearColor;
+	header.curCamera = data->curCamera;
+	header.flags = (data->wantShadows ? SCENE_FLAG_SHADOWS : 0) | (data->wantEffects ? SCENE_FLAG_EFFECTS : 0);
+
+	int numLightOverrides = 0, numObjectOverrides = 0;
+	for(a=0;a<data->numLightArrays;a++)
+		numLightOverrides += data->lightArrayList[a].numOverrides;
+	for(a=0;a<data->numObjectArrays;a++)
+		numObjectOverrides += data->objectArrayList[a].numOverrides;
+	header.section[SECTION_NODES].count = data->numSceneNodes;
+	header.section[SECTION_OBJECTS].count = data->ListedObjects();
+	header.section[SECTION_LIGHTS].count = data->ListedLights();
+	header.section[SECTION_CAMERAS].count = data->numCameras;
+	header.section[SECTION_LIGHT_ARRAYS].count = data->numLightArrays;
+	header.section[SECTION_LIGHT_OVERRIDES].count = numLightOverrides;
+	header.section[SECTION_OBJECT_ARRAYS].count = data->numObjectArrays;
+	header.section[SECTION_OBJECT_OVERRIDES].count = numObjectOverrides;
+
+	// the records go in as they are, then get their names numbered
+	LG3DSceneWriter w;
+	memset(&w, 0, sizeof(w));
+	unsigned long offset = Align(sizeof(LG3DSceneFileHeader));
+	for(s=0;s<NUM_RECORD_SECTIONS;s++) {
+		header.section[s].offset = offset;
+		header.section[s].size = header.section[s].count * recordSize[s];
+		offset = Align(offset + header.section[s].size);
+	}
+	w.capacity = w.size = offset;
+	w.buf = (unsigned char *)calloc(1, w.capacity);
+
+	const LG3DSceneFileSection *sec = header.section;
+	if (data->numSceneNodes > 0)
+		memcpy(w.buf + sec[SECTION_NODES].offset, data->sceneNodeList, sec[SECTION_NODES].size);
+	if (sec[SECTION_OBJECTS].count > 0)
+		memcpy(w.buf + sec[SECTION_OBJECTS].offset, data->sceneObjectList, sec[SECTION_OBJECTS].size);
+	for(i=0;i<(int)sec[SECTION_LIGHTS].count;i++)
+		CurrentLight(data, i, (LG3DSceneLight *)(w.buf + sec[SECTION_LIGHTS].offset) + i);
+	if (data->numCameras > 0)
+		memcpy(w.buf + sec[SECTION_CAMERAS].offset, data->cameraList, sec[SECTION_CAMERAS].size);
+
+	for(i=0;i<data->numSceneNodes;i++)
+		WriteName(&w, sec[SECTION_NODES].offset + i*sizeof(LG3DSceneNode) + offsetof(LG3DSceneNode, name));
+	for(i=0;i<(int)sec[SECTION_OBJECTS].count;i++)
+		WriteName(&w, sec[SECTION_OBJECTS].offset + i*sizeof(LG3DSceneObject) + offsetof(LG3DSceneObject, meshName));
+	for(i=0;i<(int)sec[SECTION_LIGHTS].count;i++)
+		WriteName(&w, sec[SECTION_LIGHTS].offset + i*sizeof(LG3DSceneLight) + offsetof(LG3DSceneLight, goboName));
+	for(i=0;i<data->numCameras;i++)
+		WriteName(&w, sec[SECTION_CAMERAS].offset + i*sizeof(LG3DCameraObject) + offsetof(LG3DCameraObject, name));
+
+	int o = 0;
+	for(a=0;a<data->numLightArrays;a++) {
+		unsigned long at = sec[SECTION_LIGHT_ARRAYS].offset + a*sizeof(LG3DLightArray);
+		LG3DLightArray *array = (LG3DLightArray *)(w.buf + at);
+		*array = data->lightArrayList[a];
+		array->overrides = NULL;
+		array->firstLight = -1;
+		WriteName(&w, at + offsetof(LG3DLightArray, light) + offsetof(LG3DSceneLight, goboName));
+		for(i=0;i<array->numOverrides;i++,o++) {
+			at = sec[SECTION_LIGHT_OVERRIDES].offset + o*sizeof(LG3DLightArrayOverride);
+			*(LG3DLightArrayOverride *)(w.buf + at) = data->lightArrayList[a].overrides[i];
+			WriteName(&w, at + offsetof(LG3DLightArrayOverride, light) + offsetof(LG3DSceneLight, goboName));
+		}
+	}
+	o = 0;
+	for(a=0;a<data->numObjectArrays;a++) {
+		unsigned long at = sec[SECTION_OBJECT_ARRAYS].offset + a*sizeof(LG3DObjectArray);
+		LG3DObjectArray *array = (LG3DObjectArray *)(w.buf + at);
+		*array = data->objectArrayList[a];
+		array->overrides = NULL;
+		array->firstObject = -1;
+		WriteName(&w, at + offsetof(LG3DObjectArray, object) + offsetof(LG3DSceneObject, meshName));
+		for(i=0;i<array->numOverrides;i++,o++) {
+			at = sec[SECTION_OBJECT_OVERRIDES].offset + o*sizeof(LG3DObjectArrayOverride);
+			*(LG3DObjectArrayOverride *)(w.buf + at) = data->objectArrayList[a].overrides[i];
+			WriteName(&w, at + offsetof(LG3DObjectArrayOverride, object) + offsetof(LG3DSceneObject, meshName));
+		}
+	}
+
+	header.section[SECTION_STRINGS].offset = offset;
+	header.section[SECTION_STRINGS].size = w.stringsSize * sizeof(WCHAR);
+	header.section[SECTION_STRINGS].count = w.numStrings;
+	offset = Align(offset + header.section[SECTION_STRINGS].size);
+	header.section[SECTION_NAME_FIXUPS].offset = offset;
+	header.section[SECTION_NAME_FIXUPS].size = w.numFixups * sizeof(unsigned long);
+	header.section[SECTION_NAME_FIXUPS].count = w.numFixups;
+	header.fileSize = offset + header.section[SECTION_NAME_FIXUPS].size;
+	memcpy(w.buf, &header, sizeof(header));
+
+	bool ok = false;
+	FILE *file;
+	if (_wfopen_s(&file, path, L"wb") == 0) {
+		// the padding between sections is written as zeros
+		static const unsigned char zero[SCENE_FILE_ALIGN] = {0};
+		ok = (fwrite(w.buf, 1, w.size, file) == w.size);
+		if (w.stringsSize)
+			ok = ok && (fwrite(w.strings, sizeof(WCHAR), w.stringsSize, file) == w.stringsSize);
+		unsigned long pad = header.section[SECTION_NAME_FIXUPS].offset - (w.size + header.section[SECTION_STRINGS].size);
+		ok = ok && (fwrite(zero, 1, pad, file) == pad);
+		if (w.numFixups)
+			ok = ok && (fwrite(w.fixup, sizeof(unsigned long), w.numFixups, file) == w.numFixups);
+		ok = (fclose(file) == 0) && ok;
+	}
+	free(w.buf);
+	free(w.number);
+	free(w.strings);
+	free(w.fixup);
+	return ok;
+}
+
+LG3DSceneFile::LG3DSceneFile()
+{
+	file = INVALID_HANDLE_VALUE;
+	mapping = NULL;
+	base = NULL;
+	size = 0;
+}
+
+LG3DSceneFile::~LG3DSceneFile()
+{
+	Close();
+}
+
+void LG3DSceneFile::Close()
+{
+	if (base)
+		UnmapViewOfFile(base);
+	if (mapping)
+		CloseHandle(mapping);
+	if (file != INVALID_HANDLE_VALUE)
+		CloseHandle(file);
+	file = INVALID_HANDLE_VALUE;
+	mapping = NULL;
+	base = NULL;
+	size = 0;
+}
+
+// everything Open relies on, so a damaged or foreign file is refused rather than crashed on
+static bool Valid(const unsigned char *base, unsigned long size)
+{
+	unsigned long s;
+	if (size < sizeof(LG3DSceneFileHeader))
+		return false;
+	const LG3DSceneFileHeader *header = (const LG3DSceneFileHeader *)base;
+	if ((header->magic != SCENE_FILE_MAGIC) || (header->version != SCENE_FILE_VERSION) || (header->fileSize != size))
+		return false;
+	if (memcmp(header->recordSize, recordSize, sizeof(recordSize)) != 0)
+		return false;
+	for(s=0;s<NUM_SECTIONS;s++) {
+		const LG3DSceneFileSection *sec = &header->section[s];
+		if ((sec->offset & (SCENE_FILE_ALIGN-1)) || (sec->offset < sizeof(LG3DSceneFileHeader)) ||
+			(sec->offset > size) || (sec->size > size - sec->offset) || (sec->count > 0x7fffffff))
+			return false;
+		if ((s != SECTION_STRINGS) && ((sec->count > size / recordSize[s]) || (sec->size != sec->count * recordSize[s])))
+			return false;
+	}
+	const LG3DSceneFileSection *strings = &header->section[SECTION_STRINGS];
+	if ((strings->size & (sizeof(WCHAR)-1)) ||
+		((strings->size > 0) && (((const WCHAR *)(base + strings->offset))[strings->size / sizeof(WCHAR) - 1] != 0)))
+		return false;
+
+	// names may only be fixed up inside the records
+	const unsigned long *fixup = (const unsigned long *)(base + header->section[SECTION_NAME_FIXUPS].offset);
+	unsigned long f;
+	for(f=0;f<header->section[SECTION_NAME_FIXUPS].count;f++) {
+		if (fixup[f] & (sizeof(LG3DNameId)-1))
+			return false;
+		for(s=0;s<NUM_RECORD_SECTIONS;s++) {
+			const LG3DSceneFileSection *sec = &header->section[s];
+			if ((fixup[f] >= sec->offset) && (fixup[f] + sizeof(LG3DNameId) <= sec->offset + sec->size))
+				break;
+		}
+		if (s == NUM_RECORD_SECTIONS)
+			return false;
+		LG3DNameId number = *(const LG3DNameId *)(base + fixup[f]);
+		if ((number == 0) || (number > strings->count))
+			return false;
+	}
+
+	// and the arrays must share out the overrides exactly
+	unsigned long n = 0;
+	const LG3DLightArray *lightArray = (const LG3DLightArray *)(base + header->section[SECTION_LIGHT_ARRAYS].offset);
+	for(s=0;s<header->section[SECTION_LIGHT_ARRAYS].count;s++) {
+		if ((lightArray[s].numOverrides < 0) || (lightArray[s].layout.count < 0))
+			return false;
+		n += lightArray[s].numOverrides;
+	}
+	if (n != header->section[SECTION_LIGHT_OVERRIDES].count)
+		return false;
+	n = 0;
+	const LG3DObjectArray *objectArray = (const LG3DObjectArray *)(base + header->section[SECTION_OBJECT_ARRAYS].offset);
+	for(s=0;s<header->section[SECTION_OBJECT_ARRAYS].count;s++) {
+		if ((objectArray[s].numOverrides < 0) || (objectArray[s].layout.count < 0))
+			return false;
+		n += objectArray[s].numOverrides;
+	}
+	return n == header->section[SECTION_OBJECT_OVERRIDES].count;
+}
+
+bool LG3DSceneFile::Open(const WCHAR *path, LG3DControlData *data)
+{
+	unsigned long i, a;
+	Close();
+	file = CreateFile(path, GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+	if (file == INVALID_HANDLE_VALUE)
+		return false;
+	size = GetFileSize(file, NULL);
+	if ((size == 0xffffffff) || (size < sizeof(LG3DSceneFileHeader))) {
+		Close();
+		return false;
+	}
+
+	// copy-on-write, what the control data writes into the lists stays in this process
+	mapping = CreateFileMapping(file, NULL, PAGE_WRITECOPY, 0, 0, NULL);
+	if (mapping)
+		base = (unsigned char *)MapViewOfFile(mapping, FILE_MAP_COPY, 0, 0, 0);
+	if (!base || !Valid(base, size)) {
+		Close();
+		return false;
+	}
+
+	// intern every string once, then put the ids in the fields that name them
+	const LG3DSceneFileHeader *header = (const LG3DSceneFileHeader *)base;
+	const LG3DSceneFileSection *sec = header->section;
+	unsigned long numStrings = sec[SECTION_STRINGS].count;
+	LG3DNameId *id = (LG3DNameId *)malloc(sizeof(LG3DNameId) * (numStrings+1));
+	const WCHAR *str = (const WCHAR *)(base + sec[SECTION_STRINGS].offset);
+	const WCHAR *strEnd = str + sec[SECTION_STRINGS].size / sizeof(WCHAR);
+	for(i=0;i<numStrings;i++) {
+		id[i] = (str < strEnd) ? LG3DInternName(str) : 0;
+		while (str < strEnd && *str)
+			str++;
+		str++;
+	}
+	const unsigned long *fixup = (const unsigned long *)(base + sec[SECTION_NAME_FIXUPS].offset);
+	for(i=0;i<sec[SECTION_NAME_FIXUPS].count;i++) {
+		LG3DNameId *field = (LG3DNameId *)(base + fixup[i]);
+		*field = id[*field - 1];
+	}
+	free(id);
+
+	data->numSceneNodes = sec[SECTION_NODES].count;
+	data->sceneNodeList = sec[SECTION_NODES].count ? (LG3DSceneNode *)(base + sec[SECTION_NODES].offset) : NULL;
+	data->numSceneObjects = sec[SECTION_OBJECTS].count;
+	data->sceneObjectList = sec[SECTION_OBJECTS].count ? (LG3DSceneObject *)(base + sec[SECTION_OBJECTS].offset) : NULL;
+	data->numSceneLights = sec[SECTION_LIGHTS].count;
+	data->sceneLightList = sec[SECTION_LIGHTS].count ? (LG3DSceneLight *)(base + sec[SECTION_LIGHTS].offset) : NULL;
+	data->numCameras = sec[SECTION_CAMERAS].count;
+	data->cameraList = sec[SECTION_CAMERAS].count ? (LG3DCameraObject *)(base + sec[SECTION_CAMERAS].offset) : NULL;
+
+	data->numLightArrays = sec[SECTION_LIGHT_ARRAYS].count;
+	data->lightArrayList = sec[SECTION_LIGHT_ARRAYS].count ? (LG3DLightArray *)(base + sec[SECTION_LIGHT_ARRAYS].offset) : NULL;
+	LG3DLightArrayOverride *lightOverride = (LG3DLightArrayOverride *)(base + sec[SECTION_LIGHT_OVERRIDES].offset);
+	for(a=0;a<sec[SECTION_LIGHT_ARRAYS].count;a++) {
+		data->lightArrayList[a].overrides = data->lightArrayList[a].numOverrides ? lightOverride : NULL;
+		lightOverride += data->lightArrayList[a].numOverrides;
+	}
+	data->numObjectArrays = sec[SECTION_OBJECT_ARRAYS].count;
+	data->objectArrayList = sec[SECTION_OBJECT_ARRAYS].count ? (LG3DObjectArray *)(base + sec[SECTION_OBJECT_ARRAYS].offset) : NULL;
+	LG3DObjectArrayOverride *objectOverride = (LG3DObjectArrayOverride *)(base + sec[SECTION_OBJECT_OVERRIDES].offset);
+	for(a=0;a<sec[SECTION_OBJECT_ARRAYS].count;a++) {
+		data->objectArrayList[a].overrides = data->objectArrayList[a].numOverrides ? objectOverride : NULL;
+		objectOverride += data->objectArrayList[a].numOverrides;
+	}
+
+	data->ambient = header->ambient;
+	data->clearColor = header->clearColor;
+	data->curCamera = (header->curCamera < data->numCameras) ? header->curCamera : -1;
+	data->wantShadows = (header->flags & SCENE_FLAG_SHADOWS) != 0;
+	data->wantEffects = (header->flags & SCENE_FLAG_EFFECTS) != 0;
+	data->sceneFile = this;
+	return true;
+}
+
+bool LG3DControlData::IsMapped(const void *list) const
+{
+	return sceneFile && list && sceneFile->Contains(list);
+}
+
+// ---------------------------------------------------------
+// text form
+// ---------------------------------------------------------
+//
+// One record to a line, '#' starts a comment.  Names are in double quotes, "" for none, and
+// are UTF-8 (with no '"' or '#' in them).  Flags are 0 or 1, masks may be hex (0x..).
+//
+//	ambient R G B
+//	clear R G B
+//	options curCamera shadows effects
+//	camera "name" x y z h p r fov pinMask
+//	node "name" parent x y z h p r
+//	object "mesh" node x y z h p r
+//	light node x y z h p r R G B umbra penumbra att1 att2 pinMask enabled shadows "gobo"
+//	lightarray line|ring|grid count columns sx sy sz rx ry rz radius startAngle sweep
+//	objectarray line|ring|grid count columns sx sy sz rx ry rz radius startAngle sweep
+//	override element fields
+//
+// The light (or object) line after a lightarray (objectarray) line is the array's template,
+// the one after an override line is that element of the last array, fields being the
+// LG3DDirtyFieldType bits it overrides.  Any other light & object lines are listed ones.
+
+#define TEXT_MAX_LINE 1024
+
+static const char *shapeName[] = {"line", "ring", "grid"};
+
+enum {
+	PENDING_LISTED,
+	PENDING_TEMPLATE,
+	PENDING_OVERRIDE,
+};
+
+// a list being read, grown as its records turn up
+struct LG3DTextList {
+	void			*item;
+	int				count;
+	int				capacity;
+};
+
+static void *Append(LG3DTextList *list, size_t itemSize, const void *item)
+{
+	if (list->count == list->capacity) {
+		list->capacity = list->capacity ? list->capacity*2 : 64;
+		list->item = realloc(list->item, itemSize * list->capacity);
+	}
+	void *p = (unsigned char *)list->item + itemSize * list->count++;
+	memcpy(p, item, itemSize);
+	return p;
+}
+
+static const char *SkipSpace(const char *s)
+{
+	while (*s == ' ' || *s == '\t')
+		s++;
+	return s;
+}
+
+static bool ReadFloat(const char **s, float *v)
+{
+	char *end;
+	*v = (float)strtod(*s, &end);
+	if (end == *s)
+		return false;
+	*s = SkipSpace(end);
+	return true;
+}
+
+static bool ReadInt(const char **s, int *v)
+{
+	char *end;
+	*v = (int)strtol(*s, &end, 0);
+	if (end == *s)
+		return false;
+	*s = SkipSpace(end);
+	return true;
+}
+
+static bool ReadMask(const char **s, unsigned long *v)
+{
+	char *end;
+	*v = strtoul(*s, &end, 0);
+	if (end == *s)
+		return false;
+	*s = SkipSpace(end);
+	return true;
+}
+
+static bool ReadBool(const char **s, bool *v)
+{
+	int i;
+	if (!ReadInt(s, &i))
+		return false;
+	*v = (i != 0);
+	return true;
+}
+
+static bool ReadFloats(const char **s, float *v, int n)
+{
+	int i;
+	for(i=0;i<n;i++)
+		if (!ReadFloat(s, &v[i]))
+			return false;
+	return true;
+}
+
+static bool ReadName(const char **s, LG3DNameId *id)
+{
+	const char *p = *s;
+	if (*p != '"')
+		return false;
+	const char *end = strchr(p+1, '"');
+	if (!end)
+		return false;
+	int len = (int)(end - (p+1));
+	*id = 0;
+	if (len > 0) {
+		WCHAR name[TEXT_MAX_LINE];
+		int n = MultiByteToWideChar(CP_UTF8, 0, p+1, len, name, TEXT_MAX_LINE-1);
+		if (n <= 0)
+			return false;
+		name[n] = 0;
+		*id = LG3DInternName(name);
+	}
+	*s = SkipSpace(end+1);
+	return true;
+}
+
+static bool ReadColor(const char **s, LG3DLightColor *c)
+{
+	return ReadInt(s, &c->r) && ReadInt(s, &c->g) && ReadInt(s, &c->b);
+}
+
+static bool ReadPlacement(const char **s, LG3DPosition *pos, LG3DOrientation *orient)
+{
+	return ReadFloats(s, &pos->x, 3) && ReadFloats(s, &orient->h, 3);
+}
+
+static bool ReadLight(const char **s, LG3DSceneLight *light)
+{
+	return ReadInt(s, &light->parentNode) && ReadPlacement(s, &light->position, &light->orientation) &&
+		ReadColor(s, &light->color) && ReadFloat(s, &light->umbra) && ReadFloat(s, &light->penumbra) &&
+		ReadFloat(s, &light->att1) && ReadFloat(s, &light->att2) && ReadMask(s, &light->pinMask) &&
+		ReadBool(s, &light->enabled) && ReadBool(s, &light->castsShadows) && ReadName(s, &light->goboName);
+}
+
+static bool ReadObject(const char **s, LG3DSceneObject *object)
+{
+	return ReadName(s, &object->meshName) && ReadInt(s, &object->parentNode) &&
+		ReadPlacement(s, &object->position, &object->orientation);
+}
+
+static bool ReadLayout(const char **s, LG3DArrayLayout *layout)
+{
+	int i;
+	for(i=0;i<3;i++) {
+		size_t len = strlen(shapeName[i]);
+		if ((strncmp(*s, shapeName[i], len) == 0) && ((*s)[len] == ' ' || (*s)[len] == '\t')) {
+			layout->shape = i;
+			*s = SkipSpace(*s + len);
+			break;
+		}
+	}
+	if (i == 3)
+		return false;
+	return ReadInt(s, &layout->count) && (layout->count >= 0) && ReadInt(s, &layout->columns) &&
+		ReadFloats(s, &layout->step.x, 3) && ReadFloats(s, &layout->rowStep.x, 3) &&
+		ReadFloat(s, &layout->radius) && ReadFloat(s, &layout->startAngle) && ReadFloat(s, &layout->sweep);
+}
+
+// the lists as ReadText hands them over, allocated with new [] the way a host's are
+static void FreeLists(LG3DControlData *data)
+{
+	int a;
+	delete [] data->sceneObjectList;
+	delete [] data->sceneLightList;
+	delete [] data->sceneNodeList;
+	for(a=0;a<data->numLightArrays;a++)
+		delete [] data->lightArrayList[a].overrides;
+	delete [] data->lightArrayList;
+	for(a=0;a<data->numObjectArrays;a++)
+		delete [] data->objectArrayList[a].overrides;
+	delete [] data->objectArrayList;
+	delete [] data->cameraList;
+	data->sceneObjectList = NULL;
+	data->sceneLightList = NULL;
+	data->sceneNodeList = NULL;
+	data->lightArrayList = NULL;
+	data->objectArrayList = NULL;
+	data->cameraList = NULL;
+	data->numSceneObjects = data->numSceneLights = data->numSceneNodes = 0;
+	data->numLightArrays = data->numObjectArrays = data->numCameras = 0;
+}
+
+// the overrides of each array, in element order
+static void SortOverrides(LG3DLightArrayOverride *o, int n)
+{
+	int i, j;
+	for(i=1;i<n;i++) {
+		LG3DLightArrayOverride t = o[i];
+		for(j=i;(j > 0) && (o[j-1].element > t.element);j--)
+			o[j] = o[j-1];
+		o[j] = t;
+	}
+}
+
+static void SortOverrides(LG3DObjectArrayOverride *o, int n)
+{
+	int i, j;
+	for(i=1;i<n;i++) {
+		LG3DObjectArrayOverride t = o[i];
+		for(j=i;(j > 0) && (o[j-1].element > t.element);j--)
+			o[j] = o[j-1];
+		o[j] = t;
+	}
+}
+
+bool LG3DSceneFile::ReadText(const WCHAR *path, LG3DControlData *data, int *errorLine)
+{
+	FILE *file;
+	if (errorLine)
+		*errorLine = 0;
+	if (_wfopen_s(&file, path, L"rt") != 0)
+		return false;
+
+	LG3DTextList nodes, objects, lights, cameras, lightArrays, objectArrays, lightOverrides, objectOverrides;
+	memset(&nodes, 0, sizeof(nodes));
+	objects = lights = cameras = lightArrays = objectArrays = lightOverrides = objectOverrides = nodes;
+	int *lightOverrideArray = NULL, *objectOverrideArray = NULL;	// which array each override is for
+	int maxLightOverrides = 0, maxObjectOverrides = 0;
+
+	bool ok = true;
+	int lineNumber = 0;
+	int pending = PENDING_LISTED;
+	bool lastArrayIsLight = true;
+	int overrideElement = 0;
+	unsigned long overrideFields = 0;
+	char line[TEXT_MAX_LINE];
+	while (ok && fgets(line, sizeof(line), file)) {
+		lineNumber++;
+		char *comment = strchr(line, '#');
+		if (comment)
+			*comment = 0;
+		const char *s = SkipSpace(line);
+		char keyword[16];
+		int len = 0;
+		while ((s[len] >= 'a') && (s[len] <= 'z') && (len < 15))
+			len++;
+		if (len == 0) {
+			ok = (*s == 0 || *s == '\n' || *s == '\r');
+			continue;
+		}
+		memcpy(keyword, s, len);
+		keyword[len] = 0;
+		s = SkipSpace(s + len);
+
+		if (strcmp(keyword, "light") == 0) {
+			LG3DSceneLight light;
+			ok = ReadLight(&s, &light);
+			if (!ok)
+				break;
+			if (pending == PENDING_TEMPLATE) {
+				ok = lastArrayIsLight;
+				if (ok)
+					((LG3DLightArray *)lightArrays.item)[lightArrays.count-1].light = light;
+			} else if (pending == PENDING_OVERRIDE) {
+				ok = lastArrayIsLight;
+				if (ok) {
+					LG3DLightArrayOverride o;
+					o.element = overrideElement;
+					o.fields = overrideFields;
+					o.light = light;
+					Append(&lightOverrides, sizeof(o), &o);
+					if (lightOverrides.count > maxLightOverrides) {
+						maxLightOverrides = lightOverrides.capacity;
+						lightOverrideArray = (int *)realloc(lightOverrideArray, sizeof(int) * maxLightOverrides);
+					}
+					lightOverrideArray[lightOverrides.count-1] = lightArrays.count-1;
+				}
+			} else
+				Append(&lights, sizeof(light), &light);
+			pending = PENDING_LISTED;
+		} else if (strcmp(keyword, "object") == 0) {
+			LG3DSceneObject object;
+			ok = ReadObject(&s, &object);
+			if (!ok)
+				break;
+			if (pending == PENDING_TEMPLATE) {
+				ok = !lastArrayIsLight;
+				if (ok)
+					((LG3DObjectArray *)objectArrays.item)[objectArrays.count-1].object = object;
+			} else if (pending == PENDING_OVERRIDE) {
+				ok = !lastArrayIsLight;
+				if (ok) {
+					LG3DObjectArrayOverride o;
+					o.element = overrideElement;
+					o.fields = overrideFields;
+					o.object = object;
+					Append(&objectOverrides, sizeof(o), &o);
+					if (objectOverrides.count > maxObjectOverrides) {
+						maxObjectOverrides = objectOverrides.capacity;
+						objectOverrideArray = (int *)realloc(objectOverrideArray, sizeof(int) * maxObjectOverrides);
+					}
+					objectOverrideArray[objectOverrides.count-1] = objectArrays.count-1;
+				}
+			} else
+				Append(&objects, sizeof(object), &object);
+			pending = PENDING_LISTED;
+		} else if (pending != PENDING_LISTED) {
+			ok = false; // an array or override with nothing to describe it
+		} else if (strcmp(keyword, "node") == 0) {
+			LG3DSceneNode node;
+			ok = ReadName(&s, &node.name) && ReadInt(&s, &node.parent) && ReadPlacement(&s, &node.position, &node.orientation);
+			if (ok)
+				Append(&nodes, sizeof(node), &node);
+		} else if (strcmp(keyword, "camera") == 0) {
+			LG3DCameraObject camera;
+			ok = ReadName(&s, &camera.name) && ReadPlacement(&s, &camera.position, &camera.orientation) &&
+				ReadFloat(&s, &camera.fov) && ReadMask(&s, &camera.pinMask);
+			if (ok)
+				Append(&cameras, sizeof(camera), &camera);
+		} else if ((strcmp(keyword, "lightarray") == 0) || (strcmp(keyword, "objectarray") == 0)) {
+			LG3DArrayLayout layout;
+			ok = ReadLayout(&s, &layout);
+			lastArrayIsLight = (keyword[0] == 'l');
+			if (ok && lastArrayIsLight) {
+				LG3DLightArray array;
+				array.layout = layout;
+				Append(&lightArrays, sizeof(array), &array);
+			} else if (ok) {
+				LG3DObjectArray array;
+				array.layout = layout;
+				Append(&objectArrays, sizeof(array), &array);
+			}
+			pending = PENDING_TEMPLATE;
+		} else if (strcmp(keyword, "override") == 0) {
+			ok = ReadInt(&s, &overrideElement) && ReadMask(&s, &overrideFields) &&
+				((lastArrayIsLight ? lightArrays.count : objectArrays.count) > 0);
+			pending = PENDING_OVERRIDE;
+		} else if (strcmp(keyword, "ambient") == 0) {
+			ok = ReadColor(&s, &data->ambient);
+		} else if (strcmp(keyword, "clear") == 0) {
+			ok = ReadColor(&s, &data->clearColor);
+		} else if (strcmp(keyword, "options") == 0) {
+			ok = ReadInt(&s, &data->curCamera) && ReadBool(&s, &data->wantShadows) && ReadBool(&s, &data->wantEffects);
+		} else
+			ok = false;
+		ok = ok && (*s == 0 || *s == '\n' || *s == '\r');
+	}
+	fclose(file);
+	if (pending != PENDING_LISTED)
+		ok = false; // the file ended before the record the last line promised
+
+	int i, a;
+	if (ok) {
+		// into lists of the host's own kind
+		data->numSceneNodes = nodes.count;
+		data->sceneNodeList = nodes.count ? new LG3DSceneNode[nodes.count] : NULL;
+		for(i=0;i<nodes.count;i++)
+			data->sceneNodeList[i] = ((LG3DSceneNode *)nodes.item)[i];
+		data->numSceneObjects = objects.count;
+		data->sceneObjectList = objects.count ? new LG3DSceneObject[objects.count] : NULL;
+		for(i=0;i<objects.count;i++)
+			data->sceneObjectList[i] = ((LG3DSceneObject *)objects.item)[i];
+		data->numSceneLights = lights.count;
+		data->sceneLightList = lights.count ? new LG3DSceneLight[lights.count] : NULL;
+		for(i=0;i<lights.count;i++)
+			data->sceneLightList[i] = ((LG3DSceneLight *)lights.item)[i];
+		data->numCameras = cameras.count;
+		data->cameraList = cameras.count ? new LG3DCameraObject[cameras.count] : NULL;
+		for(i=0;i<cameras.count;i++)
+			data->cameraList[i] = ((LG3DCameraObject *)cameras.item)[i];
+		if (data->curCamera >= data->numCameras)
+			data->curCamera = -1;
+
+		data->numLightArrays = lightArrays.count;
+		data->lightArrayList = lightArrays.count ? new LG3DLightArray[lightArrays.count] : NULL;
+		for(a=0;a<lightArrays.count;a++) {
+			LG3DLightArray *array = &data->lightArrayList[a];
+			*array = ((LG3DLightArray *)lightArrays.item)[a];
+			for(i=0;i<lightOverrides.count;i++)
+				array->numOverrides += (lightOverrideArray[i] == a);
+			array->overrides = array->numOverrides ? new LG3DLightArrayOverride[array->numOverrides] : NULL;
+			int n = 0;
+			for(i=0;i<lightOverrides.count;i++)
+				if (lightOverrideArray[i] == a)
+					array->overrides[n++] = ((LG3DLightArrayOverride *)lightOverrides.item)[i];
+			SortOverrides(array->overrides, n);
+		}
+		data->numObjectArrays = objectArrays.count;
+		data->objectArrayList = objectArrays.count ? new LG3DObjectArray[objectArrays.count] : NULL;
+		for(a=0;a<objectArrays.count;a++) {
+			LG3DObjectArray *array = &data->objectArrayList[a];
+			*array = ((LG3DObjectArray *)objectArrays.item)[a];
+			for(i=0;i<objectOverrides.count;i++)
+				array->numOverrides += (objectOverrideArray[i] == a);
+			array->overrides = array->numOverrides ? new LG3DObjectArrayOverride[array->numOverrides] : NULL;
+			int n = 0;
+			for(i=0;i<objectOverrides.count;i++)
+				if (objectOverrideArray[i] == a)
+					array->overrides[n++] = ((LG3DObjectArrayOverride *)objectOverrides.item)[i];
+			SortOverrides(array->overrides, n);
+		}
+	} else if (errorLine)
+		*errorLine = lineNumber;
+
+	free(nodes.item);
+	free(objects.item);
+	free(lights.item);
+	free(cameras.item);
+	free(lightArrays.item);
+	free(objectArrays.item);
+	free(lightOverrides.item);
+	free(objectOverrides.item);
+	free(lightOverrideArray);
+	free(objectOverrideArray);
+	return ok;
+}
+
+static void WriteName(FILE *file, LG3DNameId id)
+{
+	char name[TEXT_MAX_LINE];
+	int n = WideCharToMultiByte(CP_UTF8, 0, LG3DNameString(id), -1, name, sizeof(name), NULL, NULL);
+	fprintf(file, " \"%s\"", (n > 0) ? name : "");
+}
+
+static void WritePlacement(FILE *file, const LG3DPosition *pos, const LG3DOrientation *orient)
+{
+	fprintf(file, " %.9g %.9g %.9g %.9g %.9g %.9g", pos->x, pos->y, pos->z, orient->h, orient->p, orient->r);
+}
+
+static void WriteLight(FILE *file, const LG3DSceneLight *light)
+{
+	fprintf(file, "light %d", light->parentNode);
+	WritePlacement(file, &light->position, &light->orientation);
+	fprintf(file, " %d %d %d %.9g %.9g %.9g %.9g 0x%lx %d %d", light->color.r, light->color.g, light->color.b,
+		light->umbra, light->penumbra, light->att1, light->att2, light->pinMask, light->enabled ? 1 : 0, light->castsShadows ? 1 : 0);
+	WriteName(file, light->goboName);
+	fprintf(file, "\n");
+}
+
+static void WriteObject(FILE *file, const LG3DSceneObject *object)
+{
+	fprintf(file, "object");
+	WriteName(file, object->meshName);
+	fprintf(file, " %d", object->parentNode);
+	WritePlacement(file, &object->position, &object->orientation);
+	fprintf(file, "\n");
+}
+
+static void WriteLayout(FILE *file, const char *keyword, const LG3DArrayLayout *layout)
+{
+	fprintf(file, "%s %s %d %d %.9g %.9g %.9g %.9g %.9g %.9g %.9g %.9g %.9g\n", keyword,
+		shapeName[(layout->shape >= 0 && layout->shape < 3) ? layout->shape : 0], layout->count, layout->columns,
+		layout->step.x, layout->step.y, layout->step.z, layout->rowStep.x, layout->rowStep.y, layout->rowStep.z,
+		layout->radius, layout->startAngle, layout->sweep);
+}
+
+bool LG3DSceneFile::WriteText(const WCHAR *path, const LG3DControlData *data)
+{
+	int i, a;
+	FILE *file;
+	if (_wfopen_s(&file, path, L"wt") != 0)
+		return false;
+
+	fprintf(file, "# lg3d scene\n");
+	fprintf(file, "ambient %d %d %d\n", data->ambient.r, data->ambient.g, data->ambient.b);
+	fprintf(file, "clear %d %d %d\n", data->clearColor.r, data->clearColor.g, data->clearColor.b);
+	fprintf(file, "options %d %d %d\n", data->curCamera, data->wantShadows ? 1 : 0, data->wantEffects ? 1 : 0);
+	for(i=0;i<data->numCameras;i++) {
+		const LG3DCameraObject *camera = &data->cameraList[i];
+		fprintf(file, "camera");
+		WriteName(file, camera->name);
+		WritePlacement(file, &camera->position, &camera->orientation);
+		fprintf(file, " %.9g 0x%lx\n", camera->fov, camera->pinMask);
+	}
+	for(i=0;i<data->numSceneNodes;i++) {
+		const LG3DSceneNode *node = &data->sceneNodeList[i];
+		fprintf(file, "node");
+		WriteName(file, node->name);
+		fprintf(file, " %d", node->parent);
+		WritePlacement(file, &node->position, &node->orientation);
+		fprintf(file, "\n");
+	}
+	int listed = data->ListedObjects();
+	for(i=0;i<listed;i++)
+		WriteObject(file, &data->sceneObjectList[i]);
+	listed = data->ListedLights();
+	for(i=0;i<listed;i++) {
+		LG3DSceneLight light;
+		CurrentLight(data, i, &light);
+		WriteLight(file, &light);
+	}
+
+	for(a=0;a<data->numLightArrays;a++) {
+		const LG3DLightArray *array = &data->lightArrayList[a];
+		WriteLayout(file, "lightarray", &array->layout);
+		WriteLight(file, &array->light);
+		for(i=0;i<array->numOverrides;i++) {
+			fprintf(file, "override %d 0x%lx\n", array->overrides[i].element, array->overrides[i].fields);
+			WriteLight(file, &array->overrides[i].light);
+		}
+	}
+	for(a=0;a<data->numObjectArrays;a++) {
+		const LG3DObjectArray *array = &data->objectArrayList[a];
+		WriteLayout(file, "objectarray", &array->layout);
+		WriteObject(file, &array->object);
+		for(i=0;i<array->numOverrides;i++) {
+			fprintf(file, "override %d 0x%lx\n", array->overrides[i].element, array->overrides[i].fields);
+			WriteObject(file, &array->overrides[i].object);
+		}
+	}
+	return (fclose(file) == 0);
+}
+
+bool LG3DSceneFile::Convert(const WCHAR *textPath, const WCHAR *binaryPath, int *errorLine)
+{
+	LG3DControlData data;
+	bool ok = ReadText(textPath, &data, errorLine);
+	if (ok)
+		ok = Write(binaryPath, &data);
+	FreeLists(&data);
+	return ok;
+}
@@ -0,0 +1,405 @@
+#include "lg3d.h"
+
+// The shared memory is the header, the ring of records, then the two state buffers of
+// maxLights LG3DSharedLightState each.  The controller only writes tail & the records past it,
+// the renderer only writes head & the state buffers.  A state buffer's sequence is odd while
+// the renderer writes it, a reader copying it out checks it was even & unchanged throughout.
+
+#define SHARED_MAGIC 0x4d53474c			// "LGSM"
+#define SHARED_VERSION 1
+
+#define SHARED_LIGHT 1
+#define SHARED_OBJECT 2
+
+#define SHARED_LINE 64					// head & tail each get a cache line to themselves
+#define SHARED_BATCH 256				// records handed to UpdateLights & UpdateObjects at a time
+#define SHARED_READ_TRIES 64			// copies ReadState tries before giving up on a busy renderer
+
+#define SHARED_BODY_SIZE (sizeof(LG3DLightUpdate) > sizeof(LG3DObjectUpdate) ? sizeof(LG3DLightUpdate) : sizeof(LG3DObjectUpdate))
+
+struct LG3DSharedHeader {
+	unsigned long	magic;					// written last, once the rest is set up
+	unsigned long	version;
+	unsigned long	recordSize;				// both sides must be built alike
+	unsigned long	ringCapacity;			// records, a power of 2
+	unsigned long	maxLights;
+	unsigned long	size;					// of the whole shared memory
+	volatile LONG	writer;					// process id of the controller attached, 0 if none
+	volatile LONG	beat;					// publish count
+	volatile LONG	published;				// the state buffer last published
+	volatile LONG	stateSeq[2];
+	volatile LONG	numLights[2];
+	char			pad0[SHARED_LINE];
+	volatile LONG	tail;					// records pushed
+	char			pad1[SHARED_LINE - sizeof(LONG)];
+	volatile LONG	head;					// records taken
+	char			pad2[SHARED_LINE - sizeof(LONG)];
+};
+
+struct LG3DSharedRecord {
+	unsigned long	type;					// SHARED_LIGHT or SHARED_OBJECT
+	unsigned long	reserved;
+	LONGLONG		stamp;
+	double			body[(SHARED_BODY_SIZE + 7) / 8];	// the update
+};
+
+static unsigned long RingOffset()
+{
+	return (sizeof(LG3DSharedHeader) + SHARED_LINE-1) & ~(SHARED_LINE-1);
+}
+
+static unsigned long SharedSize(unsigned long ringCapacity, unsigned long maxLights)
+{
+	return RingOffset() + ringCapacity * sizeof(LG3DSharedRecord) + 2 * maxLights * sizeof(LG3DSharedLightState);
+}
+
+// a bool from the other process may hold any byte
+static bool SharedBool(const bool *b)
+{
+	unsigned char v;
+	memcpy(&v, b, 1);
+	return v != 0;
+}
+
+// whether the controller process that holds the channel is still running
+static bool ProcessAlive(LONG pid)
+{
+	HANDLE process = OpenProcess(SYNCHRONIZE, FALSE, (DWORD)pid);
+	bool alive = process && (WaitForSingleObject(process, 0) == WAIT_TIMEOUT);
+	if (process)
+		CloseHandle(process);
+	return alive;
+}
+
+LG3DSharedChannel::LG3DSharedChannel()
+{
+	mapping = NULL;
+	header = NULL;
+	ring = NULL;
+	ringCapacity = 0;
+	maxLights = 0;
+	isRenderer = false;
+	lastBeat = 0;
+	dropped = 0;
+	lastStamp = 0;
+	published = false;
+	publishedGeneration = 0;
+	lightBatch = NULL;
+	objectBatch = NULL;
+}
+
+LG3DSharedChannel::~LG3DSharedChannel()
+{
+	Close();
+}
+
+LG3DSharedLightState *LG3DSharedChannel::State(int buffer) const
+{
+	unsigned char *base = (unsigned char *)header + RingOffset() + ringCapacity * sizeof(LG3DSharedRecord);
+	return (LG3DSharedLightState *)(base + buffer * maxLights * sizeof(LG3DSharedLightState));
+}
+
+bool LG3DSharedChannel::Create(const WCHAR *name, int ringRecords, int _maxLights)
+{
+	Close();
+	unsigned long capacity = 1;
+	while ((int)capacity < ringRecords)
+		capacity <<= 1;
+	unsigned long size = SharedSize(capacity, _maxLights);
+	mapping = CreateFileMapping(INVALID_HANDLE_VALUE, NULL, PAGE_READWRITE, 0, size, name);
+	if (!mapping)
+		return false;
+	bool existed = GetLastError() == ERROR_ALREADY_EXISTS;
+	header = (LG3DSharedHeader *)MapViewOfFile(mapping, FILE_MAP_ALL_ACCESS, 0, 0, size);
+	if (!header) {
+		Close();
+		return false;
+	}
+
+	if (existed) {
+		// a controller still holding the channel from a renderer before us, it carries on if
+		// built alike.  What it pushed for that renderer is dropped.
+		if ((header->magic != SHARED_MAGIC) || (header->version != SHARED_VERSION) ||
+			(header->recordSize != sizeof(LG3DSharedRecord)) || (header->ringCapacity != capacity) ||
+			(header->maxLights != (unsigned long)_maxLights) || (header->size != size)) {
+			Close();
+			return false;
+		}
+		InterlockedExchange(&header->head, header->tail);
+
+		// a renderer that died publishing leaves a buffer's sequence odd, which would keep
+		// readers retrying for good.  Both buffers are emptied, moving their sequences on.
+		int b;
+		for(b=0;b<2;b++) {
+			if (!(header->stateSeq[b] & 1))
+				InterlockedIncrement(&header->stateSeq[b]);
+			header->numLights[b] = 0;
+			InterlockedIncrement(&header->stateSeq[b]);
+		}
+	} else {
+		// new mappings come zeroed
+		header->version = SHARED_VERSION;
+		header->recordSize = sizeof(LG3DSharedRecord);
+		header->ringCapacity = capacity;
+		header->maxLights = _maxLights;
+		header->size = size;
+		MemoryBarrier();
+		header->magic = SHARED_MAGIC;
+	}
+	ring = (LG3DSharedRecord *)((unsigned char *)header + RingOffset());
+	ringCapacity = capacity;
+	maxLights = _maxLights;
+	isRenderer = true;
+	published = false;
+	lightBatch = (LG3DLightUpdate *)malloc(sizeof(LG3DLightUpdate) * SHARED_BATCH);
+	objectBatch = (LG3DObjectUpdate *)malloc(sizeof(LG3DObjectUpdate) * SHARED_BATCH);
+	return true;
+}
+
+bool LG3DSharedChannel::Open(const WCHAR *name)
+{
+	Close();
+	mapping = OpenFileMapping(FILE_MAP_ALL_ACCESS, FALSE, name);
+	if (!mapping)
+		return false;
+
+	// the header says how big the rest is, a view past the end of the memory fails
+	LG3DSharedHeader *h = (LG3DSharedHeader *)MapViewOfFile(mapping, FILE_MAP_ALL_ACCESS, 0, 0, sizeof(LG3DSharedHeader));
+	if (!h) {
+		Close();
+		return false;
+	}
+	bool ok = (h->magic == SHARED_MAGIC) && (h->version == SHARED_VERSION) && (h->recordSize == sizeof(LG3DSharedRecord)) &&
+		h->ringCapacity && !(h->ringCapacity & (h->ringCapacity-1)) && (h->size == SharedSize(h->ringCapacity, h->maxLights));
+	unsigned long size = h->size;
+	UnmapViewOfFile(h);
+	if (ok)
+		header = (LG3DSharedHeader *)MapViewOfFile(mapping, FILE_MAP_ALL_ACCESS, 0, 0, size);
+	if (!header) {
+		Close();
+		return false;
+	}
+
+	// take the channel, from a controller that is gone if need be
+	LONG pid = (LONG)GetCurrentProcessId();
+	LONG was = InterlockedCompareExchange(&header->writer, pid, 0);
+	if (was && (was != pid)) {
+		if (ProcessAlive(was) || (InterlockedCompareExchange(&header->writer, pid, was) != was)) {
+			Close();
+			return false;
+		}
+	}
+	ring = (LG3DSharedRecord *)((unsigned char *)header + RingOffset());
+	ringCapacity = header->ringCapacity;
+	maxLights = (int)header->maxLights;
+	isRenderer = false;
+	lastBeat = header->beat;
+	dropped = 0;
+	return true;
+}
+
+void LG3DSharedChannel::Close()
+{
+	if (header) {
+		if (!isRenderer)
+			InterlockedCompareExchange(&header->writer, 0, (LONG)GetCurrentProcessId());
+		UnmapViewOfFile(header);
+	}
+	if (mapping)
+		CloseHandle(mapping);
+	free(lightBatch);
+	free(objectBatch);
+	mapping = NULL;
+	header = NULL;
+	ring = NULL;
+	lightBatch = NULL;
+	objectBatch = NULL;
+}
+
+bool LG3DSharedChannel::Push(unsigned long type, const void *update, int size, LONGLONG stamp)
+{
+	if (!header || isRenderer)
+		return false;
+	LONG tail = header->tail;
+	if ((unsigned long)(tail - header->head) >= ringCapacity) {
+		dropped++;
+		return false;
+	}
+	LG3DSharedRecord *r = &ring[tail & (ringCapacity-1)];
+	r->type = type;
+	r->stamp = stamp;
+	memcpy(r->body, update, size);
+	InterlockedExchange(&header->tail, tail+1); // the record is complete before the renderer can see it
+	return true;
+}
+
+bool LG3DSharedChannel::PushLight(const LG3DLightUpdate *update, LONGLONG stamp)
+{
+	return Push(SHARED_LIGHT, update, sizeof(LG3DLightUpdate), stamp);
+}
+
+bool LG3DSharedChannel::PushObject(const LG3DObjectUpdate *update, LONGLONG stamp)
+{
+	return Push(SHARED_OBJECT, update, sizeof(LG3DObjectUpdate), stamp);
+}
+
+int LG3DSharedChannel::PushLights(const LG3DLightUpdate *updates, int numUpdates, LONGLONG stamp)
+{
+	if (!header || isRenderer)
+		return 0;
+	LONG tail = header->tail;
+	unsigned long waiting = (unsigned long)(tail - header->head);
+	int room = (waiting < ringCapacity) ? (int)(ringCapacity - waiting) : 0;
+	int n, num = min(numUpdates, room);
+	for(n=0;n<num;n++) {
+		LG3DSharedRecord *r = &ring[(tail+n) & (ringCapacity-1)];
+		r->type = SHARED_LIGHT;
+		r->stamp = stamp;
+		memcpy(r->body, &updates[n], sizeof(LG3DLightUpdate));
+	}
+	InterlockedExchange(&header->tail, tail+num);
+	dropped += numUpdates - num;
+	return num;
+}
+
+int LG3DSharedChannel::Apply(LG3DControlData *data)
+{
+	if (!header || !isRenderer)
+		return 0;
+	LONG head = header->head;
+	LONG tail = header->tail;
+	if ((unsigned long)(tail - head) > ringCapacity) {
+		// nothing a working controller could have done, start again from where it is
+		InterlockedExchange(&header->head, tail);
+		return 0;
+	}
+
+	// runs of light records & of object records are applied together, each one checked first
+	int numLights = 0, numObjects = 0, taken = 0;
+	for(;head!=tail;head++,taken++) {
+		const LG3DSharedRecord *r = &ring[head & (ringCapacity-1)];
+		unsigned long type = r->type;
+		if (r->stamp)
+			lastStamp = r->stamp;
+		if ((type == SHARED_LIGHT) && !numObjects) {
+			LG3DLightUpdate *u = &lightBatch[numLights];
+			memcpy(u, r->body, sizeof(LG3DLightUpdate));
+			if (!data->LightInUse(u->index))
+				continue;
+			u->relative = SharedBool(&u->relative);
+			u->enabled = SharedBool(&u->enabled);
+			u->castsShadows = SharedBool(&u->castsShadows);
+			if (++numLights == SHARED_BATCH) {
+				data->UpdateLights(lightBatch, numLights);
+				numLights = 0;
+			}
+		} else if ((type == SHARED_OBJECT) && !numLights) {
+			LG3DObjectUpdate *u = &objectBatch[numObjects];
+			memcpy(u, r->body, sizeof(LG3DObjectUpdate));
+			if (!data->ObjectInUse(u->index))
+				continue;
+			u->relative = SharedBool(&u->relative);
+			if (++numObjects == SHARED_BATCH) {
+				data->UpdateObjects(objectBatch, numObjects);
+				numObjects = 0;
+			}
+		} else if ((type == SHARED_LIGHT) || (type == SHARED_OBJECT)) {
+			// the other kind's run ends here, apply it & take this record again
+			if (numLights)
+				data->UpdateLights(lightBatch, numLights);
+			if (numObjects)
+				data->UpdateObjects(objectBatch, numObjects);
+			numLights = numObjects = 0;
+			head--;
+			taken--;
+		}
+	}
+	if (numLights)
+		data->UpdateLights(lightBatch, numLights);
+	if (numObjects)
+		data->UpdateObjects(objectBatch, numObjects);
+	InterlockedExchange(&header->head, tail);
+	return taken;
+}
+
+void LG3DSharedChannel::Publish(const LG3DControlData *data)
+{
+	if (!header || !isRenderer)
+		return;
+	if (published && (data->generation == publishedGeneration)) {
+		InterlockedIncrement(&header->beat); // nothing changed, the last state stands
+		return;
+	}
+	publishedGeneration = data->generation;
+	published = true;
+	int b = 1 - (header->published & 1);
+	InterlockedIncrement(&header->stateSeq[b]);
+	const LG3DLightTable *t = &data->lights;
+	LG3DSharedLightState *s = State(b);
+	int i, n = min(t->count, maxLights);
+	for(i=0;i<n;i++,s++) {
+		s->position.x = t->posX[i];
+		s->position.y = t->posY[i];
+		s->position.z = t->posZ[i];
+		s->orientation.h = t->head[i];
+		s->orientation.p = t->pitch[i];
+		s->orientation.r = t->roll[i];
+		s->colorR = t->colorR[i];
+		s->colorG = t->colorG[i];
+		s->colorB = t->colorB[i];
+		s->flags = t->flags[i];
+	}
+	header->numLights[b] = n;
+	InterlockedIncrement(&header->stateSeq[b]);
+	InterlockedExchange(&header->published, b);
+	InterlockedIncrement(&header->beat);
+}
+
+int LG3DSharedChannel::ReadState(LG3DSharedLightState *lights, int maxCount, unsigned long *publishCount) const
+{
+	if (!header)
+		return -1;
+	int tries;
+	for(tries=0;tries<SHARED_READ_TRIES;tries++) {
+		int b = header->published & 1;
+		LONG seq = header->stateSeq[b];
+		if (seq & 1) {
+			YieldProcessor();
+			continue;
+		}
+		LONG beat = header->beat;
+		int n = min(min((int)header->numLights[b], maxCount), maxLights);
+		if (n > 0)
+			memcpy(lights, State(b), sizeof(LG3DSharedLightState) * n);
+		MemoryBarrier();
+		if (header->stateSeq[b] == seq) {
+			if (publishCount)
+				*publishCount = (unsigned long)beat;
+			return max(n, 0);
+		}
+	}
+	return -1;
+}
+
+// a controller that went away without closing is let go of here, the same as Open would
+bool LG3DSharedChannel::ControllerAttached() const
+{
+	if (!header || !isRenderer)
+		return false;
+	LONG was = header->writer;
+	if (was && !ProcessAlive(was)) {
+		InterlockedCompareExchange(&header->writer, 0, was);
+		return false;
+	}
+	return was != 0;
+}
+
+bool LG3DSharedChannel::RendererAlive()
+{
+	if (!header)
+		return false;
+	LONG beat = header->beat;
+	bool alive = beat != lastBeat;
+	lastBeat = beat;
+	return alive;
+}
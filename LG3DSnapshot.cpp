@@ -0,0 +1,281 @@
+#include "lg3d.h"
+
+// lights & objects are tracked and copied in blocks of this many entries
+#define SNAPSHOT_BLOCK_SHIFT 6
+#define SNAPSHOT_BLOCK_SIZE (1<<SNAPSHOT_BLOCK_SHIFT)
+
+// or'd into LG3DSnapshot::middle when the buffer there holds a state the renderer has not seen
+#define SNAPSHOT_FRESH 4
+
+struct LG3DSnapshotSlot {
+	unsigned long	seq;					// publish number of the state held here, 0 if never filled
+	LG3DLightTable	lights;
+	unsigned long	*lightBlockSeq;			// the writer's block publish numbers when this state was published
+	int				numLightBlocks;
+	int				numObjects;
+	LG3DPosition	*objectPosition;
+	LG3DOrientation	*objectOrientation;
+	int				*objectParent;
+	unsigned long	*objectBlockSeq;
+	int				numObjectBlocks;
+	int				numNodes;
+	LG3DSceneNode	*node;
+	unsigned long	nodeSeq;				// the writer's nodeSeq when this state was published
+	LG3DLightColor	ambient;
+	int				curLight;
+	bool			wantShadows;
+	bool			wantEffects;
+
+	LG3DSnapshotSlot()
+	{
+		seq = 0;
+		lightBlockSeq = NULL;
+		numLightBlocks = 0;
+		numObjects = 0;
+		objectPosition = NULL;
+		objectOrientation = NULL;
+		objectParent = NULL;
+		objectBlockSeq = NULL;
+		numObjectBlocks = 0;
+		numNodes = 0;
+		node = NULL;
+		nodeSeq = 0;
+		ambient.r = ambient.g = ambient.b = 0;
+		curLight = -1;
+		wantShadows = false;
+		wantEffects = false;
+	}
+
+	~LG3DSnapshotSlot()
+	{
+		free(lightBlockSeq);
+		free(objectPosition);
+		free(objectOrientation);
+		free(objectParent);
+		free(objectBlockSeq);
+		delete [] node;
+	}
+};
+
+static int NumBlocks(int count)
+{
+	return (count + SNAPSHOT_BLOCK_SIZE-1) >> SNAPSHOT_BLOCK_SHIFT;
+}
+
+// grow a block sequence array, new entries are set to fill
+static void GrowBlockSeq(unsigned long **blockSeq, int *numBlocks, int newNumBlocks, unsigned long fill)
+{
+	if (newNumBlocks <= *numBlocks)
+		return;
+	*blockSeq = (unsigned long *)realloc(*blockSeq, sizeof(unsigned long) * newNumBlocks);
+	int b;
+	for(b=*numBlocks;b<newNumBlocks;b++)
+		(*blockSeq)[b] = fill;
+	*numBlocks = newNumBlocks;
+}
+
+// LG3DDirtyFieldType bits of the fields that differ between light i of the two tables
+static unsigned long DiffLight(const LG3DLightTable *a, const LG3DLightTable *b, int i)
+{
+	unsigned long fields = 0;
+	if (a->posX[i] != b->posX[i] || a->posY[i] != b->posY[i] || a->posZ[i] != b->posZ[i])
+		fields |= LG3DDirty_Position;
+	if (a->head[i] != b->head[i] || a->pitch[i] != b->pitch[i] || a->roll[i] != b->roll[i])
+		fields |= LG3DDirty_Orientation;
+	if (a->colorR[i] != b->colorR[i] || a->colorG[i] != b->colorG[i] || a->colorB[i] != b->colorB[i])
+		fields |= LG3DDirty_Color;
+	if (a->umbra[i] != b->umbra[i] || a->penumbra[i] != b->penumbra[i])
+		fields |= LG3DDirty_Cone;
+	if (a->att1[i] != b->att1[i] || a->att2[i] != b->att2[i])
+		fields |= LG3DDirty_Attenuation;
+	unsigned long flags = a->flags[i] ^ b->flags[i];
+	if (flags & LG3DLightFlag_Enabled)
+		fields |= LG3DDirty_Enabled;
+	if (flags & LG3DLightFlag_CastsShadows)
+		fields |= LG3DDirty_Shadows;
+	// the renderer only rebuilds its attach lists & gobo textures for these bits
+	if (a->parentNode[i] != b->parentNode[i])
+		fields |= LG3DDirty_Node | LG3DDirty_Position | LG3DDirty_Orientation;
+	if ((flags & LG3DLightFlag_HasGobo) || (a->cold[i].goboName != b->cold[i].goboName))
+		fields |= LG3DDirty_Slot;
+	return fields;
+}
+
+// CopyRange leaves out the cold data, the gobo names are copied apart
+static void CopyLights(LG3DLightTable *dst, const LG3DLightTable *src, int first, int num)
+{
+	dst->CopyRange(src, first, num);
+	memcpy(&dst->cold[first], &src->cold[first], sizeof(LG3DLightColdData) * num);
+}
+
+LG3DSnapshot::LG3DSnapshot()
+{
+	slot = new LG3DSnapshotSlot[3];
+	back = 0;
+	middle = 1;
+	front = 2;
+	writeSeq = 0;
+	lightBlockSeq = NULL;
+	objectBlockSeq = NULL;
+	numLightBlocks = 0;
+	numObjectBlocks = 0;
+	nodeSeq = 0;
+	readSeq = 0;
+}
+
+LG3DSnapshot::~LG3DSnapshot()
+{
+	delete [] slot;
+	free(lightBlockSeq);
+	free(objectBlockSeq);
+}
+
+void LG3DSnapshot::AttachWriter(LG3DControlData *writer)
+{
+	writer->LoadScene();
+	writer->AllocDirtyState(); // everything starts out dirty, so the first publish copies it all
+}
+
+void LG3DSnapshot::Publish(LG3DControlData *writer)
+{
+	int b, i, n;
+	writeSeq++;
+
+	// fold the writer's dirty lists into the per-block change numbers.  Blocks that are
+	// new (first publish, or the rig grew) count as changed.
+	int numLights = writer->lights.count;
+	int numObjects = writer->numSceneObjects;
+	GrowBlockSeq(&lightBlockSeq, &numLightBlocks, NumBlocks(numLights), writeSeq);
+	GrowBlockSeq(&objectBlockSeq, &numObjectBlocks, NumBlocks(numObjects), writeSeq);
+	for(n=0;n<writer->numDirtyLights;n++)
+		lightBlockSeq[writer->dirtyLightList[n] >> SNAPSHOT_BLOCK_SHIFT] = writeSeq;
+	for(n=0;n<writer->numDirtyObjects;n++)
+		objectBlockSeq[writer->dirtyObjectList[n] >> SNAPSHOT_BLOCK_SHIFT] = writeSeq;
+	if (writer->firstDirtyNode < writer->numSceneNodes)
+		nodeSeq = writeSeq;
+	writer->ClearDirtyState();
+
+	// bring the back buffer up to date, copying only the blocks changed since it was last filled
+	LG3DSnapshotSlot *s = &slot[back];
+	if (s->lights.count != numLights) {
+		s->lights.Resize(numLights);
+		s->seq = 0;
+	}
+	if (s->numObjects != numObjects) {
+		s->objectPosition = (LG3DPosition *)realloc(s->objectPosition, sizeof(LG3DPosition) * (numObjects+1));
+		s->objectOrientation = (LG3DOrientation *)realloc(s->objectOrientation, sizeof(LG3DOrientation) * (numObjects+1));
+		s->objectParent = (int *)realloc(s->objectParent, sizeof(int) * (numObjects+1));
+		s->numObjects = numObjects;
+		s->seq = 0;
+	}
+	GrowBlockSeq(&s->lightBlockSeq, &s->numLightBlocks, numLightBlocks, 0);
+	GrowBlockSeq(&s->objectBlockSeq, &s->numObjectBlocks, numObjectBlocks, 0);
+
+	for(b=0;b<NumBlocks(numLights);b++) {
+		if (lightBlockSeq[b] > s->seq) {
+			int first = b << SNAPSHOT_BLOCK_SHIFT;
+			int num = min(SNAPSHOT_BLOCK_SIZE, numLights - first);
+			CopyLights(&s->lights, &writer->lights, first, num);
+		}
+	}
+	memcpy(s->lightBlockSeq, lightBlockSeq, sizeof(unsigned long) * numLightBlocks);
+
+	for(b=0;b<NumBlocks(numObjects);b++) {
+		if (objectBlockSeq[b] > s->seq) {
+			int last = min((b+1) << SNAPSHOT_BLOCK_SHIFT, numObjects);
+			for(i=b << SNAPSHOT_BLOCK_SHIFT;i<last;i++) {
+				s->objectPosition[i] = writer->sceneObjectList[i].position;
+				s->objectOrientation[i] = writer->sceneObjectList[i].orientation;
+				s->objectParent[i] = writer->sceneObjectList[i].parentNode;
+			}
+		}
+	}
+	memcpy(s->objectBlockSeq, objectBlockSeq, sizeof(unsigned long) * numObjectBlocks);
+
+	// there are only a handful of nodes, they are copied all together
+	if (s->numNodes != writer->numSceneNodes) {
+		delete [] s->node;
+		s->node = new LG3DSceneNode[writer->numSceneNodes];
+		s->numNodes = writer->numSceneNodes;
+		s->seq = 0;
+	}
+	if (nodeSeq > s->seq) {
+		for(i=0;i<s->numNodes;i++)
+			s->node[i] = writer->sceneNodeList[i];
+	}
+	s->nodeSeq = nodeSeq;
+
+	s->ambient = writer->ambient;
+	s->curLight = writer->curLight;
+	s->wantShadows = writer->wantShadows;
+	s->wantEffects = writer->wantEffects;
+	s->seq = writeSeq;
+
+	// hand the filled buffer over, and take back whichever one was in the middle
+	back = InterlockedExchange(&middle, back | SNAPSHOT_FRESH) & ~SNAPSHOT_FRESH;
+}
+
+bool LG3DSnapshot::Acquire(LG3DControlData *reader)
+{
+	int b, i;
+	if (!(middle & SNAPSHOT_FRESH))
+		return false;
+	front = InterlockedExchange(&middle, front) & ~SNAPSHOT_FRESH;
+	LG3DSnapshotSlot *s = &slot[front];
+
+	// only blocks changed since our last acquire are looked at, and only the
+	// lights & objects in them that really differ are marked dirty
+	int numLights = min(s->lights.count, reader->lights.count);
+	for(b=0;b<NumBlocks(numLights);b++) {
+		if (s->lightBlockSeq[b] > readSeq) {
+			int first = b << SNAPSHOT_BLOCK_SHIFT;
+			int num = min(SNAPSHOT_BLOCK_SIZE, numLights - first);
+			for(i=first;i<first+num;i++) {
+				unsigned long fields = DiffLight(&reader->lights, &s->lights, i);
+				if (fields)
+					reader->MarkLightDirty(i, fields);
+			}
+			CopyLights(&reader->lights, &s->lights, first, num);
+		}
+	}
+
+	int numObjects = min(s->numObjects, reader->numSceneObjects);
+	for(b=0;b<NumBlocks(numObjects);b++) {
+		if (s->objectBlockSeq[b] > readSeq) {
+			int last = min((b+1) << SNAPSHOT_BLOCK_SHIFT, numObjects);
+			for(i=b << SNAPSHOT_BLOCK_SHIFT;i<last;i++) {
+				LG3DSceneObject *obj = &reader->sceneObjectList[i];
+				unsigned long fields = 0;
+				if (memcmp(&obj->position, &s->objectPosition[i], sizeof(LG3DPosition)))
+					fields |= LG3DDirty_Position;
+				if (memcmp(&obj->orientation, &s->objectOrientation[i], sizeof(LG3DOrientation)))
+					fields |= LG3DDirty_Orientation;
+				if (obj->parentNode != s->objectParent[i])
+					fields |= LG3DDirty_Node | LG3DDirty_Position | LG3DDirty_Orientation;
+				if (fields) {
+					obj->position = s->objectPosition[i];
+					obj->orientation = s->objectOrientation[i];
+					obj->parentNode = s->objectParent[i];
+					reader->MarkObjectDirty(i, fields);
+				}
+			}
+		}
+	}
+
+	if (s->nodeSeq > readSeq) {
+		int numNodes = min(s->numNodes, reader->numSceneNodes);
+		for(i=0;i<numNodes;i++) {
+			if (memcmp(&reader->sceneNodeList[i], &s->node[i], sizeof(LG3DSceneNode))) {
+				reader->sceneNodeList[i] = s->node[i];
+				reader->MarkNodeDirty(i, LG3DDirty_Transform);
+			}
+		}
+	}
+
+	reader->ambient = s->ambient;
+	reader->curLight = s->curLight;
+	reader->wantShadows = s->wantShadows;
+	reader->wantEffects = s->wantEffects;
+	readSeq = s->seq;
+	return true;
+}
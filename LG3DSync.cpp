@@ -0,0 +1,947 @@
+#include <winsock2.h>
+#include <math.h>
+
+#include "lg3d.h"
+
+#pragma comment( lib, "ws2_32.lib" )
+
+// A message is a header of little endian words
+//
+//	size		of the whole message, header included
+//	type		SYNC_KEYFRAME or SYNC_DELTA in the low byte, the version in the next
+//	sequence	one more than the delta before it, a keyframe has that of its frame's delta
+//	counts		lights, objects & nodes of the rig
+//	listed		how many lights, objects & nodes the message carries
+//
+// then a stream of bits, low bits first.  For each light listed, then each object, then each
+// node: its index (zigzagged, from the one before), its group bits (see the tables below) and
+// for each group set, the difference of each of its values from the last sent, zigzagged.  A
+// keyframe is the difference from all zeros, every light, object & node with every group.
+// Numbers are sent as
+//
+//	0				zero
+//	10 + 7 bits		below 128
+//	110 + 15 bits	below 32768
+//	1110 + 23 bits	below 8388608
+//	1111 + 32 bits
+
+#define SYNC_VERSION 1
+
+#define SYNC_KEYFRAME 1
+#define SYNC_DELTA 2
+
+#define SYNC_HEADER 36
+
+#define SYNC_LIGHT_VALUES 16
+#define SYNC_OBJECT_VALUES 7
+#define SYNC_NODE_VALUES 6
+
+// worst cases in bytes: index, group bits & values of 36 bits at most
+#define SYNC_MAX_NUMBER 5
+#define SYNC_MAX_LIGHT ((2 + SYNC_LIGHT_VALUES) * SYNC_MAX_NUMBER)
+#define SYNC_MAX_OBJECT ((2 + SYNC_OBJECT_VALUES) * SYNC_MAX_NUMBER)
+#define SYNC_MAX_NODE ((2 + SYNC_NODE_VALUES) * SYNC_MAX_NUMBER)
+
+// a client this far behind is skipped, it gets a keyframe once it has caught up
+#define SYNC_MAX_PENDING (1024*1024)
+#define SYNC_SEND_BUFFER (256*1024)
+#define SYNC_RECEIVE_BUFFER (1024*1024)
+
+// anything bigger is taken as a broken stream
+#define SYNC_MAX_MESSAGE (64*1024*1024)
+#define SYNC_RECEIVE_CHUNK 65536
+
+#define SYNC_BATCH 256
+
+// quantized values are kept within this
+#define SYNC_LIMIT 2000000000.0
+
+struct SyncGroup {
+	unsigned long	field;					// LG3DDirtyFieldType
+	int				offset;
+	int				count;
+};
+
+static const SyncGroup lightGroup[] = {
+	{LG3DDirty_Position, 0, 3},				// millimeters
+	{LG3DDirty_Orientation, 3, 3},			// hundredths of a degree
+	{LG3DDirty_Color, 6, 3},				// 0 to 255
+	{LG3DDirty_Cone, 9, 2},					// hundredths of a degree
+	{LG3DDirty_Attenuation, 11, 2},			// float bits
+	{LG3DDirty_Enabled, 13, 1},
+	{LG3DDirty_Shadows, 14, 1},
+	{LG3DDirty_Node, 15, 1},
+}, objectGroup[] = {
+	{LG3DDirty_Position, 0, 3},
+	{LG3DDirty_Orientation, 3, 3},
+	{LG3DDirty_Node, 6, 1},
+}, nodeGroup[] = {
+	{LG3DDirty_Position, 0, 3},
+	{LG3DDirty_Orientation, 3, 3},
+};
+
+#define SYNC_LIGHT_GROUPS ((int)(sizeof(lightGroup) / sizeof(lightGroup[0])))
+#define SYNC_OBJECT_GROUPS ((int)(sizeof(objectGroup) / sizeof(objectGroup[0])))
+#define SYNC_NODE_GROUPS ((int)(sizeof(nodeGroup) / sizeof(nodeGroup[0])))
+
+// group bits the client applies other than through UpdateLights & UpdateObjects
+#define SYNC_LIGHT_NODE (1<<7)
+#define SYNC_OBJECT_TRANSFORM 3
+#define SYNC_OBJECT_NODE (1<<2)
+
+static const int syncZero[SYNC_LIGHT_VALUES] = {0};
+
+struct LG3DSyncPeer {
+	SOCKET			sock;
+	unsigned char	*out;					// queued messages, sent from outSent on
+	int				outSize, outSent, outCapacity;
+	bool			needKey;				// new, or skipped some deltas
+};
+
+struct SyncBits {
+	unsigned char	*p;
+	ULONGLONG		acc;
+	int				numBits;
+};
+
+struct SyncReader {
+	const unsigned char *p, *end;
+	ULONGLONG		acc;
+	int				numBits;
+	bool			bad;					// ran off the end
+};
+
+// ---------------------------------------------------------
+// quantizing
+// ---------------------------------------------------------
+static int Quantize(float value, double scale)
+{
+	double q = floor(value * scale + 0.5);
+	if (!(q >= -SYNC_LIMIT)) // and NaN
+		q = -SYNC_LIMIT;
+	else if (q > SYNC_LIMIT)
+		q = SYNC_LIMIT;
+	return (int)q;
+}
+
+static int FloatBits(float f)
+{
+	int bits;
+	memcpy(&bits, &f, sizeof(bits));
+	return bits;
+}
+
+static float BitsFloat(int bits)
+{
+	float f;
+	memcpy(&f, &bits, sizeof(f));
+	return f;
+}
+
+static void QuantizeTransform(const LG3DPosition *pos, const LG3DOrientation *orient, int *v)
+{
+	v[0] = Quantize(pos->x, 1000.0);
+	v[1] = Quantize(pos->y, 1000.0);
+	v[2] = Quantize(pos->z, 1000.0);
+	v[3] = Quantize(orient->h, 100.0);
+	v[4] = Quantize(orient->p, 100.0);
+	v[5] = Quantize(orient->r, 100.0);
+}
+
+static void GatherLight(const LG3DControlData *data, int i, int *v)
+{
+	const LG3DLightTable *t = &data->lights;
+	LG3DPosition pos = {t->posX[i], t->posY[i], t->posZ[i]};
+	LG3DOrientation orient = {t->head[i], t->pitch[i], t->roll[i]};
+	QuantizeTransform(&pos, &orient, v);
+	LG3DLightColor color;
+	data->GetLightColor(i, &color);
+	v[6] = color.r;
+	v[7] = color.g;
+	v[8] = color.b;
+	v[9] = Quantize(t->umbra[i], 100.0);
+	v[10] = Quantize(t->penumbra[i], 100.0);
+	v[11] = FloatBits(t->att1[i]);
+	v[12] = FloatBits(t->att2[i]);
+	v[13] = (t->flags[i] & LG3DLightFlag_Enabled) != 0;
+	v[14] = (t->flags[i] & LG3DLightFlag_CastsShadows) != 0;
+	v[15] = t->parentNode[i];
+}
+
+static void GatherObject(const LG3DControlData *data, int i, int *v)
+{
+	const LG3DSceneObject *o = &data->sceneObjectList[i];
+	QuantizeTransform(&o->position, &o->orientation, v);
+	v[6] = o->parentNode;
+}
+
+static void GatherNode(const LG3DControlData *data, int i, int *v)
+{
+	const LG3DSceneNode *n = &data->sceneNodeList[i];
+	QuantizeTransform(&n->position, &n->orientation, v);
+}
+
+static unsigned long ChangedGroups(unsigned long dirty, const SyncGroup *group, int numGroups, const int *v, const int *old)
+{
+	unsigned long groups = 0;
+	int g;
+	for(g=0;g<numGroups;g++)
+		if ((dirty & group[g].field) && memcmp(&v[group[g].offset], &old[group[g].offset], sizeof(int) * group[g].count))
+			groups |= 1 << g;
+	return groups;
+}
+
+// ---------------------------------------------------------
+// bit streams
+// ---------------------------------------------------------
+static void PutBits(SyncBits *w, unsigned long value, int n)
+{
+	w->acc |= (ULONGLONG)value << w->numBits;
+	w->numBits += n;
+	while (w->numBits >= 8) {
+		*w->p++ = (unsigned char)w->acc;
+		w->acc >>= 8;
+		w->numBits -= 8;
+	}
+}
+
+static void PutNumber(SyncBits *w, unsigned long z)
+{
+	if (z == 0)
+		PutBits(w, 0, 1);
+	else if (z < (1<<7)) {
+		PutBits(w, 1, 2);
+		PutBits(w, z, 7);
+	} else if (z < (1<<15)) {
+		PutBits(w, 3, 3);
+		PutBits(w, z, 15);
+	} else if (z < (1<<23)) {
+		PutBits(w, 7, 4);
+		PutBits(w, z, 23);
+	} else {
+		PutBits(w, 15, 4);
+		PutBits(w, z, 32);
+	}
+}
+
+static void PutDifference(SyncBits *w, int value, int old)
+{
+	int d = (int)((unsigned long)value - (unsigned long)old);
+	PutNumber(w, ((unsigned long)d << 1) ^ (unsigned long)(d >> 31));
+}
+
+static void EndBits(SyncBits *w)
+{
+	if (w->numBits)
+		*w->p++ = (unsigned char)w->acc;
+	w->acc = 0;
+	w->numBits = 0;
+}
+
+static unsigned long GetBits(SyncReader *r, int n)
+{
+	while (r->numBits < n) {
+		if (r->p >= r->end) {
+			r->bad = true;
+			return 0;
+		}
+		r->acc |= (ULONGLONG)*r->p++ << r->numBits;
+		r->numBits += 8;
+	}
+	unsigned long v = (unsigned long)(r->acc & (((ULONGLONG)1 << n) - 1));
+	r->acc >>= n;
+	r->numBits -= n;
+	return v;
+}
+
+static unsigned long GetNumber(SyncReader *r)
+{
+	if (!GetBits(r, 1))
+		return 0;
+	if (!GetBits(r, 1))
+		return GetBits(r, 7);
+	if (!GetBits(r, 1))
+		return GetBits(r, 15);
+	if (!GetBits(r, 1))
+		return GetBits(r, 23);
+	return GetBits(r, 32);
+}
+
+static int GetDifference(SyncReader *r)
+{
+	unsigned long z = GetNumber(r);
+	return (int)((z >> 1) ^ (0 - (z & 1)));
+}
+
+static void PutEntry(SyncBits *w, int index, int *prev, unsigned long groups, const SyncGroup *group, int numGroups, int *v, const int *old)
+{
+	PutDifference(w, index, *prev);
+	*prev = index;
+	PutBits(w, groups, numGroups);
+	int g, k;
+	for(g=0;g<numGroups;g++) {
+		if (!(groups & (1 << g)))
+			continue;
+		for(k=group[g].offset;k<group[g].offset+group[g].count;k++)
+			PutDifference(w, v[k], old[k]);
+	}
+}
+
+// the index & values of one entry into state, -1 if the stream is bad
+static int GetEntry(SyncReader *r, int *prev, int count, unsigned long *groups, const SyncGroup *group, int numGroups, int *state, int numValues)
+{
+	int index = (int)((unsigned long)*prev + (unsigned long)GetDifference(r));
+	*groups = GetBits(r, numGroups);
+	if (r->bad || (index < 0) || (index >= count))
+		return -1;
+	*prev = index;
+	int *v = &state[index * numValues];
+	int g, k;
+	for(g=0;g<numGroups;g++) {
+		if (!(*groups & (1 << g)))
+			continue;
+		for(k=group[g].offset;k<group[g].offset+group[g].count;k++)
+			v[k] = (int)((unsigned long)v[k] + (unsigned long)GetDifference(r));
+	}
+	return r->bad ? -1 : index;
+}
+
+static void PutLong(unsigned char *p, unsigned long v)
+{
+	p[0] = (unsigned char)v;
+	p[1] = (unsigned char)(v >> 8);
+	p[2] = (unsigned char)(v >> 16);
+	p[3] = (unsigned char)(v >> 24);
+}
+
+static unsigned long GetLong(const unsigned char *p)
+{
+	return p[0] | (p[1] << 8) | (p[2] << 16) | ((unsigned long)p[3] << 24);
+}
+
+static void PutHeader(unsigned char *p, int size, int type, unsigned long sequence, int numLights, int numObjects, int numNodes,
+	int listedLights, int listedObjects, int listedNodes)
+{
+	PutLong(p, size);
+	PutLong(p + 4, type | (SYNC_VERSION << 8));
+	PutLong(p + 8, sequence);
+	PutLong(p + 12, numLights);
+	PutLong(p + 16, numObjects);
+	PutLong(p + 20, numNodes);
+	PutLong(p + 24, listedLights);
+	PutLong(p + 28, listedObjects);
+	PutLong(p + 32, listedNodes);
+}
+
+static void Grow(unsigned char **buffer, int *capacity, int size)
+{
+	if (size <= *capacity)
+		return;
+	*capacity = max(size, *capacity * 2);
+	*buffer = (unsigned char *)realloc(*buffer, *capacity);
+}
+
+// ---------------------------------------------------------
+// server
+// ---------------------------------------------------------
+LG3DSyncServer::LG3DSyncServer()
+{
+	sock = INVALID_SOCKET;
+	maxPeers = 0;
+	peer = NULL;
+	numPeers = 0;
+	state = NULL;
+	numLights = numObjects = numNodes = 0;
+	haveState = false;
+	sequence = 0;
+	keyframeInterval = 300;
+	sinceKeyframe = 0;
+	delta = NULL;
+	deltaSize = deltaCapacity = 0;
+	key = NULL;
+	keySize = keyCapacity = 0;
+	keyBuilt = false;
+	bytesSent = 0;
+	keyframesSent = 0;
+}
+
+LG3DSyncServer::~LG3DSyncServer()
+{
+	Close();
+	free(state);
+	free(delta);
+	free(key);
+}
+
+bool LG3DSyncServer::Listen(unsigned short port, int maxClients)
+{
+	WSADATA wsa;
+	Close();
+	if (WSAStartup(MAKEWORD(2, 2), &wsa) != 0)
+		return false;
+	SOCKET s = socket(AF_INET, SOCK_STREAM, IPPROTO_TCP);
+	if (s == INVALID_SOCKET) {
+		WSACleanup();
+		return false;
+	}
+	sockaddr_in addr;
+	memset(&addr, 0, sizeof(addr));
+	addr.sin_family = AF_INET;
+	addr.sin_port = htons(port);
+	addr.sin_addr.s_addr = htonl(INADDR_ANY);
+	u_long nonBlocking = 1;
+	if ((bind(s, (const sockaddr *)&addr, sizeof(addr)) != 0) || (listen(s, SOMAXCONN) != 0) ||
+		(ioctlsocket(s, FIONBIO, &nonBlocking) != 0)) {
+		closesocket(s);
+		WSACleanup();
+		return false;
+	}
+	sock = s;
+	maxPeers = max(maxClients, 1);
+	peer = (LG3DSyncPeer *)malloc(sizeof(LG3DSyncPeer) * maxPeers);
+	numPeers = 0;
+	haveState = false;
+	return true;
+}
+
+void LG3DSyncServer::Close()
+{
+	if (sock == INVALID_SOCKET)
+		return;
+	while (numPeers)
+		Drop(numPeers-1);
+	free(peer);
+	peer = NULL;
+	closesocket(sock);
+	WSACleanup();
+	sock = INVALID_SOCKET;
+	haveState = false;
+}
+
+bool LG3DSyncServer::IsOpen() const
+{
+	return sock != INVALID_SOCKET;
+}
+
+void LG3DSyncServer::Drop(int index)
+{
+	closesocket(peer[index].sock);
+	free(peer[index].out);
+	peer[index] = peer[--numPeers];
+}
+
+void LG3DSyncServer::Accept()
+{
+	for(;;) {
+		SOCKET s = accept(sock, NULL, NULL);
+		if (s == INVALID_SOCKET)
+			return;
+		u_long nonBlocking = 1;
+		if ((numPeers == maxPeers) || (ioctlsocket(s, FIONBIO, &nonBlocking) != 0)) {
+			closesocket(s);
+			continue;
+		}
+		int noDelay = 1;
+		int size = SYNC_SEND_BUFFER;
+		setsockopt(s, IPPROTO_TCP, TCP_NODELAY, (const char *)&noDelay, sizeof(noDelay));
+		setsockopt(s, SOL_SOCKET, SO_SNDBUF, (const char *)&size, sizeof(size));
+		LG3DSyncPeer *p = &peer[numPeers++];
+		p->sock = s;
+		p->out = NULL;
+		p->outSize = p->outSent = p->outCapacity = 0;
+		p->needKey = true;
+	}
+}
+
+void LG3DSyncServer::BuildState(const LG3DControlData *data)
+{
+	numLights = data->lights.count;
+	numObjects = data->numSceneObjects;
+	numNodes = data->numSceneNodes;
+	free(state);
+	state = (int *)malloc(sizeof(int) * (numLights * SYNC_LIGHT_VALUES + numObjects * SYNC_OBJECT_VALUES + numNodes * SYNC_NODE_VALUES + 1));
+	int i;
+	int *v = state;
+	for(i=0;i<numLights;i++,v+=SYNC_LIGHT_VALUES)
+		GatherLight(data, i, v);
+	for(i=0;i<numObjects;i++,v+=SYNC_OBJECT_VALUES)
+		GatherObject(data, i, v);
+	for(i=0;i<numNodes;i++,v+=SYNC_NODE_VALUES)
+		GatherNode(data, i, v);
+	haveState = true;
+	sequence++;
+}
+
+void LG3DSyncServer::EncodeDelta(const LG3DControlData *data)
+{
+	int n, i, prev;
+	int v[SYNC_LIGHT_VALUES];
+	unsigned long groups;
+	bool tracked = data->dirtyLightList != NULL; // otherwise everything is compared
+	int numDirtyLights = tracked ? data->numDirtyLights : numLights;
+	int numDirtyObjects = tracked ? data->numDirtyObjects : numObjects;
+	int firstNode = (tracked && data->nodeDirty) ? data->firstDirtyNode : 0;
+	Grow(&delta, &deltaCapacity, SYNC_HEADER + numDirtyLights * SYNC_MAX_LIGHT + numDirtyObjects * SYNC_MAX_OBJECT +
+		(numNodes - firstNode) * SYNC_MAX_NODE + 1);
+
+	SyncBits w;
+	w.p = delta + SYNC_HEADER;
+	w.acc = 0;
+	w.numBits = 0;
+
+	int listedLights = 0;
+	prev = 0;
+	for(n=0;n<numDirtyLights;n++) {
+		i = tracked ? data->dirtyLightList[n] : n;
+		unsigned long dirty = tracked ? data->lights.dirty[i] : LG3DDirty_All;
+		if (dirty & LG3DDirty_Slot)
+			dirty = LG3DDirty_All;
+		int *old = &state[i * SYNC_LIGHT_VALUES];
+		GatherLight(data, i, v);
+		groups = ChangedGroups(dirty, lightGroup, SYNC_LIGHT_GROUPS, v, old);
+		if (groups) {
+			PutEntry(&w, i, &prev, groups, lightGroup, SYNC_LIGHT_GROUPS, v, old);
+			memcpy(old, v, sizeof(int) * SYNC_LIGHT_VALUES);
+			listedLights++;
+		}
+	}
+
+	int listedObjects = 0;
+	int *objectState = &state[numLights * SYNC_LIGHT_VALUES];
+	prev = 0;
+	for(n=0;n<numDirtyObjects;n++) {
+		i = tracked ? data->dirtyObjectList[n] : n;
+		unsigned long dirty = tracked ? data->objectDirty[i] : LG3DDirty_All;
+		if (dirty & LG3DDirty_Slot)
+			dirty = LG3DDirty_All;
+		int *old = &objectState[i * SYNC_OBJECT_VALUES];
+		GatherObject(data, i, v);
+		groups = ChangedGroups(dirty, objectGroup, SYNC_OBJECT_GROUPS, v, old);
+		if (groups) {
+			PutEntry(&w, i, &prev, groups, objectGroup, SYNC_OBJECT_GROUPS, v, old);
+			memcpy(old, v, sizeof(int) * SYNC_OBJECT_VALUES);
+			listedObjects++;
+		}
+	}
+
+	// nodes have no list, only a first dirty one
+	int listedNodes = 0;
+	int *nodeState = &objectState[numObjects * SYNC_OBJECT_VALUES];
+	prev = 0;
+	for(i=firstNode;i<numNodes;i++) {
+		unsigned long dirty = (tracked && data->nodeDirty) ? data->nodeDirty[i] : LG3DDirty_All;
+		if (!dirty)
+			continue;
+		int *old = &nodeState[i * SYNC_NODE_VALUES];
+		GatherNode(data, i, v);
+		groups = ChangedGroups(dirty, nodeGroup, SYNC_NODE_GROUPS, v, old);
+		if (groups) {
+			PutEntry(&w, i, &prev, groups, nodeGroup, SYNC_NODE_GROUPS, v, old);
+			memcpy(old, v, sizeof(int) * SYNC_NODE_VALUES);
+			listedNodes++;
+		}
+	}
+	EndBits(&w);
+
+	if (listedLights + listedObjects + listedNodes) {
+		deltaSize = (int)(w.p - delta);
+		sequence++;
+		PutHeader(delta, deltaSize, SYNC_DELTA, sequence, numLights, numObjects, numNodes, listedLights, listedObjects, listedNodes);
+	}
+}
+
+void LG3DSyncServer::EncodeKeyframe()
+{
+	Grow(&key, &keyCapacity, SYNC_HEADER + numLights * SYNC_MAX_LIGHT + numObjects * SYNC_MAX_OBJECT + numNodes * SYNC_MAX_NODE + 1);
+	SyncBits w;
+	w.p = key + SYNC_HEADER;
+	w.acc = 0;
+	w.numBits = 0;
+	int i, prev;
+	int *v = state;
+	for(i=0,prev=0;i<numLights;i++,v+=SYNC_LIGHT_VALUES)
+		PutEntry(&w, i, &prev, (1 << SYNC_LIGHT_GROUPS) - 1, lightGroup, SYNC_LIGHT_GROUPS, v, syncZero);
+	for(i=0,prev=0;i<numObjects;i++,v+=SYNC_OBJECT_VALUES)
+		PutEntry(&w, i, &prev, (1 << SYNC_OBJECT_GROUPS) - 1, objectGroup, SYNC_OBJECT_GROUPS, v, syncZero);
+	for(i=0,prev=0;i<numNodes;i++,v+=SYNC_NODE_VALUES)
+		PutEntry(&w, i, &prev, (1 << SYNC_NODE_GROUPS) - 1, nodeGroup, SYNC_NODE_GROUPS, v, syncZero);
+	EndBits(&w);
+	keySize = (int)(w.p - key);
+	PutHeader(key, keySize, SYNC_KEYFRAME, sequence, numLights, numObjects, numNodes, numLights, numObjects, numNodes);
+	keyBuilt = true;
+}
+
+bool LG3DSyncServer::Queue(LG3DSyncPeer *p, const unsigned char *message, int size)
+{
+	int pending = p->outSize - p->outSent;
+	if (pending && (pending + size > SYNC_MAX_PENDING))
+		return false;
+	Grow(&p->out, &p->outCapacity, p->outSize + size);
+	memcpy(p->out + p->outSize, message, size);
+	p->outSize += size;
+	return true;
+}
+
+// false once the client has gone
+bool LG3DSyncServer::Flush(LG3DSyncPeer *p)
+{
+	while (p->outSent < p->outSize) {
+		int n = send(p->sock, (const char *)p->out + p->outSent, p->outSize - p->outSent, 0);
+		if (n == SOCKET_ERROR) {
+			if (WSAGetLastError() != WSAEWOULDBLOCK)
+				return false;
+			break;
+		}
+		p->outSent += n;
+		bytesSent += n;
+	}
+	if (p->outSent == p->outSize)
+		p->outSent = p->outSize = 0;
+
+	// clients send nothing, a read that ends is the client hanging up
+	char discard[256];
+	int n = recv(p->sock, discard, sizeof(discard), 0);
+	if (n == 0)
+		return false;
+	if ((n == SOCKET_ERROR) && (WSAGetLastError() != WSAEWOULDBLOCK))
+		return false;
+	return true;
+}
+
+int LG3DSyncServer::Serve(const LG3DControlData *data)
+{
+	if (sock == INVALID_SOCKET)
+		return 0;
+	Accept();
+	deltaSize = 0;
+	keyBuilt = false;
+	if (!numPeers) {
+		haveState = false; // picked up again in full when someone connects
+		return 0;
+	}
+
+	bool everyone = false;
+	if (!haveState || (data->lights.count != numLights) || (data->numSceneObjects != numObjects) || (data->numSceneNodes != numNodes)) {
+		BuildState(data);
+		everyone = true;
+	} else
+		EncodeDelta(data);
+	if (keyframeInterval && (++sinceKeyframe >= keyframeInterval))
+		everyone = true;
+	if (everyone)
+		sinceKeyframe = 0;
+
+	int i, queued = 0;
+	for(i=numPeers-1;i>=0;i--) {
+		LG3DSyncPeer *p = &peer[i];
+		if (everyone)
+			p->needKey = true;
+		if (p->needKey) {
+			if (!keyBuilt)
+				EncodeKeyframe();
+			if (Queue(p, key, keySize)) {
+				p->needKey = false;
+				queued += keySize;
+				keyframesSent++;
+			}
+		} else if (deltaSize) {
+			if (Queue(p, delta, deltaSize))
+				queued += deltaSize;
+			else
+				p->needKey = true;
+		}
+		if (!Flush(p))
+			Drop(i);
+	}
+	return queued;
+}
+
+// ---------------------------------------------------------
+// client
+// ---------------------------------------------------------
+LG3DSyncClient::LG3DSyncClient()
+{
+	sock = INVALID_SOCKET;
+	buffer = NULL;
+	bufferSize = bufferCapacity = 0;
+	state = NULL;
+	numLights = numObjects = numNodes = 0;
+	sequence = 0;
+	connecting = false;
+	inSync = false;
+	mismatched = false;
+	bytesReceived = 0;
+	keyframesTaken = 0;
+	deltasSkipped = 0;
+	lightBatch = (LG3DLightUpdate *)malloc(sizeof(LG3DLightUpdate) * SYNC_BATCH);
+	objectBatch = (LG3DObjectUpdate *)malloc(sizeof(LG3DObjectUpdate) * SYNC_BATCH);
+}
+
+LG3DSyncClient::~LG3DSyncClient()
+{
+	Close();
+	free(buffer);
+	free(state);
+	free(lightBatch);
+	free(objectBatch);
+}
+
+bool LG3DSyncClient::Connect(unsigned long ipAddress, unsigned short port)
+{
+	WSADATA wsa;
+	Close();
+	if (WSAStartup(MAKEWORD(2, 2), &wsa) != 0)
+		return false;
+	SOCKET s = socket(AF_INET, SOCK_STREAM, IPPROTO_TCP);
+	if (s == INVALID_SOCKET) {
+		WSACleanup();
+		return false;
+	}
+	int size = SYNC_RECEIVE_BUFFER;
+	setsockopt(s, SOL_SOCKET, SO_RCVBUF, (const char *)&size, sizeof(size));
+	sockaddr_in addr;
+	memset(&addr, 0, sizeof(addr));
+	addr.sin_family = AF_INET;
+	addr.sin_port = htons(port);
+	addr.sin_addr.s_addr = htonl(ipAddress);
+
+	// the connection is only begun here, Receive sees it through, so a server that doesn't
+	// answer never holds up a frame
+	u_long nonBlocking = 1;
+	if ((ioctlsocket(s, FIONBIO, &nonBlocking) != 0) ||
+		((connect(s, (const sockaddr *)&addr, sizeof(addr)) != 0) && (WSAGetLastError() != WSAEWOULDBLOCK))) {
+		closesocket(s);
+		WSACleanup();
+		return false;
+	}
+	sock = s;
+	connecting = true;
+	bufferSize = 0;
+	inSync = false;
+	mismatched = false;
+	return true;
+}
+
+void LG3DSyncClient::Close()
+{
+	if (sock == INVALID_SOCKET)
+		return;
+	closesocket(sock);
+	WSACleanup();
+	sock = INVALID_SOCKET;
+	connecting = false;
+	bufferSize = 0;
+	inSync = false;
+}
+
+// true once the connection begun by Connect is made, a refused one closes the client
+bool LG3DSyncClient::Connected()
+{
+	fd_set writable, failed;
+	FD_ZERO(&writable);
+	FD_ZERO(&failed);
+	FD_SET(sock, &writable);
+	FD_SET(sock, &failed);
+	timeval now = {0, 0};
+	int n = select(0, NULL, &writable, &failed, &now);
+	if ((n == SOCKET_ERROR) || FD_ISSET(sock, &failed)) {
+		Close();
+		return false;
+	}
+	if (!FD_ISSET(sock, &writable))
+		return false;
+	connecting = false;
+	return true;
+}
+
+bool LG3DSyncClient::IsConnected() const
+{
+	return sock != INVALID_SOCKET;
+}
+
+int LG3DSyncClient::Receive(LG3DControlData *data)
+{
+	int applied = 0;
+	if (connecting && !Connected())
+		return 0;
+	while (sock != INVALID_SOCKET) {
+		Grow(&buffer, &bufferCapacity, bufferSize + SYNC_RECEIVE_CHUNK);
+		int n = recv(sock, (char *)buffer + bufferSize, bufferCapacity - bufferSize, 0);
+		if (n == 0) {
+			Close(); // the server has gone
+			break;
+		}
+		if (n == SOCKET_ERROR) {
+			if (WSAGetLastError() != WSAEWOULDBLOCK)
+				Close();
+			break;
+		}
+		bufferSize += n;
+		bytesReceived += n;
+
+		// the whole messages in
+		int used = 0;
+		while (bufferSize - used >= SYNC_HEADER) {
+			int size = (int)GetLong(buffer + used);
+			if ((size < SYNC_HEADER) || (size > SYNC_MAX_MESSAGE)) {
+				Close();
+				return applied;
+			}
+			if (bufferSize - used < size)
+				break;
+			if (Decode(data, buffer + used, size))
+				applied++;
+			used += size;
+		}
+		bufferSize -= used;
+		memmove(buffer, buffer + used, bufferSize);
+	}
+	return applied;
+}
+
+bool LG3DSyncClient::Decode(LG3DControlData *data, const unsigned char *message, int size)
+{
+	unsigned long type = GetLong(message + 4);
+	if ((type >> 8) != SYNC_VERSION)
+		return false;
+	type &= 0xff;
+	unsigned long seq = GetLong(message + 8);
+	int countLights = (int)GetLong(message + 12);
+	int countObjects = (int)GetLong(message + 16);
+	int countNodes = (int)GetLong(message + 20);
+	int listedLights = (int)GetLong(message + 24);
+	int listedObjects = (int)GetLong(message + 28);
+	int listedNodes = (int)GetLong(message + 32);
+	bool sameRig = (countLights == data->lights.count) && (countObjects == data->numSceneObjects) && (countNodes == data->numSceneNodes);
+
+	if (type == SYNC_KEYFRAME) {
+		mismatched = !sameRig;
+		if (mismatched) {
+			inSync = false;
+			return false;
+		}
+		if (!state || (countLights != numLights) || (countObjects != numObjects) || (countNodes != numNodes)) {
+			numLights = countLights;
+			numObjects = countObjects;
+			numNodes = countNodes;
+			free(state);
+			state = (int *)malloc(sizeof(int) * (numLights * SYNC_LIGHT_VALUES + numObjects * SYNC_OBJECT_VALUES + numNodes * SYNC_NODE_VALUES + 1));
+		}
+		memset(state, 0, sizeof(int) * (numLights * SYNC_LIGHT_VALUES + numObjects * SYNC_OBJECT_VALUES + numNodes * SYNC_NODE_VALUES));
+		keyframesTaken++;
+	} else if ((type != SYNC_DELTA) || !inSync || !sameRig || (seq != sequence + 1)) {
+		// a rig changed here under the mirror is out of step until the server's next keyframe
+		if (!sameRig)
+			inSync = false;
+		deltasSkipped++;
+		return false;
+	}
+	sequence = seq;
+	inSync = true;
+
+	SyncReader r;
+	r.p = message + SYNC_HEADER;
+	r.end = message + size;
+	r.acc = 0;
+	r.numBits = 0;
+	r.bad = false;
+
+	int n, i, prev, batched = 0;
+	unsigned long groups;
+	if ((listedLights < 0) || (listedLights > numLights) || (listedObjects < 0) || (listedObjects > numObjects) ||
+		(listedNodes < 0) || (listedNodes > numNodes))
+		r.bad = true;
+
+	for(n=0,prev=0;(n<listedLights) && !r.bad;n++) {
+		i = GetEntry(&r, &prev, numLights, &groups, lightGroup, SYNC_LIGHT_GROUPS, state, SYNC_LIGHT_VALUES);
+		if (i < 0) {
+			r.bad = true;
+			break;
+		}
+		const int *v = &state[i * SYNC_LIGHT_VALUES];
+		if ((groups & SYNC_LIGHT_NODE) && (v[15] >= -1) && (v[15] < numNodes))
+			data->AttachLight(i, v[15]);
+		LG3DLightUpdate *u = &lightBatch[batched];
+		u->index = i;
+		u->fields = 0;
+		int g;
+		for(g=0;g<SYNC_LIGHT_GROUPS;g++)
+			if ((groups & ~SYNC_LIGHT_NODE) & (1 << g))
+				u->fields |= lightGroup[g].field;
+		u->relative = false;
+		u->position.x = v[0] / 1000.0f;
+		u->position.y = v[1] / 1000.0f;
+		u->position.z = v[2] / 1000.0f;
+		u->orientation.h = v[3] / 100.0f;
+		u->orientation.p = v[4] / 100.0f;
+		u->orientation.r = v[5] / 100.0f;
+		u->color.r = v[6];
+		u->color.g = v[7];
+		u->color.b = v[8];
+		u->umbra = v[9] / 100.0f;
+		u->penumbra = v[10] / 100.0f;
+		u->att1 = BitsFloat(v[11]);
+		u->att2 = BitsFloat(v[12]);
+		u->enabled = v[13] != 0;
+		u->castsShadows = v[14] != 0;
+		if (u->fields && (++batched == SYNC_BATCH)) {
+			data->UpdateLights(lightBatch, batched);
+			batched = 0;
+		}
+	}
+	if (batched)
+		data->UpdateLights(lightBatch, batched);
+
+	int *objectState = &state[numLights * SYNC_LIGHT_VALUES];
+	batched = 0;
+	for(n=0,prev=0;(n<listedObjects) && !r.bad;n++) {
+		i = GetEntry(&r, &prev, numObjects, &groups, objectGroup, SYNC_OBJECT_GROUPS, objectState, SYNC_OBJECT_VALUES);
+		if (i < 0) {
+			r.bad = true;
+			break;
+		}
+		const int *v = &objectState[i * SYNC_OBJECT_VALUES];
+		if ((groups & SYNC_OBJECT_NODE) && (v[6] >= -1) && (v[6] < numNodes))
+			data->AttachObject(i, v[6]);
+		if (!(groups & SYNC_OBJECT_TRANSFORM))
+			continue;
+		LG3DObjectUpdate *u = &objectBatch[batched];
+		u->index = i;
+		u->fields = ((groups & 1) ? LG3DDirty_Position : 0) | ((groups & 2) ? LG3DDirty_Orientation : 0);
+		u->relative = false;
+		u->position.x = v[0] / 1000.0f;
+		u->position.y = v[1] / 1000.0f;
+		u->position.z = v[2] / 1000.0f;
+		u->orientation.h = v[3] / 100.0f;
+		u->orientation.p = v[4] / 100.0f;
+		u->orientation.r = v[5] / 100.0f;
+		if (++batched == SYNC_BATCH) {
+			data->UpdateObjects(objectBatch, batched);
+			batched = 0;
+		}
+	}
+	if (batched)
+		data->UpdateObjects(objectBatch, batched);
+
+	int *nodeState = &objectState[numObjects * SYNC_OBJECT_VALUES];
+	for(n=0,prev=0;(n<listedNodes) && !r.bad;n++) {
+		i = GetEntry(&r, &prev, numNodes, &groups, nodeGroup, SYNC_NODE_GROUPS, nodeState, SYNC_NODE_VALUES);
+		if (i < 0) {
+			r.bad = true;
+			break;
+		}
+		const int *v = &nodeState[i * SYNC_NODE_VALUES];
+		if (groups & 1) {
+			LG3DPosition pos = {v[0] / 1000.0f, v[1] / 1000.0f, v[2] / 1000.0f};
+			data->SetNodePosition(i, &pos);
+		}
+		if (groups & 2) {
+			LG3DOrientation orient = {v[3] / 100.0f, v[4] / 100.0f, v[5] / 100.0f};
+			data->SetNodeOrientation(i, &orient);
+		}
+	}
+
+	if (r.bad)
+		inSync = false; // what was applied stands, the rest waits for a keyframe
+	return !r.bad;
+}
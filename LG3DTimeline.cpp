@@ -0,0 +1,423 @@
+#include <math.h>
+
+#include "lg3d.h"
+#include "LG3DInternal.h"
+
+struct LG3DTimelineTrack {
+	int				target;					// LG3DTrackTargetType
+	int				index;					// light, object or camera
+	int				param;					// LG3DTrackParamType
+	int				firstKey;				// the track's keys are firstKey .. firstKey+numKeys-1
+	int				numKeys;
+	int				cursor;					// while active, the last key at or before the time evaluated
+	bool			firstOnField;			// the earliest starting track of its field, which a seek holds at its first key until it starts
+};
+
+// used to sort the tracks by start time, and by field then start time
+struct LG3DTrackStart {
+	float			time;
+	int				track;
+	int				target, index, param;
+};
+
+static int CompareTrackStart(const void *a, const void *b)
+{
+	const LG3DTrackStart *sa = (const LG3DTrackStart *)a;
+	const LG3DTrackStart *sb = (const LG3DTrackStart *)b;
+	if (sa->time != sb->time)
+		return (sa->time < sb->time) ? -1 : 1;
+	return sa->track - sb->track;
+}
+
+static int CompareTrackField(const void *a, const void *b)
+{
+	const LG3DTrackStart *sa = (const LG3DTrackStart *)a;
+	const LG3DTrackStart *sb = (const LG3DTrackStart *)b;
+	if (sa->target != sb->target)
+		return sa->target - sb->target;
+	if (sa->index != sb->index)
+		return sa->index - sb->index;
+	if (sa->param != sb->param)
+		return sa->param - sb->param;
+	return CompareTrackStart(a, b);
+}
+
+// first of times[lo..hi-1] (in order) later than t, hi if none is
+static int UpperBound(const float *times, int lo, int hi, float t)
+{
+	while (lo < hi) {
+		int mid = (lo + hi) >> 1;
+		if (times[mid] <= t)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+	return lo;
+}
+
+// the LG3DDirtyFieldType & LG3DPinMaskType bits of each track parameter
+static const unsigned long paramField[LG3DTrack_Fov+1] = {
+	LG3DDirty_Position, LG3DDirty_Position, LG3DDirty_Position,
+	LG3DDirty_Orientation, LG3DDirty_Orientation, LG3DDirty_Orientation,
+	LG3DDirty_Color, LG3DDirty_Color, LG3DDirty_Color,
+	LG3DDirty_Cone, LG3DDirty_Cone,
+	LG3DDirty_Attenuation, LG3DDirty_Attenuation,
+	LG3DDirty_Enabled, LG3DDirty_Shadows,
+	0,
+};
+
+static const unsigned long paramPin[LG3DTrack_Fov+1] = {
+	LG3DPinMask_X, LG3DPinMask_Y, LG3DPinMask_Z,
+	LG3DPinMask_H, LG3DPinMask_P, LG3DPinMask_R,
+	0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+};
+
+static void ApplyLightTrack(LG3DControlData *data, int i, int param, float value)
+{
+	LG3DLightTable *lights = &data->lights;
+	if (!data->LightInUse(i))
+		return;
+	if (lights->pinMask[i] & paramPin[param])
+		return;
+
+	if ((param == LG3DTrack_Enabled) || (param == LG3DTrack_CastsShadows)) {
+		unsigned long flag = (param == LG3DTrack_Enabled) ? LG3DLightFlag_Enabled : LG3DLightFlag_CastsShadows;
+		if (((lights->flags[i] & flag) != 0) != (value >= 0.5f)) {
+			lights->flags[i] ^= flag;
+			data->MarkLightDirty(i, paramField[param]);
+		}
+		return;
+	}
+
+	if ((param == LG3DTrack_ColorR) || (param == LG3DTrack_ColorG) || (param == LG3DTrack_ColorB))
+		value /= 255.0f;
+	float *values = LightParam(lights, param);
+	if (!values || (values[i] == value))
+		return;
+	values[i] = value;
+	if (paramField[param] == LG3DDirty_Cone)
+		lights->SetCone(i, lights->umbra[i], lights->penumbra[i]);
+	data->MarkLightDirty(i, paramField[param]);
+}
+
+// position & orientation of an object or camera
+static float *TransformParam(LG3DPosition *position, LG3DOrientation *orientation, int param)
+{
+	switch (param) {
+		case LG3DTrack_PosX: return &position->x;
+		case LG3DTrack_PosY: return &position->y;
+		case LG3DTrack_PosZ: return &position->z;
+		case LG3DTrack_Head: return &orientation->h;
+		case LG3DTrack_Pitch: return &orientation->p;
+		case LG3DTrack_Roll: return &orientation->r;
+	}
+	return NULL;
+}
+
+static void ApplyTrack(LG3DControlData *data, const LG3DTimelineTrack *trk, float value)
+{
+	int i = trk->index;
+	float *field;
+	switch (trk->target) {
+		case LG3DTrackTarget_Light:
+			ApplyLightTrack(data, i, trk->param, value);
+		break;
+
+		case LG3DTrackTarget_Object:
+			if (!data->ObjectInUse(i))
+				return;
+			field = TransformParam(&data->sceneObjectList[i].position, &data->sceneObjectList[i].orientation, trk->param);
+			if (field && (*field != value)) {
+				*field = value;
+				data->MarkObjectDirty(i, paramField[trk->param]);
+			}
+		break;
+
+		case LG3DTrackTarget_Camera:
+			// cameras are read fresh every frame, there is nothing to mark
+			if ((i < 0) || (i >= data->numCameras))
+				return;
+			if (trk->param == LG3DTrack_Fov)
+				field = &data->cameraList[i].fov;
+			else
+				field = TransformParam(&data->cameraList[i].position, &data->cameraList[i].orientation, trk->param);
+			if (field && (*field != value)) {
+				*field = value;
+				data->generation++;
+			}
+		break;
+	}
+}
+
+LG3DTimeline::LG3DTimeline()
+{
+	track = NULL;
+	numTracks = 0;
+	maxTracks = 0;
+	keyTime = NULL;
+	keyValue = NULL;
+	keyInHandle = NULL;
+	keyOutHandle = NULL;
+	keyInterp = NULL;
+	numKeys = 0;
+	maxKeys = 0;
+	duration = 0.0f;
+	loop = false;
+	startOrder = NULL;
+	startTime = NULL;
+	startOrderDirty = false;
+	positioned = false;
+	nextStart = 0;
+	activeList = NULL;
+	numActive = 0;
+	lastTime = 0.0;
+	batchKey = NULL;
+	batchU = NULL;
+	batchValue = NULL;
+}
+
+LG3DTimeline::~LG3DTimeline()
+{
+	free(track);
+	free(keyTime);
+	free(keyValue);
+	free(keyInHandle);
+	free(keyOutHandle);
+	free(keyInterp);
+	free(startOrder);
+	free(startTime);
+	free(activeList);
+	free(batchKey);
+	free(batchU);
+	free(batchValue);
+}
+
+int LG3DTimeline::AddTrack(int target, int index, int param, const LG3DKey *keys, int numTrackKeys)
+{
+	int k;
+	if ((numTrackKeys <= 0) || (index < 0) || (param < 0) || (param > LG3DTrack_Fov))
+		return -1;
+	// each target takes only the params it has, objects & cameras just the transform (& fov)
+	switch (target) {
+		case LG3DTrackTarget_Light:
+			if (param == LG3DTrack_Fov)
+				return -1;
+		break;
+		case LG3DTrackTarget_Object:
+			if (param > LG3DTrack_Roll)
+				return -1;
+		break;
+		case LG3DTrackTarget_Camera:
+			if ((param > LG3DTrack_Roll) && (param != LG3DTrack_Fov))
+				return -1;
+		break;
+		default:
+			return -1;
+	}
+	for(k=1;k<numTrackKeys;k++) {
+		if (keys[k].time < keys[k-1].time)
+			return -1;
+	}
+
+	if (numTracks == maxTracks) {
+		maxTracks = max(64, maxTracks*2);
+		track = (LG3DTimelineTrack *)realloc(track, sizeof(LG3DTimelineTrack) * maxTracks);
+		startOrder = (int *)realloc(startOrder, sizeof(int) * maxTracks);
+		startTime = (float *)realloc(startTime, sizeof(float) * maxTracks);
+		activeList = (int *)realloc(activeList, sizeof(int) * maxTracks);
+		batchKey = (int *)realloc(batchKey, sizeof(int) * maxTracks);
+		batchU = (float *)realloc(batchU, sizeof(float) * maxTracks);
+		batchValue = (float *)realloc(batchValue, sizeof(float) * maxTracks);
+	}
+	if (numKeys + numTrackKeys > maxKeys) {
+		maxKeys = max(numKeys + numTrackKeys, maxKeys*2);
+		keyTime = (float *)realloc(keyTime, sizeof(float) * maxKeys);
+		keyValue = (float *)realloc(keyValue, sizeof(float) * maxKeys);
+		keyInHandle = (float *)realloc(keyInHandle, sizeof(float) * maxKeys);
+		keyOutHandle = (float *)realloc(keyOutHandle, sizeof(float) * maxKeys);
+		keyInterp = (unsigned char *)realloc(keyInterp, maxKeys);
+	}
+
+	LG3DTimelineTrack *trk = &track[numTracks];
+	trk->target = target;
+	trk->index = index;
+	trk->param = param;
+	trk->firstKey = numKeys;
+	trk->numKeys = numTrackKeys;
+	trk->cursor = numKeys;
+	trk->firstOnField = false;
+	for(k=0;k<numTrackKeys;k++) {
+		keyTime[numKeys+k] = keys[k].time;
+		keyValue[numKeys+k] = keys[k].value;
+		keyInHandle[numKeys+k] = keys[k].inHandle;
+		keyOutHandle[numKeys+k] = keys[k].outHandle;
+		keyInterp[numKeys+k] = (unsigned char)keys[k].interp;
+	}
+	// the last key holds its value, whatever it says
+	keyInterp[numKeys+numTrackKeys-1] = LG3DInterp_Step;
+	numKeys += numTrackKeys;
+	if (keys[numTrackKeys-1].time > duration)
+		duration = keys[numTrackKeys-1].time;
+
+	startOrder[numTracks] = numTracks;
+	startOrderDirty = true;
+	return numTracks++;
+}
+
+void LG3DTimeline::Clear()
+{
+	numTracks = 0;
+	numKeys = 0;
+	duration = 0.0f;
+	startOrderDirty = false;
+	positioned = false;
+	nextStart = 0;
+	numActive = 0;
+	lastTime = 0.0;
+}
+
+// sort the tracks by start time for the seeks & for starting them in turn, and find
+// the earliest track of each field
+void LG3DTimeline::BuildIndex()
+{
+	int n;
+	LG3DTrackStart *start = (LG3DTrackStart *)malloc(sizeof(LG3DTrackStart) * numTracks);
+	for(n=0;n<numTracks;n++) {
+		start[n].time = keyTime[track[n].firstKey];
+		start[n].track = n;
+		start[n].target = track[n].target;
+		start[n].index = track[n].index;
+		start[n].param = track[n].param;
+	}
+
+	qsort(start, numTracks, sizeof(LG3DTrackStart), CompareTrackField);
+	track[start[0].track].firstOnField = true;
+	for(n=1;n<numTracks;n++) {
+		const LG3DTrackStart *prev = &start[n-1];
+		track[start[n].track].firstOnField =
+			(prev->target != start[n].target) || (prev->index != start[n].index) || (prev->param != start[n].param);
+	}
+
+	qsort(start, numTracks, sizeof(LG3DTrackStart), CompareTrackStart);
+	for(n=0;n<numTracks;n++) {
+		startOrder[n] = start[n].track;
+		startTime[n] = start[n].time;
+	}
+	free(start);
+	startOrderDirty = false;
+	positioned = false;
+}
+
+// step each active track on to the key it is past, and how far along to the next.  A track
+// past its last key gets -1, it writes that key's value one last time.  Playing, the next
+// key is almost always the one or one after, a jump binary searches the rest of the track.
+void LG3DTimeline::StepTracks(float t)
+{
+	int a, k;
+	for(a=0;a<numActive;a++) {
+		LG3DTimelineTrack *trk = &track[activeList[a]];
+		int last = trk->firstKey + trk->numKeys - 1;
+		k = trk->cursor;
+		if ((k < last) && (keyTime[k+1] <= t)) {
+			if ((k+1 == last) || (keyTime[k+2] > t))
+				k++;
+			else
+				k = UpperBound(keyTime, k+2, last+1, t) - 1;
+		}
+		trk->cursor = k;
+		batchKey[a] = k;
+		if (k == last)
+			batchU[a] = -1.0f;
+		else
+			batchU[a] = (t - keyTime[k]) / (keyTime[k+1] - keyTime[k]);
+	}
+}
+
+// interpolate the whole batch, write the values out in start order (so of two tracks on a
+// field the later one wins), and drop the tracks that ended
+void LG3DTimeline::ApplyBatch(LG3DControlData *data)
+{
+	int a, n, k;
+	for(a=0;a<numActive;a++) {
+		k = batchKey[a];
+		float u = batchU[a];
+		float v0 = keyValue[k];
+		if ((u <= 0.0f) || (keyInterp[k] == LG3DInterp_Step))
+			batchValue[a] = v0;
+		else if (keyInterp[k] == LG3DInterp_Linear)
+			batchValue[a] = v0 + (keyValue[k+1] - v0) * u;
+		else {
+			float s = 1.0f - u;
+			batchValue[a] = s*s*s*v0 + 3.0f*s*s*u*keyOutHandle[k] + 3.0f*s*u*u*keyInHandle[k+1] + u*u*u*keyValue[k+1];
+		}
+	}
+
+	n = 0;
+	for(a=0;a<numActive;a++) {
+		ApplyTrack(data, &track[activeList[a]], batchValue[a]);
+		if (batchU[a] >= 0.0f)
+			activeList[n++] = activeList[a];
+	}
+	numActive = n;
+}
+
+void LG3DTimeline::Seek(LG3DControlData *data, double time)
+{
+	int s;
+	if (numTracks == 0)
+		return;
+	if (loop && (duration > 0.0f) && (time >= duration))
+		time = fmod(time, (double)duration);
+	if (startOrderDirty)
+		BuildIndex();
+	float t = (float)time;
+
+	// fields whose tracks are all still to come hold the first key of the earliest
+	nextStart = UpperBound(startTime, 0, numTracks, t);
+	for(s=nextStart;s<numTracks;s++) {
+		const LG3DTimelineTrack *trk = &track[startOrder[s]];
+		if (trk->firstOnField)
+			ApplyTrack(data, trk, keyValue[trk->firstKey]);
+	}
+
+	// every track already started gives its value at t, those that ended drop out again
+	numActive = 0;
+	for(s=0;s<nextStart;s++) {
+		int id = startOrder[s];
+		track[id].cursor = track[id].firstKey;
+		activeList[numActive++] = id;
+	}
+	StepTracks(t);
+	ApplyBatch(data);
+
+	lastTime = time;
+	positioned = true;
+}
+
+bool LG3DTimeline::Evaluate(LG3DControlData *data, double time)
+{
+	if (numTracks == 0)
+		return false;
+	if (loop && (duration > 0.0f) && (time >= duration))
+		time = fmod(time, (double)duration);
+	if (startOrderDirty)
+		BuildIndex();
+
+	if (!positioned || (time < lastTime))
+		Seek(data, time);
+	else {
+		lastTime = time;
+		float t = (float)time;
+
+		// tracks whose first key has come up join the active list
+		while ((nextStart < numTracks) && (startTime[nextStart] <= t)) {
+			int id = startOrder[nextStart++];
+			track[id].cursor = track[id].firstKey;
+			activeList[numActive++] = id;
+		}
+		StepTracks(t);
+		ApplyBatch(data);
+	}
+
+	return loop || (nextStart < numTracks) || (numActive > 0);
+}
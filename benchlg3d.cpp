@@ -0,0 +1,1541 @@
+#include "dxstdafx.h"
+
+#include "lg3d.h"
+#include "benchlg3d.h"
+
+static LARGE_INTEGER benchFreq;
+static WCHAR benchReport[8192];
+
+static void BenchStart(LARGE_INTEGER *start)
+{
+	QueryPerformanceCounter(start);
+}
+
+// microseconds since start
+static double BenchElapsed(LARGE_INTEGER *start)
+{
+	LARGE_INTEGER now;
+	QueryPerformanceCounter(&now);
+	return (now.QuadPart - start->QuadPart) * 1000000.0 / (double)benchFreq.QuadPart;
+}
+
+static void BenchReport(const WCHAR *line)
+{
+	OutputDebugString(line);
+	wcscat_s(benchReport, line);
+}
+
+// ---------------------------------------------------------
+// frame move cost for a still rig, and with 1% of the lights
+// changing every frame
+// ---------------------------------------------------------
+static void BenchFrameMove(LG3DControl *lg3d, LG3DControlData *data)
+{
+	IDirect3DDevice9 *pd3dDevice = DXUTGetD3DDevice();
+	const int frames = 1000;
+	int numLights = data->lights.count;
+	int changing = numLights / 100;
+	int f, k;
+	LARGE_INTEGER start;
+	WCHAR line[256];
+
+	// flush anything pending before timing
+	lg3d->OnFrameMove(pd3dDevice, 0.0, 0.0f);
+
+	BenchStart(&start);
+	for(f=0;f<frames;f++)
+		lg3d->OnFrameMove(pd3dDevice, 0.0, 0.0f);
+	double stillTime = BenchElapsed(&start) / frames;
+
+	LG3DOrientation delta = {0.5f, 0.25f, 0.0f};
+	BenchStart(&start);
+	for(f=0;f<frames;f++) {
+		for(k=0;k<changing;k++)
+			data->MoveLight((f*changing*7 + k*101) % numLights, NULL, &delta);
+		lg3d->OnFrameMove(pd3dDevice, 0.0, 0.0f);
+	}
+	double movingTime = BenchElapsed(&start) / frames;
+
+	swprintf_s(line, L"frame move, %d lights, none changing: %.2f us/frame\n", numLights, stillTime);
+	BenchReport(line);
+	swprintf_s(line, L"frame move, %d lights, %d changing: %.2f us/frame\n", numLights, changing, movingTime);
+	BenchReport(line);
+}
+
+// ---------------------------------------------------------
+// 10k light moves through the per-call API vs. one bulk
+// UpdateLights call carrying the same 10k records
+// ---------------------------------------------------------
+static void BenchBulkUpdate(LG3DControl *lg3d, LG3DControlData *data)
+{
+	IDirect3DDevice9 *pd3dDevice = DXUTGetD3DDevice();
+	const int numUpdates = 10000;
+	const int runs = 100;
+	int numLights = data->lights.count;
+	int r, k;
+	LARGE_INTEGER start;
+	WCHAR line[256];
+
+	LG3DLightUpdate *updates = new LG3DLightUpdate[numUpdates];
+	for(k=0;k<numUpdates;k++) {
+		updates[k].index = (k*101) % numLights;
+		updates[k].fields = LG3DDirty_Transform;
+		updates[k].relative = true;
+		updates[k].position.x = 0.001f;
+		updates[k].orientation.h = 0.5f;
+		updates[k].orientation.p = 0.25f;
+	}
+
+	// the frame moves in between runs flush the dirty state, and are not timed
+	double perCallTime = 0.0;
+	for(r=0;r<runs;r++) {
+		lg3d->OnFrameMove(pd3dDevice, 0.0, 0.0f);
+		BenchStart(&start);
+		for(k=0;k<numUpdates;k++)
+			data->MoveLight(updates[k].index, &updates[k].position, &updates[k].orientation);
+		perCallTime += BenchElapsed(&start);
+	}
+
+	double bulkTime = 0.0;
+	for(r=0;r<runs;r++) {
+		lg3d->OnFrameMove(pd3dDevice, 0.0, 0.0f);
+		BenchStart(&start);
+		data->UpdateLights(updates, numUpdates);
+		bulkTime += BenchElapsed(&start);
+	}
+	lg3d->OnFrameMove(pd3dDevice, 0.0, 0.0f);
+
+	delete [] updates;
+
+	swprintf_s(line, L"%d light moves, per call: %.2f us\n", numUpdates, perCallTime / runs);
+	BenchReport(line);
+	swprintf_s(line, L"%d light moves, bulk: %.2f us\n", numUpdates, bulkTime / runs);
+	BenchReport(line);
+}
+
+// ---------------------------------------------------------
+// flying one truss every frame, vs. moving the same lights
+// one by one
+// ---------------------------------------------------------
+static void BenchTrussMove(LG3DControl *lg3d, LG3DControlData *data)
+{
+	IDirect3DDevice9 *pd3dDevice = DXUTGetD3DDevice();
+	const int frames = 1000;
+	int f, i, numOnTruss = 0;
+	LARGE_INTEGER start;
+	WCHAR line[256];
+
+	if (data->numSceneNodes == 0)
+		return;
+	for(i=0;i<data->lights.count;i++) {
+		if (data->lights.parentNode[i] == 0)
+			numOnTruss++;
+	}
+
+	lg3d->OnFrameMove(pd3dDevice, 0.0, 0.0f);
+
+	LG3DPosition up = {0.0f, 0.0f, 0.001f};
+	BenchStart(&start);
+	for(f=0;f<frames;f++) {
+		data->MoveNode(0, &up, NULL);
+		lg3d->OnFrameMove(pd3dDevice, 0.0, 0.0f);
+	}
+	double trussTime = BenchElapsed(&start) / frames;
+
+	LG3DPosition down = {0.0f, 0.0f, -0.001f};
+	BenchStart(&start);
+	for(f=0;f<frames;f++) {
+		for(i=0;i<data->lights.count;i++) {
+			if (data->lights.parentNode[i] == 0)
+				data->MoveLight(i, &down, NULL);
+		}
+		lg3d->OnFrameMove(pd3dDevice, 0.0, 0.0f);
+	}
+	double perLightTime = BenchElapsed(&start) / frames;
+
+	// put the truss back where it was
+	LG3DPosition back = {0.0f, 0.0f, -0.001f * frames};
+	data->MoveNode(0, &back, NULL);
+	lg3d->OnFrameMove(pd3dDevice, 0.0, 0.0f);
+
+	swprintf_s(line, L"fly 1 truss of %d lights: %.2f us/frame\n", numOnTruss, trussTime);
+	BenchReport(line);
+	swprintf_s(line, L"move the same %d lights one by one: %.2f us/frame\n", numOnTruss, perLightTime);
+	BenchReport(line);
+}
+
+// ---------------------------------------------------------
+// 1000 presets, each re-coloring 8 more lights than the one
+// before, then recalling them out of order.  The frame moves
+// between recalls are not timed.
+// ---------------------------------------------------------
+static void BenchPresets(LG3DControl *lg3d, LG3DControlData *data)
+{
+	IDirect3DDevice9 *pd3dDevice = DXUTGetD3DDevice();
+	const int numPresets = 1000;
+	const int perPreset = 8;
+	int numLights = data->lights.count;
+	int p, k, changed = 0;
+	LARGE_INTEGER start;
+	WCHAR line[256];
+	LG3DPresetStore presets;
+
+	lg3d->OnFrameMove(pd3dDevice, 0.0, 0.0f);
+	presets.Store(numPresets, data); // the original look, to put back at the end
+
+	double storeTime = 0.0;
+	for(p=0;p<numPresets;p++) {
+		for(k=0;k<perPreset;k++) {
+			LG3DLightColor color = {(p*7)%255, (p*13)%255, (p*29)%255};
+			data->SetLightColor(((p*perPreset + k)*101) % numLights, &color);
+		}
+		BenchStart(&start);
+		presets.Store(p, data);
+		storeTime += BenchElapsed(&start);
+	}
+	lg3d->OnFrameMove(pd3dDevice, 0.0, 0.0f);
+
+	double recallTime = 0.0;
+	for(p=0;p<numPresets;p++) {
+		BenchStart(&start);
+		changed += presets.Recall((p*379) % numPresets, data);
+		recallTime += BenchElapsed(&start);
+		lg3d->OnFrameMove(pd3dDevice, 0.0, 0.0f);
+	}
+
+	presets.Recall(numPresets, data);
+	lg3d->OnFrameMove(pd3dDevice, 0.0, 0.0f);
+
+	swprintf_s(line, L"%d presets of %d lights: %d KB in %d blocks, store %.2f us\n",
+		numPresets, numLights, (int)(presets.MemoryUsed() / 1024), presets.NumBlocks(), storeTime / numPresets);
+	BenchReport(line);
+	swprintf_s(line, L"preset recall: %.2f us, %d lights changed on average\n", recallTime / numPresets, changed / numPresets);
+	BenchReport(line);
+}
+
+// ---------------------------------------------------------
+// every light crossfading to a re-aimed & re-colored look,
+// the fade on its own and as part of the frame move
+// ---------------------------------------------------------
+static void BenchCrossfade(LG3DControl *lg3d, LG3DControlData *data)
+{
+	IDirect3DDevice9 *pd3dDevice = DXUTGetD3DDevice();
+	const int frames = 100;
+	const float frameTime = 1.0f / 60.0f;
+	int f, i;
+	LARGE_INTEGER start;
+	WCHAR line[256];
+
+	int count = data->lights.count;
+	LG3DLightTable original, look;
+	original.Resize(count);
+	original.CopyRange(&data->lights, 0, count);
+	look.Resize(count);
+	look.CopyRange(&data->lights, 0, count);
+	for(i=0;i<count;i++) {
+		look.head[i] += 135.0f;
+		look.pitch[i] -= 10.0f;
+		look.colorR[i] = 1.0f - look.colorR[i];
+		look.umbra[i] += 5.0f;
+	}
+
+	lg3d->OnFrameMove(pd3dDevice, 0.0, 0.0f);
+
+	// the fade on its own, the dirty state is flushed between frames untimed
+	LG3DCrossfade fade;
+	int numFading = fade.Start(data, &look, frames * frameTime * 2.0f);
+	double fadeTime = 0.0;
+	for(f=0;f<frames;f++) {
+		BenchStart(&start);
+		fade.Evaluate(data, f * frameTime);
+		fadeTime += BenchElapsed(&start);
+		data->ClearDirtyState();
+	}
+
+	// and along with the frame move, through to the end of the fade
+	BenchStart(&start);
+	for(f=frames;f<frames*2;f++) {
+		fade.Evaluate(data, f * frameTime);
+		lg3d->OnFrameMove(pd3dDevice, f * frameTime, frameTime);
+	}
+	double frameMoveTime = BenchElapsed(&start) / frames;
+
+	// snap back to the original look
+	fade.Start(data, &original, 0.0f);
+	fade.Evaluate(data, 0.0);
+	lg3d->OnFrameMove(pd3dDevice, 0.0, 0.0f);
+
+	swprintf_s(line, L"crossfade, %d lights fading: %.2f us/frame\n", numFading, fadeTime / frames);
+	BenchReport(line);
+	swprintf_s(line, L"frame move with %d lights fading: %.2f us/frame\n", numFading, frameMoveTime);
+	BenchReport(line);
+}
+
+// ---------------------------------------------------------
+// 50 effects of 40 lights each, a mix of waves on pan, tilt,
+// color & intensity, against the same frame move without them
+// ---------------------------------------------------------
+static void BenchEffects(LG3DControl *lg3d, LG3DControlData *data)
+{
+	IDirect3DDevice9 *pd3dDevice = DXUTGetD3DDevice();
+	const int frames = 100;
+	const int numEffects = 50;
+	const int groupSize = 40;
+	const float frameTime = 1.0f / 60.0f;
+	static const int params[4] = {LG3DTrack_Head, LG3DTrack_Pitch, LG3DTrack_ColorG, LG3DTrack_Intensity};
+	int f, e, i;
+	LARGE_INTEGER start;
+	WCHAR line[256];
+
+	lg3d->OnFrameMove(pd3dDevice, 0.0, 0.0f);
+	BenchStart(&start);
+	for(f=0;f<frames;f++)
+		lg3d->OnFrameMove(pd3dDevice, f * frameTime, frameTime);
+	double plainTime = BenchElapsed(&start) / frames;
+
+	LG3DEffects fx;
+	int group[groupSize];
+	int numFixtures = 0;
+	for(e=0;e<numEffects;e++) {
+		for(i=0;i<groupSize;i++)
+			group[i] = (e*groupSize + i) % data->lights.count;
+		LG3DEffect effect;
+		effect.param = params[e%4];
+		effect.wave = e % (LG3DWave_Random+1);
+		effect.speed = 0.2f + 0.05f * e;
+		effect.size = (effect.param == LG3DTrack_Intensity) ? 0.8f : 20.0f;
+		effect.phaseSpread = 1.0f;
+		if (fx.Add(&effect, group, groupSize) >= 0)
+			numFixtures += groupSize;
+	}
+
+	// the effects on their own, the dirty state is flushed between frames untimed
+	double fxTime = 0.0;
+	for(f=0;f<frames;f++) {
+		BenchStart(&start);
+		fx.Evaluate(data, f * frameTime);
+		fxTime += BenchElapsed(&start);
+		data->ClearDirtyState();
+	}
+
+	// and along with the frame move
+	BenchStart(&start);
+	for(f=frames;f<frames*2;f++) {
+		fx.Evaluate(data, f * frameTime);
+		lg3d->OnFrameMove(pd3dDevice, f * frameTime, frameTime);
+	}
+	double frameMoveTime = BenchElapsed(&start) / frames;
+
+	// the lights go back to their bases
+	for(e=0;e<numEffects;e++)
+		fx.Remove(e, data);
+	lg3d->OnFrameMove(pd3dDevice, 0.0, 0.0f);
+
+	swprintf_s(line, L"effects, %d running over %d fixtures: %.2f us/frame\n", numEffects, numFixtures, fxTime / frames);
+	BenchReport(line);
+	swprintf_s(line, L"frame move with the effects: %.2f us/frame, without: %.2f us/frame\n", frameMoveTime, plainTime);
+	BenchReport(line);
+
+	// two waves stacked on the pan of the same lights have to stay within their summed size
+	// of where the lights started, and leave them there when removed
+	float startHead[groupSize];
+	int numStacked = (groupSize < data->lights.count) ? groupSize : data->lights.count;
+	for(i=0;i<numStacked;i++) {
+		group[i] = i;
+		startHead[i] = data->lights.head[i];
+	}
+	LG3DEffects stacked;
+	LG3DEffect effect;
+	effect.param = LG3DTrack_Head;
+	effect.wave = LG3DWave_Sine;
+	effect.speed = 0.5f;
+	effect.size = 20.0f;
+	effect.phaseSpread = 1.0f;
+	int first = stacked.Add(&effect, group, numStacked);
+	effect.speed = 0.3f;
+	effect.size = 10.0f;
+	int second = stacked.Add(&effect, group, numStacked);
+	float drift = 0.0f;
+	for(f=0;f<frames*10;f++) {
+		stacked.Evaluate(data, f * frameTime);
+		for(i=0;i<numStacked;i++) {
+			float d = fabsf(data->lights.head[i] - startHead[i]);
+			if (d > drift)
+				drift = d;
+		}
+	}
+	stacked.Remove(second, data);
+	stacked.Remove(first, data);
+	int offBase = 0;
+	for(i=0;i<numStacked;i++)
+		offBase += (data->lights.head[i] != startHead[i]);
+	lg3d->OnFrameMove(pd3dDevice, 0.0, 0.0f);
+
+	swprintf_s(line, L"stacked pan waves: widest swing %.2f of %.2f degrees, %d lights off their base after removal\n", drift, 30.0f, offBase);
+	BenchReport(line);
+}
+
+// ---------------------------------------------------------
+// user written effects over every light, compiled then run
+// a frame at a time
+// ---------------------------------------------------------
+static void BenchExpressions(LG3DControl *lg3d, LG3DControlData *data)
+{
+	IDirect3DDevice9 *pd3dDevice = DXUTGetD3DDevice();
+	const int frames = 100;
+	const int numPrograms = 4;
+	static const WCHAR *source[numPrograms] = {
+		L"pan = 30*sin(t*2 + index*0.1)",
+		L"tilt = -45 + 10*cos(t*3 + x)",
+		L"red = 128 + 127*sin(t + index*0.05); green = 255*rand(index + floor(t*4))",
+		L"blue = 255*frac(t*0.5 + index/count)",
+	};
+	int count = data->lights.count;
+	int f, i, p;
+	LARGE_INTEGER start;
+	WCHAR line[256];
+
+	LG3DPresetStore original;
+	original.Store(0, data);
+	int *all = new int[count];
+	for(i=0;i<count;i++)
+		all[i] = i;
+
+	LG3DExpression program[numPrograms];
+	int numOps = 0;
+	BenchStart(&start);
+	for(p=0;p<numPrograms;p++) {
+		program[p].Compile(source[p]);
+		numOps += program[p].NumOps();
+	}
+	double compileTime = BenchElapsed(&start);
+
+	// the frame moves in between are not timed
+	double runTime = 0.0;
+	for(f=0;f<frames;f++) {
+		BenchStart(&start);
+		for(p=0;p<numPrograms;p++)
+			program[p].Run(data, all, count, f / 60.0);
+		runTime += BenchElapsed(&start);
+		lg3d->OnFrameMove(pd3dDevice, 0.0, 0.0f);
+	}
+
+	original.Recall(0, data);
+	lg3d->OnFrameMove(pd3dDevice, 0.0, 0.0f);
+	delete [] all;
+
+	swprintf_s(line, L"expressions, %d programs of %d ops compiled: %.2f us\n", numPrograms, numOps, compileTime);
+	BenchReport(line);
+	swprintf_s(line, L"expressions over %d lights: %.2f us/frame, %.0f light expressions/ms\n",
+		count, runTime / frames, (double)count * numPrograms * frames / (runTime / 1000.0));
+	BenchReport(line);
+}
+
+// ---------------------------------------------------------
+// 3 seconds of a 30 fps loopback timecode, with a cue every
+// tenth of a second fading every light between 2 looks, the
+// frames run flat out in real time
+// ---------------------------------------------------------
+static void BenchCues(LG3DControl *lg3d, LG3DControlData *data)
+{
+	IDirect3DDevice9 *pd3dDevice = DXUTGetD3DDevice();
+	const double runTime = 3.0;
+	int count = data->lights.count;
+	int i, k, frames = 0;
+	WCHAR line[256];
+
+	LG3DPresetStore original;
+	original.Store(0, data);
+	LG3DLightTable look[2];
+	for(k=0;k<2;k++) {
+		look[k].Resize(count);
+		look[k].CopyRange(&data->lights, 0, count);
+		for(i=0;i<count;i++)
+			look[k].pitch[i] += k ? 20.0f : -20.0f;
+	}
+
+	LG3DCrossfade fade;
+	LG3DCueScheduler cues;
+	cues.SetCrossfade(&fade);
+	cues.SetLatency(1.0f / 60.0f);
+	for(k=0;k<(int)(runTime * 10.0);k++)
+		cues.AddCue(0.1 * (k+1), &look[k & 1], 0.05f);
+
+	LG3DTimecodeSource timecode;
+	LG3DTimecode from = {0, 0, 0, 0, 30.0f};
+	double startTime = lg3d->GetTime(), lastTime = startTime, now;
+	timecode.StartLoopback(&from, startTime, 0.001f);
+	while ((now = lg3d->GetTime()) < startTime + runTime + 0.2) {
+		timecode.Poll(&cues, now);
+		cues.Dispatch(data, now);
+		fade.Evaluate(data, now);
+		lg3d->OnFrameMove(pd3dDevice, now, (float)(now - lastTime));
+		lastTime = now;
+		frames++;
+	}
+
+	original.Recall(0, data);
+	lg3d->OnFrameMove(pd3dDevice, lg3d->GetTime(), 0.0f);
+
+	LG3DCueStats stats;
+	cues.GetStats(&stats);
+	swprintf_s(line, L"cues, %d fired over %d frames: %.3f ms late on average, jitter %.3f ms, worst %.3f ms\n",
+		stats.cuesFired, frames, stats.meanLate * 1000.0, stats.jitter * 1000.0, stats.maxLate * 1000.0);
+	BenchReport(line);
+	swprintf_s(line, L"cues, timecode lock jitter with 1 ms of arrival jitter: %.3f ms\n", stats.lockJitter * 1000.0);
+	BenchReport(line);
+}
+
+// ---------------------------------------------------------
+// every light told to pan half way round & tilt down at once,
+// then followed under the moving head limits until it stops
+// ---------------------------------------------------------
+static void BenchKinematics(LG3DControl *lg3d, LG3DControlData *data)
+{
+	IDirect3DDevice9 *pd3dDevice = DXUTGetD3DDevice();
+	const float frameTime = 1.0f / 60.0f;
+	const int maxFrames = 600;
+	int count = data->lights.count;
+	int f, i;
+	LARGE_INTEGER start;
+	WCHAR line[256];
+
+	LG3DPresetStore original;
+	original.Store(0, data);
+
+	LG3DKinematics kinematics;
+	kinematics.Advance(data, frameTime);
+	LG3DOrientation turn = {180.0f, -30.0f, 0.0f};
+	for(i=0;i<count;i++)
+		data->MoveLight(i, NULL, &turn);
+
+	// the frame moves in between are not timed
+	double movingTime = 0.0;
+	int moving = 0;
+	for(f=0;f<maxFrames;f++) {
+		BenchStart(&start);
+		kinematics.Advance(data, frameTime);
+		movingTime += BenchElapsed(&start);
+		moving += kinematics.NumMoving();
+		lg3d->OnFrameMove(pd3dDevice, 0.0, 0.0f);
+		if (kinematics.NumMoving() == 0)
+			break;
+	}
+	int settleFrames = f+1;
+
+	const int restFrames = 100;
+	BenchStart(&start);
+	for(f=0;f<restFrames;f++)
+		kinematics.Advance(data, frameTime);
+	double restTime = BenchElapsed(&start) / restFrames;
+
+	// a pan wave on the moving heads, the way the frame move runs them together.  The
+	// targets have to stay on the wave however far behind the fixtures fall.
+	const int numWaving = (count < 64) ? count : 64;
+	int group[64];
+	float baseHead[64];
+	for(i=0;i<numWaving;i++) {
+		group[i] = i;
+		baseHead[i] = data->lights.head[i];
+	}
+	LG3DEffects fx;
+	LG3DEffect wave;
+	wave.param = LG3DTrack_Head;
+	wave.wave = LG3DWave_Sine;
+	wave.speed = 0.5f;
+	wave.size = 60.0f;
+	wave.phaseSpread = 1.0f;
+	fx.Add(&wave, group, numWaving);
+	float stray = 0.0f;
+	for(f=0;f<maxFrames;f++) {
+		kinematics.BeginFrame(data);
+		fx.Evaluate(data, f * frameTime);
+		kinematics.Advance(data, frameTime);
+		for(i=0;i<numWaving;i++) {
+			LG3DOrientation aim;
+			kinematics.GetTarget(i, NULL, &aim);
+			float d = fabsf(aim.h - baseHead[i]) - wave.size;
+			if (d > stray)
+				stray = d;
+		}
+		data->ClearDirtyState();
+	}
+	fx.Remove(0, data);
+
+	original.Recall(0, data);
+	lg3d->OnFrameMove(pd3dDevice, 0.0, 0.0f);
+
+	swprintf_s(line, L"kinematics, %d lights moving on average: %.2f us/frame, settled in %d frames\n",
+		moving / settleFrames, movingTime / settleFrames, settleFrames);
+	BenchReport(line);
+	swprintf_s(line, L"kinematics, %d lights at rest: %.2f us/frame\n", count, restTime);
+	BenchReport(line);
+	swprintf_s(line, L"kinematics under a pan wave: targets strayed %.2f degrees past its size\n", stray);
+	BenchReport(line);
+}
+
+void BenchBuildArrayRig(LG3DControlData *data, int numLights)
+{
+	// a ring of lights 6m across, an arc of 64 on each truss, all rigged at the origin
+	data->numSceneNodes = numLights / 64;
+	data->sceneNodeList = new LG3DSceneNode[data->numSceneNodes];
+	data->numLightArrays = data->numSceneNodes;
+	data->lightArrayList = new LG3DLightArray[data->numLightArrays];
+	int i;
+	for(i=0;i<data->numLightArrays;i++) {
+		LG3DLightArray *arc = &data->lightArrayList[i];
+		arc->light.att1 = 0.2f;
+		arc->light.umbra = 3.0f;
+		arc->light.penumbra = 7.0f;
+		arc->light.position.z = 2.6f;
+		arc->light.orientation.p = -20.0f;
+		arc->light.castsShadows = (numLights <= 64);
+		arc->light.enabled = true;
+		arc->light.color.r = rand()%255;
+		arc->light.color.g = rand()%255;
+		arc->light.color.b = rand()%255;
+		arc->light.pinMask = LG3DPinMask_XYZ; // lights can rotate but position is fixed
+		arc->light.parentNode = i;
+		arc->layout.shape = LG3DArray_Ring;
+		arc->layout.count = 64;
+		arc->layout.radius = 6.0f;
+		arc->layout.startAngle = 360.0f * i * 64 / numLights;
+		arc->layout.sweep = 360.0f * 64 / numLights;
+	}
+
+	// the first light of each arc picks out where it starts, tilted further down & white
+	for(i=0;i<data->numLightArrays;i++) {
+		LG3DLightArray *arc = &data->lightArrayList[i];
+		arc->numOverrides = 1;
+		arc->overrides = new LG3DLightArrayOverride[1];
+		arc->overrides[0].element = 0;
+		arc->overrides[0].fields = LG3DDirty_Orientation | LG3DDirty_Color;
+		arc->overrides[0].light.orientation.h = arc->layout.startAngle;
+		arc->overrides[0].light.orientation.p = -40.0f;
+		arc->overrides[0].light.color.r = 255;
+		arc->overrides[0].light.color.g = 255;
+		arc->overrides[0].light.color.b = 255;
+	}
+}
+
+// ---------------------------------------------------------
+// the stress rig's ring described as arrays, in a rig of its
+// own: loaded, drawn in & let out again with every array
+// re-placed in one pass each, and what describing the rig as
+// arrays saves over listing every light
+// ---------------------------------------------------------
+static void BenchArrays(LG3DControl *lg3d, LG3DControlData *data)
+{
+	const int numLights = 4096;
+	const int runs = 20;
+	int a, r;
+	LARGE_INTEGER start;
+	WCHAR line[256];
+
+	// the dirty state is flushed between runs untimed, nothing is drawn
+	LG3DControlData rig;
+	BenchBuildArrayRig(&rig, numLights);
+	BenchStart(&start);
+	rig.LoadScene();
+	double loadTime = BenchElapsed(&start);
+	rig.AllocDirtyState();
+
+	double layoutTime = 0.0;
+	int moved = 0;
+	for(r=0;r<=runs;r++) {
+		rig.ClearDirtyState();
+		BenchStart(&start);
+		for(a=0;a<rig.numLightArrays;a++) {
+			LG3DArrayLayout layout = rig.lightArrayList[a].layout;
+			layout.radius = (r & 1) ? 5.0f : 6.0f; // the last run puts the ring back
+			moved += rig.SetLightArrayLayout(a, &layout, NULL, NULL);
+		}
+		if (r < runs)
+			layoutTime += BenchElapsed(&start);
+	}
+
+	int listedBytes = numLights * sizeof(LG3DSceneLight);
+	int arrayBytes = rig.numLightArrays * sizeof(LG3DLightArray);
+	for(a=0;a<rig.numLightArrays;a++)
+		arrayBytes += rig.lightArrayList[a].numOverrides * sizeof(LG3DLightArrayOverride);
+
+	swprintf_s(line, L"arrays, %d lights in %d arrays loaded: %.2f us, re-placed: %.2f us, %d moved\n",
+		rig.lights.count, rig.numLightArrays, loadTime, layoutTime / runs, moved / (runs+1));
+	BenchReport(line);
+	swprintf_s(line, L"arrays, rig description %d bytes listed light by light, %d bytes as arrays\n", listedBytes, arrayBytes);
+	BenchReport(line);
+
+	for(a=0;a<rig.numLightArrays;a++)
+		delete [] rig.lightArrayList[a].overrides;
+	delete [] rig.lightArrayList;
+	delete [] rig.sceneNodeList;
+}
+
+// ---------------------------------------------------------
+// a 1000 step mouse drag of one light, journaled as the
+// control does it, then every light turned as one edit and
+// that taken back & done again
+// ---------------------------------------------------------
+static void BenchJournal(LG3DControl *lg3d, LG3DControlData *data)
+{
+	IDirect3DDevice9 *pd3dDevice = DXUTGetD3DDevice();
+	const int steps = 1000;
+	const int runs = 20;
+	int count = data->lights.count;
+	int i, r;
+	LARGE_INTEGER start;
+	WCHAR line[256];
+
+	LG3DPresetStore original;
+	original.Store(0, data);
+
+	LG3DJournal journal;
+	LG3DOrientation nudge = {0.5f, 0.25f, 0.0f};
+	unsigned long key = journal.NewMergeKey();
+	BenchStart(&start);
+	for(i=0;i<steps;i++) {
+		journal.BeginEdit(key);
+		journal.TouchLight(data, 0, LG3DDirty_Transform);
+		data->MoveLight(0, NULL, &nudge);
+		journal.EndEdit(data);
+	}
+	double dragTime = BenchElapsed(&start) / steps;
+	int dragBytes = journal.BytesUsed();
+	journal.Undo(data);
+
+	// the frame moves in between flush the dirty state, and are not timed
+	LG3DOrientation turn = {10.0f, 0.0f, 0.0f};
+	double editTime = 0.0, plainTime = 0.0, undoTime = 0.0, redoTime = 0.0;
+	int editBytes = 0;
+	for(r=0;r<runs;r++) {
+		journal.Clear();
+		lg3d->OnFrameMove(pd3dDevice, 0.0, 0.0f);
+		BenchStart(&start);
+		for(i=0;i<count;i++)
+			data->MoveLight(i, NULL, &turn);
+		plainTime += BenchElapsed(&start);
+		lg3d->OnFrameMove(pd3dDevice, 0.0, 0.0f);
+
+		BenchStart(&start);
+		journal.BeginEdit(0);
+		for(i=0;i<count;i++) {
+			journal.TouchLight(data, i, LG3DDirty_Orientation);
+			data->MoveLight(i, NULL, &turn);
+		}
+		journal.EndEdit(data);
+		editTime += BenchElapsed(&start);
+		editBytes = journal.BytesUsed();
+		lg3d->OnFrameMove(pd3dDevice, 0.0, 0.0f);
+
+		BenchStart(&start);
+		journal.Undo(data);
+		undoTime += BenchElapsed(&start);
+		lg3d->OnFrameMove(pd3dDevice, 0.0, 0.0f);
+
+		BenchStart(&start);
+		journal.Redo(data);
+		redoTime += BenchElapsed(&start);
+	}
+
+	original.Recall(0, data);
+	lg3d->OnFrameMove(pd3dDevice, 0.0, 0.0f);
+
+	swprintf_s(line, L"journal, %d step drag as one undo step: %.2f us/step, %d bytes\n", steps, dragTime, dragBytes);
+	BenchReport(line);
+	swprintf_s(line, L"journal, %d lights turned: %.2f us journaled, %.2f us not, %d bytes\n",
+		count, editTime / runs, plainTime / runs, editBytes);
+	BenchReport(line);
+	swprintf_s(line, L"journal, undo %.2f us, redo %.2f us\n", undoTime / runs, redoTime / runs);
+	BenchReport(line);
+}
+
+// ---------------------------------------------------------
+// a chase panning every 8th light each frame, recorded, then
+// played back a frame per frame move in place of the inputs
+// ---------------------------------------------------------
+static void BenchReplay(LG3DControl *lg3d, LG3DControlData *data)
+{
+	IDirect3DDevice9 *pd3dDevice = DXUTGetD3DDevice();
+	const int frames = 240;
+	int count = data->lights.count;
+	int i, f;
+	LARGE_INTEGER start;
+	WCHAR line[256];
+
+	LG3DPresetStore original;
+	original.Store(0, data);
+	lg3d->OnFrameMove(pd3dDevice, 0.0, 0.0f);
+
+	// the same chase, first not recorded, then recorded
+	double plainTime = 0.0, recordTime = 0.0;
+	LG3DRecorder recorder;
+	int pass;
+	for(pass=0;pass<2;pass++) {
+		if (pass == 1) {
+			original.Recall(0, data);
+			lg3d->OnFrameMove(pd3dDevice, 0.0, 0.0f);
+			recorder.Start(data);
+			lg3d->SetRecorder(&recorder);
+		}
+		BenchStart(&start);
+		for(f=0;f<frames;f++) {
+			LG3DOrientation pan = {2.0f, 0.0f, 0.0f};
+			for(i=f&7;i<count;i+=8)
+				data->MoveLight(i, NULL, &pan);
+			lg3d->OnFrameMove(pd3dDevice, f / 60.0, 1.0f / 60.0f);
+		}
+		if (pass == 0)
+			plainTime = BenchElapsed(&start) / frames;
+		else
+			recordTime = BenchElapsed(&start) / frames;
+	}
+	lg3d->SetRecorder(NULL);
+	recorder.Stop();
+	int keyBytes = 0;
+	{
+		LG3DRecorder key;
+		key.Start(data);
+		keyBytes = key.BytesUsed();
+	}
+
+	// back to the start & play it all again
+	original.Recall(0, data);
+	lg3d->OnFrameMove(pd3dDevice, 0.0, 0.0f);
+	LG3DReplay replay;
+	replay.LoadRecording(&recorder);
+	BenchStart(&start);
+	bool started = replay.Start(data);
+	double startTime = BenchElapsed(&start);
+	lg3d->SetReplay(&replay, false);
+	BenchStart(&start);
+	while (started && !replay.AtEnd())
+		lg3d->OnFrameMove(pd3dDevice, 0.0, 0.0f);
+	double replayTime = BenchElapsed(&start) / frames;
+	lg3d->SetReplay(NULL, false);
+
+	original.Recall(0, data);
+	lg3d->OnFrameMove(pd3dDevice, 0.0, 0.0f);
+
+	swprintf_s(line, L"record, %d lights, 1 in 8 panned a frame: %.2f us/frame recorded, %.2f us not\n",
+		count, recordTime, plainTime);
+	BenchReport(line);
+	swprintf_s(line, L"record, %d frames in %lu bytes, %lu bytes/frame past the %d byte rig\n",
+		recorder.NumFrames(), recorder.BytesUsed(), (recorder.BytesUsed() - keyBytes) / max(recorder.NumFrames(), 1), keyBytes);
+	BenchReport(line);
+	swprintf_s(line, L"replay, %d frames: start %.2f us, %.2f us/frame move\n", replay.FramesPlayed(), startTime, replayTime);
+	BenchReport(line);
+}
+
+// ---------------------------------------------------------
+// 1000 follow spots each tracking its own performer walking
+// a circle, then all of them onto one point
+// ---------------------------------------------------------
+static void BenchAim(LG3DControl *lg3d, LG3DControlData *data)
+{
+	IDirect3DDevice9 *pd3dDevice = DXUTGetD3DDevice();
+	const int frames = 100;
+	int count = min(data->lights.count, 1000);
+	int f, i, turned = 0;
+	LARGE_INTEGER start;
+	WCHAR line[256];
+
+	LG3DPresetStore original;
+	original.Store(0, data);
+
+	int *spots = (int *)malloc(sizeof(int) * (count+1));
+	LG3DPosition *target = (LG3DPosition *)malloc(sizeof(LG3DPosition) * (count+1));
+	for(i=0;i<count;i++)
+		spots[i] = i;
+
+	LG3DAimSolver aim;
+	double aimTime = 0.0;
+	for(f=0;f<frames;f++) {
+		for(i=0;i<count;i++) {
+			float a = DEG2RADf(f * 3.6f + i);
+			target[i].x = 5.0f * cosf(a);
+			target[i].y = 5.0f * sinf(a);
+			target[i].z = 1.5f;
+		}
+		BenchStart(&start);
+		turned += aim.Aim(data, spots, count, target, count);
+		aimTime += BenchElapsed(&start);
+	}
+
+	LG3DPosition centre = {0.0f, 0.0f, 0.0f};
+	BenchStart(&start);
+	for(f=0;f<frames;f++) {
+		centre.z = (float)(f & 1);
+		aim.Aim(data, spots, count, &centre, 1);
+	}
+	double oneTime = BenchElapsed(&start) / frames;
+
+	free(target);
+	free(spots);
+	original.Recall(0, data);
+	lg3d->OnFrameMove(pd3dDevice, 0.0, 0.0f);
+
+	swprintf_s(line, L"aim, %d lights at their own targets: %.2f us/solve, %d turned on average\n",
+		count, aimTime / frames, turned / frames);
+	BenchReport(line);
+	swprintf_s(line, L"aim, %d lights at one target: %.2f us/solve\n", count, oneTime);
+	BenchReport(line);
+}
+
+// ---------------------------------------------------------
+// the rig patched as 9 channel moving heads over Art-Net,
+// every universe sent over loopback at 44Hz, first with the
+// pan of every light moving, then with one light a universe
+// ---------------------------------------------------------
+static void BenchArtNet(LG3DControl *lg3d, LG3DControlData *data)
+{
+	IDirect3DDevice9 *pd3dDevice = DXUTGetD3DDevice();
+	const int frames = 44;
+	const int perUniverse = LG3D_DMX_CHANNELS / 9;
+	int count = data->lights.count;
+	int i, f, u;
+	LARGE_INTEGER start;
+	WCHAR line[256];
+
+	LG3DPresetStore original;
+	original.Store(0, data);
+
+	LG3DDmxPersonality head;
+	const unsigned char channels[9] = {LG3DDmx_Pan, LG3DDmx_PanFine, LG3DDmx_Tilt, LG3DDmx_TiltFine,
+		LG3DDmx_Dimmer, LG3DDmx_Red, LG3DDmx_Green, LG3DDmx_Blue, LG3DDmx_Zoom};
+	head.numChannels = 9;
+	memcpy(head.channel, channels, sizeof(channels));
+	head.panRange = 540.0f;
+	head.tiltRange = 270.0f;
+	head.zoomMin = 5.0f;
+	head.zoomMax = 45.0f;
+	LG3DDmxPatch *patch = (LG3DDmxPatch *)malloc(sizeof(LG3DDmxPatch) * count);
+	for(i=0;i<count;i++) {
+		patch[i].lightIndex = i;
+		patch[i].universe = i / perUniverse;
+		patch[i].address = 1 + (i % perUniverse) * 9;
+		patch[i].personality = 0;
+	}
+	LG3DArtNet artNet;
+	if (!artNet.Open(LG3D_ARTNET_PORT + 1)) {
+		free(patch);
+		BenchReport(L"artnet, no loopback socket\n");
+		return;
+	}
+	BenchStart(&start);
+	artNet.Compile(&head, 1, patch, count);
+	double compileTime = BenchElapsed(&start);
+	free(patch);
+	int numUniverses = artNet.NumUniverses();
+	unsigned char *dmx = (unsigned char *)calloc(numUniverses, LG3D_DMX_CHANNELS);
+	for(u=0;u<numUniverses;u++)
+		artNet.Send(0x7f000001, u, &dmx[u * LG3D_DMX_CHANNELS], LG3D_DMX_CHANNELS);
+	artNet.Receive();
+	artNet.Apply(data);
+	lg3d->OnFrameMove(pd3dDevice, 0.0, 0.0f);
+
+	// the frame moves in between flush the dirty state, and are not timed
+	double receiveTime[2] = {0.0, 0.0}, applyTime[2] = {0.0, 0.0};
+	int changed[2] = {0, 0};
+	int pass;
+	for(pass=0;pass<2;pass++) {
+		for(f=0;f<frames;f++) {
+			for(u=0;u<numUniverses;u++) {
+				unsigned char *universe = &dmx[u * LG3D_DMX_CHANNELS];
+				if (pass == 0) {
+					for(i=0;i<perUniverse;i++)
+						universe[i*9 + 1] += 16; // fine pan
+				} else
+					universe[(f % perUniverse) * 9 + 5]++; // red
+				artNet.Send(0x7f000001, u, universe, LG3D_DMX_CHANNELS);
+			}
+			BenchStart(&start);
+			artNet.Receive();
+			receiveTime[pass] += BenchElapsed(&start);
+			BenchStart(&start);
+			changed[pass] += artNet.Apply(data);
+			applyTime[pass] += BenchElapsed(&start);
+			lg3d->OnFrameMove(pd3dDevice, 0.0, 0.0f);
+		}
+	}
+	free(dmx);
+
+	original.Recall(0, data);
+	lg3d->OnFrameMove(pd3dDevice, 0.0, 0.0f);
+
+	swprintf_s(line, L"artnet, %d lights over %d universes: patch compiled in %.2f us, %lu packets used, %lu dropped\n",
+		count, numUniverses, compileTime, artNet.PacketsUsed(), artNet.PacketsDropped());
+	BenchReport(line);
+	swprintf_s(line, L"artnet, every pan moving: %.2f us receive, %.2f us apply a frame, %d lights\n",
+		receiveTime[0] / frames, applyTime[0] / frames, changed[0] / frames);
+	BenchReport(line);
+	swprintf_s(line, L"artnet, one light a universe: %.2f us receive, %.2f us apply a frame, %d lights\n",
+		receiveTime[1] / frames, applyTime[1] / frames, changed[1] / frames);
+	BenchReport(line);
+}
+
+// ---------------------------------------------------------
+// a controller thread on the far side of a shared channel,
+// as it would be in another process: updates a second with
+// every light's color pushed in runs of 256, then one light
+// at a time, each waiting for the renderer to take the last,
+// timing push to apply
+// ---------------------------------------------------------
+struct SharedBenchClient {
+	int				numLights;
+	int				total;				// updates to push, 0 for ping-pong
+	int				rounds;				// ping-pong
+	volatile LONG	done;
+	bool			opened;
+};
+
+static DWORD WINAPI SharedBenchClientThread(LPVOID param)
+{
+	SharedBenchClient *client = (SharedBenchClient *)param;
+	LG3DSharedChannel channel;
+	client->opened = channel.Open(L"Local\\lg3dBench");
+	if (client->opened) {
+		LG3DLightUpdate batch[256];
+		memset(batch, 0, sizeof(batch));
+		int i, sent = 0;
+		if (client->total) {
+			while (sent < client->total) {
+				int n = min(256, client->total - sent);
+				for(i=0;i<n;i++) {
+					batch[i].index = (sent + i) % client->numLights;
+					batch[i].fields = LG3DDirty_Color;
+					batch[i].color.r = (float)((sent + i) & 255);
+				}
+				sent += channel.PushLights(batch, n);
+			}
+		} else {
+			batch[0].fields = LG3DDirty_Color;
+			for(i=0;i<client->rounds;i++) {
+				batch[0].index = i % client->numLights;
+				batch[0].color.g = (float)(i & 255);
+				channel.RendererAlive();
+				LARGE_INTEGER now;
+				QueryPerformanceCounter(&now);
+				while (!channel.PushLight(&batch[0], now.QuadPart))
+					YieldProcessor();
+				// a publish could have been under way as we pushed, the second one is after our record was taken
+				int beats = 0;
+				while (beats < 2) {
+					if (channel.RendererAlive())
+						beats++;
+					else
+						YieldProcessor();
+				}
+			}
+		}
+		channel.Close();
+	}
+	InterlockedExchange(&client->done, 1);
+	return 0;
+}
+
+static int BenchCompareDouble(const void *a, const void *b)
+{
+	double d = *(const double *)a - *(const double *)b;
+	return (d < 0.0) ? -1 : ((d > 0.0) ? 1 : 0);
+}
+
+static void BenchSharedChannel(LG3DControl *lg3d, LG3DControlData *data)
+{
+	IDirect3DDevice9 *pd3dDevice = DXUTGetD3DDevice();
+	const int rounds = 2000;
+	int count = data->lights.count;
+	int taken = 0, pings = 0;
+	LARGE_INTEGER start, now;
+	WCHAR line[256];
+
+	LG3DPresetStore original;
+	original.Store(0, data);
+
+	LG3DSharedChannel channel;
+	if (!channel.Create(L"Local\\lg3dBench", 4096, count)) {
+		BenchReport(L"shared channel, no shared memory\n");
+		return;
+	}
+
+	SharedBenchClient client;
+	client.numLights = count;
+	client.total = count * 250;
+	client.rounds = rounds;
+	client.done = 0;
+	client.opened = false;
+	HANDLE thread = CreateThread(NULL, 0, SharedBenchClientThread, &client, 0, NULL);
+	BenchStart(&start);
+	while (!client.done) {
+		taken += channel.Apply(data);
+		channel.Publish(data);
+	}
+	taken += channel.Apply(data);
+	double pushTime = BenchElapsed(&start);
+	WaitForSingleObject(thread, INFINITE);
+	CloseHandle(thread);
+	lg3d->OnFrameMove(pd3dDevice, 0.0, 0.0f);
+	if (!client.opened) {
+		BenchReport(L"shared channel, the controller could not open it\n");
+		return;
+	}
+
+	double *latency = (double *)malloc(sizeof(double) * rounds);
+	client.total = 0;
+	client.done = 0;
+	thread = CreateThread(NULL, 0, SharedBenchClientThread, &client, 0, NULL);
+	while (!client.done) {
+		if (channel.Apply(data) && (pings < rounds)) {
+			QueryPerformanceCounter(&now);
+			latency[pings++] = (now.QuadPart - channel.LastStamp()) * 1000000.0 / (double)benchFreq.QuadPart;
+		}
+		channel.Publish(data);
+	}
+	WaitForSingleObject(thread, INFINITE);
+	CloseHandle(thread);
+	channel.Close();
+
+	original.Recall(0, data);
+	lg3d->OnFrameMove(pd3dDevice, 0.0, 0.0f);
+
+	swprintf_s(line, L"shared channel, %d lights: %d updates taken in %.2f ms, %.2f million a second\n",
+		count, taken, pushTime / 1000.0, taken / pushTime);
+	BenchReport(line);
+	if (pings) {
+		qsort(latency, pings, sizeof(double), BenchCompareDouble);
+		swprintf_s(line, L"shared channel, push to apply over %d pings: %.2f us median, %.2f us 99%%, %.2f us worst\n",
+			pings, latency[pings / 2], latency[pings * 99 / 100], latency[pings - 1]);
+		BenchReport(line);
+	}
+	free(latency);
+}
+
+// ---------------------------------------------------------
+// the rig mirrored over loopback TCP onto a copy of it, with
+// nothing changing and under heavy cueing - a quarter of the
+// lights re-aimed & recolored every frame
+// ---------------------------------------------------------
+static int BenchSyncFrame(LG3DSyncServer *server, LG3DSyncClient *client, LG3DControlData *data, LG3DControlData *mirror,
+	double *serveTime, double *receiveTime)
+{
+	LARGE_INTEGER start;
+	BenchStart(&start);
+	server->Serve(data);
+	*serveTime += BenchElapsed(&start);
+	data->ClearDirtyState();
+	int tries;
+	for(tries=0;(tries<10000) && (client->Sequence() != server->Sequence());tries++) {
+		BenchStart(&start);
+		client->Receive(mirror);
+		*receiveTime += BenchElapsed(&start);
+		if (client->Sequence() != server->Sequence())
+			Sleep(0);
+	}
+	mirror->ClearDirtyState();
+	return server->DeltaBytes();
+}
+
+static void BenchSync(LG3DControl *lg3d, LG3DControlData *data)
+{
+	IDirect3DDevice9 *pd3dDevice = DXUTGetD3DDevice();
+	const int frames = 100;
+	int count = data->lights.count;
+	int f, i, n;
+	WCHAR line[256];
+
+	LG3DPresetStore original;
+	original.Store(0, data);
+
+	LG3DControlData mirror;
+	mirror.numSceneLights = count;
+	mirror.sceneLightList = new LG3DSceneLight[count];
+	for(i=0;i<count;i++)
+		data->GetLight(i, &mirror.sceneLightList[i]);
+	mirror.numSceneObjects = data->numSceneObjects;
+	mirror.sceneObjectList = new LG3DSceneObject[data->numSceneObjects];
+	for(i=0;i<data->numSceneObjects;i++)
+		mirror.sceneObjectList[i] = data->sceneObjectList[i];
+	mirror.numSceneNodes = data->numSceneNodes;
+	mirror.sceneNodeList = new LG3DSceneNode[data->numSceneNodes];
+	for(i=0;i<data->numSceneNodes;i++)
+		mirror.sceneNodeList[i] = data->sceneNodeList[i];
+	mirror.LoadScene();
+	mirror.AllocDirtyState();
+
+	LG3DSyncServer server;
+	LG3DSyncClient client;
+	if (!server.Listen(LG3D_SYNC_PORT + 1) || !client.Connect(0x7f000001, LG3D_SYNC_PORT + 1)) {
+		BenchReport(L"sync, no loopback socket\n");
+		delete [] mirror.sceneLightList;
+		delete [] mirror.sceneObjectList;
+		delete [] mirror.sceneNodeList;
+		return;
+	}
+	server.SetKeyframeInterval(0);
+	double serveTime[2] = {0.0, 0.0}, receiveTime[2] = {0.0, 0.0};
+	int bytes[2] = {0, 0}, maxBytes = 0;
+	BenchSyncFrame(&server, &client, data, &mirror, &serveTime[0], &receiveTime[0]); // the keyframe
+	int keyframeBytes = server.KeyframeBytes();
+	serveTime[0] = receiveTime[0] = 0.0;
+
+	LG3DLightUpdate *updates = (LG3DLightUpdate *)malloc(sizeof(LG3DLightUpdate) * (count / 4 + 1));
+	int pass;
+	for(pass=0;pass<2;pass++) {
+		for(f=0;f<frames;f++) {
+			if (pass == 1) {
+				for(i=f%4,n=0;i<count;i+=4,n++) {
+					LG3DLightUpdate *u = &updates[n];
+					memset(u, 0, sizeof(LG3DLightUpdate));
+					u->index = i;
+					u->fields = LG3DDirty_Orientation | LG3DDirty_Color;
+					u->orientation.h = sinf(f * 0.05f + i) * 170.0f;
+					u->orientation.p = cosf(f * 0.03f + i) * 80.0f;
+					u->color.r = (f*3 + i) & 255;
+					u->color.g = (f + i) & 255;
+					u->color.b = 128;
+				}
+				data->UpdateLights(updates, n);
+			}
+			int size = BenchSyncFrame(&server, &client, data, &mirror, &serveTime[pass], &receiveTime[pass]);
+			bytes[pass] += size;
+			maxBytes = max(maxBytes, size);
+		}
+	}
+	free(updates);
+
+	// the mirror should be within the quantizing of the rig
+	int off = 0;
+	for(i=0;i<count;i++) {
+		LG3DLightColor a, b;
+		data->GetLightColor(i, &a);
+		mirror.GetLightColor(i, &b);
+		if ((fabsf(data->lights.head[i] - mirror.lights.head[i]) > 0.01f) || (fabsf(data->lights.pitch[i] - mirror.lights.pitch[i]) > 0.01f) ||
+			memcmp(&a, &b, sizeof(LG3DLightColor)))
+			off++;
+	}
+	client.Close();
+	server.Close();
+
+	original.Recall(0, data);
+	lg3d->OnFrameMove(pd3dDevice, 0.0, 0.0f);
+	delete [] mirror.sceneLightList;
+	delete [] mirror.sceneObjectList;
+	delete [] mirror.sceneNodeList;
+
+	swprintf_s(line, L"sync, %d lights: keyframe %d bytes (%d bytes as scene lights), %d lights off in the mirror\n",
+		count, keyframeBytes, count * (int)sizeof(LG3DSceneLight), off);
+	BenchReport(line);
+	swprintf_s(line, L"sync, still rig: %.2f us serve, %.2f us receive a frame, %d bytes\n",
+		serveTime[0] / frames, receiveTime[0] / frames, bytes[0] / frames);
+	BenchReport(line);
+	swprintf_s(line, L"sync, heavy cueing: %.2f us serve, %.2f us receive a frame, %d bytes a frame, %d at most\n",
+		serveTime[1] / frames, receiveTime[1] / frames, bytes[1] / frames, maxBytes);
+	BenchReport(line);
+}
+
+// ---------------------------------------------------------
+// three inputs on every light - a console and a media server
+// merging color highest takes precedence, and an operator
+// holding positions.  Merging with nothing new, with 1% of
+// the lights changed and with every light changed.
+// ---------------------------------------------------------
+static void BenchMerge(LG3DControl *lg3d, LG3DControlData *data)
+{
+	IDirect3DDevice9 *pd3dDevice = DXUTGetD3DDevice();
+	const int frames = 100;
+	int count = data->lights.count;
+	int f, i, changed = 0;
+	LARGE_INTEGER start;
+	WCHAR line[256];
+
+	LG3DMerge merge;
+	int console = merge.AddSource(10);
+	int mediaServer = merge.AddSource(10);
+	int operatorInput = merge.AddSource(20);
+	LG3DLightColor *original = new LG3DLightColor[count];
+	LG3DPosition pos;
+	for(i=0;i<count;i++) {
+		data->GetLightColor(i, &original[i]);
+		merge.SetColor(console, i, &original[i]);
+		merge.SetColor(mediaServer, i, &original[i]);
+		data->GetLightPosition(i, &pos);
+		merge.SetPosition(operatorInput, i, &pos);
+	}
+	merge.Merge(data);
+	lg3d->OnFrameMove(pd3dDevice, 0.0, 0.0f);
+
+	BenchStart(&start);
+	for(f=0;f<frames;f++)
+		merge.Merge(data);
+	double stillTime = BenchElapsed(&start) / frames;
+
+	// the frame moves in between merges flush the dirty state, and are not timed
+	double someTime = 0.0, allTime = 0.0;
+	for(f=0;f<frames;f++) {
+		for(i=f%100;i<count;i+=100) {
+			LG3DLightColor flash = {(f*7)%255, 255, (f*13)%255};
+			merge.SetColor(mediaServer, i, &flash);
+		}
+		BenchStart(&start);
+		changed += merge.Merge(data);
+		someTime += BenchElapsed(&start);
+		lg3d->OnFrameMove(pd3dDevice, 0.0, 0.0f);
+	}
+	for(f=0;f<frames;f++) {
+		for(i=0;i<count;i++) {
+			LG3DLightColor flash = {(f*7+i)%255, (f*3+i)%255, (f*13+i)%255};
+			merge.SetColor(console, i, &flash);
+		}
+		BenchStart(&start);
+		merge.Merge(data);
+		allTime += BenchElapsed(&start);
+		lg3d->OnFrameMove(pd3dDevice, 0.0, 0.0f);
+	}
+
+	// hand the lights back as they were
+	merge.RemoveSource(mediaServer);
+	merge.RemoveSource(operatorInput);
+	for(i=0;i<count;i++)
+		merge.SetColor(console, i, &original[i]);
+	merge.Merge(data);
+	lg3d->OnFrameMove(pd3dDevice, 0.0, 0.0f);
+	delete [] original;
+
+	swprintf_s(line, L"merge, 3 inputs on %d lights, nothing new: %.2f us\n", count, stillTime);
+	BenchReport(line);
+	swprintf_s(line, L"merge, 1%% of the lights changed: %.2f us, %d lights changed on average\n", someTime / frames, changed / frames);
+	BenchReport(line);
+	swprintf_s(line, L"merge, every light changed: %.2f us\n", allTime / frames);
+	BenchReport(line);
+}
+
+// ---------------------------------------------------------
+// a 3 hour show - two tracks of 60 keys on every light, each
+// running for 2 minutes somewhere in the show, played for
+// 20 seconds from the middle, then scrubbed about
+// ---------------------------------------------------------
+static void BenchTimeline(LG3DControl *lg3d, LG3DControlData *data)
+{
+	IDirect3DDevice9 *pd3dDevice = DXUTGetD3DDevice();
+	const int frames = 600;
+	const int keysPerTrack = 60;
+	int count = data->lights.count;
+	int f, i, k;
+	LARGE_INTEGER start;
+	WCHAR line[256];
+
+	LG3DPresetStore original;
+	original.Store(0, data);
+
+	LG3DTimeline show;
+	LG3DKey keys[keysPerTrack];
+	for(i=0;i<count*2;i++) {
+		float startTime = (i % 90) * 120.0f;
+		for(k=0;k<keysPerTrack;k++) {
+			keys[k].time = startTime + k * 2.0f;
+			keys[k].value = (float)((i*7 + k*31) % 255);
+			keys[k].interp = k % 3;
+			keys[k].outHandle = keys[k].value + 20.0f;
+			keys[k].inHandle = keys[k].value - 20.0f;
+		}
+		show.AddTrack(LG3DTrackTarget_Light, i/2, (i & 1) ? LG3DTrack_Head : LG3DTrack_ColorG, keys, keysPerTrack);
+	}
+
+	show.Evaluate(data, 3600.0);
+	lg3d->OnFrameMove(pd3dDevice, 0.0, 0.0f);
+
+	// the frame moves in between are not timed
+	double playTime = 0.0;
+	int active = 0;
+	for(f=0;f<frames;f++) {
+		BenchStart(&start);
+		show.Evaluate(data, 3600.0 + f / 30.0);
+		playTime += BenchElapsed(&start);
+		active += show.NumActive();
+		lg3d->OnFrameMove(pd3dDevice, 0.0, 0.0f);
+	}
+
+	const int seeks = 100;
+	double seekTime = 0.0;
+	for(f=0;f<seeks;f++) {
+		BenchStart(&start);
+		show.Seek(data, (double)((f * 7919) % (int)show.Duration()));
+		seekTime += BenchElapsed(&start);
+		lg3d->OnFrameMove(pd3dDevice, 0.0, 0.0f);
+	}
+
+	original.Recall(0, data);
+	lg3d->OnFrameMove(pd3dDevice, 0.0, 0.0f);
+
+	swprintf_s(line, L"timeline, %d tracks, %d keys, %d active: %.2f us/frame\n",
+		show.NumTracks(), show.NumKeys(), active / frames, playTime / frames);
+	BenchReport(line);
+	swprintf_s(line, L"timeline seek anywhere in %.0f minutes: %.2f us\n", show.Duration() / 60.0f, seekTime / seeks);
+	BenchReport(line);
+}
+
+// ---------------------------------------------------------
+// a 10k fixture show - the stress rig two and a half times
+// over, every light listed - saved as text & converted, then
+// opened from the scene file and from the text
+// ---------------------------------------------------------
+static void BenchSceneFile(LG3DControl *lg3d, LG3DControlData *data)
+{
+	const int numLights = 10240;
+	const int runs = 10;
+	const WCHAR *textPath = L".\\bench_show.txt";
+	const WCHAR *filePath = L".\\bench_show.lg3d";
+	int i, r;
+	LARGE_INTEGER start;
+	WCHAR line[256];
+	if (data->lights.count == 0)
+		return;
+
+	LG3DControlData show;
+	show.numSceneLights = numLights;
+	show.sceneLightList = new LG3DSceneLight[numLights];
+	for(i=0;i<numLights;i++) {
+		data->DescribeLight(i % data->lights.count, &show.sceneLightList[i]);
+		show.sceneLightList[i].position.z += (float)(i / data->lights.count);
+	}
+	show.numSceneNodes = data->numSceneNodes;
+	show.sceneNodeList = data->sceneNodeList;
+	show.numSceneObjects = data->ListedObjects();
+	show.sceneObjectList = data->sceneObjectList;
+	show.numCameras = data->numCameras;
+	show.cameraList = data->cameraList;
+
+	BenchStart(&start);
+	bool ok = LG3DSceneFile::WriteText(textPath, &show);
+	double writeTime = BenchElapsed(&start);
+	BenchStart(&start);
+	ok = ok && LG3DSceneFile::Convert(textPath, filePath);
+	double convertTime = BenchElapsed(&start);
+	delete [] show.sceneLightList;
+	if (!ok)
+		return;
+
+	double openTime = 0.0, loadTime = 0.0, textTime = 0.0;
+	unsigned long fileSize = 0;
+	for(r=0;r<runs;r++) {
+		LG3DSceneFile file;
+		LG3DControlData opened;
+		BenchStart(&start);
+		file.Open(filePath, &opened);
+		openTime += BenchElapsed(&start);
+		fileSize = file.Size();
+		BenchStart(&start);
+		opened.LoadScene();
+		loadTime += BenchElapsed(&start);
+
+		LG3DControlData read;
+		BenchStart(&start);
+		LG3DSceneFile::ReadText(textPath, &read);
+		textTime += BenchElapsed(&start);
+		delete [] read.sceneLightList;
+		delete [] read.sceneObjectList;
+		delete [] read.sceneNodeList;
+		delete [] read.cameraList;
+	}
+	DeleteFile(textPath);
+	DeleteFile(filePath);
+
+	swprintf_s(line, L"scene file, %d lights: text written in %.2f ms, converted in %.2f ms, %lu bytes\n",
+		numLights, writeTime / 1000.0, convertTime / 1000.0, fileSize);
+	BenchReport(line);
+	swprintf_s(line, L"scene file, opened %.2f ms + loaded %.2f ms, text read %.2f ms\n",
+		openTime / runs / 1000.0, loadTime / runs / 1000.0, textTime / runs / 1000.0);
+	BenchReport(line);
+}
+
+static void BenchReloadCase(LG3DControl *lg3d, const LG3DControlData *show, const WCHAR *name)
+{
+	LARGE_INTEGER start;
+	WCHAR line[256];
+	LG3DReloadStats stats;
+
+	BenchStart(&start);
+	lg3d->Reload(show, &stats);
+	double reloadTime = BenchElapsed(&start);
+
+	swprintf_s(line, L"reload, %s: %.2f us, %d changed, reused/rebuilt meshes %d/%d, textures %d/%d, shadow maps %d/%d\n",
+		name, reloadTime, stats.changed, stats.meshesReused, stats.meshesRebuilt,
+		stats.texturesReused, stats.texturesRebuilt, stats.shadowMapsReused, stats.shadowMapsRebuilt);
+	BenchReport(line);
+}
+
+// ---------------------------------------------------------
+// differential reload of a copy of the live show, unchanged,
+// with 1% of the lights re-aimed, and with every light
+// recolored.  The original show is reloaded at the end.
+// ---------------------------------------------------------
+static void BenchReload(LG3DControl *lg3d, LG3DControlData *data)
+{
+	int i;
+	LG3DControlData original, show;
+	LG3DControlData *copies[2] = {&original, &show};
+	int c;
+	for(c=0;c<2;c++) {
+		LG3DControlData *copy = copies[c];
+		copy->numSceneLights = data->lights.count;
+		copy->sceneLightList = new LG3DSceneLight[data->lights.count];
+		for(i=0;i<data->lights.count;i++)
+			data->GetLight(i, &copy->sceneLightList[i]);
+		copy->numSceneObjects = data->numSceneObjects;
+		copy->sceneObjectList = new LG3DSceneObject[data->numSceneObjects];
+		for(i=0;i<data->numSceneObjects;i++)
+			copy->sceneObjectList[i] = data->sceneObjectList[i];
+		copy->numCameras = data->numCameras;
+		copy->cameraList = new LG3DCameraObject[data->numCameras];
+		for(i=0;i<data->numCameras;i++)
+			copy->cameraList[i] = data->cameraList[i];
+		copy->ambient = data->ambient;
+		copy->clearColor = data->clearColor;
+	}
+
+	BenchReloadCase(lg3d, &show, L"unchanged");
+
+	for(i=0;i<show.numSceneLights;i+=100)
+		show.sceneLightList[i].orientation.h += 10.0f;
+	BenchReloadCase(lg3d, &show, L"1% re-aimed");
+
+	for(i=0;i<show.numSceneLights;i++)
+		show.sceneLightList[i].color.r = 255 - show.sceneLightList[i].color.r;
+	BenchReloadCase(lg3d, &show, L"all recolored");
+
+	lg3d->Reload(&original, NULL);
+
+	for(c=0;c<2;c++) {
+		delete [] copies[c]->sceneLightList;
+		delete [] copies[c]->sceneObjectList;
+		delete [] copies[c]->cameraList;
+	}
+}
+
+void RunBenchmarks(LG3DControl *lg3d, LG3DControlData *lg3dData)
+{
+	QueryPerformanceFrequency(&benchFreq);
+	benchReport[0] = 0;
+
+	BenchFrameMove(lg3d, lg3dData);
+	BenchBulkUpdate(lg3d, lg3dData);
+	BenchTrussMove(lg3d, lg3dData);
+	BenchPresets(lg3d, lg3dData);
+	BenchCrossfade(lg3d, lg3dData);
+	BenchMerge(lg3d, lg3dData);
+	BenchArtNet(lg3d, lg3dData);
+	BenchSharedChannel(lg3d, lg3dData);
+	BenchSync(lg3d, lg3dData);
+	BenchEffects(lg3d, lg3dData);
+	BenchExpressions(lg3d, lg3dData);
+	BenchCues(lg3d, lg3dData);
+	BenchKinematics(lg3d, lg3dData);
+	BenchAim(lg3d, lg3dData);
+	BenchArrays(lg3d, lg3dData);
+	BenchJournal(lg3d, lg3dData);
+	BenchReplay(lg3d, lg3dData);
+	BenchTimeline(lg3d, lg3dData);
+	BenchSceneFile(lg3d, lg3dData);
+	BenchReload(lg3d, lg3dData);
+
+	MessageBox(NULL, benchReport, L"LG3D Benchmarks", MB_OK);
+}
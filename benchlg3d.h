@@ -0,0 +1,15 @@
+#ifndef __BENCHLG3D__
+#define __BENCHLG3D__
+
+#include "lg3d.h"
+
+// runs the timing tests against an already created (and drawn once) control, results
+// go to the debugger output and a message box
+void RunBenchmarks(LG3DControl *lg3d, LG3DControlData *lg3dData);
+
+// describes the stress rig's ring of numLights (a multiple of 64) as one light array per
+// truss, each arc in a color of its own.  The array benchmark loads it, the test app shows it
+// as its last stress rig.
+void BenchBuildArrayRig(LG3DControlData *data, int numLights);
+
+#endif /* __BENCHLG3D__ */
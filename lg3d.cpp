@@ -4,38 +4,99 @@
 #include "lg3d.h"
 #include "lg3dDXSupport.h"
 
-struct LG3DInternalLight {
-	bool				lightMoved;			// set when light move detected
-	double				hash;				// hash value used to detect when key control light values have changed
-	LPDIRECT3DTEXTURE9	shadowMap;			// pointer to possible light shadow map texture
+// per-light matrices, read by the shadow map, light can and per-pixel passes
+struct LG3DLightMatrices {
 	D3DXMATRIXA16		worldMat;			// light's world-space representation
 	D3DXMATRIXA16		viewMat;			// light's view-space representation
 	D3DXMATRIXA16		projMat;			// Projection matrix for light & shadow map
     D3DXMATRIXA16		worldViewProj;		// world * view * projection
-	D3DXVECTOR4			lightDir;			// direction vector for light
+};
+
+// per-light device resources, only touched when a light is created, changes shape, or is drawn per-pixel
+struct LG3DInternalLight {
+	LPDIRECT3DTEXTURE9	shadowMap;			// pointer to possible light shadow map texture
 	LPDIRECT3DTEXTURE9	goboMap;			// texture map for gobo spotlight projections
-	float				cosTheta;			// cosine of (umbra + penumbra)
-	D3DXVECTOR4			color;				// source color of this light
-	int					loopId;				// determines what loop to draw this light in, loop 0 is vertex-only lights, loop 1 is per-pixel gobo, loop 2 is per-pixel gobo + shadow
+	int					spotShape;			// index of the shared umbra/penumbra texture used as goboMap, -1 if goboMap was loaded from a file
+	int					gobo;				// index of the shared gobo texture used as goboMap, -1 if goboMap is a spot shape
 	LPDIRECT3DVERTEXBUFFER9 lightBeamVB;	// light beam effect
 	int					numBeams;			// number of light beam primitives
+	int					loopId;				// determines what loop to draw this light in, loop 0 is vertex-only lights, loop 1 is per-pixel gobo, loop 2 is per-pixel gobo + shadow
+	bool				lightMoved;			// set when light move detected, shadow map needs regenerating
 };
 
 struct LG3DInternalObject {
 	CDXUTMesh			*mesh;				// .x mesh object
+	int					sharedMesh;			// index of the mesh in LG3DScene::sharedMesh
 	D3DXMATRIXA16		matWorld;			// world transform matrix
     D3DXMATRIXA16		worldViewProj;		// world * view * projection
-	double				hash;				// hash value used to detect when key control object values have changed
-	bool				moved;				// set when object move detected
+};
+
+// generated umbra/penumbra textures, shared by all lights without a gobo that have the same cone.
+// Shared resources no longer used are kept until the end of the frame move, so one released and
+// asked for again in the same frame move (a reload, a light being replaced) is not rebuilt.
+struct LG3DSpotShape {
+	float				umbra;
+	float				penumbra;
+	LPDIRECT3DTEXTURE9	tex;
+	int					refCount;			// number of lights using this texture, the slot is free when 0 and tex is NULL
+};
+
+// textures & meshes loaded from file, shared by everything that names the same file
+struct LG3DSharedGobo {
+	LG3DNameId			name;
+	LPDIRECT3DTEXTURE9	tex;
+	int					refCount;			// number of lights using this texture, the slot is free when 0 and tex is NULL
+};
+
+struct LG3DSharedMesh {
+	LG3DNameId			name;
+	CDXUTMesh			*mesh;
+	int					refCount;			// number of objects using this mesh, the slot is free when 0 and mesh is NULL
 };
 
 struct LG3DScene {
 	ID3DXEffect			*effect;			// D3DX effect interface
 	ID3DXEffect			*vertLightEffect;	// D3DX effect interface
-	LG3DInternalLight	*light;				// list of internal light data
+	LG3DInternalLight	*light;				// list of internal light resources
+	LG3DLightMatrices	*lightMat;			// list of light matrices, 16 byte aligned
+	float				*lightDirX;			// world space light direction (Y up), one array per component
+	float				*lightDirY;
+	float				*lightDirZ;
+	float				*lightPosX;			// world space light position (Y up), differs from the control data's for lights on a node
+	float				*lightPosY;
+	float				*lightPosZ;
+	int					*loopList[3];		// indices of the lights drawn in each loop, see LG3DInternalLight::loopId
+	int					numLoopLights[3];
+	bool				loopListsDirty;		// set when some light's loopId changed
 	LG3DInternalObject	*obj;				// list of internal object data
 	LPDIRECT3DSURFACE9	shadowDepthStencil;	// Depth-stencil buffer for rendering to shadow map
 	D3DCOLOR			clearColor;
+	LG3DSpotShape		*spotShape;			// list of shared spot shape textures
+	int					numSpotShapes;
+	LG3DSharedGobo		*sharedGobo;		// list of shared gobo textures, keyed by name
+	int					numSharedGobos;
+	LG3DSharedMesh		*sharedMesh;		// list of shared object meshes, keyed by name
+	int					numSharedMeshes;
+	int					lightCapacity;		// allocated size of the per-light arrays above
+	int					objCapacity;		// allocated size of obj & sharedMesh
+	int					numLights;			// light count as of the last frame move, lights added since are not drawn or picked yet
+	int					numObjects;			// same, for objects
+	LPDIRECT3DTEXTURE9	*spareShadowMap;	// shadow maps released this frame move, handed to the next light needing one
+	int					numSpareShadowMaps;
+	bool				unusedResources;	// set when a shared resource or shadow map was released this frame move
+	LG3DReloadStats		rebuilt;			// count of the resources loaded or created, for LG3DControl::Reload
+	int					*movedLightList;	// indices of lights with lightMoved set this frame
+	int					numMovedLights;
+	bool				allLightsMoved;		// set when an object moved, every shadow map needs regenerating
+	bool				shadowsWanted;		// controlData->wantShadows as of the last frame move
+	D3DXMATRIXA16		*nodeWorld;			// per-node world transform, 16 byte aligned
+	bool				*nodeMoved;			// set for the nodes whose world transform changed this frame move
+	int					*nodeFirstLight;	// nodeLightList[nodeFirstLight[n] .. nodeFirstLight[n+1]-1] are the lights hanging from node n
+	int					*nodeLightList;
+	int					*nodeFirstObject;	// same, for objects
+	int					*nodeObjectList;
+	int					numNodes;
+	bool				attachListsDirty;	// set when some light or object was attached, added or removed
 
 	LG3DScene() {memset(this, 0, sizeof(LG3DScene));}
 };
@@ -80,6 +141,14 @@ struct LightBeam {
 };
 LPDIRECT3DTEXTURE9	lightBeamTex = NULL;			// light beam shaping texture
 
+// #define LIGHT_BEAM_METHOD_1
+#define LIGHT_BEAM_METHOD_2
+#if defined(LIGHT_BEAM_METHOD_1)
+#define LIGHT_BEAM_COUNT 7		// more beams yield a better volume at the cost of a performance hit.  11 is probably a good max #, and 1 would be the minimum
+#elif defined(LIGHT_BEAM_METHOD_2)
+#define LIGHT_BEAM_COUNT 14		// number of horizontal plus vertical slices
+#endif /* LIGHT_BEAM_METHOD_X */
+
 LG3DControl::LG3DControl(HWND _parent, LG3DControlData *_controlData)
 {
 	// ---------------------------------------------------------
@@ -88,7 +157,26 @@ LG3DControl::LG3DControl(HWND _parent, LG3DControlData *_controlData)
 	parent = _parent;
 	globalParent = parent;
 	controlData = _controlData;
+	controlData->LoadScene(); // copy the rig description into the light table
 	scene = new LG3DScene;
+	snapshot = NULL;
+	crossfade = NULL;
+	merge = NULL;
+	timeline = NULL;
+	timelineStart = 0.0;
+	effects = NULL;
+	cues = NULL;
+	kinematics = NULL;
+	journal = NULL;
+	dragKey = 0;
+	recorder = NULL;
+	replay = NULL;
+	replayRealTime = false;
+	replayStart = -1.0;
+	artNet = NULL;
+	sharedChannel = NULL;
+	syncServer = NULL;
+	syncClient = NULL;
 	shadowMapSize = 512; // this is a power of 2 tex map size, larger for better shadow resolution, probably don't want any smaller than 256
 
 	manipObjId = -1;
@@ -293,6 +381,444 @@ void LG3DControl::CreateRenderWindow()
 		NULL);
 }
 
+static void GenerateSpotTexture(LPDIRECT3DTEXTURE9 tex, float umbra, float penumbra)
+{
+	// generate the umbra & penumbra portions of the texture
+	D3DLOCKED_RECT texRect;
+	tex->LockRect(0, &texRect, NULL, 0);
+	int x, y;
+	float totalAngle = umbra + penumbra;
+	float centerX = 127.5f, centerY = 127.5f;
+	float penumbraAmount;
+	unsigned long penumbraVal;
+	float dist;
+	float pixAngle;
+	float dx, dy;
+	unsigned char *texPix = (unsigned char *)texRect.pBits;
+	for(y=0;y<256;y++) {
+		dy = centerY - y;
+		for(x=0;x<256;x++) {
+			dx = centerX - x;
+			dist = sqrtf(dx*dx+dy*dy);
+			pixAngle = totalAngle * dist / 127.0f;
+			if (pixAngle > totalAngle) { // no light in this region
+				*(DWORD *)(texPix+x*4+y*texRect.Pitch) = 0;
+			} else if (pixAngle > umbra) { // this is the penumbra outer edge region
+				penumbraAmount = 1.0f - (pixAngle-umbra)/penumbra;
+				penumbraAmount = powf(penumbraAmount, 0.5f);  // the penumbra falloff is just a square root function, but we could make the 0.5 a parameter per spotlight if we wanted
+				penumbraVal = (unsigned char)(penumbraAmount*255);
+				*(DWORD *)(texPix+x*4+y*texRect.Pitch) = (penumbraVal<<24) | (penumbraVal<<16) | (penumbraVal<<8) | penumbraVal;
+			} else { // this is the dolid light area of the umbra
+				*(DWORD *)(texPix+x*4+y*texRect.Pitch) = 0xffffffff;
+			}
+		}
+	}
+	tex->UnlockRect(0);
+}
+
+// free the textures & meshes of the shared slots nobody uses any more, and the spare shadow maps
+static void PurgeUnusedResources(LG3DScene *scene)
+{
+	int i;
+	unsigned int j;
+	for(i=0;i<scene->numSpotShapes;i++) {
+		if (scene->spotShape[i].refCount == 0)
+			SAFE_RELEASE(scene->spotShape[i].tex);
+	}
+	for(i=0;i<scene->numSharedGobos;i++) {
+		if (scene->sharedGobo[i].refCount == 0)
+			SAFE_RELEASE(scene->sharedGobo[i].tex);
+	}
+	for(i=0;i<scene->numSharedMeshes;i++) {
+		LG3DSharedMesh *shared = &scene->sharedMesh[i];
+		if ((shared->refCount == 0) && shared->mesh) {
+			for(j=0;j<shared->mesh->m_dwNumMaterials;j++) {
+				if (shared->mesh->m_pTextures[j] == g_pWhiteMap)
+					shared->mesh->m_pTextures[j] = NULL;
+			}
+			delete shared->mesh;
+			shared->mesh = NULL;
+		}
+	}
+	for(i=0;i<scene->numSpareShadowMaps;i++)
+		SAFE_RELEASE(scene->spareShadowMap[i]);
+	scene->numSpareShadowMaps = 0;
+	scene->unusedResources = false;
+}
+
+static int AcquireSpotShape(IDirect3DDevice9 *pd3dDevice, LG3DScene *scene, float umbra, float penumbra)
+{
+	int i, freeSlot = -1;
+	for(i=0;i<scene->numSpotShapes;i++) {
+		LG3DSpotShape *shape = &scene->spotShape[i];
+		if ((shape->refCount == 0) && !shape->tex) {
+			if (freeSlot < 0)
+				freeSlot = i;
+		} else if ((shape->umbra == umbra) && (shape->penumbra == penumbra)) {
+			shape->refCount++;
+			return i;
+		}
+	}
+
+	if (freeSlot < 0) {
+		if (scene->numSpotShapes < scene->lightCapacity+1)
+			freeSlot = scene->numSpotShapes++;
+		else {
+			// list is full, make room by dropping the unused resources kept for reuse
+			PurgeUnusedResources(scene);
+			for(freeSlot=0;scene->spotShape[freeSlot].refCount;freeSlot++)
+				;
+		}
+	}
+
+	// create a texture with which to model the requested umbra & penumbra values
+	// D3DXCreateTexture(pd3dDevice, 256, 256, 1, D3DUSAGE_DYNAMIC, D3DFMT_A8R8G8B8, D3DPOOL_DEFAULT, &tex);
+	LG3DSpotShape *shape = &scene->spotShape[freeSlot];
+	shape->umbra = umbra;
+	shape->penumbra = penumbra;
+	shape->refCount = 1;
+	shape->tex = NULL;
+	pd3dDevice->CreateTexture(256, 256, 1, 0, D3DFMT_A8R8G8B8, D3DPOOL_MANAGED, &shape->tex, NULL);
+	GenerateSpotTexture(shape->tex, umbra, penumbra);
+	scene->rebuilt.texturesRebuilt++;
+	return freeSlot;
+}
+
+static void ReleaseSpotShape(LG3DScene *scene, int shapeIndex)
+{
+	LG3DSpotShape *shape = &scene->spotShape[shapeIndex];
+	shape->refCount--;
+	if (shape->refCount == 0)
+		scene->unusedResources = true;
+}
+
+static int AcquireGobo(IDirect3DDevice9 *pd3dDevice, LG3DScene *scene, LG3DNameId name)
+{
+	int i, freeSlot = -1;
+	for(i=0;i<scene->numSharedGobos;i++) {
+		LG3DSharedGobo *gobo = &scene->sharedGobo[i];
+		if ((gobo->refCount == 0) && !gobo->tex) {
+			if (freeSlot < 0)
+				freeSlot = i;
+		} else if (gobo->name == name) {
+			gobo->refCount++;
+			return i;
+		}
+	}
+
+	if (freeSlot < 0) {
+		if (scene->numSharedGobos < scene->lightCapacity+1)
+			freeSlot = scene->numSharedGobos++;
+		else {
+			// list is full, make room by dropping the unused resources kept for reuse
+			PurgeUnusedResources(scene);
+			for(freeSlot=0;scene->sharedGobo[freeSlot].refCount;freeSlot++)
+				;
+		}
+	}
+
+	LG3DSharedGobo *gobo = &scene->sharedGobo[freeSlot];
+	gobo->name = name;
+	gobo->refCount = 1;
+	gobo->tex = NULL;
+	D3DXCreateTextureFromFile( pd3dDevice, LG3DNameString(name), &gobo->tex );
+	scene->rebuilt.texturesRebuilt++;
+	return freeSlot;
+}
+
+static void ReleaseGobo(LG3DScene *scene, int goboIndex)
+{
+	LG3DSharedGobo *gobo = &scene->sharedGobo[goboIndex];
+	gobo->refCount--;
+	if (gobo->refCount == 0)
+		scene->unusedResources = true;
+}
+
+static int AcquireMesh(IDirect3DDevice9 *pd3dDevice, LG3DScene *scene, LG3DNameId name)
+{
+	int i, freeSlot = -1;
+	for(i=0;i<scene->numSharedMeshes;i++) {
+		LG3DSharedMesh *shared = &scene->sharedMesh[i];
+		if ((shared->refCount == 0) && !shared->mesh) {
+			if (freeSlot < 0)
+				freeSlot = i;
+		} else if (shared->name == name) {
+			shared->refCount++;
+			return i;
+		}
+	}
+
+	if (freeSlot < 0) {
+		if (scene->numSharedMeshes < scene->objCapacity+1)
+			freeSlot = scene->numSharedMeshes++;
+		else {
+			// list is full, make room by dropping the unused resources kept for reuse
+			PurgeUnusedResources(scene);
+			for(freeSlot=0;scene->sharedMesh[freeSlot].refCount;freeSlot++)
+				;
+		}
+	}
+
+	LG3DSharedMesh *shared = &scene->sharedMesh[freeSlot];
+	shared->name = name;
+	shared->refCount = 1;
+	shared->mesh = new CDXUTMesh;
+	shared->mesh->Create(pd3dDevice, LG3DNameString(name));
+	unsigned int j;
+	for(j=0;j<shared->mesh->m_dwNumMaterials;j++) {
+		if (shared->mesh->m_pTextures[j] == NULL)
+			shared->mesh->m_pTextures[j] = g_pWhiteMap;
+	}
+	scene->rebuilt.meshesRebuilt++;
+	return freeSlot;
+}
+
+static void ReleaseMesh(LG3DScene *scene, int meshIndex)
+{
+	LG3DSharedMesh *shared = &scene->sharedMesh[meshIndex];
+	shared->refCount--;
+	if (shared->refCount == 0)
+		scene->unusedResources = true;
+}
+
+// shadow maps are all the same size, so one released during a frame move is handed to
+// the next light needing one instead of being re-created
+static LPDIRECT3DTEXTURE9 AcquireShadowMap(IDirect3DDevice9 *pd3dDevice, LG3DScene *scene, int shadowMapSize)
+{
+	if (scene->numSpareShadowMaps > 0)
+		return scene->spareShadowMap[--scene->numSpareShadowMaps];
+	LPDIRECT3DTEXTURE9 shadowMap = NULL;
+	pd3dDevice->CreateTexture(shadowMapSize, shadowMapSize, 1, D3DUSAGE_RENDERTARGET, D3DFMT_R32F, D3DPOOL_DEFAULT, &shadowMap, NULL);
+	scene->rebuilt.shadowMapsRebuilt++;
+	return shadowMap;
+}
+
+static void ReleaseShadowMap(LG3DScene *scene, LPDIRECT3DTEXTURE9 *shadowMap)
+{
+	if (!*shadowMap)
+		return;
+	scene->spareShadowMap[scene->numSpareShadowMaps++] = *shadowMap;
+	*shadowMap = NULL;
+	scene->unusedResources = true;
+}
+
+// determines in which loop a light should contribute to the scene
+static int LightLoopId(unsigned long flags)
+{
+	if (!(flags & LG3DLightFlag_HasGobo) && !(flags & LG3DLightFlag_CastsShadows))
+		return 0;
+	else if ((flags & LG3DLightFlag_HasGobo) && !(flags & LG3DLightFlag_CastsShadows))
+		return 1;
+	return 2;
+}
+
+// fill the light beam effect vertex buffer from the light's cone & color
+static void FillLightBeam(LG3DInternalLight *light, const LG3DLightTable *lights, int i)
+{
+	if (!light->lightBeamVB)
+		return;
+
+	int colorR = (int)(lights->colorR[i]*255.0f + 0.5f);
+	int colorG = (int)(lights->colorG[i]*255.0f + 0.5f);
+	int colorB = (int)(lights->colorB[i]*255.0f + 0.5f);
+
+#if defined(LIGHT_BEAM_METHOD_1)
+	LightBeam *lightBeam;
+	light->lightBeamVB->Lock(0, 0, (void**)&lightBeam, 0);
+	const float beamDist = 10.0f; // max dist beam projects
+	const float r = beamDist * sinf(DEG2RADf(lights->umbra[i] + lights->penumbra[i])*0.5f);
+
+	int lbi;
+	for (lbi=0;lbi<light->numBeams;lbi++) {
+		lightBeam[lbi*3+0].v = D3DXVECTOR3(0.0f, 0.0f, 0.0f);
+		lightBeam[lbi*3+0].color = D3DCOLOR_ARGB(0x30, colorR, colorG, colorB);
+		lightBeam[lbi*3+0].tu = 0.5f;
+		lightBeam[lbi*3+0].tv = 0.0f;
+
+		// x*x + y*y = r*r; where r == 5.0f
+		// 1.8f is a factor determining how near the top/bottom the beginning/ending ray will be.
+		// 2.0f would yield exactly the top/bottom, 1.0f would yield 3/4 to the top/bottom.
+		float t = 1.8f * (lbi-light->numBeams/2)/(float)(light->numBeams-1);
+		float y1 = t * r;
+		float x1 = sqrtf(r*r - y1*y1);
+		float y2 = t * -r;
+		float x2 = -x1;
+
+		lightBeam[lbi*3+1].v = D3DXVECTOR3(x1, y1, beamDist);
+		lightBeam[lbi*3+1].color = D3DCOLOR_ARGB(0x00, colorR, colorG, colorB);
+		lightBeam[lbi*3+1].tu = 0.0f;
+		lightBeam[lbi*3+1].tv = 1.0f;
+
+		lightBeam[lbi*3+2].v = D3DXVECTOR3(x2, y2, beamDist);
+		lightBeam[lbi*3+2].color = D3DCOLOR_ARGB(0x00, colorR, colorG, colorB);
+		lightBeam[lbi*3+2].tu = 1.0f;
+		lightBeam[lbi*3+2].tv = 1.0f;
+	}
+#elif defined(LIGHT_BEAM_METHOD_2)
+	LightBeam *lightBeam;
+	light->lightBeamVB->Lock(0, 0, (void**)&lightBeam, 0);
+	const float beamDist = 10.0f; // max dist beam projects
+	const float r = beamDist * sinf(DEG2RADf(lights->umbra[i] + lights->penumbra[i])*0.5f);
+
+	int lbi;
+	for (lbi=0;lbi<light->numBeams;lbi+=2) {
+		lightBeam[lbi*3+0].v = D3DXVECTOR3(0.0f, 0.0f, 0.0f);
+		lightBeam[lbi*3+0].color = D3DCOLOR_ARGB(0x20, colorR, colorG, colorB);
+		lightBeam[lbi*3+0].tu = 0.5f;
+		lightBeam[lbi*3+0].tv = 0.0f;
+
+		// x*x + y*y = r*r; where r == 5.0f
+		// 1.8f is a factor determining how near the top/bottom the beginning/ending ray will be.
+		// 2.0f would yield exactly the top/bottom, 1.0f would yield 3/4 to the top/bottom.
+		float t = 1.8f * (lbi/2-light->numBeams/4)/(float)(light->numBeams/2-1);
+		float y1 = t * r;
+		float x1 = sqrtf(r*r - y1*y1);
+		// horizontal slices
+		float y2 = y1;
+		float x2 = -x1;
+
+		lightBeam[lbi*3+1].v = D3DXVECTOR3(x1, y1, beamDist);
+		lightBeam[lbi*3+1].color = D3DCOLOR_ARGB(0x00, colorR, colorG, colorB);
+		lightBeam[lbi*3+1].tu = 0.0f;
+		lightBeam[lbi*3+1].tv = 1.0f;
+
+		lightBeam[lbi*3+2].v = D3DXVECTOR3(x2, y2, beamDist);
+		lightBeam[lbi*3+2].color = D3DCOLOR_ARGB(0x00, colorR, colorG, colorB);
+		lightBeam[lbi*3+2].tu = 1.0f;
+		lightBeam[lbi*3+2].tv = 1.0f;
+
+		lightBeam[lbi*3+3] = lightBeam[lbi*3+0];
+		lightBeam[lbi*3+4] = lightBeam[lbi*3+1];
+		lightBeam[lbi*3+5] = lightBeam[lbi*3+2];
+
+		// vertical slices
+		x1 = t * r;
+		y1 = sqrtf(r*r - x1*x1);
+		x2 = x1;
+		y2 = -y1;
+		lightBeam[lbi*3+4].v = D3DXVECTOR3(x1, y1, beamDist);
+		lightBeam[lbi*3+5].v = D3DXVECTOR3(x2, y2, beamDist);
+	}
+#endif /* LIGHT_BEAM_METHOD_X */
+
+	light->lightBeamVB->Unlock();
+}
+
+// grow the per-light arrays to hold at least numLights lights, new entries have no resources
+static void GrowSceneLights(LG3DScene *scene, int numLights)
+{
+	if (numLights <= scene->lightCapacity)
+		return;
+	int i, oldCapacity = scene->lightCapacity;
+	int newCapacity = oldCapacity*2;
+	if (newCapacity < numLights)
+		newCapacity = numLights;
+
+	scene->light = (LG3DInternalLight *)realloc(scene->light, sizeof(LG3DInternalLight) * newCapacity);
+	memset(&scene->light[oldCapacity], 0, sizeof(LG3DInternalLight) * (newCapacity-oldCapacity));
+	for(i=oldCapacity;i<newCapacity;i++) {
+		scene->light[i].spotShape = -1;
+		scene->light[i].gobo = -1;
+	}
+	scene->lightMat = (LG3DLightMatrices *)_aligned_realloc(scene->lightMat, sizeof(LG3DLightMatrices) * (newCapacity+1), 16);
+	scene->lightDirX = (float *)realloc(scene->lightDirX, sizeof(float) * (newCapacity+1));
+	scene->lightDirY = (float *)realloc(scene->lightDirY, sizeof(float) * (newCapacity+1));
+	scene->lightDirZ = (float *)realloc(scene->lightDirZ, sizeof(float) * (newCapacity+1));
+	scene->lightPosX = (float *)realloc(scene->lightPosX, sizeof(float) * (newCapacity+1));
+	scene->lightPosY = (float *)realloc(scene->lightPosY, sizeof(float) * (newCapacity+1));
+	scene->lightPosZ = (float *)realloc(scene->lightPosZ, sizeof(float) * (newCapacity+1));
+	for(i=0;i<3;i++)
+		scene->loopList[i] = (int *)realloc(scene->loopList[i], sizeof(int) * (newCapacity+1));
+	// a light changing shape acquires its new spot shape before releasing the old one, hence the +1
+	scene->spotShape = (LG3DSpotShape *)realloc(scene->spotShape, sizeof(LG3DSpotShape) * (newCapacity+1));
+	scene->sharedGobo = (LG3DSharedGobo *)realloc(scene->sharedGobo, sizeof(LG3DSharedGobo) * (newCapacity+1));
+	scene->movedLightList = (int *)realloc(scene->movedLightList, sizeof(int) * (newCapacity+1));
+	scene->spareShadowMap = (LPDIRECT3DTEXTURE9 *)realloc(scene->spareShadowMap, sizeof(LPDIRECT3DTEXTURE9) * (newCapacity+1));
+	scene->lightCapacity = newCapacity;
+}
+
+static void GrowSceneObjects(LG3DScene *scene, int numObjects)
+{
+	if (numObjects <= scene->objCapacity)
+		return;
+	int i, oldCapacity = scene->objCapacity;
+	int newCapacity = oldCapacity*2;
+	if (newCapacity < numObjects)
+		newCapacity = numObjects;
+
+	scene->obj = (LG3DInternalObject *)realloc(scene->obj, sizeof(LG3DInternalObject) * newCapacity);
+	for(i=oldCapacity;i<newCapacity;i++) {
+		scene->obj[i].mesh = NULL;
+		scene->obj[i].sharedMesh = -1;
+	}
+	scene->sharedMesh = (LG3DSharedMesh *)realloc(scene->sharedMesh, sizeof(LG3DSharedMesh) * (newCapacity+1));
+	scene->objCapacity = newCapacity;
+}
+
+// create the device resources for light i.  The beam vertices are filled in by the frame
+// move's color change handling.
+static void CreateLightResources(IDirect3DDevice9 *pd3dDevice, LG3DScene *scene, const LG3DLightTable *lights, int i, int shadowMapSize)
+{
+	LG3DInternalLight *light = &scene->light[i];
+
+	// if light requires a shadow map
+	if (lights->flags[i] & LG3DLightFlag_CastsShadows)
+		light->shadowMap = AcquireShadowMap(pd3dDevice, scene, shadowMapSize);
+
+	// if gobo specified, load up that file, once for all the lights naming it
+	light->spotShape = -1;
+	light->gobo = -1;
+	if (lights->flags[i] & LG3DLightFlag_HasGobo) {
+		light->gobo = AcquireGobo(pd3dDevice, scene, lights->cold[i].goboName);
+		light->goboMap = scene->sharedGobo[light->gobo].tex;
+	} else {
+		// we assume its a spotlight, and point to the default spotlight shape
+		// light->goboMap = g_pSpotMap;
+
+		// use a texture modeling the requested umbra & penumbra values
+		light->spotShape = AcquireSpotShape(pd3dDevice, scene, lights->umbra[i], lights->penumbra[i]);
+		light->goboMap = scene->spotShape[light->spotShape].tex;
+	}
+
+	// determine in which loop this light should contribute to the scene
+	light->loopId = LightLoopId(lights->flags[i]);
+
+	// create the light beam effect vertex buffer
+	light->numBeams = LIGHT_BEAM_COUNT;
+	pd3dDevice->CreateVertexBuffer(light->numBeams * 3 * sizeof(LightBeam), D3DUSAGE_WRITEONLY, 0, D3DPOOL_MANAGED, &light->lightBeamVB, NULL);
+}
+
+static void ReleaseLightResources(LG3DScene *scene, int i)
+{
+	LG3DInternalLight *light = &scene->light[i];
+	ReleaseShadowMap(scene, &light->shadowMap);
+	if (light->spotShape >= 0)
+		ReleaseSpotShape(scene, light->spotShape);
+	else if (light->gobo >= 0)
+		ReleaseGobo(scene, light->gobo);
+	SAFE_RELEASE(light->lightBeamVB);
+	light->goboMap = NULL;
+	light->spotShape = -1;
+	light->gobo = -1;
+	light->numBeams = 0;
+	light->loopId = 0;
+}
+
+// objects naming the same file share one mesh
+static void CreateObjectResources(IDirect3DDevice9 *pd3dDevice, LG3DScene *scene, const LG3DSceneObject *object, int i)
+{
+	scene->obj[i].sharedMesh = AcquireMesh(pd3dDevice, scene, object->meshName);
+	scene->obj[i].mesh = scene->sharedMesh[scene->obj[i].sharedMesh].mesh;
+}
+
+static void ReleaseObjectResources(LG3DScene *scene, int i)
+{
+	if (scene->obj[i].sharedMesh >= 0)
+		ReleaseMesh(scene, scene->obj[i].sharedMesh);
+	scene->obj[i].sharedMesh = -1;
+	scene->obj[i].mesh = NULL;
+}
+
 HRESULT CALLBACK LG3DControl::OnCreateDevice( IDirect3DDevice9* pd3dDevice, const D3DSURFACE_DESC* pBackBufferSurfaceDesc )
 {
 	// ---------------------------------------------------------
@@ -302,20 +828,16 @@ HRESULT CALLBACK LG3DControl::OnCreateDevice( IDirect3DDevice9* pd3dDevice, cons
 	D3DXCreateTextureFromFile( pd3dDevice, L".\\data\\white.bmp", &g_pWhiteMap );
 	D3DXCreateTextureFromFile( pd3dDevice, L".\\data\\lightBeam5.dds", &lightBeamTex );
 
-	scene->obj = (LG3DInternalObject *)malloc(sizeof(LG3DInternalObject) * controlData->numSceneObjects);
+	// objects are loaded on the first frame move, along with any added later
+	scene->obj = NULL;
+	scene->sharedMesh = NULL;
+	scene->numSharedMeshes = 0;
+	scene->objCapacity = 0;
+	scene->numObjects = 0;
+	GrowSceneObjects(scene, controlData->numSceneObjects);
 
 	int i;
 	unsigned int j;
-	for(i=0;i<controlData->numSceneObjects;i++) {
-		scene->obj[i].mesh = new CDXUTMesh;
-		scene->obj[i].mesh->Create(pd3dDevice, (LPCWSTR)controlData->sceneObjectList[i].meshName);
-		for(j=0;j<scene->obj[i].mesh->m_dwNumMaterials;j++) {
-			if (scene->obj[i].mesh->m_pTextures[j] == NULL)
-				scene->obj[i].mesh->m_pTextures[j] = g_pWhiteMap;
-		}
-		// force matrix update on first render
-		scene->obj[i].moved = true;
-	}
 
 	// DXUTCreateArrowMeshFromInternalArray( pd3dDevice, &g_arrow );
 	g_lightCan1 = new CDXUTMesh();
@@ -340,177 +862,47 @@ HRESULT CALLBACK LG3DControl::OnCreateDevice( IDirect3DDevice9* pd3dDevice, cons
 	D3DXCreateTextureFromFile( pd3dDevice, L".\\data\\NormTest.dds", &g_pNormMap );
 
 	// ---------------------------------------------------------
-	// allocate space for shadow map list and each required shadow map
+	// allocate space for the per-light data.  The lights' resources
+	// are created on the first frame move, the same way as for
+	// lights added later on.
 	// ---------------------------------------------------------
-	scene->light = (LG3DInternalLight *)malloc(sizeof(LG3DInternalLight) * controlData->numSceneLights);
-	memset(scene->light, 0, sizeof(LG3DInternalLight) * controlData->numSceneLights);
-	for(i=0;i<controlData->numSceneLights;i++) {
-		// if light requires a shadow map
-		if (controlData->sceneLightList[i].castsShadows) {
-			V_RETURN( pd3dDevice->CreateTexture( shadowMapSize, shadowMapSize,
-												 1, D3DUSAGE_RENDERTARGET,
-												 D3DFMT_R32F,
-												 D3DPOOL_DEFAULT,
-												 &scene->light[i].shadowMap,
-												 NULL ) );
-		}
-
-		// force shadow map update on first render
-		scene->light[i].lightMoved = true;
-
-		// if gobo specified, load up that file
-		if (controlData->sceneLightList[i].goboName[0] != 0)
-			D3DXCreateTextureFromFile( pd3dDevice, controlData->sceneLightList[i].goboName, &scene->light[i].goboMap );
-		else {
-			// we assume its a spotlight, and point to the default spotlight shape
-			// scene->light[i].goboMap = g_pSpotMap;
-
-			// create a texture with which to model the requested umbra & penumbra values
-			// D3DXCreateTexture(pd3dDevice, 256, 256, 1, D3DUSAGE_DYNAMIC, D3DFMT_A8R8G8B8, D3DPOOL_DEFAULT, &scene->light[i].goboMap);
-			pd3dDevice->CreateTexture(256, 256, 1, 0, D3DFMT_A8R8G8B8, D3DPOOL_MANAGED, &scene->light[i].goboMap, NULL);
-			D3DSURFACE_DESC desc;
-			scene->light[i].goboMap->GetLevelDesc(0, &desc);
-
-			// generate the umbra & penumbra portions of the texture
-			D3DLOCKED_RECT texRect;
-			scene->light[i].goboMap->LockRect(0, &texRect, NULL, 0);
-			int x, y;
-			float umbra = controlData->sceneLightList[i].umbra;
-			float penumbra = controlData->sceneLightList[i].penumbra;
-			float totalAngle = umbra + penumbra;
-			float centerX = 127.5f, centerY = 127.5f;
-			float penumbraAmount;
-			unsigned long penumbraVal;
-			float dist;
-			float pixAngle;
-			float dx, dy;
-			unsigned char *texPix = (unsigned char *)texRect.pBits;
-			for(y=0;y<256;y++) {
-				dy = centerY - y;
-				for(x=0;x<256;x++) {
-					dx = centerX - x;
-					dist = sqrtf(dx*dx+dy*dy);
-					pixAngle = totalAngle * dist / 127.0f;
-					if (pixAngle > totalAngle) { // no light in this region
-						*(DWORD *)(texPix+x*4+y*texRect.Pitch) = 0;
-					} else if (pixAngle > umbra) { // this is the penumbra outer edge region
-						penumbraAmount = 1.0f - (pixAngle-umbra)/penumbra;
-						penumbraAmount = powf(penumbraAmount, 0.5f);  // the penumbra falloff is just a square root function, but we could make the 0.5 a parameter per spotlight if we wanted
-						penumbraVal = (unsigned char)(penumbraAmount*255);
-						*(DWORD *)(texPix+x*4+y*texRect.Pitch) = (penumbraVal<<24) | (penumbraVal<<16) | (penumbraVal<<8) | penumbraVal;
-					} else { // this is the dolid light area of the umbra
-						*(DWORD *)(texPix+x*4+y*texRect.Pitch) = 0xffffffff;
-					}
-				}
-			}
-			scene->light[i].goboMap->UnlockRect(0);
-		}
-
-		// determine in which loop this light should contribute to the scene
-		if ((controlData->sceneLightList[i].goboName[0] == 0) && !controlData->sceneLightList[i].castsShadows)
-			scene->light[i].loopId = 0;
-		else if ((controlData->sceneLightList[i].goboName[0] != 0) && !controlData->sceneLightList[i].castsShadows)
-			scene->light[i].loopId = 1;
-		else
-			scene->light[i].loopId = 2;
-
-		// set source color of this light
-		scene->light[i].color = D3DXVECTOR4(controlData->sceneLightList[i].color.r/255.0f, controlData->sceneLightList[i].color.g/255.0f, controlData->sceneLightList[i].color.b/255.0f, 1.0f);
-
-// #define LIGHT_BEAM_METHOD_1
-#define LIGHT_BEAM_METHOD_2
-		// create the light beam effect vertex buffer
-		// if (controlData->sceneLightList[i].goboName[0] == 0) {
-		if (1) {
-#if defined(LIGHT_BEAM_METHOD_1)
-			scene->light[i].numBeams = 7; // more beams yield a better volume at the cost of a performance hit.  11 is probably a good max #, and 1 would be the minimum
-			pd3dDevice->CreateVertexBuffer(scene->light[i].numBeams * 3 * sizeof(LightBeam), D3DUSAGE_WRITEONLY, 0, D3DPOOL_MANAGED, &scene->light[i].lightBeamVB, NULL);
-			LightBeam *lightBeam;
-			scene->light[i].lightBeamVB->Lock(0, 0, (void**)&lightBeam, 0);
-			const float beamDist = 10.0f; // max dist beam projects
-			const float r = beamDist * sinf(DEG2RADf(controlData->sceneLightList[i].umbra + controlData->sceneLightList[i].penumbra)*0.5f);
-
-			int lbi;
-			for (lbi=0;lbi<scene->light[i].numBeams;lbi++) {
-				lightBeam[lbi*3+0].v = D3DXVECTOR3(0.0f, 0.0f, 0.0f);
-				lightBeam[lbi*3+0].color = D3DCOLOR_ARGB(0x30, controlData->sceneLightList[i].color.r, controlData->sceneLightList[i].color.g, controlData->sceneLightList[i].color.b);
-				lightBeam[lbi*3+0].tu = 0.5f;
-				lightBeam[lbi*3+0].tv = 0.0f;
-
-				// x*x + y*y = r*r; where r == 5.0f
-				// 1.8f is a factor determining how near the top/bottom the beginning/ending ray will be.
-				// 2.0f would yield exactly the top/bottom, 1.0f would yield 3/4 to the top/bottom.
-				float t = 1.8f * (lbi-scene->light[i].numBeams/2)/(float)(scene->light[i].numBeams-1);
-				float y1 = t * r;
-				float x1 = sqrtf(r*r - y1*y1);
-				float y2 = t * -r;
-				float x2 = -x1;
-
-				lightBeam[lbi*3+1].v = D3DXVECTOR3(x1, y1, beamDist);
-				lightBeam[lbi*3+1].color = D3DCOLOR_ARGB(0x00, controlData->sceneLightList[i].color.r, controlData->sceneLightList[i].color.g, controlData->sceneLightList[i].color.b);
-				lightBeam[lbi*3+1].tu = 0.0f;
-				lightBeam[lbi*3+1].tv = 1.0f;
-
-				lightBeam[lbi*3+2].v = D3DXVECTOR3(x2, y2, beamDist);
-				lightBeam[lbi*3+2].color = D3DCOLOR_ARGB(0x00, controlData->sceneLightList[i].color.r, controlData->sceneLightList[i].color.g, controlData->sceneLightList[i].color.b);
-				lightBeam[lbi*3+2].tu = 1.0f;
-				lightBeam[lbi*3+2].tv = 1.0f;
-			}
-#elif defined(LIGHT_BEAM_METHOD_2)
-			scene->light[i].numBeams = 14; // number of horizontal plus vertical slices
-			pd3dDevice->CreateVertexBuffer(scene->light[i].numBeams * 3 * sizeof(LightBeam), D3DUSAGE_WRITEONLY, 0, D3DPOOL_MANAGED, &scene->light[i].lightBeamVB, NULL);
-			LightBeam *lightBeam;
-			scene->light[i].lightBeamVB->Lock(0, 0, (void**)&lightBeam, 0);
-			const float beamDist = 10.0f; // max dist beam projects
-			const float r = beamDist * sinf(DEG2RADf(controlData->sceneLightList[i].umbra + controlData->sceneLightList[i].penumbra)*0.5f);
-
-			int lbi;
-			for (lbi=0;lbi<scene->light[i].numBeams;lbi+=2) {
-				lightBeam[lbi*3+0].v = D3DXVECTOR3(0.0f, 0.0f, 0.0f);
-				lightBeam[lbi*3+0].color = D3DCOLOR_ARGB(0x20, controlData->sceneLightList[i].color.r, controlData->sceneLightList[i].color.g, controlData->sceneLightList[i].color.b);
-				lightBeam[lbi*3+0].tu = 0.5f;
-				lightBeam[lbi*3+0].tv = 0.0f;
-
-				// x*x + y*y = r*r; where r == 5.0f
-				// 1.8f is a factor determining how near the top/bottom the beginning/ending ray will be.
-				// 2.0f would yield exactly the top/bottom, 1.0f would yield 3/4 to the top/bottom.
-				float t = 1.8f * (lbi/2-scene->light[i].numBeams/4)/(float)(scene->light[i].numBeams/2-1);
-				float y1 = t * r;
-				float x1 = sqrtf(r*r - y1*y1);
-				// horizontal slices
-				float y2 = y1;
-				float x2 = -x1;
-
-				lightBeam[lbi*3+1].v = D3DXVECTOR3(x1, y1, beamDist);
-				lightBeam[lbi*3+1].color = D3DCOLOR_ARGB(0x00, controlData->sceneLightList[i].color.r, controlData->sceneLightList[i].color.g, controlData->sceneLightList[i].color.b);
-				lightBeam[lbi*3+1].tu = 0.0f;
-				lightBeam[lbi*3+1].tv = 1.0f;
-
-				lightBeam[lbi*3+2].v = D3DXVECTOR3(x2, y2, beamDist);
-				lightBeam[lbi*3+2].color = D3DCOLOR_ARGB(0x00, controlData->sceneLightList[i].color.r, controlData->sceneLightList[i].color.g, controlData->sceneLightList[i].color.b);
-				lightBeam[lbi*3+2].tu = 1.0f;
-				lightBeam[lbi*3+2].tv = 1.0f;
-
-				lightBeam[lbi*3+3] = lightBeam[lbi*3+0];
-				lightBeam[lbi*3+4] = lightBeam[lbi*3+1];
-				lightBeam[lbi*3+5] = lightBeam[lbi*3+2];
-
-				// vertical slices
-				x1 = t * r;
-				y1 = sqrtf(r*r - x1*x1);
-				x2 = x1;
-				y2 = -y1;
-				lightBeam[lbi*3+4].v = D3DXVECTOR3(x1, y1, beamDist);
-				lightBeam[lbi*3+5].v = D3DXVECTOR3(x2, y2, beamDist);
-			}
-#endif /* LIGHT_BEAM_METHOD_X */
-
-			scene->light[i].lightBeamVB->Unlock();
-		} else {
-			scene->light[i].lightBeamVB = NULL;
-			scene->light[i].numBeams = 0;
-		}
+	scene->light = NULL;
+	scene->lightMat = NULL;
+	scene->lightDirX = scene->lightDirY = scene->lightDirZ = NULL;
+	scene->lightPosX = scene->lightPosY = scene->lightPosZ = NULL;
+	for(i=0;i<3;i++) {
+		scene->loopList[i] = NULL;
+		scene->numLoopLights[i] = 0;
 	}
+	scene->spotShape = NULL;
+	scene->numSpotShapes = 0;
+	scene->sharedGobo = NULL;
+	scene->numSharedGobos = 0;
+	scene->movedLightList = NULL;
+	scene->numMovedLights = 0;
+	scene->spareShadowMap = NULL;
+	scene->numSpareShadowMaps = 0;
+	scene->unusedResources = false;
+	scene->lightCapacity = 0;
+	scene->numLights = 0;
+	GrowSceneLights(scene, controlData->lights.count);
+	scene->loopListsDirty = true;
+
+	// node transforms are worked out on the first frame move as well
+	int numNodes = controlData->numSceneNodes;
+	scene->nodeWorld = (D3DXMATRIXA16 *)_aligned_malloc(sizeof(D3DXMATRIXA16) * (numNodes+1), 16);
+	scene->nodeMoved = (bool *)calloc(numNodes+1, sizeof(bool));
+	scene->nodeFirstLight = (int *)calloc(numNodes+1, sizeof(int));
+	scene->nodeFirstObject = (int *)calloc(numNodes+1, sizeof(int));
+	scene->nodeLightList = NULL;
+	scene->nodeObjectList = NULL;
+	scene->numNodes = numNodes;
+	scene->attachListsDirty = true;
+
+	// everything starts out dirty, so the first frame move creates all light & object resources
+	controlData->AllocDirtyState();
+	scene->allLightsMoved = true;
+	scene->shadowsWanted = controlData->wantShadows;
 
 	// ---------------------------------------------------------
 	// load the fx file (our vertex & pixel shaders)
@@ -623,7 +1015,7 @@ void CALLBACK LG3DControl::OnLostDevice( )
     SAFE_RELEASE( g_pTextSprite );
 
 	int light;
-	for(light=0;light<controlData->numSceneLights;light++) {
+	for(light=0;light<scene->numLights;light++) {
 		SAFE_RELEASE( scene->light[light].shadowMap );
 	}
 
@@ -634,14 +1026,15 @@ void CALLBACK LG3DControl::OnDestroyDevice( )
 {
 	int i;
 	unsigned int j;
-	for(i=0;i<controlData->numSceneObjects;i++) {
-		for(j=0;j<scene->obj[i].mesh->m_dwNumMaterials;j++) {
-			if (scene->obj[i].mesh->m_pTextures[j] == g_pWhiteMap)
-				scene->obj[i].mesh->m_pTextures[j] = NULL;
-		}
-		delete scene->obj[i].mesh;
-	}
+	for(i=0;i<scene->numObjects;i++)
+		ReleaseObjectResources(scene, i);
+	PurgeUnusedResources(scene);
 	free(scene->obj);
+	free(scene->sharedMesh);
+	scene->obj = NULL;
+	scene->sharedMesh = NULL;
+	scene->numSharedMeshes = 0;
+	scene->objCapacity = 0;
     SAFE_RELEASE(scene->effect);
     SAFE_RELEASE(scene->vertLightEffect);
     // SAFE_RELEASE(scene->shadowMapFx);
@@ -653,14 +1046,50 @@ void CALLBACK LG3DControl::OnDestroyDevice( )
 	}
 	delete g_lightCan1;
 
-	int light;
-	for(light=0;light<controlData->numSceneLights;light++) {
-		SAFE_RELEASE( scene->light[light].shadowMap );
-		if (scene->light[light].goboMap != g_pSpotMap)
-			SAFE_RELEASE(scene->light[light].goboMap);
-		SAFE_RELEASE(scene->light[light].lightBeamVB);
-	}
+	for(i=0;i<scene->numLights;i++)
+		ReleaseLightResources(scene, i);
+	PurgeUnusedResources(scene);
 	free(scene->light);
+	_aligned_free(scene->lightMat);
+	free(scene->lightDirX);
+	free(scene->lightDirY);
+	free(scene->lightDirZ);
+	free(scene->lightPosX);
+	free(scene->lightPosY);
+	free(scene->lightPosZ);
+	for(i=0;i<3;i++) {
+		free(scene->loopList[i]);
+		scene->loopList[i] = NULL;
+		scene->numLoopLights[i] = 0;
+	}
+	free(scene->spotShape);
+	free(scene->movedLightList);
+	scene->light = NULL;
+	scene->lightMat = NULL;
+	scene->lightDirX = scene->lightDirY = scene->lightDirZ = NULL;
+	scene->lightPosX = scene->lightPosY = scene->lightPosZ = NULL;
+	scene->spotShape = NULL;
+	scene->numSpotShapes = 0;
+	free(scene->sharedGobo);
+	scene->sharedGobo = NULL;
+	scene->numSharedGobos = 0;
+	scene->movedLightList = NULL;
+	scene->numMovedLights = 0;
+	free(scene->spareShadowMap);
+	scene->spareShadowMap = NULL;
+	scene->lightCapacity = 0;
+
+	_aligned_free(scene->nodeWorld);
+	free(scene->nodeMoved);
+	free(scene->nodeFirstLight);
+	free(scene->nodeLightList);
+	free(scene->nodeFirstObject);
+	free(scene->nodeObjectList);
+	scene->nodeWorld = NULL;
+	scene->nodeMoved = NULL;
+	scene->nodeFirstLight = scene->nodeLightList = NULL;
+	scene->nodeFirstObject = scene->nodeObjectList = NULL;
+	scene->numNodes = 0;
 
     SAFE_RELEASE(m_pOverlayVB);
 	SAFE_RELEASE(m_pShowMapPS);
@@ -688,93 +1117,322 @@ void RenderText()
     txtHelper.End();
 }
 
-static double GenerateHash(LG3DSceneLight *light)
+// calculate light's world, view, and projection matrices
+static void UpdateLightTransform(LG3DScene *scene, const LG3DLightTable *lights, int i)
+{
+	LG3DLightMatrices *mat = &scene->lightMat[i];
+
+	// first just set up the light's rotational portion of the world matrix,
+	// then add in the translation, and carry it along with the node the
+	// light hangs from, if any
+	D3DXMATRIXA16 mHead, mPitch;
+	D3DXMatrixRotationY(&mHead, DEG2RADf(lights->head[i])); // heading
+	D3DXMatrixRotationX(&mPitch, -DEG2RADf(lights->pitch[i])); // pitch
+	mat->worldMat = mPitch * mHead;
+	mat->worldMat._41 = lights->posX[i];
+	mat->worldMat._42 = lights->posZ[i];
+	mat->worldMat._43 = lights->posY[i];
+	int node = lights->parentNode[i];
+	if ((node >= 0) && (node < scene->numNodes))
+		D3DXMatrixMultiply(&mat->worldMat, &mat->worldMat, &scene->nodeWorld[node]);
+
+	// now rotate the look vector by the light's rotations
+	D3DXVECTOR3 lookVec(0.0f, 0.0f, 1.0f); // +Z is into the screen
+	D3DXVECTOR3 vDir3;
+	D3DXVec3TransformNormal(&vDir3, &lookVec, &mat->worldMat);
+	// vDir3 should still be normalized, so noneed to renormalize it
+	scene->lightDirX[i] = vDir3.x;
+	scene->lightDirY[i] = vDir3.y;
+	scene->lightDirZ[i] = vDir3.z;
+
+	// and setup the view matrix
+	D3DXVECTOR3 vEyePt = D3DXVECTOR3(mat->worldMat._41, mat->worldMat._42, mat->worldMat._43);
+	scene->lightPosX[i] = vEyePt.x;
+	scene->lightPosY[i] = vEyePt.y;
+	scene->lightPosZ[i] = vEyePt.z;
+	D3DXVECTOR3 vLookatPt = vEyePt + vDir3; // lookat point is just our light position plus the light direction
+	D3DXVECTOR3 vUpVec(0,1,0); // Y up
+	D3DXMatrixLookAtLH(&mat->viewMat, &vEyePt, &vLookatPt, &vUpVec);
+
+	// calculate the projection
+	D3DXMatrixPerspectiveFovLH( &mat->projMat, DEG2RADf(lights->umbra[i]+lights->penumbra[i]), 1.0f, 0.01f, 100.0f);
+
+	// notice here the world matrix is omitted due to the fact that the view matrix contains all the info needed
+	mat->worldViewProj = /*mat->worldMat * */ mat->viewMat * mat->projMat;
+}
+
+// rebuild the per-loop light index lists, so each render loop only walks its own lights
+static void BuildLoopLists(LG3DScene *scene, const LG3DSlotList *lightSlots)
+{
+	int i, loopId;
+	for(loopId=0;loopId<3;loopId++)
+		scene->numLoopLights[loopId] = 0;
+	for(i=0;i<lightSlots->count;i++) {
+		if (!lightSlots->InUse(i))
+			continue;
+		loopId = scene->light[i].loopId;
+		scene->loopList[loopId][scene->numLoopLights[loopId]++] = i;
+	}
+	scene->loopListsDirty = false;
+}
+
+// a reload brought more nodes, the attach lists are rebuilt to cover them
+static void GrowSceneNodes(LG3DScene *scene, int numNodes)
+{
+	scene->nodeWorld = (D3DXMATRIXA16 *)_aligned_realloc(scene->nodeWorld, sizeof(D3DXMATRIXA16) * (numNodes+1), 16);
+	scene->nodeMoved = (bool *)realloc(scene->nodeMoved, sizeof(bool) * (numNodes+1));
+	scene->nodeFirstLight = (int *)realloc(scene->nodeFirstLight, sizeof(int) * (numNodes+1));
+	scene->nodeFirstObject = (int *)realloc(scene->nodeFirstObject, sizeof(int) * (numNodes+1));
+	memset(&scene->nodeMoved[scene->numNodes], 0, sizeof(bool) * (numNodes+1 - scene->numNodes));
+	scene->numNodes = numNodes;
+	scene->attachListsDirty = true;
+}
+
+// rebuild the lists of lights & objects hanging from each node, bucketed by node
+static void BuildAttachLists(LG3DScene *scene, const LG3DControlData *data)
 {
-	double hash =
-		light->position.x + light->position.y + light->position.z +
-		light->orientation.h + light->orientation.p + light->orientation.r +
-		light->penumbra + light->umbra;
-	return hash;
+	int i, n, node;
+	int numNodes = scene->numNodes;
+	const LG3DLightTable *lights = &data->lights;
+	scene->nodeLightList = (int *)realloc(scene->nodeLightList, sizeof(int) * (lights->count+1));
+	scene->nodeObjectList = (int *)realloc(scene->nodeObjectList, sizeof(int) * (data->numSceneObjects+1));
+
+	// count into the slot after each node's, sum up to get each node's first entry, and
+	// then fill - which leaves every first entry pointing at the next node's, so shift back
+	memset(scene->nodeFirstLight, 0, sizeof(int) * (numNodes+1));
+	for(i=0;i<lights->count;i++) {
+		node = lights->parentNode[i];
+		if ((node >= 0) && (node < numNodes) && data->lightSlots.InUse(i))
+			scene->nodeFirstLight[node+1]++;
+	}
+	for(n=0;n<numNodes;n++)
+		scene->nodeFirstLight[n+1] += scene->nodeFirstLight[n];
+	for(i=0;i<lights->count;i++) {
+		node = lights->parentNode[i];
+		if ((node >= 0) && (node < numNodes) && data->lightSlots.InUse(i))
+			scene->nodeLightList[scene->nodeFirstLight[node]++] = i;
+	}
+	for(n=numNodes;n>0;n--)
+		scene->nodeFirstLight[n] = scene->nodeFirstLight[n-1];
+	scene->nodeFirstLight[0] = 0;
+
+	memset(scene->nodeFirstObject, 0, sizeof(int) * (numNodes+1));
+	for(i=0;i<data->numSceneObjects;i++) {
+		node = data->sceneObjectList[i].parentNode;
+		if ((node >= 0) && (node < numNodes) && data->objectSlots.InUse(i))
+			scene->nodeFirstObject[node+1]++;
+	}
+	for(n=0;n<numNodes;n++)
+		scene->nodeFirstObject[n+1] += scene->nodeFirstObject[n];
+	for(i=0;i<data->numSceneObjects;i++) {
+		node = data->sceneObjectList[i].parentNode;
+		if ((node >= 0) && (node < numNodes) && data->objectSlots.InUse(i))
+			scene->nodeObjectList[scene->nodeFirstObject[node]++] = i;
+	}
+	for(n=numNodes;n>0;n--)
+		scene->nodeFirstObject[n] = scene->nodeFirstObject[n-1];
+	scene->nodeFirstObject[0] = 0;
+
+	scene->attachListsDirty = false;
 }
 
-static double GenerateHash(LG3DSceneObject *obj)
+// bring the node world transforms up to date, and mark the lights & objects hanging from
+// nodes that moved dirty so the light & object passes rebuild their matrices.  Nodes are
+// listed parents first, so one pass starting at the first changed node covers every node
+// below it - and only the fixtures on those nodes are touched.
+static void UpdateSceneNodes(LG3DScene *scene, LG3DControlData *data)
 {
-	double hash =
-		obj->position.x + obj->position.y + obj->position.z +
-		obj->orientation.h + obj->orientation.p + obj->orientation.r;
-	return hash;
+	int i, n;
+	if (data->numSceneNodes > scene->numNodes)
+		GrowSceneNodes(scene, data->numSceneNodes);
+	if (scene->numNodes == 0)
+		return;
+
+	// lights & objects that were added, removed or re-attached change the attach lists
+	for(n=0;(n<data->numDirtyLights) && !scene->attachListsDirty;n++) {
+		if (data->lights.dirty[data->dirtyLightList[n]] & (LG3DDirty_Slot | LG3DDirty_Node))
+			scene->attachListsDirty = true;
+	}
+	for(n=0;(n<data->numDirtyObjects) && !scene->attachListsDirty;n++) {
+		if (data->objectDirty[data->dirtyObjectList[n]] & (LG3DDirty_Slot | LG3DDirty_Node))
+			scene->attachListsDirty = true;
+	}
+	if (scene->attachListsDirty)
+		BuildAttachLists(scene, data);
+
+	// nodes before the first changed one are untouched this frame, so a parent
+	// only counts as moved if it is at or past that point
+	int first = data->firstDirtyNode;
+	for(i=first;i<scene->numNodes;i++) {
+		const LG3DSceneNode *node = &data->sceneNodeList[i];
+		bool parentMoved = (node->parent >= first) && (node->parent < i) && scene->nodeMoved[node->parent];
+		scene->nodeMoved[i] = (data->nodeDirty[i] != 0) || parentMoved;
+		if (!scene->nodeMoved[i])
+			continue;
+
+		D3DXMATRIXA16 mHead, mPitch, mRoll;
+		D3DXMatrixRotationY(&mHead, DEG2RADf(node->orientation.h)); // heading
+		D3DXMatrixRotationX(&mPitch, -DEG2RADf(node->orientation.p)); // pitch
+		D3DXMatrixRotationZ(&mRoll, DEG2RADf(node->orientation.r)); // roll
+		D3DXMATRIXA16 *world = &scene->nodeWorld[i];
+		*world = mRoll * mPitch * mHead;
+		world->_41 = node->position.x;
+		world->_42 = node->position.z;
+		world->_43 = node->position.y;
+		if ((node->parent >= 0) && (node->parent < i))
+			D3DXMatrixMultiply(world, world, &scene->nodeWorld[node->parent]);
+
+		for(n=scene->nodeFirstLight[i];n<scene->nodeFirstLight[i+1];n++)
+			data->MarkLightDirty(scene->nodeLightList[n], LG3DDirty_Position);
+		for(n=scene->nodeFirstObject[i];n<scene->nodeFirstObject[i+1];n++)
+			data->MarkObjectDirty(scene->nodeObjectList[n], LG3DDirty_Position);
+	}
 }
 
 void CALLBACK LG3DControl::OnFrameMove( IDirect3DDevice9* pd3dDevice, double fTime, float fElapsedTime )
 {
-	// update hash values for lights
-	int i;
-	double hash;
-	for(i=0;i<controlData->numSceneLights;i++) {
-		hash = GenerateHash(&controlData->sceneLightList[i]);
-		if (hash != scene->light[i].hash) {
-			scene->light[i].hash = hash;
-			scene->light[i].lightMoved = true;
-		}
+	// pick up the latest state published by the control thread, if any
+	if (snapshot)
+		snapshot->Acquire(controlData);
+
+	// a replay plays back what a recording's inputs did, the live inputs stand aside till it ends
+	bool replaying = replay && !replay->AtEnd();
+	if (replaying) {
+		if (replayRealTime) {
+			if (replayStart < 0.0)
+				replayStart = fTime;
+			while (!replay->AtEnd() && (replay->NextFrameTime() <= fTime - replayStart))
+				replay->NextFrame(controlData, NULL, NULL);
+		} else
+			replay->NextFrame(controlData, NULL, NULL);
 	}
 
-	// update hash values for objects
-	for(i=0;i<controlData->numSceneObjects;i++) {
-		hash = GenerateHash(&controlData->sceneObjectList[i]);
-		if (hash != scene->obj[i].hash) {
-			scene->obj[i].hash = hash;
-			scene->obj[i].moved = true;
-		}
+	// take in a mirrored server's changes & the DMX, settle what the control inputs asked for,
+	// play the show, fire the cues due, move the lights of a crossfade in progress, then run the
+	// effects on top of it all.  Last of all the moving heads follow as fast as they really can.
+	// All mark what they change dirty like any other change.  Moving heads show the inputs their
+	// targets while they run.
+	if (kinematics && !replaying)
+		kinematics->BeginFrame(controlData);
+	if (syncClient && !replaying)
+		syncClient->Receive(controlData);
+	if (artNet) {
+		artNet->Receive(); // kept up with during a replay, the latest values apply once it ends
+		if (!replaying)
+			artNet->Apply(controlData);
+	}
+	if (sharedChannel && !replaying)
+		sharedChannel->Apply(controlData);
+	if (merge && !replaying)
+		merge->Merge(controlData);
+	if (timeline && !replaying) {
+		if (timelineStart < 0.0)
+			timelineStart = fTime;
+		timeline->Evaluate(controlData, fTime - timelineStart);
 	}
+	if (cues && !replaying)
+		cues->Dispatch(controlData, fTime);
+	if (crossfade && !replaying)
+		crossfade->Evaluate(controlData, fTime);
+	if (effects && !replaying)
+		effects->Evaluate(controlData, fTime);
+	if (kinematics && !replaying)
+		kinematics->Advance(controlData, fElapsedTime);
+
+	// what this frame changed, all inputs applied
+	if (sharedChannel)
+		sharedChannel->Publish(controlData);
+	if (syncServer)
+		syncServer->Serve(controlData);
+	if (recorder)
+		recorder->RecordFrame(controlData, fTime, fElapsedTime);
+
+	// ---------------------------------------------------------
+	// retire last frame's move flags.  Only the lights that
+	// moved are on the list, so a frame where nothing changed
+	// costs next to nothing.
+	// ---------------------------------------------------------
+	int i, n;
+	for(n=0;n<scene->numMovedLights;n++)
+		scene->light[scene->movedLightList[n]].lightMoved = false;
+	scene->numMovedLights = 0;
+	scene->allLightsMoved = false;
+
+	// shadow maps are not kept up to date while shadows are off
+	if (controlData->wantShadows && !scene->shadowsWanted)
+		scene->allLightsMoved = true;
+	scene->shadowsWanted = controlData->wantShadows;
+
+	// ---------------------------------------------------------
+	// trusses - flying a node marks just the lights & objects
+	// hanging below it dirty, so only their matrices & shadow
+	// maps are rebuilt by the passes below
+	// ---------------------------------------------------------
+	UpdateSceneNodes(scene, controlData);
 
 	// ---------------------------------------------------------
-	// see if any lights have moved (hash values different)
-	// and if so, recalculate visible object list and various
-	// light parameters
+	// visit only the lights the control data flagged as changed,
+	// and recalculate the light parameters that depend on the
+	// changed fields
 	// ---------------------------------------------------------
-	for(i=0;i<controlData->numSceneLights;i++) {
-		if (scene->light[i].lightMoved) {
-			// calculate light's world, view, and projection matrices
-
-			// first just set up the light's rotational portion of the world matrix
-			// we will then use this to get our view direction for the lookat view matrix calcs
-			// then we can apply the translation to the world matrix
-			D3DXMATRIXA16 mHead, mPitch;
-			D3DXMatrixRotationY(&mHead, DEG2RADf(controlData->sceneLightList[i].orientation.h)); // heading
-			D3DXMatrixRotationX(&mPitch, -DEG2RADf(controlData->sceneLightList[i].orientation.p)); // pitch
-			scene->light[i].worldMat = mPitch * mHead;
-
-			// now rotate the look vector by the light's rotations
-			D3DXVECTOR3 lookVec(0.0f, 0.0f, 1.0f); // +Z is into the screen
-			D3DXVec3Transform(&scene->light[i].lightDir, &lookVec, &scene->light[i].worldMat);
-			D3DXVECTOR3 vDir3(scene->light[i].lightDir.x, scene->light[i].lightDir.y, scene->light[i].lightDir.z);
-			// vDir3 should still be normalized, so noneed to renormalize it
-
-			// and setup the view matrix
-			D3DXVECTOR3 vEyePt = D3DXVECTOR3(
-				controlData->sceneLightList[i].position.x,
-				controlData->sceneLightList[i].position.z,
-				controlData->sceneLightList[i].position.y);
-			D3DXVECTOR3 vLookatPt = vEyePt + vDir3; // lookat point is just our light position plus the light direction
-			D3DXVECTOR3 vUpVec(0,1,0); // Y up
-			D3DXMatrixLookAtLH(&scene->light[i].viewMat, &vEyePt, &vLookatPt, &vUpVec);
-
-			// now add in the translation to complete the world matrix
-			scene->light[i].worldMat._41 = controlData->sceneLightList[i].position.x;
-			scene->light[i].worldMat._42 = controlData->sceneLightList[i].position.z;
-			scene->light[i].worldMat._43 = controlData->sceneLightList[i].position.y;
-
-			// calculate the projection
-			D3DXMatrixPerspectiveFovLH( &scene->light[i].projMat, DEG2RADf(controlData->sceneLightList[i].umbra+controlData->sceneLightList[i].penumbra), 1.0f, 0.01f, 100.0f);
-
-			// notice here the world matrix is omitted due to the fact that the view matrix contains all the info needed
-			scene->light[i].worldViewProj = /*scene->light[i].worldMat * */ scene->light[i].viewMat * scene->light[i].projMat;
-
-			// set the cosine of (umbra + penumbra)
-			scene->light[i].cosTheta = cosf(DEG2RADf(controlData->sceneLightList[i].umbra+controlData->sceneLightList[i].penumbra));
+	LG3DLightTable *lights = &controlData->lights;
+	GrowSceneLights(scene, lights->count);
+	scene->numLights = lights->count;
+	for(n=0;n<controlData->numDirtyLights;n++) {
+		i = controlData->dirtyLightList[n];
+		unsigned long dirty = lights->dirty[i];
+		LG3DInternalLight *light = &scene->light[i];
+
+		// lights that were added or removed get their resources (re)created, the rest
+		// of their state is then filled in below like for any other change
+		if (dirty & LG3DDirty_Slot) {
+			ReleaseLightResources(scene, i);
+			scene->loopListsDirty = true;
+			if (!controlData->lightSlots.InUse(i))
+				continue;
+			CreateLightResources(pd3dDevice, scene, lights, i, shadowMapSize);
+		}
+
+		if (dirty & (LG3DDirty_Transform | LG3DDirty_Cone))
+			UpdateLightTransform(scene, lights, i);
+
+		if ((dirty & LG3DDirty_Cone) && (light->spotShape >= 0)) {
+			LG3DSpotShape *shape = &scene->spotShape[light->spotShape];
+			if ((shape->umbra != lights->umbra[i]) || (shape->penumbra != lights->penumbra[i])) {
+				int oldShape = light->spotShape;
+				light->spotShape = AcquireSpotShape(pd3dDevice, scene, lights->umbra[i], lights->penumbra[i]);
+				light->goboMap = scene->spotShape[light->spotShape].tex;
+				ReleaseSpotShape(scene, oldShape);
+			}
+		}
+
+		if (dirty & (LG3DDirty_Color | LG3DDirty_Cone))
+			FillLightBeam(light, lights, i);
+
+		if (dirty & LG3DDirty_Shadows) {
+			bool castsShadows = (lights->flags[i] & LG3DLightFlag_CastsShadows) != 0;
+			if (castsShadows && !light->shadowMap)
+				light->shadowMap = AcquireShadowMap(pd3dDevice, scene, shadowMapSize);
+			else if (!castsShadows)
+				ReleaseShadowMap(scene, &light->shadowMap);
+			int loopId = LightLoopId(lights->flags[i]);
+			if (loopId != light->loopId) {
+				light->loopId = loopId;
+				scene->loopListsDirty = true;
+			}
+		}
+
+		// shadow maps are only regenerated for enabled lights, so a light being
+		// switched back on may have a stale one
+		if (dirty & (LG3DDirty_Transform | LG3DDirty_Cone | LG3DDirty_Enabled | LG3DDirty_Shadows)) {
+			light->lightMoved = true;
+			scene->movedLightList[scene->numMovedLights++] = i;
 		}
 	}
 
+	if (scene->loopListsDirty)
+		BuildLoopLists(scene, &controlData->lightSlots);
+
 	//
 	// Camera space matrices
 	//
@@ -801,9 +1459,18 @@ void CALLBACK LG3DControl::OnFrameMove( IDirect3DDevice9* pd3dDevice, double fTi
 	// Compute the projection matrix
 	D3DXMatrixPerspectiveFovLH( &matProj, D3DXToRadian(controlData->cameraList[controlData->curCamera].fov), aspectRatio, 0.1f, 100.0f );
 
-	// compute matrices for each object in the scene
-	for(i=0;i<controlData->numSceneObjects;i++) {
-		if (scene->obj[i].moved) {
+	// (re)load the objects that were added or removed, and compute matrices for each object that moved
+	GrowSceneObjects(scene, controlData->numSceneObjects);
+	scene->numObjects = controlData->numSceneObjects;
+	for(n=0;n<controlData->numDirtyObjects;n++) {
+		i = controlData->dirtyObjectList[n];
+		if (controlData->objectDirty[i] & LG3DDirty_Slot) {
+			ReleaseObjectResources(scene, i);
+			if (controlData->objectSlots.InUse(i))
+				CreateObjectResources(pd3dDevice, scene, &controlData->sceneObjectList[i], i);
+			scene->allLightsMoved = true;
+		}
+		if (controlData->objectDirty[i] & LG3DDirty_Transform) {
 			D3DXMATRIXA16 mHead, mPitch, mRoll, mWorld;
 			D3DXMatrixRotationY(&mHead, DEG2RADf(controlData->sceneObjectList[i].orientation.h)); // heading
 			D3DXMatrixRotationX(&mPitch, -DEG2RADf(controlData->sceneObjectList[i].orientation.p)); // pitch
@@ -811,10 +1478,62 @@ void CALLBACK LG3DControl::OnFrameMove( IDirect3DDevice9* pd3dDevice, double fTi
 			D3DXMatrixTranslation(&mWorld, controlData->sceneObjectList[i].position.x, controlData->sceneObjectList[i].position.z, controlData->sceneObjectList[i].position.y);
 
 			scene->obj[i].matWorld = mWorld * mRoll * mPitch * mHead;
+			int node = controlData->sceneObjectList[i].parentNode;
+			if ((node >= 0) && (node < scene->numNodes))
+				D3DXMatrixMultiply(&scene->obj[i].matWorld, &scene->obj[i].matWorld, &scene->nodeWorld[node]);
 
 			scene->obj[i].worldViewProj = scene->obj[i].matWorld * matView * matProj;
+
+			// when an object moves, all objects need to be re-tested against lights for visibility using new object position
+			// for now, just trivially cause all lights to re-generate shadow maps
+			scene->allLightsMoved = true;
 		}
 	}
+
+	// anything released above and not picked up again is freed now
+	if (scene->unusedResources)
+		PurgeUnusedResources(scene);
+
+	// all changes have been consumed
+	controlData->ClearDirtyState();
+}
+
+void LG3DControl::Reload(const LG3DControlData *src, LG3DReloadStats *stats)
+{
+	memset(&scene->rebuilt, 0, sizeof(LG3DReloadStats));
+	scene->rebuilt.changed = controlData->Reload(src);
+	if (kinematics)
+		kinematics->Snap(controlData); // a new show, the lights go straight to where it puts them
+	scene->clearColor = D3DCOLOR_ARGB(0xff, controlData->clearColor.r, controlData->clearColor.g, controlData->clearColor.b);
+
+	IDirect3DDevice9 *pd3dDevice = DXUTGetD3DDevice();
+	if (pd3dDevice)
+		OnFrameMove(pd3dDevice, DXUTGetTime(), 0.0f);
+	if (!stats)
+		return;
+
+	// whatever is in use now and was not rebuilt above was kept from before the reload
+	*stats = scene->rebuilt;
+	int i;
+	for(i=0;i<scene->numSharedMeshes;i++) {
+		if (scene->sharedMesh[i].refCount > 0)
+			stats->meshesReused++;
+	}
+	for(i=0;i<scene->numSharedGobos;i++) {
+		if (scene->sharedGobo[i].refCount > 0)
+			stats->texturesReused++;
+	}
+	for(i=0;i<scene->numSpotShapes;i++) {
+		if (scene->spotShape[i].refCount > 0)
+			stats->texturesReused++;
+	}
+	for(i=0;i<scene->numLights;i++) {
+		if (scene->light[i].shadowMap)
+			stats->shadowMapsReused++;
+	}
+	stats->meshesReused = max(0, stats->meshesReused - stats->meshesRebuilt);
+	stats->texturesReused = max(0, stats->texturesReused - stats->texturesRebuilt);
+	stats->shadowMapsReused = max(0, stats->shadowMapsReused - stats->shadowMapsRebuilt);
 }
 
 void LG3DControl::UpdateShadowMaps(IDirect3DDevice9 *pd3dDevice)
@@ -822,9 +1541,11 @@ void LG3DControl::UpdateShadowMaps(IDirect3DDevice9 *pd3dDevice)
 	// NOTES:  Need to optimize by only setting the shadowDepthStencil buffer once, even when doing multiple light updates
 	// NOTES:  Code cleanups:  Can probably move a lot of scene geometry rendering & world view projection matrix setup into common call
 
-	int i;
-	for(i=0;i<controlData->numSceneLights;i++) {
-		if (scene->light[i].shadowMap && scene->light[i].lightMoved && controlData->sceneLightList[i].enabled) {
+	// only the shadow casting lights are on loop list 2
+	int n;
+	for(n=0;n<scene->numLoopLights[2];n++) {
+		int i = scene->loopList[2][n];
+		if (scene->light[i].shadowMap && (scene->light[i].lightMoved || scene->allLightsMoved) && (controlData->lights.flags[i] & LG3DLightFlag_Enabled)) {
 			LPDIRECT3DSURFACE9 pOldRT = NULL;
 			V( pd3dDevice->GetRenderTarget( 0, &pOldRT ) );
 			LPDIRECT3DSURFACE9 pShadowSurf;
@@ -842,7 +1563,7 @@ void LG3DControl::UpdateShadowMaps(IDirect3DDevice9 *pd3dDevice)
 				V( pd3dDevice->Clear( 0L, NULL, D3DCLEAR_TARGET|D3DCLEAR_ZBUFFER, 0xffffffff, 1.0f, 0L ) );
 
 				V( scene->effect->SetTechnique( "ShadowMapGen" ) );
-				scene->effect->SetMatrix( "g_mProj", &scene->light[i].projMat );
+				scene->effect->SetMatrix( "g_mProj", &scene->lightMat[i].projMat );
 
 				UINT iPass, cPasses;
 				V( scene->effect->Begin(&cPasses, 0) );
@@ -850,8 +1571,10 @@ void LG3DControl::UpdateShadowMaps(IDirect3DDevice9 *pd3dDevice)
 					V( scene->effect->BeginPass(iPass) );
 
 					int obj;
-					for(obj=1;obj<controlData->numSceneObjects;obj++) { // skip the 1st object, I assume its the state andwill not self-shadow
-						D3DXMATRIXA16 mWorldView = scene->obj[obj].matWorld * scene->light[i].viewMat;
+					for(obj=1;obj<scene->numObjects;obj++) { // skip the 1st object, I assume its the state andwill not self-shadow
+						if (!scene->obj[obj].mesh)
+							continue; // removed
+						D3DXMATRIXA16 mWorldView = scene->obj[obj].matWorld * scene->lightMat[i].viewMat;
 						scene->effect->SetMatrix( "g_mWorldView", &mWorldView );
 						V( scene->effect->CommitChanges() );
 						scene->obj[obj].mesh->Render(pd3dDevice, true, true);
@@ -934,23 +1657,33 @@ void CALLBACK LG3DControl::OnFrameRender( IDirect3DDevice9* pd3dDevice, double f
 		D3DXVECTOR3 g_LightPosWorld[MAX_BASIC_LIGHTS];
 		D3DXVECTOR3 g_LightDiffuse[MAX_BASIC_LIGHTS];
 		float g_fCosThetaWorld[MAX_BASIC_LIGHTS];
+		// only the lights on loop list 0 are visited here, so the cost of this loop
+		// scales with the number of basic lights rather than the whole rig.  The first
+		// batch is always drawn, even if empty, since it also adds in the ambient light.
+		const LG3DLightTable *lights = &controlData->lights;
+		const int *basicList = scene->loopList[0];
+		int numBasic = scene->numLoopLights[0];
+		int n = 0;
 		bool firstBatch = true;
-		for(i=0;i<controlData->numSceneLights;i++) {
-			if ((g_nNumActiveLights < MAX_BASIC_LIGHTS) && (scene->light[i].loopId == 0) && controlData->sceneLightList[i].enabled) {
-				g_LightDirWorld[g_nNumActiveLights].x = scene->light[i].lightDir.x;
-				g_LightDirWorld[g_nNumActiveLights].y = scene->light[i].lightDir.y;
-				g_LightDirWorld[g_nNumActiveLights].z = scene->light[i].lightDir.z;
-				g_LightPosWorld[g_nNumActiveLights].x = controlData->sceneLightList[i].position.x;
-				g_LightPosWorld[g_nNumActiveLights].y = controlData->sceneLightList[i].position.z;
-				g_LightPosWorld[g_nNumActiveLights].z = controlData->sceneLightList[i].position.y;
-				g_LightDiffuse[g_nNumActiveLights].x = (float)controlData->sceneLightList[i].color.r/255.0f;
-				g_LightDiffuse[g_nNumActiveLights].y = (float)controlData->sceneLightList[i].color.g/255.0f;
-				g_LightDiffuse[g_nNumActiveLights].z = (float)controlData->sceneLightList[i].color.b/255.0f;
-				g_fCosThetaWorld[g_nNumActiveLights] = scene->light[i].cosTheta;
+		do {
+			while ((g_nNumActiveLights < MAX_BASIC_LIGHTS) && (n < numBasic)) {
+				i = basicList[n++];
+				if (!(lights->flags[i] & LG3DLightFlag_Enabled))
+					continue;
+				g_LightDirWorld[g_nNumActiveLights].x = scene->lightDirX[i];
+				g_LightDirWorld[g_nNumActiveLights].y = scene->lightDirY[i];
+				g_LightDirWorld[g_nNumActiveLights].z = scene->lightDirZ[i];
+				g_LightPosWorld[g_nNumActiveLights].x = scene->lightPosX[i];
+				g_LightPosWorld[g_nNumActiveLights].y = scene->lightPosY[i];
+				g_LightPosWorld[g_nNumActiveLights].z = scene->lightPosZ[i];
+				g_LightDiffuse[g_nNumActiveLights].x = lights->colorR[i];
+				g_LightDiffuse[g_nNumActiveLights].y = lights->colorG[i];
+				g_LightDiffuse[g_nNumActiveLights].z = lights->colorB[i];
+				g_fCosThetaWorld[g_nNumActiveLights] = lights->cosTheta[i];
 				g_nNumActiveLights++;
 			}
 
-			if ((g_nNumActiveLights == MAX_BASIC_LIGHTS) || (i == (controlData->numSceneLights-1))) {
+			if (firstBatch || (g_nNumActiveLights > 0)) {
 				// Render the current 'batch' of lights
 				V( scene->vertLightEffect->SetValue( "g_LightDirWorld", g_LightDirWorld, sizeof(D3DXVECTOR3)*MAX_BASIC_LIGHTS ) );
 				V( scene->vertLightEffect->SetValue( "g_LightPosWorld", g_LightPosWorld, sizeof(D3DXVECTOR3)*MAX_BASIC_LIGHTS ) );
@@ -968,7 +1701,9 @@ void CALLBACK LG3DControl::OnFrameRender( IDirect3DDevice9* pd3dDevice, double f
 
 				// draw each object, lit by current 'batch' of lights
 				int obj;
-				for(obj=0;obj<controlData->numSceneObjects;obj++) {
+				for(obj=0;obj<scene->numObjects;obj++) {
+					if (!scene->obj[obj].mesh)
+						continue;
 					D3DXMATRIXA16 mWorldView = scene->obj[obj].matWorld * matView;
 					scene->vertLightEffect->SetMatrix( "g_mWorldView", &mWorldView );
 					scene->vertLightEffect->SetMatrix( "g_mWorld", &scene->obj[obj].matWorld );
@@ -977,7 +1712,7 @@ void CALLBACK LG3DControl::OnFrameRender( IDirect3DDevice9* pd3dDevice, double f
 
 				g_nNumActiveLights = 0;
 			}
-		}
+		} while (n < numBasic);
 
 		// draw the light indicator objects (light cans)
 		V( scene->effect->SetTechnique( "RenderSceneAmb" ) );
@@ -985,10 +1720,12 @@ void CALLBACK LG3DControl::OnFrameRender( IDirect3DDevice9* pd3dDevice, double f
 		D3DXVECTOR4 vMaterial(1.0f, 1.0f, 1.0f, 1.0f);
 		scene->effect->SetVector( "g_vMaterial", &vMaterial );
 
-		for(i=0;i<controlData->numSceneLights;i++) {
-			D3DXMATRIXA16 mWorldView = scene->light[i].worldMat * matView;
+		for(i=0;i<scene->numLights;i++) {
+			if (!controlData->lightSlots.InUse(i))
+				continue;
+			D3DXMATRIXA16 mWorldView = scene->lightMat[i].worldMat * matView;
 			scene->effect->SetMatrix( "g_mWorldView", &mWorldView );
-			// scene->effect->SetMatrix( "g_mWorld", &scene->light[i].worldMat );
+			// scene->effect->SetMatrix( "g_mWorld", &scene->lightMat[i].worldMat );
 			V( scene->effect->CommitChanges() );
 			if (i == controlData->curLight) {
 				D3DXVECTOR4 vMaterial(1.0f, 1.0f, 1.0f, 1.0f);
@@ -1024,40 +1761,43 @@ void CALLBACK LG3DControl::OnFrameRender( IDirect3DDevice9* pd3dDevice, double f
 				V( scene->effect->SetTechnique( "SpotLightAddNoShadow" ) );
 			}
 
-			int light;
-			for(light=0;light<controlData->numSceneLights;light++) {
-				if (controlData->sceneLightList[light].enabled && (scene->light[light].loopId == loopId)) {
+			for(n=0;n<scene->numLoopLights[loopId];n++) {
+				int light = scene->loopList[loopId][n];
+				if (lights->flags[light] & LG3DLightFlag_Enabled) {
 					// Compute the matrix to transform from view space to
 					// light projection space.  This consists of
 					// the inverse of view matrix * view matrix of light * light projection matrix
 					D3DXMATRIXA16 mViewToLightProj;
 					mViewToLightProj = matView;
 					D3DXMatrixInverse( &mViewToLightProj, NULL, &mViewToLightProj );
-					D3DXMatrixMultiply( &mViewToLightProj, &mViewToLightProj, &scene->light[light].viewMat );
-					D3DXMatrixMultiply( &mViewToLightProj, &mViewToLightProj, &scene->light[light].projMat );
+					D3DXMatrixMultiply( &mViewToLightProj, &mViewToLightProj, &scene->lightMat[light].viewMat );
+					D3DXMatrixMultiply( &mViewToLightProj, &mViewToLightProj, &scene->lightMat[light].projMat );
 					scene->effect->SetMatrix( "g_mViewToLightProj", &mViewToLightProj );
 
 					D3DXVECTOR4 lightPos4;
-					D3DXVECTOR3 lightPos(controlData->sceneLightList[light].position.x, controlData->sceneLightList[light].position.z, controlData->sceneLightList[light].position.y);
+					D3DXVECTOR3 lightPos(scene->lightPosX[light], scene->lightPosY[light], scene->lightPosZ[light]);
 					D3DXVec3Transform( &lightPos4, &lightPos, &matView );
 					scene->effect->SetVector( "g_vLightPos", &lightPos4 );
 
 					D3DXVECTOR4 lightDir4;
-					D3DXVECTOR4 lightDir = scene->light[light].lightDir;
+					D3DXVECTOR4 lightDir(scene->lightDirX[light], scene->lightDirY[light], scene->lightDirZ[light], 0.0f);
 					lightDir.w = 0.0f; // so view position has no effect
 					D3DXVec4Transform( &lightDir4, &lightDir, &matView );
 					scene->effect->SetVector( "g_vLightDir", &lightDir4 );
 
-					scene->effect->SetFloat( "g_fCosTheta", scene->light[light].cosTheta);
+					scene->effect->SetFloat( "g_fCosTheta", lights->cosTheta[light]);
 					if (controlData->wantShadows && (scene->light[light].loopId == 2))
 						scene->effect->SetTexture( "tShadowMap", scene->light[light].shadowMap );
 					scene->effect->SetTexture( "tSpotMap", scene->light[light].goboMap );
-					scene->effect->SetFloat("g_fLinearAttenuation", controlData->sceneLightList[light].att1);
-					scene->effect->SetFloat("g_fQuadraticAttenuation", controlData->sceneLightList[light].att2);
-					scene->effect->SetVector("g_vLightColor", &scene->light[light].color);
+					scene->effect->SetFloat("g_fLinearAttenuation", lights->att1[light]);
+					scene->effect->SetFloat("g_fQuadraticAttenuation", lights->att2[light]);
+					D3DXVECTOR4 lightColor(lights->colorR[light], lights->colorG[light], lights->colorB[light], 1.0f);
+					scene->effect->SetVector("g_vLightColor", &lightColor);
 
 					int i;
-					for(i=0;i<controlData->numSceneObjects;i++) {
+					for(i=0;i<scene->numObjects;i++) {
+						if (!scene->obj[i].mesh)
+							continue;
 						D3DXMATRIXA16 mWorldView = scene->obj[i].matWorld * matView;
 						scene->effect->SetMatrix( "g_mWorldView", &mWorldView );
 						scene->obj[i].mesh->Render(scene->effect, "tColorMap", "g_vMaterial");
@@ -1073,41 +1813,41 @@ void CALLBACK LG3DControl::OnFrameRender( IDirect3DDevice9* pd3dDevice, double f
 			for (iPass = 0; iPass < cPasses; iPass++) {
 				V( scene->effect->BeginPass(iPass) );
 				int light;
-				for(light=0;light<controlData->numSceneLights;light++) {
-					if (controlData->sceneLightList[light].enabled && (scene->light[light].numBeams > 0)) { // (controlData->sceneLightList[light].goboName[0] == 0)) {
+				for(light=0;light<scene->numLights;light++) {
+					if ((lights->flags[light] & LG3DLightFlag_Enabled) && (scene->light[light].numBeams > 0)) { // !(lights->flags[light] & LG3DLightFlag_HasGobo)) {
 						// Compute the matrix to transform from view space to
 						// light projection space.  This consists of
 						// the inverse of view matrix * view matrix of light * light projection matrix
 						D3DXMATRIXA16 mViewToLightProj;
 						mViewToLightProj = matView;
 						D3DXMatrixInverse( &mViewToLightProj, NULL, &mViewToLightProj );
-						D3DXMatrixMultiply( &mViewToLightProj, &mViewToLightProj, &scene->light[light].viewMat );
-						D3DXMatrixMultiply( &mViewToLightProj, &mViewToLightProj, &scene->light[light].projMat );
+						D3DXMatrixMultiply( &mViewToLightProj, &mViewToLightProj, &scene->lightMat[light].viewMat );
+						D3DXMatrixMultiply( &mViewToLightProj, &mViewToLightProj, &scene->lightMat[light].projMat );
 						scene->effect->SetMatrix( "g_mViewToLightProj", &mViewToLightProj );
 
 						D3DXVECTOR4 lightPos4;
-						D3DXVECTOR3 lightPos(controlData->sceneLightList[light].position.x, controlData->sceneLightList[light].position.z, controlData->sceneLightList[light].position.y);
+						D3DXVECTOR3 lightPos(scene->lightPosX[light], scene->lightPosY[light], scene->lightPosZ[light]);
 						D3DXVec3Transform( &lightPos4, &lightPos, &matView );
 						scene->effect->SetVector( "g_vLightPos", &lightPos4 );
 
 						D3DXVECTOR4 lightDir4;
-						D3DXVECTOR4 lightDir = scene->light[light].lightDir;
+						D3DXVECTOR4 lightDir(scene->lightDirX[light], scene->lightDirY[light], scene->lightDirZ[light], 0.0f);
 						lightDir.w = 0.0f; // so view position has no effect
 						D3DXVec4Transform( &lightDir4, &lightDir, &matView );
 						scene->effect->SetVector( "g_vLightDir", &lightDir4 );
 
-						scene->effect->SetFloat("g_fLinearAttenuation", controlData->sceneLightList[light].att1);
-						scene->effect->SetFloat("g_fQuadraticAttenuation", controlData->sceneLightList[light].att2);
+						scene->effect->SetFloat("g_fLinearAttenuation", lights->att1[light]);
+						scene->effect->SetFloat("g_fQuadraticAttenuation", lights->att2[light]);
 
 						if (controlData->wantShadows)
 							scene->effect->SetTexture( "tShadowMap", scene->light[light].shadowMap );
 
 						scene->effect->SetTexture( "tSpotMap", scene->light[light].goboMap );
 
-						D3DXMATRIXA16 mWorldView = scene->light[light].worldMat * matView;
+						D3DXMATRIXA16 mWorldView = scene->lightMat[light].worldMat * matView;
 						scene->effect->SetTexture( "tColorMap", lightBeamTex );
 						scene->effect->SetMatrix( "g_mWorldView", &mWorldView );
-						scene->effect->SetMatrix( "g_mWorld", &scene->light[light].worldMat );
+						scene->effect->SetMatrix( "g_mWorld", &scene->lightMat[light].worldMat );
 						V( scene->effect->CommitChanges() );
 						DrawLightBeam(pd3dDevice, scene->light[light].lightBeamVB, scene->light[light].numBeams);
 					} // if light enabled
@@ -1129,6 +1869,11 @@ void CALLBACK LG3DControl::OnFrameRender( IDirect3DDevice9* pd3dDevice, double f
 }
 
 
+double LG3DControl::GetTime() const
+{
+	return DXUTGetTime();
+}
+
 void LG3DControl::Draw()
 {
 	// ---------------------------------------------------------
@@ -1136,19 +1881,6 @@ void LG3DControl::Draw()
 	// call our frame move & frame render callbacks.
 	// ---------------------------------------------------------
 	DXUTRender3DEnvironment();
-
-	// ---------------------------------------------------------
-	// after things have drawn, clear any flags that may have
-	// indicated extra work this frame
-	// ---------------------------------------------------------
-	int i;
-	for(i=0;i<controlData->numSceneLights;i++) {
-		scene->light[i].lightMoved = false;
-	}
-
-	for(i=0;i<controlData->numSceneObjects;i++) {
-		scene->obj[i].moved = false;
-	}
 }
 
 void LG3DControl::Intersect()
@@ -1180,7 +1912,9 @@ void LG3DControl::Intersect()
 
 	// loop through all objects to see if we get a hit
 	int i;
-	for(i=0;i<controlData->numSceneObjects;i++) {
+	for(i=0;i<scene->numObjects;i++) {
+		if (!scene->obj[i].mesh)
+			continue;
 		D3DXMATRIXA16 mWorldView = scene->obj[i].matWorld * matView;
 		D3DXMatrixInverse( &m, NULL, &mWorldView );
 
@@ -1206,8 +1940,10 @@ void LG3DControl::Intersect()
 	}
 
 	// loop through all lights to see if we get a hit
-	for(i=0;i<controlData->numSceneLights;i++) {
-		D3DXMATRIXA16 mWorldView = scene->light[i].worldMat * matView;
+	for(i=0;i<scene->numLights;i++) {
+		if (!controlData->lightSlots.InUse(i))
+			continue;
+		D3DXMATRIXA16 mWorldView = scene->lightMat[i].worldMat * matView;
 		D3DXMatrixInverse( &m, NULL, &mWorldView );
 
 		// Transform the screen space pick ray into light's 3D space
@@ -1236,6 +1972,7 @@ void LG3DControl::Intersect()
 void LG3DControl::LButtonDown()
 {
 	lButtonDown = true;
+	dragKey = journal ? journal->NewMergeKey() : 0;
 	Intersect();
 	controlData->curLight = manipLightId;
 }
@@ -1251,6 +1988,7 @@ void LG3DControl::LButtonUp()
 void LG3DControl::RButtonDown()
 {
 	rButtonDown = true;
+	dragKey = journal ? journal->NewMergeKey() : 0;
 	Intersect();
 	controlData->curLight = manipLightId;
 }
@@ -1303,20 +2041,22 @@ void LG3DControl::MouseMove()
 			orientDelta.r = 0.0f;
 		}
 
-		if (manipLightId > -1) {
-			controlData->MoveLight(manipLightId, &posDelta, &orientDelta);
-			scene->light[manipLightId].lightMoved = true;
+		// the control data records what changed, the next frame move picks it up.  The
+		// journal folds every move of a drag into one undo step.
+		if (journal) {
+			journal->BeginEdit(dragKey);
+			journal->TouchLight(controlData, manipLightId, LG3DDirty_Transform);
+			journal->TouchObject(controlData, manipObjId, LG3DDirty_Transform);
 		}
 
-		if (manipObjId > -1) {
+		if (manipLightId > -1)
+			controlData->MoveLight(manipLightId, &posDelta, &orientDelta);
+
+		if (manipObjId > -1)
 			controlData->MoveObject(manipObjId, &posDelta, &orientDelta);
-			// when an object moves, all objects need to be re-tested against lights for visibility using new object position
-			// for now, just trivially cause all lights to re-generate shadow maps
-			int i;
-			for(i=0;i<controlData->numSceneLights;i++) {
-				scene->light[i].lightMoved = true;
-			}
-		}
+
+		if (journal)
+			journal->EndEdit(controlData);
 
 		Draw();
 	}
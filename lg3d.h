@@ -3,6 +3,7 @@
 
 #define WIN32_LEAN_AND_MEAN
 #include <windows.h>
+#include <stdlib.h>
 #include <d3d9.h>
 
 #define DEG2RAD(d) ((d)*0.017453292519943295769236907684886)
@@ -26,6 +27,28 @@ enum LG3DPinMaskType {
 	LG3DPinMask_XYZ = (LG3DPinMask_X | LG3DPinMask_Y | LG3DPinMask_Z),
 };
 
+// fields reported in the per-light and per-object dirty bits of LG3DControlData
+enum LG3DDirtyFieldType {
+	LG3DDirty_Position = (1<<0),
+	LG3DDirty_Orientation = (1<<1),
+	LG3DDirty_Color = (1<<2),
+	LG3DDirty_Cone = (1<<3),				// umbra and/or penumbra
+	LG3DDirty_Attenuation = (1<<4),
+	LG3DDirty_Enabled = (1<<5),
+	LG3DDirty_Shadows = (1<<6),				// castsShadows
+	LG3DDirty_Slot = (1<<7),				// light or object was added, removed or replaced, its resources are rebuilt
+	LG3DDirty_Node = (1<<8),				// light or object was attached to a different node
+	LG3DDirty_Transform = (LG3DDirty_Position | LG3DDirty_Orientation),
+	LG3DDirty_All = (0xffffffff),
+};
+
+// Names (meshes, gobos & cameras) are interned into one table shared by the whole process
+// and referenced by id, so equal names always have equal ids.  Id 0 is the empty name.
+typedef unsigned long LG3DNameId;
+
+LG3D_DLL LG3DNameId		LG3DInternName(const WCHAR *name);
+LG3D_DLL const WCHAR	*LG3DNameString(LG3DNameId id);
+
 struct LG3DPosition {
 	float			x, y, z;				// Z up (meters)
 };
@@ -38,11 +61,23 @@ struct LG3DLightColor {
 	int				r, g, b;				// red, green, blue, 0 to 255
 };
 
+// A truss or other rigging point that lights & objects can hang from.  A node's position &
+// orientation are relative to its parent node, and those of a light or object hanging from
+// it are relative to the node, so flying a truss carries everything on it along.
+struct LG3DSceneNode {
+	LG3DNameId		name;					// see LG3DInternName
+	int				parent;					// index of the parent node, -1 for none.  Parents must be listed before their children.
+	LG3DPosition	position;
+	LG3DOrientation	orientation;
+	LG3DSceneNode() {memset(this, 0, sizeof(LG3DSceneNode)); parent = -1;}
+};
+
 struct LG3DSceneObject {
-	WCHAR			meshName[_MAX_PATH];	// Microsoft .X file format
+	LG3DNameId		meshName;				// Microsoft .X file format, see LG3DInternName
 	LG3DPosition	position;
 	LG3DOrientation	orientation;
-	LG3DSceneObject() {memset(this, 0, sizeof(LG3DSceneObject));}
+	int				parentNode;				// node this object hangs from, -1 for none (position & orientation are then world space)
+	LG3DSceneObject() {memset(this, 0, sizeof(LG3DSceneObject)); parentNode = -1;}
 };
 
 struct LG3DSceneLight {
@@ -50,18 +85,19 @@ struct LG3DSceneLight {
 	LG3DOrientation	orientation;
 	unsigned long	pinMask;				// bitwise OR of un-changeable position & orientation settings - see LG3DPinMaskType enum
 	LG3DLightColor	color;					// rgb intensity can be implied here
-	WCHAR			goboName[_MAX_PATH];	// bitmap (.bmp) color mask file name
+	LG3DNameId		goboName;				// bitmap (.bmp) color mask file name, see LG3DInternName
 	float			umbra;					// angle in degrees
 	float			penumbra;				// angle in degrees
 	float			att1;					// linear attenuation value
 	float			att2;					// quadratic attenuation value
 	bool			enabled;				// true to turn light on, false to turn light off
 	bool			castsShadows;			// when set, this light causes shadows to be cast from it
-	LG3DSceneLight() {memset(this, 0, sizeof(LG3DSceneLight));}
+	int				parentNode;				// node this light hangs from, -1 for none (position & orientation are then world space)
+	LG3DSceneLight() {memset(this, 0, sizeof(LG3DSceneLight)); parentNode = -1;}
 };
 
 struct LG3DCameraObject {
-	WCHAR			name[256];				// name assigned to this camera
+	LG3DNameId		name;					// name assigned to this camera, see LG3DInternName
 	LG3DPosition	position;
 	LG3DOrientation	orientation;
 	float			fov;					// vertical field of view (horizontal derived from screen aspect)
@@ -69,78 +105,1314 @@ struct LG3DCameraObject {
 	LG3DCameraObject() {memset(this, 0, sizeof(LG3DCameraObject));}
 };
 
+// flags kept per light in LG3DLightTable::flags
+enum LG3DLightFlagType {
+	LG3DLightFlag_Enabled = (1<<0),
+	LG3DLightFlag_CastsShadows = (1<<1),
+	LG3DLightFlag_HasGobo = (1<<2),
+};
+
+// per-light data that is only needed when device resources are created
+struct LG3DLightColdData {
+	LG3DNameId		goboName;				// bitmap (.bmp) color mask file name
+};
+
+// live light state, stored structure-of-arrays so the per-frame loops only pull in the
+// fields they read.  Every hot array is contiguous, 16 byte aligned and padded out to a
+// multiple of 4 entries so it can be processed 4 lights at a time.
+struct LG3D_DLL LG3DLightTable {
+	int				count;
+	int				capacity;
+	float			*posX, *posY, *posZ;	// Z up (meters)
+	float			*head, *pitch, *roll;	// degrees
+	float			*colorR, *colorG, *colorB;	// 0 to 1
+	float			*umbra, *penumbra;		// degrees
+	float			*cosTheta;				// cosine of (umbra + penumbra)
+	float			*att1, *att2;			// linear & quadratic attenuation
+	unsigned long	*pinMask;				// see LG3DPinMaskType enum
+	unsigned long	*flags;					// see LG3DLightFlagType enum
+	int				*parentNode;			// node the light hangs from, -1 for none
+	unsigned long	*dirty;					// LG3DDirtyFieldType bits changed since the last frame move
+	LG3DLightColdData *cold;				// names & other rarely touched data
+	void			*block;					// single allocation holding all the hot arrays
+
+	LG3DLightTable();
+	~LG3DLightTable();
+
+	void			Resize(int newCount);
+	void			Load(int index, const LG3DSceneLight *light);
+	void			Store(int index, LG3DSceneLight *light) const;
+	void			CopyRange(const LG3DLightTable *src, int first, int num);	// hot arrays only, not the dirty bits
+	void			Repeat(int index, int num);	// copy entry index over the num after it, not the dirty bits
+
+	// the arrays of a field, n from 0: Position is posX, posY & posZ, Orientation head, pitch
+	// & roll, Color colorR, colorG & colorB, Cone umbra, penumbra & cosTheta, Attenuation att1
+	// & att2.  NULL for the fields with no float arrays.
+	float			*Field(LG3DDirtyFieldType field, int n = 0) const;
+	// the arrays of a list of fields, a field listed n times running stands for its first n
+	void			FieldArrays(const unsigned long *fieldList, int num, float **a) const;
+	void			SetCone(int index, float newUmbra, float newPenumbra);	// cosTheta to match
+
+	protected:
+	void			AssignArrays();
+};
+
+// Stable reference to a light or object slot.  The low bits hold the slot index, the high bits
+// the slot's serial number, so a handle stops matching once its slot is removed & recycled.
+typedef unsigned long LG3DHandle;
+#define LG3D_HANDLE_SLOT_BITS	20
+#define LG3D_HANDLE_SLOT_MASK	((1<<LG3D_HANDLE_SLOT_BITS)-1)
+#define LG3D_INVALID_HANDLE		0xffffffff
+
+// keeps track of which light or object slots are in use, and recycles removed ones
+struct LG3D_DLL LG3DSlotList {
+	int				count;					// number of slots, used or free
+	int				capacity;
+	unsigned long	*serial;				// per slot, odd while the slot is free, bumped on every add & remove
+	int				*freeList;				// free slots, reused last-in first-out
+	int				numFree;
+
+	LG3DSlotList();
+	~LG3DSlotList();
+
+	void			Reset(int newCount);	// newCount slots, all in use
+	int				Alloc();				// returns a recycled slot, or count (which it then grows by one)
+	void			Free(int slot);
+	void			Reload(int numInUse);	// slots below numInUse in use, the rest free.  Slots staying in use keep their handles.
+	bool			InUse(int slot) const {return (serial[slot] & 1) == 0;}
+	LG3DHandle		Handle(int slot) const {return ((serial[slot] >> 1) << LG3D_HANDLE_SLOT_BITS) | slot;}
+	int				Slot(LG3DHandle handle) const;	// -1 if the handle is stale
+};
+
+// one record of a bulk light update, see LG3DControlData::UpdateLights.  Only the values
+// named in 'fields' are applied, and position & orientation still honor the light's pinMask.
+struct LG3DLightUpdate {
+	int				index;					// light to change
+	unsigned long	fields;					// LG3DDirtyFieldType bits of the values below to apply
+	bool			relative;				// when set, position & orientation are added to the current values
+	bool			enabled;
+	bool			castsShadows;
+	LG3DPosition	position;
+	LG3DOrientation	orientation;
+	LG3DLightColor	color;
+	float			umbra, penumbra;
+	float			att1, att2;
+	LG3DLightUpdate() {memset(this, 0, sizeof(LG3DLightUpdate));}
+};
+
+// one record of a bulk object update, see LG3DControlData::UpdateObjects
+struct LG3DObjectUpdate {
+	int				index;					// object to change
+	unsigned long	fields;					// LG3DDirty_Position and/or LG3DDirty_Orientation
+	bool			relative;				// when set, position & orientation are added to the current values
+	LG3DPosition	position;
+	LG3DOrientation	orientation;
+	LG3DObjectUpdate() {memset(this, 0, sizeof(LG3DObjectUpdate));}
+};
+
+enum LG3DArrayShapeType {
+	LG3DArray_Line,
+	LG3DArray_Ring,
+	LG3DArray_Grid,
+};
+
+// where the elements of a fixture or prop array go, from its template's position & orientation
+struct LG3DArrayLayout {
+	int				shape;					// see LG3DArrayShapeType
+	int				count;					// number of elements, fixed once the array is loaded
+	int				columns;				// grid, elements per row
+	LG3DPosition	step;					// line & grid, from one element to the next along a row
+	LG3DPosition	rowStep;				// grid, from one row to the next
+	float			radius;					// ring, round the template's position in the XY plane
+	float			startAngle;				// ring, degrees.  Element k sits at startAngle + k*sweep/count and
+	float			sweep;					// has that added to its heading, so the whole ring faces in
+	LG3DArrayLayout() {memset(this, 0, sizeof(LG3DArrayLayout)); sweep = 360.0f;}
+};
+
+// an element that departs from its array's pattern
+struct LG3DLightArrayOverride {
+	int				element;				// index within the array
+	unsigned long	fields;					// LG3DDirtyFieldType bits of 'light' used instead of the pattern's, LG3DDirty_All for all of it
+	LG3DSceneLight	light;
+};
+
+struct LG3DObjectArrayOverride {
+	int				element;
+	unsigned long	fields;					// LG3DDirty_Position, _Orientation and/or _Node, LG3DDirty_All for all of it
+	LG3DSceneObject	object;
+};
+
+// A row, ring or grid of lights alike but for where they are, an LED wall or a fixture row.
+// Only the template and the elements that differ from it are described, LoadScene generates
+// the rest straight into the light table after the lights of sceneLightList.
+struct LG3DLightArray {
+	LG3DSceneLight	light;					// template, its position is the array's origin
+	LG3DArrayLayout	layout;
+	int				numOverrides;
+	LG3DLightArrayOverride *overrides;		// sorted by element, allocated with new [] by the host
+	int				firstLight;				// light table index of element 0, set by LoadScene
+	LG3DLightArray() {numOverrides = 0; overrides = NULL; firstLight = -1;}
+};
+
+// the same for objects - audience seating, say.  Objects have no table of their own, LoadScene
+// adds the elements to the end of sceneObjectList.
+struct LG3DObjectArray {
+	LG3DSceneObject	object;					// template, its position is the array's origin
+	LG3DArrayLayout	layout;
+	int				numOverrides;
+	LG3DObjectArrayOverride *overrides;		// sorted by element, allocated with new [] by the host
+	int				firstObject;			// index of element 0 in sceneObjectList, set by LoadScene
+	LG3DObjectArray() {numOverrides = 0; overrides = NULL; firstObject = -1;}
+};
+
+class LG3DSceneFile;
+
 class LG3D_DLL LG3DControlData {
 	public:
 		int				numSceneObjects;
 		LG3DSceneObject	*sceneObjectList;
 		int				numSceneLights;
-		LG3DSceneLight	*sceneLightList;
+		LG3DSceneLight	*sceneLightList;		// describes the rig, copied into 'lights' when the control is created
+		int				numSceneNodes;
+		LG3DSceneNode	*sceneNodeList;			// trusses the lights & objects hang from, the count only grows once the control is created
+		int				numLightArrays;
+		LG3DLightArray	*lightArrayList;		// rows, rings & grids of lights, see LG3DLightArray
+		int				numObjectArrays;
+		LG3DObjectArray	*objectArrayList;
 		LG3DLightColor	ambient;
 		int				numCameras;
 		LG3DCameraObject *cameraList;
 		LG3DLightColor	clearColor;				// frame buffer clear to color
 
+		// set by LG3DSceneFile::Open, the scene lists above then point into the mapped file
+		// until it is closed.  Lists the control data replaces are only deleted if they are
+		// its own, hosts freeing a show check IsMapped the same way.
+		LG3DSceneFile	*sceneFile;
+		bool			IsMapped(const void *list) const;
+
 		int				curLight;				// the currently selected light
 		int				curCamera;				// the currently selected camera
 
 		bool			wantShadows;			// set to false to disable all shadow rendering
 		bool			wantEffects;			// set to true to show light beam effects
 
-		LG3DControlData() {
-			numSceneObjects = 0;
-			sceneObjectList = NULL;
-			numSceneLights = 0;
-			sceneLightList = NULL;
-			ambient.r = ambient.g = ambient.b = 24;
-			numCameras = 0;
-			cameraList = NULL;
-			curLight = -1;
-			curCamera = -1;
-			wantShadows = true;
-			wantEffects = false;
-		}
+		// live light state.  Once loaded, change lights through the Move/Set calls below, or
+		// edit sceneLightList and call CommitLight to copy the entry back into the table.
+		LG3DLightTable	lights;
+
+		// change tracking - the renderer only revisits lights & objects listed here.  Call
+		// MarkObjectDirty after writing into sceneObjectList directly.
+		unsigned long	generation;				// bumped on every change, a cheap "did anything change" test
+		int				*dirtyLightList;		// indices of the lights with non-zero lights.dirty bits
+		int				numDirtyLights;
+		unsigned long	*objectDirty;			// per-object LG3DDirtyFieldType bits changed since the last frame move
+		int				*dirtyObjectList;		// indices of the objects with non-zero objectDirty bits
+		int				numDirtyObjects;
+		unsigned long	*nodeDirty;				// per-node LG3DDirtyFieldType bits changed since the last frame move
+		int				firstDirtyNode;			// lowest index with non-zero nodeDirty bits, numSceneNodes if none
+		int				maxDirtyLights;			// allocated size of the light, object & node change tracking arrays
+		int				maxDirtyObjects;
+		int				maxDirtyNodes;
+		int				maxSceneLights;			// allocated size of sceneLightList & sceneObjectList, LoadScene resets
+		int				maxSceneObjects;		// them to the counts of the lists the host handed over
+
+		LG3DControlData();
+		virtual ~LG3DControlData();
+
+		// copy sceneLightList into the light table, generate the arrays and reset the slot lists,
+		// called by LG3DControl on creation
+		void			LoadScene();
+		void			CommitLight(int lightIndex);	// lights of sceneLightList only, not array elements
 
-		virtual ~LG3DControlData() {};
+		// the rig as described, listed lights & objects first and then the array elements
+		int				ListedLights() const;
+		int				ListedObjects() const;
+		int				DescribedLights() const;
+		int				DescribedObjects() const;
+		void			DescribeLight(int lightIndex, LG3DSceneLight *light) const;
+		void			DescribeObject(int objectIndex, LG3DSceneObject *object) const;
 
-		virtual void MoveLight(int lightIndex, LG3DPosition *posDelta, LG3DOrientation *orientDelta)
+		// re-place a whole array in one pass, from a new layout, origin and/or orientation (NULL
+		// keeps the current one, the count can't change).  Overridden positions & orientations
+		// stay put.  This redesigns the rig rather than moving the lights, so pins are not
+		// honored.  Returns the number of elements that moved.
+		int				SetLightArrayLayout(int arrayIndex, const LG3DArrayLayout *layout, const LG3DPosition *origin, const LG3DOrientation *orient);
+		int				SetObjectArrayLayout(int arrayIndex, const LG3DArrayLayout *layout, const LG3DPosition *origin, const LG3DOrientation *orient);
+
+		// differential reload - make this rig match src (a freshly loaded show) by changing only
+		// the lights & objects that differ, each marked dirty with just the fields that changed.
+		// Lights & objects whose gobo or mesh changed, or that appear or disappear, are marked
+		// LG3DDirty_Slot.  Surplus slots are left free, the same as RemoveLight.  Nodes src adds are
+		// appended, surplus ones left unused, changed ones copied over.  Cameras, ambient and clear
+		// color are copied, the view settings (curCamera, wantShadows..) are kept.
+		// Returns the number of lights & objects that changed.
+		int				Reload(const LG3DControlData *src);
+
+		// runtime add & remove.  Removed slots stay in place (disabled) until reused by a later
+		// add, so indices of other lights & objects never change.  The renderer creates and frees
+		// the device resources of changed slots on its next frame move.
+		LG3DSlotList	lightSlots;
+		LG3DSlotList	objectSlots;
+		LG3DHandle		AddLight(const LG3DSceneLight *light);
+		void			RemoveLight(LG3DHandle light);
+		LG3DHandle		AddObject(const LG3DSceneObject *object);
+		void			RemoveObject(LG3DHandle object);
+		int				LightIndex(LG3DHandle light) const {return lightSlots.Slot(light);}
+		int				ObjectIndex(LG3DHandle object) const {return objectSlots.Slot(object);}
+		LG3DHandle		LightHandle(int lightIndex) const {return lightSlots.Handle(lightIndex);}
+		LG3DHandle		ObjectHandle(int objectIndex) const {return objectSlots.Handle(objectIndex);}
+		// false for removed slots and indices outside the rig
+		bool			LightInUse(int lightIndex) const {return (lightIndex >= 0) && (lightIndex < lights.count) && ((lightIndex >= lightSlots.count) || lightSlots.InUse(lightIndex));}
+		bool			ObjectInUse(int objectIndex) const {return (objectIndex >= 0) && (objectIndex < numSceneObjects) && ((objectIndex >= objectSlots.count) || objectSlots.InUse(objectIndex));}
+
+		// (re)size the change tracking arrays to the current light & object counts,
+		// everything starts out dirty.  Called by LG3DControl when the device is created.
+		void			AllocDirtyState();
+		void			FreeDirtyState();
+		void			GrowDirtyState();		// keep the tracking arrays in step with added lights & objects
+		void			GrowSceneLights(int count);	// lengthen the rig description lists, with room to spare
+		void			GrowSceneObjects(int count);
+
+		// forget all pending changes, only touches the entries on the dirty lists
+		void ClearDirtyState()
 		{
-			if (posDelta) {
-				if (!(sceneLightList[lightIndex].pinMask & LG3DPinMask_X))
-					sceneLightList[lightIndex].position.x += posDelta->x;
-				if (!(sceneLightList[lightIndex].pinMask & LG3DPinMask_Y))
-					sceneLightList[lightIndex].position.y += posDelta->y;
-				if (!(sceneLightList[lightIndex].pinMask & LG3DPinMask_Z))
-					sceneLightList[lightIndex].position.z += posDelta->z;
+			int i;
+			for(i=0;i<numDirtyLights;i++)
+				lights.dirty[dirtyLightList[i]] = 0;
+			numDirtyLights = 0;
+			for(i=0;i<numDirtyObjects;i++)
+				objectDirty[dirtyObjectList[i]] = 0;
+			numDirtyObjects = 0;
+			if (nodeDirty) {
+				for(i=firstDirtyNode;i<numSceneNodes;i++)
+					nodeDirty[i] = 0;
 			}
+			firstDirtyNode = numSceneNodes;
+		}
 
-			if (orientDelta) {
-				if (!(sceneLightList[lightIndex].pinMask & LG3DPinMask_H))
-					sceneLightList[lightIndex].orientation.h += orientDelta->h;
-				if (!(sceneLightList[lightIndex].pinMask & LG3DPinMask_P))
-					sceneLightList[lightIndex].orientation.p += orientDelta->p;
-				if (!(sceneLightList[lightIndex].pinMask & LG3DPinMask_R))
-					sceneLightList[lightIndex].orientation.r += orientDelta->r;
-			}
+		void MarkLightDirty(int lightIndex, unsigned long fields)
+		{
+			generation++;
+			if (!dirtyLightList || !fields)
+				return; // not attached to a renderer yet, it will pick up everything on device creation
+			if (lights.dirty[lightIndex] == 0)
+				dirtyLightList[numDirtyLights++] = lightIndex;
+			lights.dirty[lightIndex] |= fields;
 		}
 
-		virtual void MoveObject(int objectIndex, LG3DPosition *posDelta, LG3DOrientation *orientDelta)
+		void MarkObjectDirty(int objectIndex, unsigned long fields)
 		{
-			if (posDelta) {
-				sceneObjectList[objectIndex].position.x += posDelta->x;
-				sceneObjectList[objectIndex].position.y += posDelta->y;
-				sceneObjectList[objectIndex].position.z += posDelta->z;
-			}
+			generation++;
+			if (!objectDirty || !fields)
+				return;
+			if (objectDirty[objectIndex] == 0)
+				dirtyObjectList[numDirtyObjects++] = objectIndex;
+			objectDirty[objectIndex] |= fields;
+		}
 
-			if (orientDelta) {
-				sceneObjectList[objectIndex].orientation.h += orientDelta->h;
-				sceneObjectList[objectIndex].orientation.p += orientDelta->p;
-				sceneObjectList[objectIndex].orientation.r += orientDelta->r;
-			}
+		// a changed node moves everything below it, the renderer finds the affected lights & objects
+		void MarkNodeDirty(int nodeIndex, unsigned long fields)
+		{
+			generation++;
+			if (!nodeDirty || !fields)
+				return;
+			nodeDirty[nodeIndex] |= fields;
+			if (nodeIndex < firstDirtyNode)
+				firstDirtyNode = nodeIndex;
 		}
+
+		virtual void	MoveLight(int lightIndex, LG3DPosition *posDelta, LG3DOrientation *orientDelta);
+		virtual void	MoveObject(int objectIndex, LG3DPosition *posDelta, LG3DOrientation *orientDelta);
+
+		// absolute setters, position & orientation honor the light's pinMask
+		virtual void	SetLightPosition(int lightIndex, const LG3DPosition *pos);
+		virtual void	SetLightOrientation(int lightIndex, const LG3DOrientation *orient);
+		virtual void	SetLightColor(int lightIndex, const LG3DLightColor *color);
+		virtual void	SetLightCone(int lightIndex, float umbra, float penumbra);
+		virtual void	SetLightAttenuation(int lightIndex, float att1, float att2);
+		virtual void	EnableLight(int lightIndex, bool enabled);
+		virtual void	SetLightCastsShadows(int lightIndex, bool castsShadows);
+		virtual void	SetObjectPosition(int objectIndex, const LG3DPosition *pos);
+		virtual void	SetObjectOrientation(int objectIndex, const LG3DOrientation *orient);
+
+		// trusses - moving a node carries along every light, object & node hanging below it.
+		// Attaching keeps the light's or object's position & orientation values, which are
+		// then taken relative to the new node (-1 to detach).
+		virtual void	MoveNode(int nodeIndex, LG3DPosition *posDelta, LG3DOrientation *orientDelta);
+		virtual void	SetNodePosition(int nodeIndex, const LG3DPosition *pos);
+		virtual void	SetNodeOrientation(int nodeIndex, const LG3DOrientation *orient);
+		virtual void	AttachLight(int lightIndex, int nodeIndex);
+		virtual void	AttachObject(int objectIndex, int nodeIndex);
+
+		// bulk updates - apply a whole list of changes in one pass, marking each changed light
+		// or object dirty once.  Returns the number of records that changed something.
+		virtual int		UpdateLights(const LG3DLightUpdate *updates, int numUpdates);
+		virtual int		UpdateObjects(const LG3DObjectUpdate *updates, int numUpdates);
+
+		void			GetLightPosition(int lightIndex, LG3DPosition *pos) const;
+		void			GetLightOrientation(int lightIndex, LG3DOrientation *orient) const;
+		void			GetLightColor(int lightIndex, LG3DLightColor *color) const;
+		bool			IsLightEnabled(int lightIndex) const {return (lights.flags[lightIndex] & LG3DLightFlag_Enabled) != 0;}
+		void			GetLight(int lightIndex, LG3DSceneLight *light) const {lights.Store(lightIndex, light);}
+
+	protected:
+		void			LoadArrays(int firstLight);
+		void			CopyArrays(const LG3DControlData *src);
+};
+
+// what LG3DControl::Reload kept and what it had to load or create again
+struct LG3DReloadStats {
+	int				changed;				// lights & objects that differed
+	int				meshesReused, meshesRebuilt;
+	int				texturesReused, texturesRebuilt;	// gobos and generated spot shapes
+	int				shadowMapsReused, shadowMapsRebuilt;
+	LG3DReloadStats() {memset(this, 0, sizeof(LG3DReloadStats));}
 };
 
 // internal structures
 struct LG3DScene;
+struct LG3DSnapshotSlot;
+struct LG3DPreset;
+struct LG3DPresetBlock;
+struct LG3DMergeSource;
+struct LG3DTimelineTrack;
+struct LG3DEffectSlot;
+struct LG3DExprOp;
+struct LG3DCue;
+struct LG3DTimecodeFrame;
+struct LG3DJournalTouch;
+struct LG3DRecordState;
+struct LG3DDmxUniverse;
+struct LG3DDmxFixture;
+struct LG3DDmxOp;
+struct LG3DSharedHeader;
+struct LG3DSharedRecord;
+struct LG3DSyncPeer;
+
+// Lock-free triple buffer for handing complete rig states from a control thread to the
+// renderer.  The control thread keeps its own LG3DControlData, changes it through the usual
+// calls and then calls Publish.  LG3DControl picks up the latest published state at the start
+// of each frame (see LG3DControl::SetSnapshot).  Neither side ever waits on the other, and
+// only the blocks of lights & objects changed since a buffer was last filled get copied.
+// Light, object & node counts are fixed once the renderer is created.
+class LG3D_DLL LG3DSnapshot {
+	public:
+		LG3DSnapshot();
+		virtual ~LG3DSnapshot();
+
+		// control thread side - AttachWriter loads the writer's light table and starts its change tracking
+		void				AttachWriter(LG3DControlData *writer);
+		void				Publish(LG3DControlData *writer);
+
+		// render thread side - copies the latest published state into reader, marking the
+		// changed lights & objects dirty.  Returns false if nothing new was published.
+		bool				Acquire(LG3DControlData *reader);
+
+	protected:
+		LG3DSnapshotSlot	*slot;				// the 3 buffers
+		volatile LONG		middle;				// index of the buffer between the two threads, plus SNAPSHOT_FRESH when newly published
+		int					back;				// buffer owned by the control thread
+		int					front;				// buffer owned by the render thread
+
+		unsigned long		writeSeq;			// number of the last publish
+		unsigned long		*lightBlockSeq;		// publish number of the last change to each block of lights
+		unsigned long		*objectBlockSeq;	// same, for objects
+		unsigned long		nodeSeq;			// publish number of the last change to any node
+		int					numLightBlocks;
+		int					numObjectBlocks;
+
+		unsigned long		readSeq;			// publish number of the state last copied out by Acquire
+};
+
+// Stored rig states.  A preset keeps the live light values (position, orientation, color,
+// cone, attenuation, enabled & shadows - not names, pins or nodes) in blocks of lights,
+// and blocks holding the same values are shared between presets, so presets that differ
+// in a few lights cost little more than those lights.  Blocks are never changed once
+// stored, storing over a preset swaps in new blocks.  Recall only writes & marks dirty
+// the lights whose values differ from the stored ones, free light slots are left alone.
+class LG3D_DLL LG3DPresetStore {
+	public:
+		LG3DPresetStore();
+		virtual ~LG3DPresetStore();
+
+		void				Store(int presetIndex, const LG3DControlData *data);	// the store grows to fit presetIndex
+		int					Recall(int presetIndex, LG3DControlData *data);		// returns the number of lights changed
+		void				Clear(int presetIndex);
+		bool				IsStored(int presetIndex) const;
+		int					NumPresets() const {return numPresets;}
+		int					NumBlocks() const {return numBlocks;}	// distinct blocks held, shared ones counted once
+		size_t				MemoryUsed() const;
+
+	protected:
+		LG3DPreset			*preset;
+		int					numPresets;
+		LG3DPresetBlock		**hash;				// stored blocks chained by content hash, so equal blocks are found & shared
+		int					hashSize;			// always a power of 2
+		int					numBlocks;
+
+		LG3DPresetBlock		*ShareBlock(const LG3DPresetBlock *values);	// a stored block holding these values, added if there is none
+		void				ReleaseBlock(LG3DPresetBlock *block);
+};
+
+// Timed transition of the lights to another look.  Position, orientation (heading the short
+// way round), color, cone & attenuation are interpolated from where each light was when the
+// fade started, all fading lights 4 at a time, and written back with only the lights that
+// moved marked dirty.  Pinned position & orientation values are left alone.  Lights being
+// enabled (or set to cast shadows) switch on as the fade starts, ones being disabled switch
+// off as it ends.  Until then the fade owns the values it is fading, so changes made to
+// those in between are overwritten.
+class LG3D_DLL LG3DCrossfade {
+	public:
+		LG3DCrossfade();
+		virtual ~LG3DCrossfade();
+
+		// fade data's lights to those in 'to' (a light table of the same rig) over duration seconds,
+		// starting at startAt on the Evaluate clock, or on the next Evaluate if it is negative.  A
+		// fade started in the past picks up part way through.  A fade already running is dropped,
+		// its lights staying wherever they got to.  Returns the number of lights that will fade.
+		int					Start(const LG3DControlData *data, const LG3DLightTable *to, float duration, double startAt = -1.0);
+		void				Stop() {numFading = 0;}
+		bool				IsRunning() const {return numFading > 0;}
+
+		// move the fading lights to where they should be at 'time' (seconds, the clock passed to
+		// OnFrameMove), LG3DControl calls this each frame move (see LG3DControl::SetCrossfade).
+		// With a snapshot, call it on the control thread's data before each Publish instead.
+		// Returns false once the fade is done.
+		bool				Evaluate(LG3DControlData *data, double time);
+
+	protected:
+		int					numFading;
+		int					capacity;			// a multiple of 4
+		int					*light;				// index of each fading light
+		float				*value;				// start, end & current values, one array of capacity entries per value, 16 byte aligned
+		float				*endHead;			// final heading, the end value in 'value' is unwrapped to take the short way round
+		unsigned long		*flagsOn;			// LG3DLightFlagType bits to set as the fade starts
+		unsigned long		*flagsOff;			// and to clear as it ends
+		double				startTime;			// negative until the fade starts, unless it was given one
+		float				duration;
+		bool				started;
+};
+
+#define LG3D_MAX_MERGE_SOURCES	16
+#define LG3D_MAX_MERGE_PRIORITY	126
+
+// Arbitration between several control inputs (a console, a media server, a safety operator..)
+// driving the same rig.  Each source writes into its own buffer, and Merge works out the
+// effective values of every light in one pass, 4 lights at a time.  A higher priority source
+// always wins.  Between sources of the same priority color merges highest takes precedence
+// (per channel), position & orientation latest takes precedence.  A value no source holds is
+// left as it is.  Only blocks of lights some source touched since the last merge are looked at,
+// and only lights whose merged values changed are written & marked dirty.  Merged position &
+// orientation honor the light's pinMask.  Not thread safe, feed & merge on one thread (with a
+// snapshot, the control thread).
+class LG3D_DLL LG3DMerge {
+	public:
+		LG3DMerge();
+		virtual ~LG3DMerge();
+
+		int					AddSource(int priority);			// 0 to LG3D_MAX_MERGE_PRIORITY, returns the source, -1 if there are too many
+		void				RemoveSource(int source);			// releases everything the source holds
+		void				SetSourcePriority(int source, int priority);
+
+		void				SetColor(int source, int lightIndex, const LG3DLightColor *color);
+		void				SetPosition(int source, int lightIndex, const LG3DPosition *pos);
+		void				SetOrientation(int source, int lightIndex, const LG3DOrientation *orient);
+		void				Release(int source, int lightIndex, unsigned long fields);	// LG3DDirty_Color, _Position and/or _Orientation
+
+		// write the merged values into data, returns the number of lights that changed
+		int					Merge(LG3DControlData *data);
+
+	protected:
+		LG3DMergeSource		*source;			// LG3D_MAX_MERGE_SOURCES of them
+		int					capacity;			// lights each source buffer holds, a multiple of the block size
+		unsigned char		*blockDirty;		// per block of lights, set when some source touched it since the last merge
+		bool				anyDirty;
+		unsigned long		stamp;				// write counter, orders the latest takes precedence values
+
+		void				Grow(int lightIndex);
+		void				Touch(int lightIndex);
+		int					NextStamp();
+		bool				IsSource(int s) const;		// s is a source AddSource handed out
+};
+
+enum LG3DTrackTargetType {
+	LG3DTrackTarget_Light,
+	LG3DTrackTarget_Object,
+	LG3DTrackTarget_Camera,
+};
+
+// the field of the target a timeline track drives
+enum LG3DTrackParamType {
+	LG3DTrack_PosX,
+	LG3DTrack_PosY,
+	LG3DTrack_PosZ,
+	LG3DTrack_Head,
+	LG3DTrack_Pitch,
+	LG3DTrack_Roll,
+	LG3DTrack_ColorR,						// lights only, 0 to 255 like LG3DLightColor
+	LG3DTrack_ColorG,
+	LG3DTrack_ColorB,
+	LG3DTrack_Umbra,						// lights only
+	LG3DTrack_Penumbra,
+	LG3DTrack_Att1,
+	LG3DTrack_Att2,
+	LG3DTrack_Enabled,						// lights only, on at 0.5 and above
+	LG3DTrack_CastsShadows,
+	LG3DTrack_Fov,							// cameras only
+	LG3DTrack_Intensity,					// effects only, scales the light's color
+};
+
+enum LG3DInterpType {
+	LG3DInterp_Step,						// hold the key's value up to the next key
+	LG3DInterp_Linear,
+	LG3DInterp_Bezier,						// cubic, through this key's outHandle & the next key's inHandle
+};
+
+// one keyframe, the interpolation applies to the segment from this key to the next
+struct LG3DKey {
+	float			time;					// seconds from the start of the show
+	float			value;
+	int				interp;					// see LG3DInterpType
+	float			inHandle;				// Bezier control values, a third of the way in from
+	float			outHandle;				// the previous key & out to the next key
+	LG3DKey() {memset(this, 0, sizeof(LG3DKey));}
+};
+
+// Keyframed show.  Each track drives one field of a light, object or camera, and the keys
+// of all tracks are packed into one set of arrays.  A track only costs anything while the
+// show is between its first and last key (it writes its last value once as it ends), and
+// moving forward each track just steps on from the key it was at, so a frame costs in
+// proportion to the tracks running, not the keys stored.  Position & orientation honor the
+// light's pinMask, and only values that change are written & marked dirty.
+//
+// Jumping back (or the first evaluate) seeks: the tracks already started are found by a
+// binary search of the start times, and each one's key by a binary search of its key times,
+// so the whole rig state at any time costs O(tracks log keys).  A field whose tracks have not
+// started yet is set to the first key of its earliest track, so after a seek the rig is
+// exactly as the show has it at that time.  Jumping forward gets the same from stepping on.
+class LG3D_DLL LG3DTimeline {
+	public:
+		LG3DTimeline();
+		virtual ~LG3DTimeline();
+
+		// keys must be in time order.  Returns the track, -1 if there are no keys, they are out of
+		// order, or the param is not one the target has (see LG3DTrackParamType).
+		int					AddTrack(int target, int index, int param, const LG3DKey *keys, int numKeys);	// target is a LG3DTrackTargetType
+		void				Clear();
+		int					NumTracks() const {return numTracks;}
+		int					NumKeys() const {return numKeys;}
+		int					NumActive() const {return numActive;}
+		float				Duration() const {return duration;}	// time of the last key of any track
+		void				SetLoop(bool _loop) {loop = _loop;}	// start over once past the duration
+
+		// drive the tracks' fields to their values at 'time' (seconds into the show), seeking
+		// when going back.  Returns false once past the end.
+		bool				Evaluate(LG3DControlData *data, double time);
+		void				Seek(LG3DControlData *data, double time);	// scrub, the next Evaluate carries on from here
+
+	protected:
+		LG3DTimelineTrack	*track;
+		int					numTracks;
+		int					maxTracks;
+		float				*keyTime;			// all keys, each track's in one run, one array per key field
+		float				*keyValue;
+		float				*keyInHandle;
+		float				*keyOutHandle;
+		unsigned char		*keyInterp;
+		int					numKeys;
+		int					maxKeys;
+		float				duration;
+		bool				loop;
+
+		int					*startOrder;		// tracks by the time of their first key
+		float				*startTime;			// the first key's time of each track in startOrder, for the seek's binary search
+		bool				startOrderDirty;
+		bool				positioned;			// false until the first seek, and after tracks are added
+		int					nextStart;			// the next track in startOrder to become active
+		int					*activeList;		// tracks between their first & last key
+		int					numActive;
+		double				lastTime;			// time of the last Evaluate
+
+		int					*batchKey;			// per active track this frame, the key it is past
+		float				*batchU;			// and how far on towards the next key, 0 to 1
+		float				*batchValue;
+
+		void				BuildIndex();
+		void				StepTracks(float t);
+		void				ApplyBatch(LG3DControlData *data);
+};
+
+// effect waveforms, all running from -1 to 1
+enum LG3DWaveType {
+	LG3DWave_Sine,
+	LG3DWave_Triangle,
+	LG3DWave_Square,
+	LG3DWave_Saw,
+	LG3DWave_Fan,							// not moving, spread evenly across the group from -1 to 1
+	LG3DWave_Random,						// a new random value each cycle, for flicker
+};
+
+struct LG3DEffect {
+	int				param;					// LG3DTrackParamType of the lights, not fov
+	int				wave;					// see LG3DWaveType
+	float			speed;					// cycles a second
+	float			size;					// wave amplitude in the param's units (degrees, meters, 0 to 255 color), for intensity 0 to 1 (clamped)
+	float			phase;					// cycles, the first light's offset into the wave
+	float			phaseSpread;			// cycles across the whole group, 1 puts one full wave over it
+	LG3DEffect() {memset(this, 0, sizeof(LG3DEffect));}
+};
+
+// lights an expression program runs over are worked out this many at a time
+#define LG3D_EXPR_BATCH 64
+
+// A light effect written as a little program, like
+//		pan = 30*sin(t*2 + index*0.1); red = 128 + 127*cos(t + x)
+// Statements assign to light fields (x y z pan tilt roll red green blue umbra penumbra, colors
+// 0 to 255) or to local names, separated by ; or new lines.  Expressions have + - * / and
+// brackets, the functions sin cos abs sqrt floor frac min max rand (0 to 1, the same for the
+// same whole number), and read t (seconds, back to 0 every hour so it stays exact to the
+// millisecond), index & count (the light's place in the group), light (its number), pi,
+// the light fields (as they were, until assigned) and locals.
+// Compile turns it into register code, constant parts worked out up front, and each code
+// runs over a batch of lights at a time, so there is no interpreting per light.  The lights
+// are written like an effect - only what changes, pinned fields left alone.
+class LG3D_DLL LG3DExpression {
+	public:
+		LG3DExpression();
+		virtual ~LG3DExpression();
+
+		bool				Compile(const WCHAR *text);		// false if it does not make sense, see ErrorPosition
+		int					ErrorPosition() const {return errorPos;}	// the character Compile gave up at, -1 if it did not
+		int					NumOps() const {return numOps;}
+
+		// one program runs at a time, it keeps its registers in between
+		void				Run(LG3DControlData *data, const int *lights, int numLights, double time);
+
+	protected:
+		LG3DExprOp			*op;
+		int					numOps;
+		float				*reg;				// numRegs * LG3D_EXPR_BATCH, constants filled in by Compile
+		int					numRegs;
+		unsigned long		fieldsRead;			// bit per light field the program reads before assigning it
+		int					fieldOut[11];		// register holding each light field's new value, -1 if not assigned
+		int					errorPos;
+
+		void				Clear();
+		void				Execute();
+};
+
+// Moving heads as the real rig moves them.  Whatever is written to a light's position, pan
+// (heading) or tilt (pitch) - by the host, the inputs, the show or the effects - becomes that
+// fixture's target, and each frame move the lights are taken back to where the fixture
+// physically is, then advanced toward their targets no faster than the speed & acceleration
+// limits allow, all fixtures in one SIMD pass.  Writes count as absolute targets.  While the
+// inputs run, lights still on their way show their targets, so effects & other relative
+// changes made there ride on the target and not on wherever the fixture has got to.  Between
+// frame moves the lights show where they are, a relative move made by the host then is taken
+// from there, use MoveTarget to move the target instead.  Only lights still in motion are
+// marked dirty.
+class LG3D_DLL LG3DKinematics {
+	public:
+		LG3DKinematics();
+		virtual ~LG3DKinematics();
+
+		// meters & degrees per second (& per second squared), 0 for no limit.  SetDefaultLimits
+		// is for lights the kinematics has not seen yet.
+		void				SetDefaultLimits(float maxSpeed, float maxAccel, float maxTurn, float maxTurnAccel);
+		void				SetLimits(const LG3DControlData *data, int lightIndex, float maxSpeed, float maxAccel, float maxTurn, float maxTurnAccel);
+
+		void				SetTarget(const LG3DControlData *data, int lightIndex, const LG3DPosition *pos, const LG3DOrientation *orient);
+		void				MoveTarget(const LG3DControlData *data, int lightIndex, const LG3DPosition *posDelta, const LG3DOrientation *orientDelta);
+		void				GetTarget(int lightIndex, LG3DPosition *pos, LG3DOrientation *orient) const;	// roll is left alone
+		void				Reset() {count = 0;}	// every light starts again at rest where it is
+		void				Snap(const LG3DControlData *data);	// the same but keeping the limits, LG3DControl::Reload calls it
+		int					NumMoving() const {return numMoving;}
+
+		// LG3DControl calls these at the start & the end of each frame move's input stage (see
+		// LG3DControl::SetKinematics)
+		void				BeginFrame(LG3DControlData *data);
+		void				Advance(LG3DControlData *data, float elapsed);
+
+	protected:
+		int					count;
+		int					capacity;			// a multiple of 4
+		float				*block;				// all the arrays below, 16 byte aligned
+		float				*cur[5];			// posX, posY, posZ, head & pitch as last written
+		float				*target[5];
+		float				*velocity[5];
+		float				*limit[4];			// max speed, accel, turn & turn accel of each light
+		float				defaultLimit[4];
+		unsigned char		*groupActive;		// a bit per light of each group of 4 that may be moving, groups at rest are skipped
+		unsigned char		*groupRestored;		// 5 per group, a bit per light BeginFrame put on its target
+		LG3DHandle			*handle;			// slot handle of the fixture each light was seeded for
+		int					numMoving;
+
+		void				Sync(const LG3DControlData *data);
+		void				Seed(const LG3DControlData *data, int lightIndex, bool resetLimits);
+		void				SeedIfReplaced(const LG3DControlData *data, int lightIndex);
+};
+
+// Follow spots - aims groups of lights at points, solving the heading & pitch of every light
+// in one vectorized pass, the same way round as the renderer turns them (heading about the up
+// axis from +Y, pitch up from level).  Lights hanging from a node are aimed in the node's
+// frame, so they point right wherever the truss is.  Pinned heading or pitch is left alone,
+// and a new heading is taken the short way round from the light's current one.
+class LG3D_DLL LG3DAimSolver {
+	public:
+		LG3DAimSolver();
+		virtual ~LG3DAimSolver();
+
+		// aim each light at its own target (world space), or all at targets[0] if numTargets
+		// is 1.  Returns the number of lights that turned.
+		int					Aim(LG3DControlData *data, const int *lights, int numLights, const LG3DPosition *targets, int numTargets);
+		// aim at a scene object, offset (world space, optional) from its origin - a performer's head say
+		int					AimAtObject(LG3DControlData *data, const int *lights, int numLights, int objectIndex, const LG3DPosition *offset);
+
+	protected:
+		int					capacity;			// a multiple of 4
+		float				*scratch;			// the SoA arrays below, 16 byte aligned
+		float				*dirX, *dirY, *dirZ;	// light to target, in the light's frame with Y up
+		float				*head, *pitch;
+		float				*nodeFrame;			// 12 floats a node, world rotation & translation
+		int					numNodeFrames;
+
+		void				BuildNodeFrames(const LG3DControlData *data);
+};
+
+// Undo & redo of rig edits.  An edit names the lights & objects it is about to change and
+// which fields (LG3DDirtyFieldType bits), their values are taken then and again when the edit
+// ends, and only the fields that really changed are kept - so the journal grows with the size
+// of the edits, never with the rig.  An edit begun with the same merge key as the one before
+// it is folded into it, the way a drag becomes a single step.  Undo & redo write back just the
+// values kept, marking those lights & objects dirty.  Pins are not honored, undo puts back
+// exactly what was there.  Adding & removing lights or objects is not journaled, the values
+// kept for one since removed are skipped, even if its slot has been reused.
+class LG3D_DLL LG3DJournal {
+	public:
+		LG3DJournal();
+		virtual ~LG3DJournal();
+
+		unsigned long		NewMergeKey() {return ++lastKey;}	// never 0
+		void				BeginEdit(unsigned long mergeKey);	// 0 never merges
+		void				TouchLight(const LG3DControlData *data, int lightIndex, unsigned long fields);
+		void				TouchObject(const LG3DControlData *data, int objectIndex, unsigned long fields);
+		void				EndEdit(const LG3DControlData *data);	// an edit that changed nothing leaves no step
+
+		bool				Undo(LG3DControlData *data);
+		bool				Redo(LG3DControlData *data);
+		int					NumUndo() const {return cursor;}
+		int					NumRedo() const {return numSteps - cursor;}
+		void				Clear();
+		void				SetMaxBytes(int bytes);	// oldest steps are dropped past this, 0 for no limit
+		int					BytesUsed() const {return streamSize;}
+
+	protected:
+		unsigned char		*stream;			// the steps' records back to back, see LG3DJournal.cpp
+		int					streamSize;
+		int					streamCapacity;
+		int					*stepStart;			// offset of each step in the stream, and one past the last
+		unsigned long		*stepKey;
+		int					numSteps;
+		int					maxSteps;
+		int					cursor;				// steps before it are undone by Undo
+		int					maxBytes;
+		unsigned long		lastKey;
+
+		// the edit in progress
+		bool				open;
+		unsigned long		openKey;
+		LG3DJournalTouch	*touch;
+		int					numTouched;
+		int					maxTouched;
+		int					*touchHash;			// open addressed, -1 for empty
+		int					hashSize;
+
+		void				Touch(int kind, LG3DHandle handle, unsigned long fields, const LG3DControlData *data);
+		void				DropOldest();
+};
+
+// A show saved as a binary scene file.  The file holds the nodes, objects, lights, cameras &
+// arrays as the records LG3DControlData lists them in, plus a table of their names, so Open
+// maps it copy-on-write and points the control data's lists straight into it.  There is no
+// parse step, only the names are interned and the array override lists hooked up.  Records
+// are stored as this build lays them out, and a file written by a build with different
+// layouts is refused.  The mapping must outlive the control data's use of the lists.  Once the
+// scene is loaded, Write & WriteText save the listed lights as the light table has them now.
+//
+// The text form is for people, one record to a line - see LG3DSceneFile.cpp for its grammar.
+// ReadText allocates the lists with new [], the same as a host building a show in code.
+class LG3D_DLL LG3DSceneFile {
+	public:
+		LG3DSceneFile();
+		virtual ~LG3DSceneFile();
+
+		bool				Open(const WCHAR *path, LG3DControlData *data);	// data must have no lists yet
+		void				Close();
+		bool				Contains(const void *p) const {return base && ((const unsigned char *)p >= base) && ((const unsigned char *)p < base + size);}
+		unsigned long		Size() const {return size;}
+
+		static bool			Write(const WCHAR *path, const LG3DControlData *data);
+		static bool			ReadText(const WCHAR *path, LG3DControlData *data, int *errorLine = NULL);
+		static bool			WriteText(const WCHAR *path, const LG3DControlData *data);
+		static bool			Convert(const WCHAR *textPath, const WCHAR *binaryPath, int *errorLine = NULL);
+
+	protected:
+		HANDLE				file;
+		HANDLE				mapping;
+		unsigned char		*base;
+		unsigned long		size;
+};
+
+// Records how the rig changes, frame by frame, so a problem seen on site can be played back
+// in the lab.  LG3DControl hands it each frame move's changes once all the inputs have run
+// (see LG3DControl::SetRecorder), which it finds on the control data's dirty lists, so a frame
+// where little changed costs little to record.  A recording opens with the whole rig, then
+// each frame keeps the fields that changed, each value stored as the bits that differ from its
+// last recorded value.  Lights & objects added or replaced keep their gobo & mesh names.
+class LG3D_DLL LG3DRecorder {
+	public:
+		LG3DRecorder();
+		virtual ~LG3DRecorder();
+
+		bool				Start(const LG3DControlData *data, const WCHAR *path = NULL);	// with a path it is written out as it goes
+		void				Stop();
+		bool				IsRecording() const {return recording;}
+		bool				Failed() const {return failed;}	// the file couldn't be written and the recording stopped, until the next Start or Stop
+		void				RecordFrame(const LG3DControlData *data, double time, float elapsed);
+		bool				Save(const WCHAR *path) const;	// a recording kept in memory
+		int					NumFrames() const {return numFrames;}
+		unsigned long		BytesUsed() const {return flushed + logSize;}
+
+	protected:
+		friend class LG3DReplay;
+		unsigned char		*log;				// see LG3DRecorder.cpp for the layout
+		int					logSize;
+		int					logCapacity;
+		HANDLE				file;
+		unsigned long		flushed;			// bytes already written to the file
+		bool				recording;
+		bool				failed;
+		int					numFrames;
+
+		// the values last recorded, the next ones are stored as the bits that differ
+		LG3DRecordState		*state;
+
+		unsigned char		*Reserve(int bytes);	// room for bytes more, at log + logSize
+		void				RecordHeader(const LG3DControlData *data, unsigned long flags);
+		void				Flush();
+};
+
+// Plays a recording back into a control data.  Start puts the rig as it was when recording
+// began, then each NextFrame applies one frame's changes, marking them dirty like any other
+// change.  LG3DControl can play it in place of the inputs (see LG3DControl::SetReplay), in
+// real time or a frame per frame move.  Replay onto the show that was recorded - a rig with
+// other counts, or that hands out other slots as lights & objects are added, stops it.
+class LG3D_DLL LG3DReplay {
+	public:
+		LG3DReplay();
+		virtual ~LG3DReplay();
+
+		bool				Load(const WCHAR *path);
+		bool				LoadRecording(const LG3DRecorder *recorder);	// one kept in memory
+		bool				Start(LG3DControlData *data);	// false if the rig's light, object or node count differs
+		bool				NextFrame(LG3DControlData *data, double *time, float *elapsed);	// false at the end
+		bool				AtEnd() const {return !playing || (pos >= logSize);}
+		double				NextFrameTime() const {return nextTime - firstTime;}	// from the first frame
+		int					FramesPlayed() const {return framesPlayed;}
+
+	protected:
+		unsigned char		*log;
+		int					logSize;
+		int					pos;
+		int					start;				// where the frames begin
+		bool				playing;
+		int					framesPlayed;
+		double				firstTime;
+		double				nextTime;
+		LG3DRecordState		*state;
+
+		void				PeekTime();
+};
+
+#define LG3D_DMX_CHANNELS		512
+#define LG3D_DMX_MAX_FOOTPRINT	32			// channels one fixture can take
+#define LG3D_ARTNET_PORT		6454
+
+// what a fixture's DMX channel drives.  A fine channel makes its coarse one 16 bit.
+enum LG3DDmxChannelType {
+	LG3DDmx_Unused,
+	LG3DDmx_Pan,
+	LG3DDmx_PanFine,
+	LG3DDmx_Tilt,
+	LG3DDmx_TiltFine,
+	LG3DDmx_Red,
+	LG3DDmx_Green,
+	LG3DDmx_Blue,
+	LG3DDmx_Dimmer,							// scales the color, a fixture with no red, green & blue is white
+	LG3DDmx_Zoom,							// umbra
+};
+
+// a fixture type, its channels in order and how their values map onto the light
+struct LG3DDmxPersonality {
+	int				numChannels;
+	unsigned char	channel[LG3D_DMX_MAX_FOOTPRINT];	// LG3DDmxChannelType of each
+	float			panRange;				// degrees across the whole DMX range, centered on 0
+	float			tiltRange;
+	float			zoomMin, zoomMax;		// umbra degrees at the bottom & top of the range
+	LG3DDmxPersonality() {memset(this, 0, sizeof(LG3DDmxPersonality));}
+};
+
+// one light patched to a DMX address
+struct LG3DDmxPatch {
+	int				lightIndex;
+	int				universe;				// Art-Net port address, 0 to 32767
+	int				address;				// first channel, 1 to 512
+	int				personality;			// index into the personalities given to Compile
+};
+
+// DMX from the consoles, received as Art-Net (ArtDmx packets over UDP).  The patch is compiled
+// once into flat per universe lists of fixtures, each a run of channel ops, so applying a
+// universe is a walk down its fixtures: those whose channels are as last applied are skipped,
+// the others have just the fields whose channels changed written straight into the light
+// table & marked dirty.  Pinned heading & tilt are left alone.  Receive only copies packets
+// into their universe's buffer, nothing is allocated once compiled.  Late packets (by the
+// ArtDmx sequence number) & universes not patched are dropped.  Polled from one thread, see
+// LG3DControl::SetArtNet.  Send is there for testing, the listener is its own console.
+class LG3D_DLL LG3DArtNet {
+	public:
+		LG3DArtNet();
+		virtual ~LG3DArtNet();
+
+		bool				Open(unsigned short port = LG3D_ARTNET_PORT);	// listen on every interface
+		void				Close();
+		bool				IsOpen() const;
+
+		// returns the number of lights patched, bad entries (out of range, overlapping the end
+		// of the universe) are left out.  The first packet of each universe sets all its lights.
+		int					Compile(const LG3DDmxPersonality *personalities, int numPersonalities, const LG3DDmxPatch *patch, int numPatch);
+
+		int					Receive();			// takes in every packet waiting, returns how many were used
+		bool				Ingest(const unsigned char *packet, int size);	// one packet, from anywhere
+		int					Apply(LG3DControlData *data);	// returns the number of lights changed
+
+		bool				Send(unsigned long ipAddress, int universe, const unsigned char *dmx, int numChannels);	// host byte order address
+		static int			BuildPacket(unsigned char *packet, int universe, unsigned char sequence, const unsigned char *dmx, int numChannels);	// returns its size
+
+		int					NumUniverses() const {return numUniverses;}
+		unsigned long		PacketsUsed() const {return packetsUsed;}
+		unsigned long		PacketsDropped() const {return packetsDropped;}
+
+	protected:
+		UINT_PTR			sock;				// a SOCKET
+		unsigned short		port;
+		unsigned char		*packet;			// receive buffer
+		LG3DDmxPersonality	*personality;		// a copy of the ones compiled
+		short				*universeSlot;		// per port address, its entry in universe or -1
+		LG3DDmxUniverse		*universe;			// the patched universes, in port address order
+		int					numUniverses;
+		LG3DDmxFixture		*fixture;			// by universe, then address
+		int					numFixtures;
+		LG3DDmxOp			*op;				// the channel ops of each fixture, one after another
+		int					numOps;
+		unsigned char		*channels;			// received & applied values of every universe
+		unsigned long		packetsUsed;
+		unsigned long		packetsDropped;
+
+		void				FreePlan();
+};
+
+// a light's live values as the renderer publishes them to controllers, see LG3DSharedChannel
+struct LG3DSharedLightState {
+	LG3DPosition	position;
+	LG3DOrientation	orientation;
+	float			colorR, colorG, colorB;	// 0 to 1
+	unsigned long	flags;					// LG3DLightFlagType bits
+};
+
+// Control from another process, through shared memory.  The renderer creates the channel and
+// a controller process opens it by name.  The controller pushes light & object updates into a
+// ring of fixed size records, the renderer takes them at the start of each frame move and
+// applies them with UpdateLights & UpdateObjects (see LG3DControl::SetSharedChannel).  Once
+// the inputs have run, the renderer publishes every light's values into the older of two
+// state buffers, which the controller can read back.  Pushing & reading are plain memory
+// writes & reads, no calls into the system.  Either side can die without taking the other
+// with it: records the controller had not finished are never seen, the renderer checks every
+// record it takes, and a new controller can take over from one that died.  A renderer created
+// again over a channel a controller still holds starts its state buffers empty.  One controller
+// at a time, each side used from one thread.
+class LG3D_DLL LG3DSharedChannel {
+	public:
+		LG3DSharedChannel();
+		virtual ~LG3DSharedChannel();
+
+		// renderer side.  ringRecords is rounded up to a power of 2.
+		bool				Create(const WCHAR *name, int ringRecords, int maxLights);
+		int					Apply(LG3DControlData *data);		// returns the number of records taken
+		void				Publish(const LG3DControlData *data);
+		LONGLONG			LastStamp() const {return lastStamp;}	// of the last stamped record taken
+		bool				ControllerAttached() const;
+
+		// controller side.  A push returns false, and the record is dropped, when the ring is
+		// full.  stamp is the caller's to use, a QueryPerformanceCounter count to time the trip.
+		bool				Open(const WCHAR *name);
+		bool				PushLight(const LG3DLightUpdate *update, LONGLONG stamp = 0);
+		int					PushLights(const LG3DLightUpdate *updates, int numUpdates, LONGLONG stamp = 0);	// returns the number pushed
+		bool				PushObject(const LG3DObjectUpdate *update, LONGLONG stamp = 0);
+		int					ReadState(LG3DSharedLightState *lights, int maxCount, unsigned long *publishCount = NULL) const;	// returns the number of lights, -1 if no consistent copy could be had
+		bool				RendererAlive();	// true if the renderer published since the last call
+		unsigned long		Dropped() const {return dropped;}
+
+		void				Close();
+		bool				IsOpen() const {return header != NULL;}
+
+	protected:
+		HANDLE				mapping;
+		LG3DSharedHeader	*header;			// the start of the shared memory
+		LG3DSharedRecord	*ring;
+		unsigned long		ringCapacity;		// kept apart from the shared header, which the other side could spoil
+		int					maxLights;
+		bool				isRenderer;
+		LONG				lastBeat;			// the renderer's publish count as last seen
+		unsigned long		dropped;
+		LONGLONG			lastStamp;
+		bool				published;			// renderer side, a state has been published
+		unsigned long		publishedGeneration;	// the control data's generation when it was
+		LG3DLightUpdate		*lightBatch;		// renderer side, records are applied in runs
+		LG3DObjectUpdate	*objectBatch;
+
+		LG3DSharedLightState *State(int buffer) const;
+		bool				Push(unsigned long type, const void *update, int size, LONGLONG stamp);
+};
+
+#define LG3D_SYNC_PORT 7160
+
+// Mirrors the live rig onto operator workstations over TCP.  The server sends each frame
+// move only what changed, as found on the dirty lists: per light or object the groups of
+// fields (position, orientation, color..) whose quantized values differ from what was last
+// sent, each value the difference from its last in a short bit code.  Positions go to the
+// millimeter, angles to a hundredth of a degree & colors to their 0 to 255 steps,
+// attenuation exactly.  Messages are sequence numbered.  A client starts from a keyframe
+// holding the whole rig, and more go out every so many frames so a client that missed
+// deltas (one too slow to keep up is skipped, never waited for) finds its way back.  Gobos,
+// meshes, cameras & added or removed slots aren't mirrored, both ends load the same show, a
+// client whose rig doesn't have the server's light, object & node counts applies nothing.
+// Both ends poll from one thread, see LG3DControl::SetSyncServer & SetSyncClient.
+class LG3D_DLL LG3DSyncServer {
+	public:
+		LG3DSyncServer();
+		virtual ~LG3DSyncServer();
+
+		bool				Listen(unsigned short port = LG3D_SYNC_PORT, int maxClients = 8);	// on every interface
+		void				Close();
+		bool				IsOpen() const;
+		void				SetKeyframeInterval(int frames) {keyframeInterval = frames;}	// 0 for none past each client's first
+
+		// takes in new clients, sends them all this frame's changes, returns the bytes queued
+		int					Serve(const LG3DControlData *data);
+
+		int					NumClients() const {return numPeers;}
+		unsigned long		Sequence() const {return sequence;}
+		int					DeltaBytes() const {return deltaSize;}		// this frame's delta message, 0 if nothing changed
+		int					KeyframeBytes() const {return keySize;}		// the last keyframe message
+		unsigned long		BytesSent() const {return bytesSent;}
+		unsigned long		KeyframesSent() const {return keyframesSent;}
+
+	protected:
+		UINT_PTR			sock;				// a SOCKET, listening
+		int					maxPeers;
+		LG3DSyncPeer		*peer;
+		int					numPeers;
+		int					*state;				// quantized values as last sent, lights then objects then nodes
+		int					numLights, numObjects, numNodes;
+		bool				haveState;
+		unsigned long		sequence;
+		int					keyframeInterval;
+		int					sinceKeyframe;
+		unsigned char		*delta;				// this frame's message
+		int					deltaSize, deltaCapacity;
+		unsigned char		*key;
+		int					keySize, keyCapacity;
+		bool				keyBuilt;			// key holds this frame's keyframe
+		unsigned long		bytesSent;
+		unsigned long		keyframesSent;
+
+		void				Accept();
+		void				BuildState(const LG3DControlData *data);
+		void				EncodeDelta(const LG3DControlData *data);
+		void				EncodeKeyframe();
+		bool				Queue(LG3DSyncPeer *p, const unsigned char *message, int size);
+		bool				Flush(LG3DSyncPeer *p);
+		void				Drop(int index);
+};
+
+class LG3D_DLL LG3DSyncClient {
+	public:
+		LG3DSyncClient();
+		virtual ~LG3DSyncClient();
+
+		bool				Connect(unsigned long ipAddress, unsigned short port = LG3D_SYNC_PORT);	// host byte order address, finished by Receive
+		void				Close();
+		bool				IsConnected() const;	// true from Connect on, until the server goes or refuses the connection
+		bool				IsConnecting() const {return connecting;}
+
+		int					Receive(LG3DControlData *data);	// applies every complete message waiting, returns how many
+
+		unsigned long		Sequence() const {return sequence;}
+		bool				InSync() const {return inSync;}
+		bool				Mismatched() const {return mismatched;}	// the last keyframe was for another rig
+		unsigned long		BytesReceived() const {return bytesReceived;}
+		unsigned long		KeyframesTaken() const {return keyframesTaken;}
+		unsigned long		DeltasSkipped() const {return deltasSkipped;}	// out of sequence, waiting for a keyframe
+
+	protected:
+		UINT_PTR			sock;				// a SOCKET, connected
+		unsigned char		*buffer;			// bytes received, not yet a whole message
+		int					bufferSize, bufferCapacity;
+		int					*state;				// quantized values as last received
+		int					numLights, numObjects, numNodes;
+		unsigned long		sequence;
+		bool				connecting;			// Connect began the connection, Receive hasn't seen it made
+		bool				inSync;
+		bool				mismatched;
+		unsigned long		bytesReceived;
+		unsigned long		keyframesTaken;
+		unsigned long		deltasSkipped;
+		LG3DLightUpdate		*lightBatch;		// records are applied in runs
+		LG3DObjectUpdate	*objectBatch;
+
+		bool				Connected();
+		bool				Decode(LG3DControlData *data, const unsigned char *message, int size);
+};
+
+// SMPTE / MIDI timecode, frames counted at fps (24, 25 or 30, non drop)
+struct LG3DTimecode {
+	int				hours;
+	int				minutes;
+	int				seconds;
+	int				frames;
+	float			fps;
+};
+
+LG3D_DLL double		LG3DTimecodeSeconds(const LG3DTimecode *tc);
+LG3D_DLL void		LG3DSecondsTimecode(double seconds, float fps, LG3DTimecode *tc);
+
+// how well a cue scheduler has been keeping time, all in seconds
+struct LG3DCueStats {
+	int				cuesFired;
+	double			meanLate;				// how far past its time each cue was dispatched, as presented
+	double			jitter;					// spread (standard deviation) of that
+	double			maxLate;
+	double			lockJitter;				// rms difference between the timecode received and the locked clock
+};
+
+// Fires cues against incoming timecode.  The scheduler locks a clock to the timecode (on the
+// frame move's clock, which runs from the performance counter) and smooths out the arrival
+// jitter of the frames, so between frames show time is known far finer than a timecode frame.
+// Each frame move, cues due by the time the frame is presented (time + latency) start a fade
+// on the crossfade given; the fade is started at the cue's exact time, so a cue dispatched
+// late is already as far into its fade as it should be when it is seen.  A jump in the
+// timecode relocks, and brings up the last cue before the new show time.  Cue looks are
+// kept by the caller.  Use it with the crossfade also set on the LG3DControl.
+class LG3D_DLL LG3DCueScheduler {
+	public:
+		LG3DCueScheduler();
+		virtual ~LG3DCueScheduler();
+
+		void				SetCrossfade(LG3DCrossfade *_crossfade) {crossfade = _crossfade;}
+		void				SetLatency(float seconds) {latency = seconds;}	// from frame move to the frame being seen
+
+		int					AddCue(double showTime, const LG3DLightTable *look, float fadeTime);	// returns its place in the cue list
+		void				ClearCues();
+		int					NumCues() const {return numCues;}
+
+		// the timecode reader calls this with each frame as it arrives, time on the frame move's clock
+		void				ReceiveTimecode(const LG3DTimecode *tc, double time);
+		bool				IsLocked(double time) const;
+		double				ShowTime(double time) const {return time + offset;}
+
+		// LG3DControl calls this each frame move, before the crossfade (see LG3DControl::SetCues)
+		void				Dispatch(LG3DControlData *data, double time);
+
+		void				GetStats(LG3DCueStats *stats) const;
+		void				ResetStats();
+
+	protected:
+		LG3DCue				*cue;				// in show time order
+		int					numCues;
+		int					nextCue;			// the first cue not yet fired
+		LG3DCrossfade		*crossfade;
+		float				latency;
+		double				offset;				// show time less the clock
+		double				lastReceived;		// clock time of the last timecode frame
+		bool				locked;
+		bool				catchUp;			// bring up the last cue before nextCue on the next dispatch
+		int					numFired;
+		double				lateSum, lateSumSq, lateMax;
+		int					numResiduals;
+		double				residualSumSq;
+
+		void				Reposition(double showTime);
+};
+
+// Stand in for a timecode reader - a free running loopback, like a playback machine rolling,
+// or a recording of frames & the times they arrived read from a text file with lines of
+//		<arrival seconds> HH:MM:SS:FF
+// Poll hands the scheduler every frame due since the last poll, stamped with its own arrival time.
+class LG3D_DLL LG3DTimecodeSource {
+	public:
+		LG3DTimecodeSource();
+		virtual ~LG3DTimecodeSource();
+
+		// roll from 'from', jitter (seconds) is the most a frame's arrival is randomly late
+		void				StartLoopback(const LG3DTimecode *from, double time, float jitter);
+		bool				LoadFile(const WCHAR *path, float fps);
+		void				StartFile(double time);
+		void				Stop() {running = false;}
+		bool				IsRunning() const {return running;}
+
+		int					Poll(LG3DCueScheduler *cues, double time);	// returns the number of frames passed on
+
+	protected:
+		bool				running;
+		bool				loopback;
+		float				fps;
+		float				jitter;
+		double				startTime;			// clock time the source started
+		double				startShow;			// loopback show time at startTime
+		int					nextFrame;
+		LG3DTimecodeFrame	*frame;				// the file's frames
+		int					numFrames;
+};
+
+// Running stage effects - pan & tilt waves, fans, color chases, flicker.  Each effect drives
+// one field of a group of lights, riding on whatever else sets that field: a value written
+// by someone other than the effect becomes the new base the wave is added to (or, for
+// intensity, the color it scales).  Effects stacked on the same field add up in the order
+// they were added, each laid over what the ones before it left.  Colors and scaled colors
+// stay in 0..1.  All the members of an effect are evaluated 4 at a time, only values that
+// change are marked dirty, and pinned fields are left alone.  Removing an effect puts its
+// lights back on their base values.  Expression effects run an LG3DExpression over their
+// group instead, setting the fields outright, and leave the lights where they are when
+// removed.
+class LG3D_DLL LG3DEffects {
+	public:
+		LG3DEffects();
+		virtual ~LG3DEffects();
+
+		int					Add(const LG3DEffect *effect, const int *lights, int numLights);	// returns the effect, -1 if the param can not be driven
+		int					AddExpression(LG3DExpression *program, const int *lights, int numLights);	// runs a compiled program, kept by the caller
+		void				Change(int effectIndex, const LG3DEffect *effect);	// everything but the param can change on the fly, not for expressions
+		void				Remove(int effectIndex, LG3DControlData *data);
+		int					NumActive() const {return numActive;}
+
+		// LG3DControl calls this each frame move (see LG3DControl::SetEffects)
+		void				Evaluate(LG3DControlData *data, double time);
+
+	protected:
+		LG3DEffectSlot		*slot;
+		int					numSlots;
+		int					numActive;
+};
 
 class LG3D_DLL LG3DControl {
 	public:
@@ -151,6 +1423,31 @@ class LG3D_DLL LG3DControl {
 		virtual void Draw();
 
 		virtual void SetShadowMapSize(int size) {shadowMapSize = size;}
+		virtual void SetSnapshot(LG3DSnapshot *_snapshot) {snapshot = _snapshot;}	// take controlData from this snapshot each frame
+		virtual void SetCrossfade(LG3DCrossfade *_crossfade) {crossfade = _crossfade;}	// evaluate this fade at the start of each frame move
+		virtual void SetMerge(LG3DMerge *_merge) {merge = _merge;}	// merge these inputs into controlData at the start of each frame move
+		// play this show from startTime (on the frame move's clock, negative to start on the next frame move)
+		virtual void SetTimeline(LG3DTimeline *_timeline, double startTime) {timeline = _timeline; timelineStart = startTime;}
+		virtual void SetEffects(LG3DEffects *_effects) {effects = _effects;}	// run these effects at the end of each frame move's input stage
+		virtual void SetCues(LG3DCueScheduler *_cues) {cues = _cues;}	// dispatch these cues each frame move, ahead of the crossfade
+		virtual void SetKinematics(LG3DKinematics *_kinematics) {kinematics = _kinematics;}	// move the lights as the real rig can, after all the inputs
+		virtual void SetJournal(LG3DJournal *_journal) {journal = _journal;}	// record mouse drags here, each drag one undo step
+		virtual void SetRecorder(LG3DRecorder *_recorder) {recorder = _recorder;}	// record each frame move's changes, after all the inputs
+		// play a started replay in place of the inputs, every frame due by the frame move's clock
+		// when realTime, otherwise one recorded frame per frame move.  The inputs resume at its end.
+		virtual void SetReplay(LG3DReplay *_replay, bool realTime) {replay = _replay; replayRealTime = realTime; replayStart = -1.0;}
+		virtual void SetArtNet(LG3DArtNet *_artNet) {artNet = _artNet;}	// take in the consoles' DMX at the start of each frame move, ahead of the merge
+		virtual void SetSharedChannel(LG3DSharedChannel *_channel) {sharedChannel = _channel;}	// take a controller's updates with the DMX, publish the rig after all the inputs
+		virtual void SetSyncServer(LG3DSyncServer *_server) {syncServer = _server;}	// send what each frame move changed to the workstations, after all the inputs
+		virtual void SetSyncClient(LG3DSyncClient *_client) {syncClient = _client;}	// mirror a server's rig, taken in ahead of the other inputs
+		double				GetTime() const;	// the clock frame moves run on
+
+		// Apply a changed show without re-creating the device - controlData is diffed against src
+		// (see LG3DControlData::Reload), and only the meshes, textures & shadow maps of changed
+		// lights & objects are rebuilt, reusing any that another light or object already has loaded.
+		// Effects and the other device wide resources are never touched.  The changes are applied
+		// right away by a frame move, stats (optional) reports what was kept & what was rebuilt.
+		virtual void Reload(const LG3DControlData *src, LG3DReloadStats *stats);
 
 		HRESULT CALLBACK	OnCreateDevice( IDirect3DDevice9* pd3dDevice, const D3DSURFACE_DESC* pBackBufferSurfaceDesc );
 		HRESULT CALLBACK	OnResetDevice( IDirect3DDevice9* pd3dDevice, const D3DSURFACE_DESC* pBackBufferSurfaceDesc );
@@ -174,6 +1471,24 @@ class LG3D_DLL LG3DControl {
 		int					shadowMapSize;		// defaults to 256
 
 		LG3DScene			*scene;
+		LG3DSnapshot		*snapshot;			// optional, see SetSnapshot
+		LG3DCrossfade		*crossfade;			// optional, see SetCrossfade
+		LG3DMerge			*merge;				// optional, see SetMerge
+		LG3DTimeline		*timeline;			// optional, see SetTimeline
+		double				timelineStart;
+		LG3DEffects			*effects;			// optional, see SetEffects
+		LG3DCueScheduler	*cues;				// optional, see SetCues
+		LG3DKinematics		*kinematics;		// optional, see SetKinematics
+		LG3DJournal			*journal;			// optional, see SetJournal
+		LG3DRecorder		*recorder;			// optional, see SetRecorder
+		LG3DReplay			*replay;			// optional, see SetReplay
+		bool				replayRealTime;
+		double				replayStart;
+		LG3DArtNet			*artNet;			// optional, see SetArtNet
+		LG3DSharedChannel	*sharedChannel;		// optional, see SetSharedChannel
+		LG3DSyncServer		*syncServer;		// optional, see SetSyncServer
+		LG3DSyncClient		*syncClient;		// optional, see SetSyncClient
+		unsigned long		dragKey;			// merge key of the drag in progress
 
 		void				CreateRenderWindow();
 		void				UpdateShadowMaps(IDirect3DDevice9 *pd3dDevice);
@@ -4,8 +4,10 @@
 #define GET_X_LPARAM(lp)                        ((int)(short)LOWORD(lp))
 #define GET_Y_LPARAM(lp)                        ((int)(short)HIWORD(lp))
 #include <math.h>
+#include <stdio.h>
 
 #include "lg3d.h"
+#include "benchlg3d.h"
 
 HWND	hwnd;
 bool	appOK = false;
@@ -15,166 +17,384 @@ DWORD	ticsThen = 0;
 bool	tick = false;
 bool	lightToggleActive = false;
 bool	cameraSelectActive = false;
+bool	presetStoreActive = false;
+bool	presetRecallActive = false;
 bool	performanceTest = false;
 int		stressTest = 0;
 
 LG3DControl	*lg3d = NULL;
 LG3DControlData *lg3dData = NULL;
 
-void LG3DCreate()
+// fixtures patched in at runtime with the 'f' & 'o' keys, removed again with 'F' & 'O'
+#define MAX_PATCHED 64
+LG3DHandle	patchedLight[MAX_PATCHED];
+int			numPatchedLights = 0;
+LG3DHandle	patchedObject[MAX_PATCHED];
+int			numPatchedObjects = 0;
+
+// looks kept with 'k' and brought back with 'g', each followed by the preset number
+LG3DPresetStore presets;
+
+// 'x' fades the rig to a re-aimed & re-colored look
+LG3DCrossfade crossfade;
+
+// 'z' toggles a blackout from a top priority safety input, over a low priority
+// input holding the colors from before the blackout
+LG3DMerge inputs;
+int		safetySource = -1;
+int		consoleSource = -1;
+
+// 'v' toggles a pan wave and an intensity chase running across the whole rig
+LG3DEffects effects;
+int		panWave = -1;
+int		chase = -1;
+
+// 'V' toggles a rainbow ripple written as an expression
+LG3DExpression rippleProgram;
+int		ripple = -1;
+
+void LG3DStopEffects()
 {
-	lg3dData = new LG3DControlData();
+	effects.Remove(panWave, lg3dData);
+	effects.Remove(chase, lg3dData);
+	effects.Remove(ripple, lg3dData);
+	panWave = chase = ripple = -1;
+}
+
+// 'q' rolls a loopback timecode, with cues a second & a half apart fading between 4 looks
+LG3DCueScheduler cues;
+LG3DTimecodeSource timecode;
+LG3DLightTable cueLook[4];
 
-	lg3dData->ambient.r = 64;
-	lg3dData->ambient.g = 64;
-	lg3dData->ambient.b = 64;
+// 'j' toggles moving the lights only as fast as real moving heads can
+LG3DKinematics kinematics;
+bool	useKinematics = false;
 
-	lg3dData->clearColor.r = 0;
-	lg3dData->clearColor.g = 0;
-	lg3dData->clearColor.b = 32;
+// 'w' turns every light onto scene object 0, a little above its origin
+LG3DAimSolver aimSolver;
 
-	lg3dData->wantShadows = true;
+// mouse drags, spins & aiming can be taken back with ctrl+z and done again with ctrl+y
+LG3DJournal journal;
+
+// 'n' saves the show as text, converts that to a scene file and runs the show from the file
+bool	showFromFile = false;
+const WCHAR	*showTextPath = L".\\data\\show.txt";
+const WCHAR	*showFilePath = L".\\data\\show.lg3d";
+
+// 'i' starts & stops recording the rig's changes, 'I' plays the last recording back in real time
+LG3DRecorder recorder;
+LG3DReplay replay;
+const WCHAR	*recordingPath = L".\\data\\show.rec";
+
+// 'h' takes the rig over Art-Net, every light a 9 channel moving head, 56 to a universe from universe 0
+LG3DArtNet artNet;
+bool	useArtNet = false;
+
+// 'd' serves the rig to workstations mirroring it, 'D' mirrors the rig served on this machine
+// into a copy of the show, as a workstation would - the rig drawn could only mirror itself
+LG3DSyncServer syncServer;
+LG3DSyncClient syncClient;
+LG3DControlData *syncMirror = NULL;
+
+// a controller in another process can always attach, it opens the channel by this name
+LG3DSharedChannel sharedChannel;
+const WCHAR	*sharedChannelName = L"Local\\lg3dControl";
+
+void LG3DPatchArtNet()
+{
+	LG3DDmxPersonality head;
+	const unsigned char channels[9] = {LG3DDmx_Pan, LG3DDmx_PanFine, LG3DDmx_Tilt, LG3DDmx_TiltFine,
+		LG3DDmx_Dimmer, LG3DDmx_Red, LG3DDmx_Green, LG3DDmx_Blue, LG3DDmx_Zoom};
+	head.numChannels = 9;
+	memcpy(head.channel, channels, sizeof(channels));
+	head.panRange = 540.0f;
+	head.tiltRange = 270.0f;
+	head.zoomMin = 5.0f;
+	head.zoomMax = 45.0f;
+	int count = lg3dData->lights.count;
+	LG3DDmxPatch *patch = (LG3DDmxPatch *)malloc(sizeof(LG3DDmxPatch) * (count+1));
+	int i;
+	for(i=0;i<count;i++) {
+		patch[i].lightIndex = i;
+		patch[i].universe = i / (LG3D_DMX_CHANNELS / 9);
+		patch[i].address = 1 + (i % (LG3D_DMX_CHANNELS / 9)) * 9;
+		patch[i].personality = 0;
+	}
+	artNet.Compile(&head, 1, patch, count);
+	free(patch);
+}
 
-	lg3dData->numSceneObjects = 2;
-	lg3dData->sceneObjectList = new LG3DSceneObject[lg3dData->numSceneObjects];
+// 'y' draws the array stress rig's ring (the last 't' picks) in and lets it out again, an array at a time
+bool	ringDrawnIn = false;
 
-	wcscpy_s(lg3dData->sceneObjectList[0].meshName, L".\\data\\StageFloor.x");
-	// wcscpy_s(lg3dData->sceneObjectList[0].meshName, L".\\data\\Stage.x");
-	lg3dData->sceneObjectList[0].position.z = 1.5f;
-	wcscpy_s(lg3dData->sceneObjectList[1].meshName, L".\\data\\ModelColumns.x");
-	lg3dData->sceneObjectList[1].position.z = 1.5f;
+// played while animating, light 0 turning round once every 4.5 seconds
+LG3DTimeline demoShow;
 
-	if (stressTest > 0) {
+void LG3DAnimate(bool on)
+{
+	animate = on;
+	if (demoShow.NumTracks() == 0) {
+		LG3DKey turn[2];
+		turn[0].interp = LG3DInterp_Linear;
+		turn[1].time = 4.5f;
+		turn[1].value = 360.0f;
+		demoShow.AddTrack(LG3DTrackTarget_Light, 0, LG3DTrack_Head, turn, 2);
+		demoShow.SetLoop(true);
+	}
+	if (lg3d)
+		lg3d->SetTimeline(on ? &demoShow : NULL, -1.0);
+}
+
+// fill in the show description, for the stress test rig selected by stressTest
+void LG3DBuildShow(LG3DControlData *data)
+{
+	if (showFromFile) {
+		LG3DSceneFile *file = new LG3DSceneFile();
+		if (file->Open(showFilePath, data)) {
+			animate = false;
+			return;
+		}
+		delete file;
+		showFromFile = false;
+	}
+
+	data->ambient.r = 64;
+	data->ambient.g = 64;
+	data->ambient.b = 64;
+
+	data->clearColor.r = 0;
+	data->clearColor.g = 0;
+	data->clearColor.b = 32;
+
+	data->wantShadows = true;
+
+	data->numSceneObjects = 2;
+	data->sceneObjectList = new LG3DSceneObject[data->numSceneObjects];
+
+	data->sceneObjectList[0].meshName = LG3DInternName(L".\\data\\StageFloor.x");
+	// data->sceneObjectList[0].meshName = LG3DInternName(L".\\data\\Stage.x");
+	data->sceneObjectList[0].position.z = 1.5f;
+	data->sceneObjectList[1].meshName = LG3DInternName(L".\\data\\ModelColumns.x");
+	data->sceneObjectList[1].position.z = 1.5f;
+
+	if (stressTest == 4) {
+		// the 4096 light ring again, described as one array per truss
+		animate = false;
+		BenchBuildArrayRig(data, 4096);
+	} else if (stressTest > 0) {
 		animate = false;
-		lg3dData->numSceneLights = (stressTest == 1 ? 64 : 256);
-		lg3dData->sceneLightList = new LG3DSceneLight[lg3dData->numSceneLights];
+		data->numSceneLights = (stressTest == 1 ? 64 : (stressTest == 2 ? 256 : 4096));
+		data->sceneLightList = new LG3DSceneLight[data->numSceneLights];
+
+		// the lights hang from trusses of 64, all rigged at the origin
+		data->numSceneNodes = data->numSceneLights / 64;
+		data->sceneNodeList = new LG3DSceneNode[data->numSceneNodes];
 		int i;
 		float dist = 6.0f;
 		float angleRad, angleDeg;
-		for(i=0;i<lg3dData->numSceneLights;i++) {
-			angleRad = 6.283185307179586476925286766559f * i / (float)lg3dData->numSceneLights;
-			angleDeg = 360.0f * i / (float)lg3dData->numSceneLights;
-			lg3dData->sceneLightList[i].att1 = 0.2f;
-			lg3dData->sceneLightList[i].umbra = 3.0f;
-			lg3dData->sceneLightList[i].penumbra = 7.0f;
-			lg3dData->sceneLightList[i].position.x = -dist * sinf(angleRad);
-			lg3dData->sceneLightList[i].position.y = -dist * cosf(angleRad);
-			lg3dData->sceneLightList[i].position.z = 2.6f;
-			lg3dData->sceneLightList[i].orientation.h = angleDeg;
-			lg3dData->sceneLightList[i].orientation.p = -20.0f - sinf(angleRad*2.5f)*10.0f;
-			lg3dData->sceneLightList[i].castsShadows = (stressTest == 1 ? true : false);
-			lg3dData->sceneLightList[i].enabled = true;
-			lg3dData->sceneLightList[i].color.r = rand()%255;
-			lg3dData->sceneLightList[i].color.g = rand()%255;
-			lg3dData->sceneLightList[i].color.b = rand()%255;
-			lg3dData->sceneLightList[i].pinMask = LG3DPinMask_XYZ; // lights can rotate but position is fixed
+		for(i=0;i<data->numSceneLights;i++) {
+			angleRad = 6.283185307179586476925286766559f * i / (float)data->numSceneLights;
+			angleDeg = 360.0f * i / (float)data->numSceneLights;
+			data->sceneLightList[i].att1 = 0.2f;
+			data->sceneLightList[i].umbra = 3.0f;
+			data->sceneLightList[i].penumbra = 7.0f;
+			data->sceneLightList[i].position.x = -dist * sinf(angleRad);
+			data->sceneLightList[i].position.y = -dist * cosf(angleRad);
+			data->sceneLightList[i].position.z = 2.6f;
+			data->sceneLightList[i].orientation.h = angleDeg;
+			data->sceneLightList[i].orientation.p = -20.0f - sinf(angleRad*2.5f)*10.0f;
+			data->sceneLightList[i].castsShadows = (stressTest == 1 ? true : false);
+			data->sceneLightList[i].enabled = true;
+			data->sceneLightList[i].color.r = rand()%255;
+			data->sceneLightList[i].color.g = rand()%255;
+			data->sceneLightList[i].color.b = rand()%255;
+			data->sceneLightList[i].pinMask = LG3DPinMask_XYZ; // lights can rotate but position is fixed
+			data->sceneLightList[i].parentNode = i / 64;
 		}
 	} else {
-		lg3dData->numSceneLights = 4;
-		lg3dData->sceneLightList = new LG3DSceneLight[lg3dData->numSceneLights];
-
-		lg3dData->sceneLightList[0].att1 = 0.2f;
-		lg3dData->sceneLightList[0].umbra = 40.0f;
-		lg3dData->sceneLightList[0].penumbra = 5.0f;
-		lg3dData->sceneLightList[0].position.x = 2.5f;
-		lg3dData->sceneLightList[0].position.y = 0.0f;
-		lg3dData->sceneLightList[0].position.z = 2.6f;
-		lg3dData->sceneLightList[0].orientation.p = -10.0f;
-		lg3dData->sceneLightList[0].castsShadows = true;
-		lg3dData->sceneLightList[0].enabled = true;
-		// wcscpy_s(lg3dData->sceneLightList[0].goboName, L".\\data\\white.bmp");
-		lg3dData->sceneLightList[0].color.r = 255;
-		lg3dData->sceneLightList[0].color.g = 255;
-		lg3dData->sceneLightList[0].color.b = 255;
-		lg3dData->sceneLightList[0].pinMask = LG3DPinMask_XYZ; // lights can rotate but position is fixed
-
-		lg3dData->sceneLightList[1].att1 = 0.2f;
-		lg3dData->sceneLightList[1].umbra = 15.0f;
-		lg3dData->sceneLightList[1].penumbra = 5.0f;
-		lg3dData->sceneLightList[1].position.x = 2.0f;
-		lg3dData->sceneLightList[1].position.y = 2.0f;
-		lg3dData->sceneLightList[1].position.z = 3.0f;
-		lg3dData->sceneLightList[1].orientation.h = 245.0f;
-		lg3dData->sceneLightList[1].orientation.p = -40.0f;
-		lg3dData->sceneLightList[1].enabled = true;
-		lg3dData->sceneLightList[1].castsShadows = true;
-		wcscpy_s(lg3dData->sceneLightList[1].goboName, L".\\data\\gobo.bmp");
-		lg3dData->sceneLightList[1].color.r = 255;
-		lg3dData->sceneLightList[1].color.g = 255;
-		lg3dData->sceneLightList[1].color.b = 255;
-		lg3dData->sceneLightList[1].pinMask = LG3DPinMask_XYZ; // lights can rotate but position is fixed
-
-		lg3dData->sceneLightList[2].att1 = 0.2f;
-		lg3dData->sceneLightList[2].umbra = 12.5f;
-		lg3dData->sceneLightList[2].penumbra = 3.0f;
-		lg3dData->sceneLightList[2].position.x = 2.0f;
-		lg3dData->sceneLightList[2].position.y = -1.0f;
-		lg3dData->sceneLightList[2].position.z = 3.0f;
-		lg3dData->sceneLightList[2].orientation.h = 290.0f;
-		lg3dData->sceneLightList[2].orientation.p = -35.0f;
-		lg3dData->sceneLightList[2].enabled = true;
-		lg3dData->sceneLightList[2].castsShadows = true;
-		lg3dData->sceneLightList[2].color.r = 255;
-		lg3dData->sceneLightList[2].color.g = 255;
-		lg3dData->sceneLightList[2].color.b = 255;
-		lg3dData->sceneLightList[2].pinMask = LG3DPinMask_XYZ; // lights can rotate but position is fixed
-
-		lg3dData->sceneLightList[3].att1 = 0.1f;
-		lg3dData->sceneLightList[3].umbra = 25.0f;
-		lg3dData->sceneLightList[3].penumbra = 5.0f;
-		lg3dData->sceneLightList[3].position.x = -0.6f;
-		lg3dData->sceneLightList[3].position.y = -4.0f;
-		lg3dData->sceneLightList[3].position.z = 2.6f;
-		lg3dData->sceneLightList[3].orientation.h = 350.0f;
-		lg3dData->sceneLightList[3].orientation.p = -20.0f;
-		lg3dData->sceneLightList[3].enabled = true;
-		lg3dData->sceneLightList[3].castsShadows = true;
-		lg3dData->sceneLightList[3].color.r = 0;
-		lg3dData->sceneLightList[3].color.g = 255;
-		lg3dData->sceneLightList[3].color.b = 0;
-		lg3dData->sceneLightList[3].pinMask = LG3DPinMask_XYZ; // lights can rotate but position is fixed
+		data->numSceneLights = 4;
+		data->sceneLightList = new LG3DSceneLight[data->numSceneLights];
+
+		data->sceneLightList[0].att1 = 0.2f;
+		data->sceneLightList[0].umbra = 40.0f;
+		data->sceneLightList[0].penumbra = 5.0f;
+		data->sceneLightList[0].position.x = 2.5f;
+		data->sceneLightList[0].position.y = 0.0f;
+		data->sceneLightList[0].position.z = 2.6f;
+		data->sceneLightList[0].orientation.p = -10.0f;
+		data->sceneLightList[0].castsShadows = true;
+		data->sceneLightList[0].enabled = true;
+		// data->sceneLightList[0].goboName = LG3DInternName(L".\\data\\white.bmp");
+		data->sceneLightList[0].color.r = 255;
+		data->sceneLightList[0].color.g = 255;
+		data->sceneLightList[0].color.b = 255;
+		data->sceneLightList[0].pinMask = LG3DPinMask_XYZ; // lights can rotate but position is fixed
+
+		// lights 1 & 2 hang from a truss, fly it with 'u' & 'U'
+		data->numSceneNodes = 1;
+		data->sceneNodeList = new LG3DSceneNode[data->numSceneNodes];
+		data->sceneNodeList[0].name = LG3DInternName(L"truss");
+		data->sceneNodeList[0].position.x = 2.0f;
+		data->sceneNodeList[0].position.z = 3.0f;
+
+		data->sceneLightList[1].att1 = 0.2f;
+		data->sceneLightList[1].umbra = 15.0f;
+		data->sceneLightList[1].penumbra = 5.0f;
+		data->sceneLightList[1].parentNode = 0;
+		data->sceneLightList[1].position.y = 2.0f;
+		data->sceneLightList[1].orientation.h = 245.0f;
+		data->sceneLightList[1].orientation.p = -40.0f;
+		data->sceneLightList[1].enabled = true;
+		data->sceneLightList[1].castsShadows = true;
+		data->sceneLightList[1].goboName = LG3DInternName(L".\\data\\gobo.bmp");
+		data->sceneLightList[1].color.r = 255;
+		data->sceneLightList[1].color.g = 255;
+		data->sceneLightList[1].color.b = 255;
+		data->sceneLightList[1].pinMask = LG3DPinMask_XYZ; // lights can rotate but position is fixed
+
+		data->sceneLightList[2].att1 = 0.2f;
+		data->sceneLightList[2].umbra = 12.5f;
+		data->sceneLightList[2].penumbra = 3.0f;
+		data->sceneLightList[2].parentNode = 0;
+		data->sceneLightList[2].position.y = -1.0f;
+		data->sceneLightList[2].orientation.h = 290.0f;
+		data->sceneLightList[2].orientation.p = -35.0f;
+		data->sceneLightList[2].enabled = true;
+		data->sceneLightList[2].castsShadows = true;
+		data->sceneLightList[2].color.r = 255;
+		data->sceneLightList[2].color.g = 255;
+		data->sceneLightList[2].color.b = 255;
+		data->sceneLightList[2].pinMask = LG3DPinMask_XYZ; // lights can rotate but position is fixed
+
+		data->sceneLightList[3].att1 = 0.1f;
+		data->sceneLightList[3].umbra = 25.0f;
+		data->sceneLightList[3].penumbra = 5.0f;
+		data->sceneLightList[3].position.x = -0.6f;
+		data->sceneLightList[3].position.y = -4.0f;
+		data->sceneLightList[3].position.z = 2.6f;
+		data->sceneLightList[3].orientation.h = 350.0f;
+		data->sceneLightList[3].orientation.p = -20.0f;
+		data->sceneLightList[3].enabled = true;
+		data->sceneLightList[3].castsShadows = true;
+		data->sceneLightList[3].color.r = 0;
+		data->sceneLightList[3].color.g = 255;
+		data->sceneLightList[3].color.b = 0;
+		data->sceneLightList[3].pinMask = LG3DPinMask_XYZ; // lights can rotate but position is fixed
 	}
 
-	lg3dData->numCameras = 4;
-	lg3dData->cameraList = new LG3DCameraObject[lg3dData->numCameras];
+	data->numCameras = 4;
+	data->cameraList = new LG3DCameraObject[data->numCameras];
 
-	wcscpy_s(lg3dData->cameraList[0].name, L"default");
-	lg3dData->cameraList[0].fov = 60.0f;
+	data->cameraList[0].name = LG3DInternName(L"default");
+	data->cameraList[0].fov = 60.0f;
 	if (stressTest) {
-		lg3dData->cameraList[0].position.x = 8.0f;
-		lg3dData->cameraList[0].position.y = -8.0f;
-		lg3dData->cameraList[0].position.z = 3.5f;
+		data->cameraList[0].position.x = 8.0f;
+		data->cameraList[0].position.y = -8.0f;
+		data->cameraList[0].position.z = 3.5f;
 	} else {
-		lg3dData->cameraList[0].position.x = 4.0f;
-		lg3dData->cameraList[0].position.y = -4.0f;
-		lg3dData->cameraList[0].position.z = 2.5f;
+		data->cameraList[0].position.x = 4.0f;
+		data->cameraList[0].position.y = -4.0f;
+		data->cameraList[0].position.z = 2.5f;
 	}
-	lg3dData->cameraList[0].orientation.h = -45.0f;
-	lg3dData->cameraList[0].orientation.p = -15.0f;
-
-	wcscpy_s(lg3dData->cameraList[1].name, L"top");
-	lg3dData->cameraList[1].fov = 60.0f;
-	lg3dData->cameraList[1].position.z = 8.0f;
-	lg3dData->cameraList[1].orientation.h = 0.0f;
-	lg3dData->cameraList[1].orientation.p = -90.0f;
-
-	wcscpy_s(lg3dData->cameraList[2].name, L"front");
-	lg3dData->cameraList[2].fov = 45.0f;
-	lg3dData->cameraList[2].position.z = 2.0f;
-	lg3dData->cameraList[2].position.y = -8.0f;
-	lg3dData->cameraList[2].orientation.h = 0.0f;
-	lg3dData->cameraList[2].orientation.p = 0.0f;
-
-	wcscpy_s(lg3dData->cameraList[3].name, L"side");
-	lg3dData->cameraList[3].fov = 90.0f;
-	lg3dData->cameraList[3].position.z = 2.0f;
-	lg3dData->cameraList[3].position.x = 8.0f;
-	lg3dData->cameraList[3].orientation.h = -90.0f;
-	lg3dData->cameraList[3].orientation.p = 0.0f;
-
-	lg3dData->curCamera = 0;
+	data->cameraList[0].orientation.h = -45.0f;
+	data->cameraList[0].orientation.p = -15.0f;
+
+	data->cameraList[1].name = LG3DInternName(L"top");
+	data->cameraList[1].fov = 60.0f;
+	data->cameraList[1].position.z = 8.0f;
+	data->cameraList[1].orientation.h = 0.0f;
+	data->cameraList[1].orientation.p = -90.0f;
+
+	data->cameraList[2].name = LG3DInternName(L"front");
+	data->cameraList[2].fov = 45.0f;
+	data->cameraList[2].position.z = 2.0f;
+	data->cameraList[2].position.y = -8.0f;
+	data->cameraList[2].orientation.h = 0.0f;
+	data->cameraList[2].orientation.p = 0.0f;
+
+	data->cameraList[3].name = LG3DInternName(L"side");
+	data->cameraList[3].fov = 90.0f;
+	data->cameraList[3].position.z = 2.0f;
+	data->cameraList[3].position.x = 8.0f;
+	data->cameraList[3].orientation.h = -90.0f;
+	data->cameraList[3].orientation.p = 0.0f;
+
+	data->curCamera = 0;
+}
+
+// lists still in a scene file go with the file
+void LG3DFreeShow(LG3DControlData *data)
+{
+	if (!data->IsMapped(data->sceneObjectList))
+		delete [] data->sceneObjectList;
+	if (!data->IsMapped(data->sceneLightList))
+		delete [] data->sceneLightList;
+	if (!data->IsMapped(data->sceneNodeList))
+		delete [] data->sceneNodeList;
+	int a;
+	for(a=0;a<data->numLightArrays;a++)
+		if (!data->IsMapped(data->lightArrayList[a].overrides))
+			delete [] data->lightArrayList[a].overrides;
+	if (!data->IsMapped(data->lightArrayList))
+		delete [] data->lightArrayList;
+	for(a=0;a<data->numObjectArrays;a++)
+		if (!data->IsMapped(data->objectArrayList[a].overrides))
+			delete [] data->objectArrayList[a].overrides;
+	if (!data->IsMapped(data->objectArrayList))
+		delete [] data->objectArrayList;
+	if (!data->IsMapped(data->cameraList))
+		delete [] data->cameraList;
+	LG3DSceneFile *file = data->sceneFile;
+	delete data;
+	delete file;
+}
+
+void LG3DFreeMirror()
+{
+	if (syncMirror) {
+		LG3DFreeShow(syncMirror);
+		syncMirror = NULL;
+	}
+}
+
+// the sync client mirrors into a show of its own, built the same as the one drawn
+void LG3DBuildMirror()
+{
+	LG3DFreeMirror();
+	syncMirror = new LG3DControlData();
+	LG3DBuildShow(syncMirror);
+	syncMirror->LoadScene();
+	syncMirror->AllocDirtyState();
+}
+
+void LG3DCreate()
+{
+	lg3dData = new LG3DControlData();
+	LG3DBuildShow(lg3dData);
 
 	lg3d = new LG3DControl(hwnd, lg3dData);
+	lg3d->SetCrossfade(&crossfade);
+	lg3d->SetMerge(&inputs);
+	lg3d->SetEffects(&effects);
+	lg3d->SetCues(&cues);
+	lg3d->SetKinematics(useKinematics ? &kinematics : NULL);
+	lg3d->SetJournal(&journal);
+	lg3d->SetRecorder(&recorder);
+	if (useArtNet) {
+		LG3DPatchArtNet();
+		lg3d->SetArtNet(&artNet);
+	}
+	if (sharedChannel.Create(sharedChannelName, 4096, 8192)) // room for the biggest stress rig, so a controller can stay through show changes
+		lg3d->SetSharedChannel(&sharedChannel);
+	if (syncServer.IsOpen())
+		lg3d->SetSyncServer(&syncServer);
+	if (syncClient.IsConnected())
+		LG3DBuildMirror(); // the show may have changed
+	journal.Clear();
+	kinematics.Reset();
+	cues.SetCrossfade(&crossfade);
+	cues.SetLatency(1.0f / 60.0f);
+	LG3DAnimate(animate);
 	lg3d->Init();
 }
 
@@ -185,9 +405,57 @@ void LG3DClose()
 		lg3d = NULL;
 	}
 
-	delete [] lg3dData->sceneObjectList;
-	delete [] lg3dData->sceneLightList;
-	delete [] lg3dData->cameraList;
+	recorder.Stop();
+	sharedChannel.Close();
+	crossfade.Stop();
+	timecode.Stop();
+	cues.ClearCues();
+	inputs.RemoveSource(safetySource);
+	inputs.RemoveSource(consoleSource);
+	safetySource = consoleSource = -1;
+	LG3DStopEffects();
+	LG3DFreeMirror();
+	LG3DFreeShow(lg3dData);
+	lg3dData = NULL;
+	numPatchedLights = 0;
+	numPatchedObjects = 0;
+}
+
+// build the show again and hand it to the running control as a differential reload, only
+// what differs from the live rig gets rebuilt.  What was reused goes to the debugger output.
+void LG3DReload()
+{
+	crossfade.Stop();
+	timecode.Stop();
+	cues.ClearCues();
+	inputs.RemoveSource(safetySource);
+	inputs.RemoveSource(consoleSource);
+	safetySource = consoleSource = -1;
+	LG3DStopEffects();
+	LG3DControlData *show = new LG3DControlData();
+	LG3DBuildShow(show);
+	LG3DAnimate(animate); // the stress rigs stop the animation
+	LG3DReloadStats stats;
+	kinematics.Reset(); // the reloaded rig is where it is, not somewhere to move to
+	journal.Clear(); // the lights may not be the same ones any more
+	recorder.Stop(); // nor would a recording of them play back onto the new rig
+	lg3d->SetReplay(NULL, false);
+	lg3d->Reload(show, &stats);
+	LG3DFreeShow(show);
+	if (syncMirror)
+		LG3DBuildMirror();
+
+	// lights & objects patched in past the show's own are freed by the reload
+	numPatchedLights = 0;
+	numPatchedObjects = 0;
+	if (useArtNet)
+		LG3DPatchArtNet();
+
+	WCHAR line[256];
+	swprintf_s(line, L"reload: %d changed, reused/rebuilt meshes %d/%d, textures %d/%d, shadow maps %d/%d\n",
+		stats.changed, stats.meshesReused, stats.meshesRebuilt, stats.texturesReused, stats.texturesRebuilt,
+		stats.shadowMapsReused, stats.shadowMapsRebuilt);
+	OutputDebugString(line);
 }
 
 void LG3DDraw()
@@ -215,13 +483,19 @@ long FAR PASCAL WindowProc(HWND hWnd, UINT message,
 				break;
 
 				case ' ':
-					animate = false;
-					lg3dData->sceneLightList[0].orientation.h += 5.0f;
-					LG3DDraw();
+					{
+						LG3DAnimate(false);
+						LG3DOrientation spin = {5.0f, 0.0f, 0.0f};
+						journal.BeginEdit(0);
+						journal.TouchLight(lg3dData, 0, LG3DDirty_Orientation);
+						lg3dData->MoveLight(0, NULL, &spin);
+						journal.EndEdit(lg3dData);
+						LG3DDraw();
+					}
 				break;
 
 				case 'a':
-					animate = true;
+					LG3DAnimate(true);
 					ticsThen = 0; // to force immediate draw
 				break;
 
@@ -263,7 +537,7 @@ long FAR PASCAL WindowProc(HWND hWnd, UINT message,
 				case '4':
 					if (lightToggleActive) {
 						int whichLight = wParam - '1';
-						lg3dData->sceneLightList[whichLight].enabled = !lg3dData->sceneLightList[whichLight].enabled;
+						lg3dData->EnableLight(whichLight, !lg3dData->IsLightEnabled(whichLight));
 						lightToggleActive = false;
 						tick = true;
 					}
@@ -278,17 +552,358 @@ long FAR PASCAL WindowProc(HWND hWnd, UINT message,
 						cameraSelectActive = false;
 						tick =true;
 					}
+
+					if (presetStoreActive) {
+						presets.Store(wParam - '1', lg3dData);
+						presetStoreActive = false;
+					}
+
+					if (presetRecallActive) {
+						presets.Recall(wParam - '1', lg3dData);
+						presetRecallActive = false;
+						tick = true;
+					}
+				break;
+
+				case 'k': // keep the current look as a preset
+					presetStoreActive = true;
+				break;
+
+				case 'g': // go to a preset
+					presetRecallActive = true;
 				break;
 
 				case 'c': // camera select
 					cameraSelectActive = true;
 				break;
 
-				case 't':
+				case 't': // next stress test rig, applied without re-creating the device
+					stressTest = (stressTest + 1)%5;
+					LG3DReload();
+					tick =true;
+				break;
+
+				case 'r': // reload the current show, only the stress rigs' random colors differ
+					LG3DReload();
+					tick = true;
+				break;
+
+				case 'f': // patch in a new light, no device re-create needed
+					if (numPatchedLights < MAX_PATCHED) {
+						LG3DSceneLight light;
+						float angleDeg = (float)(rand()%360);
+						float angleRad = DEG2RADf(angleDeg);
+						light.att1 = 0.2f;
+						light.umbra = 10.0f;
+						light.penumbra = 5.0f;
+						light.position.x = 3.0f * sinf(angleRad);
+						light.position.y = 3.0f * cosf(angleRad);
+						light.position.z = 3.0f;
+						light.orientation.h = 180.0f + angleDeg; // face the center of the stage
+						light.orientation.p = -45.0f;
+						light.enabled = true;
+						light.color.r = rand()%255;
+						light.color.g = rand()%255;
+						light.color.b = rand()%255;
+						light.pinMask = LG3DPinMask_XYZ;
+						patchedLight[numPatchedLights++] = lg3dData->AddLight(&light);
+						tick = true;
+					}
+				break;
+
+				case 'F':
+					if (numPatchedLights > 0) {
+						lg3dData->RemoveLight(patchedLight[--numPatchedLights]);
+						tick = true;
+					}
+				break;
+
+				case 'o': // patch in a new object
+					if (numPatchedObjects < MAX_PATCHED) {
+						LG3DSceneObject obj;
+						obj.meshName = LG3DInternName(L".\\data\\ModelTeapot.x");
+						obj.position.x = (float)(rand()%5) - 2.0f;
+						obj.position.y = (float)(rand()%5) - 2.0f;
+						obj.position.z = 1.8f;
+						patchedObject[numPatchedObjects++] = lg3dData->AddObject(&obj);
+						tick = true;
+					}
+				break;
+
+				case 'O':
+					if (numPatchedObjects > 0) {
+						lg3dData->RemoveObject(patchedObject[--numPatchedObjects]);
+						tick = true;
+					}
+				break;
+
+				case 'u': // fly the first truss up & down
+				case 'U':
+					if (lg3dData->numSceneNodes > 0) {
+						LG3DPosition fly = {0.0f, 0.0f, (wParam == 'u') ? 0.1f : -0.1f};
+						lg3dData->MoveNode(0, &fly, NULL);
+						tick = true;
+					}
+				break;
+
+				case 'x': // crossfade to every light turned a quarter round, in a new color, over 2 seconds
+					{
+						LG3DLightTable look;
+						int count = lg3dData->lights.count;
+						look.Resize(count);
+						look.CopyRange(&lg3dData->lights, 0, count);
+						int i;
+						for(i=0;i<count;i++) {
+							look.head[i] += 90.0f;
+							look.colorR[i] = (rand()%255)/255.0f;
+							look.colorG[i] = (rand()%255)/255.0f;
+							look.colorB[i] = (rand()%255)/255.0f;
+						}
+						crossfade.Start(lg3dData, &look, 2.0f);
+						tick = true;
+					}
+				break;
+
+				case 'z': // safety blackout, overrides every other input while held
+					if (safetySource < 0) {
+						inputs.RemoveSource(consoleSource);
+						consoleSource = inputs.AddSource(0);
+						safetySource = inputs.AddSource(LG3D_MAX_MERGE_PRIORITY);
+						LG3DLightColor color, black = {0, 0, 0};
+						int i;
+						for(i=0;i<lg3dData->lights.count;i++) {
+							lg3dData->GetLightColor(i, &color);
+							inputs.SetColor(consoleSource, i, &color);
+							inputs.SetColor(safetySource, i, &black);
+						}
+					} else {
+						// the console's colors come back
+						inputs.RemoveSource(safetySource);
+						safetySource = -1;
+					}
+					tick = true;
+				break;
+
+				case 'v': // pan wave & chase
+					if (panWave < 0) {
+						int count = lg3dData->lights.count;
+						int *all = (int *)malloc(sizeof(int) * (count+1));
+						int i;
+						for(i=0;i<count;i++)
+							all[i] = i;
+						LG3DEffect wave;
+						wave.param = LG3DTrack_Head;
+						wave.wave = LG3DWave_Sine;
+						wave.speed = 0.25f;
+						wave.size = 30.0f;
+						wave.phaseSpread = 1.0f;
+						panWave = effects.Add(&wave, all, count);
+						LG3DEffect run;
+						run.param = LG3DTrack_Intensity;
+						run.wave = LG3DWave_Square;
+						run.speed = 0.5f;
+						run.size = 1.0f;
+						run.phaseSpread = 2.0f;
+						chase = effects.Add(&run, all, count);
+						free(all);
+					} else
+						LG3DStopEffects();
+					tick = true;
+				break;
+
+				case 'V':
+					if (ripple < 0) {
+						if (rippleProgram.NumOps() == 0)
+							rippleProgram.Compile(L"a = t*2 + index*0.2; red = 128 + 127*sin(a); green = 128 + 127*sin(a + 2.1); blue = 128 + 127*sin(a + 4.2)");
+						int count = lg3dData->lights.count;
+						int *all = (int *)malloc(sizeof(int) * (count+1));
+						int i;
+						for(i=0;i<count;i++)
+							all[i] = i;
+						ripple = effects.AddExpression(&rippleProgram, all, count);
+						free(all);
+					} else {
+						effects.Remove(ripple, lg3dData);
+						ripple = -1;
+					}
+					tick = true;
+				break;
+
+				case 'q': // timecode show, the dispatch timing goes to the debugger output when it stops
+					if (!timecode.IsRunning()) {
+						int count = lg3dData->lights.count;
+						int i, k;
+						for(k=0;k<4;k++) {
+							cueLook[k].Resize(count);
+							cueLook[k].CopyRange(&lg3dData->lights, 0, count);
+							for(i=0;i<count;i++) {
+								cueLook[k].head[i] += 90.0f * k;
+								cueLook[k].colorR[i] = (k & 1) ? 1.0f : 0.2f;
+								cueLook[k].colorB[i] = (k & 2) ? 1.0f : 0.2f;
+							}
+						}
+						cues.ClearCues();
+						for(k=0;k<40;k++)
+							cues.AddCue(1.0 + k * 1.5, &cueLook[k%4], 0.75f);
+						cues.ResetStats();
+						LG3DTimecode from = {0, 0, 0, 0, 30.0f};
+						timecode.StartLoopback(&from, lg3d->GetTime(), 0.002f);
+					} else {
+						timecode.Stop();
+						LG3DCueStats stats;
+						cues.GetStats(&stats);
+						WCHAR line[256];
+						swprintf_s(line, L"%d cues, dispatched %.2f ms late on average, jitter %.2f ms, worst %.2f ms, timecode lock jitter %.2f ms\n",
+							stats.cuesFired, stats.meanLate * 1000.0, stats.jitter * 1000.0, stats.maxLate * 1000.0, stats.lockJitter * 1000.0);
+						OutputDebugString(line);
+					}
+					tick = true;
+				break;
+
+				case 'j':
+					useKinematics = !useKinematics;
+					kinematics.Reset();
+					lg3d->SetKinematics(useKinematics ? &kinematics : NULL);
+					tick = true;
+				break;
+
+				case 'w':
+					if (lg3dData->numSceneObjects > 0) {
+						int count = lg3dData->lights.count;
+						int *all = (int *)malloc(sizeof(int) * (count+1));
+						int i;
+						for(i=0;i<count;i++)
+							all[i] = i;
+						LG3DPosition above = {0.0f, 0.0f, 1.5f};
+						journal.BeginEdit(0);
+						for(i=0;i<count;i++)
+							journal.TouchLight(lg3dData, i, LG3DDirty_Orientation);
+						aimSolver.AimAtObject(lg3dData, all, count, 0, &above);
+						journal.EndEdit(lg3dData);
+						free(all);
+					}
+					tick = true;
+				break;
+
+				case 26: // ctrl+z
+					if (journal.Undo(lg3dData))
+						tick = true;
+				break;
+
+				case 25: // ctrl+y
+					if (journal.Redo(lg3dData))
+						tick = true;
+				break;
+
+				case 'i':
+					if (recorder.IsRecording() || recorder.Failed()) {
+						// a recording the disk filled up on has stopped by itself, what was written plays back
+						bool failed = recorder.Failed();
+						recorder.Stop();
+						WCHAR line[256];
+						swprintf_s(line, failed ? L"recording failed writing after %d frames, %lu bytes kept\n" : L"recorded %d frames in %lu bytes\n",
+							recorder.NumFrames(), recorder.BytesUsed());
+						OutputDebugString(line);
+					} else if (!recorder.Start(lg3dData, recordingPath))
+						OutputDebugString(L"can't write the recording\n");
+				break;
+
+				case 'I':
+					recorder.Stop();
+					lg3d->SetReplay(NULL, false);
+					if (replay.Load(recordingPath) && replay.Start(lg3dData))
+						lg3d->SetReplay(&replay, true);
+					tick = true;
+				break;
+
+				case 'h':
+					if (useArtNet) {
+						WCHAR line[256];
+						swprintf_s(line, L"artnet: %lu packets used, %lu dropped\n", artNet.PacketsUsed(), artNet.PacketsDropped());
+						OutputDebugString(line);
+						artNet.Close();
+						lg3d->SetArtNet(NULL);
+						useArtNet = false;
+					} else if (artNet.Open()) {
+						LG3DPatchArtNet();
+						lg3d->SetArtNet(&artNet);
+						useArtNet = true;
+					}
+				break;
+
+				case 'd':
+					if (syncServer.IsOpen()) {
+						WCHAR line[256];
+						swprintf_s(line, L"sync: %lu bytes sent, %lu keyframes\n", syncServer.BytesSent(), syncServer.KeyframesSent());
+						OutputDebugString(line);
+						syncServer.Close();
+						lg3d->SetSyncServer(NULL);
+					} else if (syncServer.Listen())
+						lg3d->SetSyncServer(&syncServer);
+				break;
+
+				case 'D':
+					if (syncClient.IsConnected()) {
+						WCHAR line[256];
+						swprintf_s(line, L"sync mirror: %lu bytes received, %lu keyframes, %s\n", syncClient.BytesReceived(), syncClient.KeyframesTaken(),
+							syncClient.Mismatched() ? L"another rig" : (syncClient.InSync() ? L"in sync" : L"out of sync"));
+						OutputDebugString(line);
+						syncClient.Close();
+						LG3DFreeMirror();
+					} else if (syncClient.Connect(0x7f000001))
+						LG3DBuildMirror();
+				break;
+
+				case 'n':
+					if (showFromFile) {
+						// back to the show built in code
+						LG3DClose();
+						showFromFile = false;
+						LG3DCreate();
+					} else {
+						int errorLine;
+						if (!LG3DSceneFile::WriteText(showTextPath, lg3dData))
+							break;
+						if (!LG3DSceneFile::Convert(showTextPath, showFilePath, &errorLine)) {
+							WCHAR line[256];
+							swprintf_s(line, L"scene file: %s line %d doesn't read\n", showTextPath, errorLine);
+							OutputDebugString(line);
+							break;
+						}
+						LG3DClose();
+						showFromFile = true;
+						LG3DCreate();
+					}
+					tick = true;
+				break;
+
+				case 'y':
+					{
+						ringDrawnIn = !ringDrawnIn;
+						int a;
+						for(a=0;a<lg3dData->numLightArrays;a++) {
+							LG3DArrayLayout layout = lg3dData->lightArrayList[a].layout;
+							layout.radius = ringDrawnIn ? 4.0f : 6.0f;
+							lg3dData->SetLightArrayLayout(a, &layout, NULL, NULL);
+						}
+					}
+					tick = true;
+				break;
+
+				case 'b': // benchmarks, run against the 4096 light stress rig
 					LG3DClose();
-					stressTest = (stressTest + 1)%3;
+					useKinematics = false; // the benchmarks change the lights with no time passing
+					useArtNet = false;
+					artNet.Close();
+					syncServer.Close();
+					syncClient.Close();
+					showFromFile = false;
+					stressTest = 3;
 					LG3DCreate();
-					tick =true;
+					LG3DDraw(); // creates the device & consumes the initial dirty state
+					RunBenchmarks(lg3d, lg3dData);
+					lg3d->SetRecorder(&recorder); // the benchmarks record with their own
+					tick = true;
 				break;
 			}
 		break;
@@ -374,18 +989,28 @@ long FAR PASCAL WindowProc(HWND hWnd, UINT message,
 
 void Idle()
 {
+	// a timecode show is drawn flat out, its cues are timed off the frame move clock rather
+	// than the tick count, which is far too coarse for them
+	bool timecodeShow = lg3d && timecode.IsRunning();
+	if (timecodeShow)
+		timecode.Poll(&cues, lg3d->GetTime());
+
 	DWORD ticsNow = GetTickCount();
 	DWORD deltaTics = ticsNow - ticsThen;
-	if (!performanceTest && (deltaTics < 60)) { // 60 is roughtly 16fps
+	if (!performanceTest && !timecodeShow && (deltaTics < 60)) { // 60 is roughtly 16fps
 		Sleep(0); // give priority to other threads since we don't need it right now
 		return;
 	}
 
 	ticsThen = ticsNow;
 
-	if (animate || tick || performanceTest) {
-		if (animate)
-			lg3dData->sceneLightList[0].orientation.h += 5.0f;
+	if (syncMirror && syncClient.IsConnected()) {
+		syncClient.Receive(syncMirror);
+		syncMirror->ClearDirtyState();
+	}
+	if (animate || tick || performanceTest || timecodeShow || crossfade.IsRunning() || effects.NumActive() ||
+		(useKinematics && kinematics.NumMoving()) || useArtNet || !replay.AtEnd() || sharedChannel.ControllerAttached() ||
+		syncServer.IsOpen() || syncClient.IsConnected()) {
 		LG3DDraw();
 		tick = false;
 	} else